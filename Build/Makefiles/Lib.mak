@@ -9,6 +9,7 @@ all: libAP4.a
 
 CORE_SOURCES = 								\
     Ap4Results.cpp                          \
+    Ap4Arena.cpp                            \
     Ap4Atom.cpp                             \
     Ap4AtomFactory.cpp                      \
     Ap4AtomSampleTable.cpp                  \
@@ -96,6 +97,7 @@ CORE_SOURCES = 								\
     Ap4TrexAtom.cpp                         \
     Ap4LinearReader.cpp			            \
     Ap4Mpeg2Ts.cpp                          \
+    Ap4Crc32.cpp                            \
     Ap4Hmac.cpp                             \
     Ap4KeyWrap.cpp 							\
     Ap4MovieFragment.cpp                    \
@@ -123,6 +125,8 @@ CORE_SOURCES = 								\
     Ap4AvcParser.cpp                        \
     Ap4HevcParser.cpp                       \
     Ap4SegmentBuilder.cpp                   \
+    Ap4Threads.cpp                          \
+    Ap4ReadAheadInputStream.cpp             \
 
 
 CORE_OBJECTS=$(CORE_SOURCES:.cpp=.o)
@@ -133,7 +137,7 @@ CRYPTO_OBJECTS = $(CRYPTO_SOURCES:.cpp=.o)
 METADATA_SOURCES = Ap4MetaData.cpp
 METADATA_OBJECTS = $(METADATA_SOURCES:.cpp=.o)
 
-SYSTEM_SOURCES = $(FILE_BYTE_STREAM_IMPLEMENTATION).cpp $(RANDOM_IMPLEMENTATION).cpp
+SYSTEM_SOURCES = $(FILE_BYTE_STREAM_IMPLEMENTATION).cpp $(RANDOM_IMPLEMENTATION).cpp Ap4PosixMmapFileByteStream.cpp Ap4PosixThreads.cpp
 SYSTEM_OBJECTS = $(SYSTEM_SOURCES:.cpp=.o)
 
 CODECS_SOURCES = Ap4AdtsParser.cpp Ap4BitStream.cpp Ap4Mp4AudioInfo.cpp
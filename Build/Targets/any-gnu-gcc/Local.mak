@@ -54,7 +54,7 @@ WARNINGS_CPP = -Wall -Wshadow -Wpointer-arith -Wcast-qual
 INCLUDES_CPP =
 
 # libraries
-LIBRARIES_CPP = 
+LIBRARIES_CPP = -lpthread
 
 #######################################################################
 #    module selection
@@ -37,7 +37,7 @@
 /*----------------------------------------------------------------------
 |   constants
 +---------------------------------------------------------------------*/
-#define BANNER "MP4 To MPEG2-TS File Converter - Version 1.2\n"\
+#define BANNER "MP4 To MPEG2-TS File Converter - Version 1.3\n"\
                "(Bento4 Version " AP4_VERSION_STRING ")\n"\
                "(c) 2002-2014 Axiomatic Systems, LLC"
  
@@ -51,8 +51,9 @@ struct Options {
     unsigned int segment;
     bool         verbose;
     const char*  playlist;
-    const char*  input;
-    const char*  output;
+    const char*  master_playlist;
+    bool         shared_audio;
+    unsigned int thread_count;
     unsigned int segment_duration_threshold;
 } Options;
 
@@ -69,7 +70,7 @@ PrintUsageAndExit()
 {
     fprintf(stderr, 
             BANNER 
-            "\n\nusage: mp42ts [options] <input> <output>\n"
+            "\n\nusage: mp42ts [options] <input> <output> [<input> <output> ...]\n"
             "Options:\n"
             "  --pmt-pid <pid>   (default: 0x100)\n"
             "  --audio-pid <pid> (default: 0x101)\n"
@@ -80,7 +81,22 @@ PrintUsageAndExit()
             "  --segment-duration-threshold in ms (default = 50)\n"
             "    [only used with the --segment option]\n"
             "  --verbose\n"
-            "  --playlist <filename>\n",'%');
+            "  --playlist <filename>\n"
+            "    [with more than one input, the <filename> must be a 'printf' template,\n"
+            "     like \"stream-%cd.m3u8\", where the number is the index of the input]\n"
+            "  --master-playlist <filename>\n"
+            "    [write a master playlist that references the playlist of each input,\n"
+            "     requires the --playlist option]\n"
+            "  --shared-audio\n"
+            "    [use the audio track of the first input for all the outputs,\n"
+            "     the audio tracks of the other inputs are ignored]\n"
+            "  --threads <n>\n"
+            "    [convert up to <n> inputs at the same time (default: 0, one per processor)]\n"
+            "\n"
+            "When more than one <input> <output> pair is given, the inputs are converted\n"
+            "concurrently, and the segments of all the outputs start at the same times\n"
+            "as those of the first output.\n",
+            '%', '%');
     exit(1);
 }
 
@@ -115,7 +131,11 @@ AP4_Result
 TrackSampleReader::ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_data)
 {
     if (m_SampleIndex >= m_Track.GetSampleCount()) return AP4_ERROR_EOS;
-    return m_Track.ReadSample(m_SampleIndex++, sample, sample_data);
+    AP4_Result result = m_Track.GetSample(m_SampleIndex++, sample);
+    if (AP4_FAILED(result)) return result;
+    
+    // the input outlives the samples, so we can view their data in place
+    return sample.ReadDataView(sample_data);
 }
 
 /*----------------------------------------------------------------------
@@ -144,6 +164,228 @@ FragmentedSampleReader::ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_da
     return m_FragmentReader.ReadNextSample(m_TrackId, sample, sample_data);
 }
 
+/*----------------------------------------------------------------------
+|   SampleCache
++---------------------------------------------------------------------*/
+/**
+ * All the samples of a track, read once and kept in memory so that they
+ * can be read by several CachedSampleReader objects, from several threads.
+ * The cached samples have no data stream, their offset is the position
+ * of their data in the cache buffer.
+ */
+class SampleCache
+{
+public:
+    AP4_Result Load(SampleReader& reader);
+
+    AP4_Array<AP4_Sample> m_Samples;
+    AP4_DataBuffer        m_Data;
+};
+
+/*----------------------------------------------------------------------
+|   SampleCache::Load
++---------------------------------------------------------------------*/
+AP4_Result
+SampleCache::Load(SampleReader& reader)
+{
+    AP4_Sample     sample;
+    AP4_DataBuffer sample_data;
+    for (;;) {
+        AP4_Result result = reader.ReadSample(sample, sample_data);
+        if (result == AP4_ERROR_EOS) break;
+        if (AP4_FAILED(result)) return result;
+
+        AP4_Sample cached;
+        cached.SetOffset(m_Data.GetDataSize());
+        cached.SetSize(sample_data.GetDataSize());
+        cached.SetDuration(sample.GetDuration());
+        cached.SetDescriptionIndex(sample.GetDescriptionIndex());
+        cached.SetDts(sample.GetDts());
+        cached.SetCtsDelta(sample.GetCtsDelta());
+        cached.SetSync(sample.IsSync());
+        result = m_Samples.Append(cached);
+        if (AP4_FAILED(result)) return result;
+
+        AP4_Size data_size = m_Data.GetDataSize();
+        result = m_Data.SetDataSize(data_size+sample_data.GetDataSize());
+        if (AP4_FAILED(result)) return result;
+        AP4_CopyMemory(m_Data.UseData()+data_size, sample_data.GetData(), sample_data.GetDataSize());
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   CachedSampleReader
++---------------------------------------------------------------------*/
+class CachedSampleReader : public SampleReader
+{
+public:
+    CachedSampleReader(SampleCache& cache) : m_Cache(cache), m_SampleIndex(0) {}
+    AP4_Result ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_data);
+
+private:
+    SampleCache& m_Cache;
+    AP4_Ordinal  m_SampleIndex;
+};
+
+/*----------------------------------------------------------------------
+|   CachedSampleReader
++---------------------------------------------------------------------*/
+AP4_Result
+CachedSampleReader::ReadSample(AP4_Sample& sample, AP4_DataBuffer& sample_data)
+{
+    if (m_SampleIndex >= m_Cache.m_Samples.ItemCount()) return AP4_ERROR_EOS;
+    sample = m_Cache.m_Samples[m_SampleIndex++];
+
+    // the cache outlives the samples, so we can view their data in place
+    return sample_data.SetDataView(m_Cache.m_Data.GetData()+sample.GetOffset(), sample.GetSize());
+}
+
+/*----------------------------------------------------------------------
+|   SegmentBoundaries
++---------------------------------------------------------------------*/
+/**
+ * Start times, in milliseconds, of the segments of the first output (except
+ * the first segment), published as that output is written, so that the
+ * other outputs, written at the same time on other threads, can start their
+ * segments at the same times.
+ */
+class SegmentBoundaries
+{
+public:
+    SegmentBoundaries() : m_Complete(false) {}
+
+    void Add(AP4_UI64 ts);
+    void Complete();
+
+    /**
+     * Get the start time of a segment, waiting until it is known.
+     * @return false if the first output has no such segment.
+     */
+    bool Get(AP4_Ordinal index, AP4_UI64& ts);
+
+private:
+    AP4_Array<AP4_UI64> m_Timestamps;
+    bool                m_Complete;
+    AP4_Mutex           m_Lock;
+    AP4_Condition       m_Changed;
+};
+
+/*----------------------------------------------------------------------
+|   SegmentBoundaries::Add
++---------------------------------------------------------------------*/
+void
+SegmentBoundaries::Add(AP4_UI64 ts)
+{
+    AP4_AutoLock lock(m_Lock);
+    m_Timestamps.Append(ts);
+    m_Changed.Broadcast();
+}
+
+/*----------------------------------------------------------------------
+|   SegmentBoundaries::Complete
++---------------------------------------------------------------------*/
+void
+SegmentBoundaries::Complete()
+{
+    AP4_AutoLock lock(m_Lock);
+    m_Complete = true;
+    m_Changed.Broadcast();
+}
+
+/*----------------------------------------------------------------------
+|   SegmentBoundaries::Get
++---------------------------------------------------------------------*/
+bool
+SegmentBoundaries::Get(AP4_Ordinal index, AP4_UI64& ts)
+{
+    AP4_AutoLock lock(m_Lock);
+    while (index >= m_Timestamps.ItemCount() && !m_Complete) {
+        m_Changed.Wait(m_Lock);
+    }
+    if (index >= m_Timestamps.ItemCount()) return false;
+    ts = m_Timestamps[index];
+
+    return true;
+}
+
+/*----------------------------------------------------------------------
+|   Segment
++---------------------------------------------------------------------*/
+struct Segment {
+    AP4_UI64      duration; // milliseconds
+    AP4_LargeSize size;
+};
+
+/*----------------------------------------------------------------------
+|   Rendition
++---------------------------------------------------------------------*/
+/**
+ * One input converted to one output (and one playlist).
+ */
+struct Rendition {
+    Rendition(unsigned int rendition_index, const char* input_filename, const char* output_filename);
+   ~Rendition();
+
+    unsigned int                     index;
+    const char*                      input_name;
+    const char*                      output_name;
+    char                             playlist_name[1024];
+    char                             label[32];
+    AP4_ByteStream*                  input;
+    AP4_DefaultAtomFactory           atom_factory; // not shared between the threads
+    AP4_File*                        file;
+    AP4_Track*                       audio_track;
+    AP4_Track*                       video_track;
+    AP4_LinearReader*                linear_reader;
+    SampleReader*                    audio_reader;
+    SampleReader*                    video_reader;
+    AP4_Mpeg2TsWriter*               writer;
+    AP4_Mpeg2TsWriter::SampleStream* audio_stream;
+    AP4_Mpeg2TsWriter::SampleStream* video_stream;
+    bool                             relative_uris;
+    AP4_Array<Segment>               segments;
+    AP4_Result                       result;
+};
+
+/*----------------------------------------------------------------------
+|   Rendition::Rendition
++---------------------------------------------------------------------*/
+Rendition::Rendition(unsigned int rendition_index, const char* input_filename, const char* output_filename) :
+    index(rendition_index),
+    input_name(input_filename),
+    output_name(output_filename),
+    input(NULL),
+    file(NULL),
+    audio_track(NULL),
+    video_track(NULL),
+    linear_reader(NULL),
+    audio_reader(NULL),
+    video_reader(NULL),
+    writer(NULL),
+    audio_stream(NULL),
+    video_stream(NULL),
+    relative_uris(false),
+    result(AP4_SUCCESS)
+{
+    playlist_name[0] = '\0';
+    label[0]         = '\0';
+}
+
+/*----------------------------------------------------------------------
+|   Rendition::~Rendition
++---------------------------------------------------------------------*/
+Rendition::~Rendition()
+{
+    delete audio_reader;
+    delete video_reader;
+    delete linear_reader;
+    delete writer;
+    delete file;
+    if (input) input->Release();
+}
+
 /*----------------------------------------------------------------------
 |   OpenOutput
 +---------------------------------------------------------------------*/
@@ -162,6 +404,22 @@ OpenOutput(const char* filename_pattern, unsigned int segment_number)
     return output;
 }
 
+/*----------------------------------------------------------------------
+|   CloseSegment
++---------------------------------------------------------------------*/
+static unsigned int
+CloseSegment(Rendition& rendition, AP4_ByteStream* output, AP4_UI64 segment_duration)
+{
+    Segment segment;
+    segment.duration = segment_duration;
+    segment.size     = 0;
+    output->Tell(segment.size);
+    rendition.segments.Append(segment);
+    output->Release();
+
+    return (unsigned int)((segment_duration+500)/1000);
+}
+
 /*----------------------------------------------------------------------
 |   ReadSample
 +---------------------------------------------------------------------*/
@@ -186,19 +444,86 @@ ReadSample(SampleReader&   reader,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   IsPathSeparator
++---------------------------------------------------------------------*/
+static bool
+IsPathSeparator(char c)
+{
+    return c == '/' || c == '\\';
+}
+
+/*----------------------------------------------------------------------
+|   GetRelativePath
++---------------------------------------------------------------------*/
+static void
+GetRelativePath(const char* path, const char* reference, char* relative, unsigned int relative_size)
+{
+    // the path of the file relative to the directory of the reference file,
+    // so that it can be used as a URI in a playlist stored in that file
+    const char* original = path;
+    while (path[0] == '.' && IsPathSeparator(path[1])) path += 2;
+    while (reference[0] == '.' && IsPathSeparator(reference[1])) reference += 2;
+    
+    // an absolute path cannot be made relative to a relative one and vice versa
+    if (IsPathSeparator(path[0]) != IsPathSeparator(reference[0])) {
+        AP4_FormatString(relative, relative_size, "%s", original);
+        return;
+    }
+    
+    // skip the directories that the two paths have in common
+    for (;;) {
+        const char* path_end = path;
+        while (*path_end && !IsPathSeparator(*path_end)) ++path_end;
+        const char* reference_end = reference;
+        while (*reference_end && !IsPathSeparator(*reference_end)) ++reference_end;
+        if (*path_end == '\0' || *reference_end == '\0') break;
+        if (path_end-path != reference_end-reference || strncmp(path, reference, path_end-path)) break;
+        path      = path_end+1;
+        reference = reference_end+1;
+    }
+    
+    // go up one level for each remaining directory of the reference
+    AP4_Size length = 0;
+    relative[0] = '\0';
+    for (const char* directory = reference; *directory; ) {
+        const char* directory_end = directory;
+        while (*directory_end && !IsPathSeparator(*directory_end)) ++directory_end;
+        if (*directory_end == '\0') break;
+        if (directory_end-directory == 2 && directory[0] == '.' && directory[1] == '.') {
+            // the name of the parent directory is not known
+            AP4_FormatString(relative, relative_size, "%s", original);
+            return;
+        }
+        if (length+3 < relative_size) {
+            AP4_CopyMemory(relative+length, "../", 3);
+            length += 3;
+        }
+        directory = directory_end+1;
+    }
+    
+    // then down to the file, always with '/' separators as in a URI
+    for (; *path && length+1 < relative_size; ++path) {
+        relative[length++] = IsPathSeparator(*path) ? '/' : *path;
+    }
+    relative[length] = '\0';
+}
+
 /*----------------------------------------------------------------------
 |   WriteSamples
 +---------------------------------------------------------------------*/
 static AP4_Result
-WriteSamples(AP4_Mpeg2TsWriter&               writer,
-             AP4_Track*                       audio_track,
-             SampleReader*                    audio_reader, 
-             AP4_Mpeg2TsWriter::SampleStream* audio_stream,
-             AP4_Track*                       video_track,
-             SampleReader*                    video_reader, 
-             AP4_Mpeg2TsWriter::SampleStream* video_stream,
-             unsigned int                     segment_duration_threshold)
+WriteSamples(Rendition&         rendition,
+             SegmentBoundaries* boundaries,
+             unsigned int       segment_duration_threshold)
 {
+    AP4_Mpeg2TsWriter&               writer        = *rendition.writer;
+    AP4_Track*                       audio_track   = rendition.audio_track;
+    SampleReader*                    audio_reader  = rendition.audio_reader;
+    AP4_Mpeg2TsWriter::SampleStream* audio_stream  = rendition.audio_stream;
+    AP4_Track*                       video_track   = rendition.video_track;
+    SampleReader*                    video_reader  = rendition.video_reader;
+    AP4_Mpeg2TsWriter::SampleStream* video_stream  = rendition.video_stream;
     AP4_Sample      audio_sample;
     AP4_DataBuffer  audio_sample_data;
     unsigned int    audio_sample_count = 0;
@@ -212,11 +537,11 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
     AP4_UI64        last_ts = 0;
     unsigned int    segment_number = 0;
     AP4_UI64        segment_duration = 0;
+    AP4_Ordinal     boundary_index = 0;
     AP4_ByteStream* output = NULL;
     AP4_ByteStream* playlist = NULL;
-    char            string_buffer[32];
+    char            string_buffer[1024];
     AP4_Result      result = AP4_SUCCESS;
-    AP4_Array<unsigned int> segment_durations;
     
     // prime the samples
     if (audio_reader) {
@@ -251,28 +576,35 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
         
         // check if we need to start a new segment
         if (Options.segment && sync_sample) {
-            if (video_track) {
-                segment_duration = video_ts - last_ts;
+            AP4_UI64 ts = video_track?video_ts:audio_ts;
+            segment_duration = ts - last_ts;
+            bool new_segment = false;
+            if (boundaries && rendition.index) {
+                // follow the segments of the first output
+                AP4_UI64 boundary = 0;
+                while (boundaries->Get(boundary_index, boundary) &&
+                       ts+segment_duration_threshold >= boundary) {
+                    ++boundary_index;
+                    new_segment = true;
+                }
             } else {
-                segment_duration = audio_ts - last_ts;
+                new_segment = segment_duration >= (AP4_UI64)Options.segment*1000 - segment_duration_threshold;
             }
-            if (segment_duration >= (AP4_UI64)Options.segment*1000 - segment_duration_threshold) {
-                if (video_track) {
-                    last_ts = video_ts;
-                } else {
-                    last_ts = audio_ts;
-                }
+            if (new_segment) {
+                last_ts = ts;
                 if (output) {
-                    unsigned int segment_duration_s = (unsigned int)((segment_duration+500)/1000);
-                    segment_durations.Append(segment_duration_s);
+                    unsigned int segment_duration_s = CloseSegment(rendition, output, segment_duration);
                     if (Options.verbose) {
-                        printf("Segment %d, duration=%d, %d audio samples, %d video samples\n", 
+                        printf("%sSegment %d, duration=%d, %d audio samples, %d video samples\n",
+                               rendition.label,
                                segment_number, 
                                segment_duration_s, 
                                audio_sample_count, 
                                video_sample_count);
                     }
-                    output->Release();
+                    if (boundaries && rendition.index == 0) {
+                        boundaries->Add(ts);
+                    }
                     output = NULL;
                     ++segment_number;
                     audio_sample_count = 0;
@@ -281,7 +613,7 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
             }
         }
         if (output == NULL) {
-            output = OpenOutput(Options.output, segment_number);
+            output = OpenOutput(rendition.output_name, segment_number);
             if (output == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
             writer.WritePAT(*output);
             writer.WritePMT(*output);
@@ -322,16 +654,15 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
         } else {
             segment_duration = audio_ts - last_ts;
         }
-        unsigned int segment_duration_s = (unsigned int)((segment_duration+500)/1000);
-        segment_durations.Append(segment_duration_s);
+        unsigned int segment_duration_s = CloseSegment(rendition, output, segment_duration);
         if (Options.verbose) {
-            printf("Segment %d, duration=%d, %d audio samples, %d video samples\n", 
+            printf("%sSegment %d, duration=%d, %d audio samples, %d video samples\n",
+                   rendition.label,
                    segment_number, 
                    segment_duration_s, 
                    audio_sample_count, 
                    video_sample_count);
         }
-        output->Release();
         output = NULL;
         ++segment_number;
         audio_sample_count = 0;
@@ -340,13 +671,14 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
 
     // create the playlist file if needed 
     if (Options.playlist) {
-        playlist = OpenOutput(Options.playlist, 0);
+        playlist = OpenOutput(Options.playlist, rendition.index);
         if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
 
         unsigned int target_duration = 0;
-        for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
-            if (segment_durations[i] > target_duration) {
-                target_duration = segment_durations[i];
+        for (unsigned int i=0; i<rendition.segments.ItemCount(); i++) {
+            unsigned int segment_duration_s = (unsigned int)((rendition.segments[i].duration+500)/1000);
+            if (segment_duration_s > target_duration) {
+                target_duration = segment_duration_s;
             }
         }
 
@@ -356,10 +688,16 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
         sprintf(string_buffer, "%d\r\n\r\n", target_duration);
         playlist->WriteString(string_buffer);
 
-        for (unsigned int i=0; i<segment_durations.ItemCount(); i++) {
-            sprintf(string_buffer, "#EXTINF:%d,\r\n", segment_durations[i]);
+        for (unsigned int i=0; i<rendition.segments.ItemCount(); i++) {
+            sprintf(string_buffer, "#EXTINF:%d,\r\n", (unsigned int)((rendition.segments[i].duration+500)/1000));
             playlist->WriteString(string_buffer);
-            sprintf(string_buffer, Options.output, i);
+            if (rendition.relative_uris) {
+                char segment_name[1024];
+                sprintf(segment_name, rendition.output_name, i);
+                GetRelativePath(segment_name, rendition.playlist_name, string_buffer, sizeof(string_buffer));
+            } else {
+                sprintf(string_buffer, rendition.output_name, i);
+            }
             playlist->WriteString(string_buffer);
             playlist->WriteString("\r\n");
         }
@@ -374,7 +712,8 @@ WriteSamples(AP4_Mpeg2TsWriter&               writer,
         } else {
             segment_duration = audio_ts - last_ts;
         }
-        printf("Conversion complete, duration=%d secs, %d audio samples, %d video samples\n", 
+        printf("%sConversion complete, duration=%d secs, %d audio samples, %d video samples\n",
+               rendition.label,
                (unsigned int)(segment_duration/1000), 
                audio_sample_count, 
                video_sample_count);
@@ -387,153 +726,188 @@ end:
 }
 
 /*----------------------------------------------------------------------
-|   main
+|   RenditionQueue
 +---------------------------------------------------------------------*/
-int
-main(int argc, char** argv)
+/**
+ * Hands out the renditions to convert, in order, to the threads that call
+ * Run(). The first rendition is always started first, so the threads that
+ * wait for its segment boundaries never wait for a rendition that is not
+ * running.
+ */
+class RenditionQueue
 {
-    if (argc < 3) {
-        PrintUsageAndExit();
-    }
-    
-    // default options
-    Options.segment                    = 0;
-    Options.pmt_pid                    = 0x100;
-    Options.audio_pid                  = 0x101;
-    Options.video_pid                  = 0x102;
-    Options.verbose                    = false;
-    Options.playlist                   = NULL;
-    Options.input                      = NULL;
-    Options.output                     = NULL;
-    Options.segment_duration_threshold = DefaultSegmentDurationThreshold;
-    
-    // parse command line
-    AP4_Result result;
-    char** args = argv+1;
-    while (const char* arg = *args++) {
-        if (!strcmp(arg, "--segment")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --segment requires a number\n");
-                return 1;
-            }
-            Options.segment = strtoul(*args++, NULL, 10);
-        } else if (!strcmp(arg, "--segment-duration-threshold")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --segment-duration-threshold requires a number\n");
-                return 1;
-            }
-            Options.segment_duration_threshold = strtoul(*args++, NULL, 10);
-        } else if (!strcmp(arg, "--verbose")) {
-            Options.verbose = true;
-        } else if (!strcmp(arg, "--pmt-pid")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --pmt-pid requires a number\n");
-                return 1;
-            }
-            Options.pmt_pid = strtoul(*args++, NULL, 10);
-        } else if (!strcmp(arg, "--audio-pid")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --audio-pid requires a number\n");
-                return 1;
-            }
-            Options.audio_pid = strtoul(*args++, NULL, 10);
-        } else if (!strcmp(arg, "--video-pid")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --video-pid requires a number\n");
-                return 1;
-            }
-            Options.video_pid = strtoul(*args++, NULL, 10);
-        } else if (!strcmp(arg, "--playlist")) {
-            if (*args == NULL) {
-                fprintf(stderr, "ERROR: --playlist requires a filename\n");
-                return 1;
-            }
-            Options.playlist = *args++;
-        } else if (Options.input == NULL) {
-            Options.input = arg;
-        } else if (Options.output == NULL) {
-            Options.output = arg;
-        } else {
-            fprintf(stderr, "ERROR: unexpected argument\n");
-            return 1;
+public:
+    RenditionQueue(AP4_Array<Rendition*>& renditions, SegmentBoundaries* boundaries) :
+        m_Renditions(renditions), m_Boundaries(boundaries), m_NextRendition(0) {}
+
+    void Run();
+
+private:
+    AP4_Array<Rendition*>& m_Renditions;
+    SegmentBoundaries*     m_Boundaries;
+    AP4_Ordinal            m_NextRendition;
+    AP4_Mutex              m_Lock;
+};
+
+/*----------------------------------------------------------------------
+|   RenditionQueue::Run
++---------------------------------------------------------------------*/
+void
+RenditionQueue::Run()
+{
+    for (;;) {
+        m_Lock.Lock();
+        AP4_Ordinal index = m_NextRendition++;
+        m_Lock.Unlock();
+        if (index >= m_Renditions.ItemCount()) break;
+
+        Rendition& rendition = *m_Renditions[index];
+        rendition.result = WriteSamples(rendition, m_Boundaries, Options.segment_duration_threshold);
+        if (AP4_FAILED(rendition.result)) {
+            fprintf(stderr, "ERROR: failed to write samples for %s (%d)\n", rendition.input_name, rendition.result);
         }
+
+        // even if it failed, the first rendition must let the others finish
+        if (index == 0 && m_Boundaries) m_Boundaries->Complete();
     }
+}
 
-    // check args
-    if (Options.input == NULL) {
-        fprintf(stderr, "ERROR: missing input file name\n");
-        return 1;
+/*----------------------------------------------------------------------
+|   RenditionThread
++---------------------------------------------------------------------*/
+class RenditionThread : public AP4_Thread
+{
+public:
+    RenditionThread(RenditionQueue& queue) : m_Queue(queue) {}
+
+protected:
+    void Run() { m_Queue.Run(); }
+
+private:
+    RenditionQueue& m_Queue;
+};
+
+/*----------------------------------------------------------------------
+|   LoadSharedAudio
++---------------------------------------------------------------------*/
+static AP4_Result
+LoadSharedAudio(Rendition& rendition, SampleCache& cache)
+{
+    // read all the audio samples, and put the input back where the
+    // readers of the video samples expect it
+    AP4_Position position = 0;
+    rendition.input->Tell(position);
+    AP4_Result result;
+    if (rendition.file->GetMovie()->HasFragments()) {
+        AP4_LinearReader       linear_reader(*rendition.file->GetMovie(),
+                                              rendition.input,
+                                              AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE,
+                                              rendition.atom_factory);
+        FragmentedSampleReader reader(linear_reader, rendition.audio_track->GetId());
+        result = cache.Load(reader);
+    } else {
+        TrackSampleReader reader(*rendition.audio_track);
+        result = cache.Load(reader);
     }
-    if (Options.output == NULL) {
-        fprintf(stderr, "ERROR: missing output file name\n");
-        return 1;
+    if (AP4_FAILED(result)) return result;
+    result = rendition.input->Seek(position);
+    if (AP4_FAILED(result)) return result;
+
+    // create the sample descriptions now, as the track will be used by
+    // several threads
+    for (unsigned int i=0; i<rendition.audio_track->GetSampleDescriptionCount(); i++) {
+        rendition.audio_track->GetSampleDescription(i);
     }
-    
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   OpenRendition
++---------------------------------------------------------------------*/
+static AP4_Result
+OpenRendition(Rendition& rendition, SampleCache* shared_audio, Rendition* first_rendition)
+{
 	// create the input stream
-    AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ, input);
+    AP4_Result result = AP4_FileByteStream::Create(rendition.input_name,
+                                                   AP4_FileByteStream::STREAM_MODE_READ_MAPPED,
+                                                   rendition.input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
-        return 1;
+        return result;
     }
-    
+
 	// open the file
-    AP4_File* input_file = new AP4_File(*input, AP4_DefaultAtomFactory::Instance, true);   
+    rendition.file = new AP4_File(*rendition.input, rendition.atom_factory, true);
 
     // get the movie
     AP4_SampleDescription* sample_description;
-    AP4_Movie* movie = input_file->GetMovie();
+    AP4_Movie* movie = rendition.file->GetMovie();
     if (movie == NULL) {
         fprintf(stderr, "ERROR: no movie in file\n");
-        return 1;
+        return AP4_ERROR_INVALID_FORMAT;
     }
 
     // get the audio and video tracks
-    AP4_Track* audio_track = movie->GetTrack(AP4_Track::TYPE_AUDIO);
-    AP4_Track* video_track = movie->GetTrack(AP4_Track::TYPE_VIDEO);
-    if (audio_track == NULL && video_track == NULL) {
+    rendition.video_track = movie->GetTrack(AP4_Track::TYPE_VIDEO);
+    if (shared_audio && first_rendition) {
+        rendition.audio_track = first_rendition->audio_track;
+    } else {
+        rendition.audio_track = movie->GetTrack(AP4_Track::TYPE_AUDIO);
+    }
+    if (rendition.audio_track == NULL && rendition.video_track == NULL) {
         fprintf(stderr, "ERROR: no suitable tracks found\n");
-        delete input_file;
-        input->Release();
-        return 1;
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    AP4_Track* audio_track = rendition.audio_track;
+    AP4_Track* video_track = rendition.video_track;
+
+    // the first rendition reads the shared audio samples for all the others
+    if (shared_audio && first_rendition == NULL && audio_track) {
+        result = LoadSharedAudio(rendition, *shared_audio);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to read audio samples (%d)\n", result);
+            return result;
+        }
     }
 
     // create the appropriate readers
-    AP4_LinearReader* linear_reader = NULL;
-    SampleReader*     audio_reader  = NULL;
-    SampleReader*     video_reader  = NULL;
+    if (shared_audio && audio_track) {
+        rendition.audio_reader = new CachedSampleReader(*shared_audio);
+    }
     if (movie->HasFragments()) {
         // create a linear reader to get the samples
-        linear_reader = new AP4_LinearReader(*movie, input);
-    
-        if (audio_track) {
-            linear_reader->EnableTrack(audio_track->GetId());
-            audio_reader = new FragmentedSampleReader(*linear_reader, audio_track->GetId());
+        rendition.linear_reader = new AP4_LinearReader(*movie,
+                                                       rendition.input,
+                                                       AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE,
+                                                       rendition.atom_factory);
+
+        if (audio_track && shared_audio == NULL) {
+            rendition.linear_reader->EnableTrack(audio_track->GetId());
+            rendition.audio_reader = new FragmentedSampleReader(*rendition.linear_reader, audio_track->GetId());
         }
         if (video_track) {
-            linear_reader->EnableTrack(video_track->GetId());
-            video_reader = new FragmentedSampleReader(*linear_reader, video_track->GetId());
+            rendition.linear_reader->EnableTrack(video_track->GetId());
+            rendition.video_reader = new FragmentedSampleReader(*rendition.linear_reader, video_track->GetId());
         }
     } else {
-        if (audio_track) {
-            audio_reader = new TrackSampleReader(*audio_track);
+        if (audio_track && shared_audio == NULL) {
+            rendition.audio_reader = new TrackSampleReader(*audio_track);
         }
         if (video_track) {
-            video_reader = new TrackSampleReader(*video_track);
+            rendition.video_reader = new TrackSampleReader(*video_track);
         }
     }
-    
+
     // create an MPEG2 TS Writer
-    AP4_Mpeg2TsWriter writer(Options.pmt_pid);
-    AP4_Mpeg2TsWriter::SampleStream* audio_stream = NULL;
-    AP4_Mpeg2TsWriter::SampleStream* video_stream = NULL;
-    
+    rendition.writer = new AP4_Mpeg2TsWriter(Options.pmt_pid);
+
     // add the audio stream
     if (audio_track) {
         sample_description = audio_track->GetSampleDescription(0);
         if (sample_description == NULL) {
             fprintf(stderr, "ERROR: unable to parse audio sample description\n");
-            goto end;
+            return AP4_ERROR_INVALID_FORMAT;
         }
 
         unsigned int stream_type = 0;
@@ -547,28 +921,28 @@ main(int argc, char** argv)
             stream_id   = AP4_MPEG2_TS_STREAM_ID_PRIVATE_STREAM_1;
         } else {
             fprintf(stderr, "ERROR: audio codec not supported\n");
-            return 1;
+            return AP4_ERROR_NOT_SUPPORTED;
         }
 
-        result = writer.SetAudioStream(audio_track->GetMediaTimeScale(),
-                                       stream_type,
-                                       stream_id,
-                                       audio_stream,
-                                       Options.audio_pid);
+        result = rendition.writer->SetAudioStream(audio_track->GetMediaTimeScale(),
+                                                  stream_type,
+                                                  stream_id,
+                                                  rendition.audio_stream,
+                                                  Options.audio_pid);
         if (AP4_FAILED(result)) {
             fprintf(stderr, "could not create audio stream (%d)\n", result);
-            goto end;
+            return result;
         }
     }
-    
+
     // add the video stream
     if (video_track) {
         sample_description = video_track->GetSampleDescription(0);
         if (sample_description == NULL) {
             fprintf(stderr, "ERROR: unable to parse video sample description\n");
-            goto end;
+            return AP4_ERROR_INVALID_FORMAT;
         }
-        
+
         // decide on the stream type
         unsigned int stream_type = 0;
         unsigned int stream_id   = AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO;
@@ -582,34 +956,300 @@ main(int argc, char** argv)
             stream_type = AP4_MPEG2_STREAM_TYPE_HEVC;
         } else {
             fprintf(stderr, "ERROR: video codec not supported\n");
-            return 1;
+            return AP4_ERROR_NOT_SUPPORTED;
         }
-        result = writer.SetVideoStream(video_track->GetMediaTimeScale(),
-                                       stream_type,
-                                       stream_id,
-                                       video_stream,
-                                       Options.video_pid);
+        result = rendition.writer->SetVideoStream(video_track->GetMediaTimeScale(),
+                                                  stream_type,
+                                                  stream_id,
+                                                  rendition.video_stream,
+                                                  Options.video_pid);
         if (AP4_FAILED(result)) {
             fprintf(stderr, "could not create video stream (%d)\n", result);
-            goto end;
+            return result;
+        }
+    }
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   GetCodecString
++---------------------------------------------------------------------*/
+static AP4_Result
+GetCodecString(AP4_Track* track, AP4_String& codec)
+{
+    AP4_SampleDescription* sample_description = track->GetSampleDescription(0);
+    if (sample_description == NULL) return AP4_ERROR_INVALID_FORMAT;
+
+    char coding[5];
+    char string[64];
+    AP4_FormatFourChars(coding, sample_description->GetFormat());
+    AP4_AvcSampleDescription* avc_desc = AP4_DYNAMIC_CAST(AP4_AvcSampleDescription, sample_description);
+    AP4_MpegAudioSampleDescription* mpeg_audio_desc = AP4_DYNAMIC_CAST(AP4_MpegAudioSampleDescription, sample_description);
+    if (avc_desc) {
+        AP4_FormatString(string, sizeof(string), "%s.%02X%02X%02X",
+                         coding,
+                         avc_desc->GetProfile(),
+                         avc_desc->GetProfileCompatibility(),
+                         avc_desc->GetLevel());
+    } else if (mpeg_audio_desc) {
+        if (mpeg_audio_desc->GetObjectTypeId() == AP4_OTI_MPEG4_AUDIO) {
+            AP4_FormatString(string, sizeof(string), "%s.%02X.%d",
+                             coding,
+                             mpeg_audio_desc->GetObjectTypeId(),
+                             mpeg_audio_desc->GetMpeg4AudioObjectType());
+        } else {
+            AP4_FormatString(string, sizeof(string), "%s.%02X", coding, mpeg_audio_desc->GetObjectTypeId());
+        }
+    } else if (sample_description->GetFormat() == AP4_SAMPLE_FORMAT_AC_3 ||
+               sample_description->GetFormat() == AP4_SAMPLE_FORMAT_EC_3) {
+        AP4_FormatString(string, sizeof(string), "%s", coding);
+    } else {
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    codec = string;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   WriteMasterPlaylist
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteMasterPlaylist(AP4_Array<Rendition*>& renditions)
+{
+    AP4_ByteStream* playlist = OpenOutput(Options.master_playlist, 0);
+    if (playlist == NULL) return AP4_ERROR_CANNOT_OPEN_FILE;
+
+    playlist->WriteString("#EXTM3U\r\n");
+    for (unsigned int i=0; i<renditions.ItemCount(); i++) {
+        Rendition& rendition = *renditions[i];
+
+        // the peak and average bitrates of the segments
+        AP4_UI64      peak_bandwidth = 0;
+        AP4_UI64      total_duration = 0;
+        AP4_LargeSize total_size     = 0;
+        for (unsigned int j=0; j<rendition.segments.ItemCount(); j++) {
+            const Segment& segment = rendition.segments[j];
+            if (segment.duration) {
+                AP4_UI64 bandwidth = (8*segment.size*1000)/segment.duration;
+                if (bandwidth > peak_bandwidth) peak_bandwidth = bandwidth;
+            }
+            total_duration += segment.duration;
+            total_size     += segment.size;
+        }
+        AP4_UI64 average_bandwidth = total_duration?(8*total_size*1000)/total_duration:0;
+        if (peak_bandwidth == 0) peak_bandwidth = average_bandwidth;
+
+        char string_buffer[1024];
+        AP4_FormatString(string_buffer, sizeof(string_buffer),
+                         "#EXT-X-STREAM-INF:BANDWIDTH=%u,AVERAGE-BANDWIDTH=%u",
+                         (unsigned int)peak_bandwidth,
+                         (unsigned int)average_bandwidth);
+        playlist->WriteString("\r\n");
+        playlist->WriteString(string_buffer);
+
+        // the codecs, only if all of them can be described
+        AP4_String video_codec;
+        AP4_String audio_codec;
+        if ((rendition.video_track == NULL || AP4_SUCCEEDED(GetCodecString(rendition.video_track, video_codec))) &&
+            (rendition.audio_track == NULL || AP4_SUCCEEDED(GetCodecString(rendition.audio_track, audio_codec)))) {
+            playlist->WriteString(",CODECS=\"");
+            playlist->WriteString(video_codec.GetChars());
+            if (video_codec.GetLength() && audio_codec.GetLength()) playlist->WriteString(",");
+            playlist->WriteString(audio_codec.GetChars());
+            playlist->WriteString("\"");
+        }
+
+        if (rendition.video_track) {
+            AP4_VideoSampleDescription* video_desc =
+                AP4_DYNAMIC_CAST(AP4_VideoSampleDescription, rendition.video_track->GetSampleDescription(0));
+            if (video_desc) {
+                AP4_FormatString(string_buffer, sizeof(string_buffer), ",RESOLUTION=%dx%d",
+                                 video_desc->GetWidth(),
+                                 video_desc->GetHeight());
+                playlist->WriteString(string_buffer);
+            }
         }
+        playlist->WriteString("\r\n");
+        GetRelativePath(rendition.playlist_name, Options.master_playlist, string_buffer, sizeof(string_buffer));
+        playlist->WriteString(string_buffer);
+        playlist->WriteString("\r\n");
+    }
+    playlist->Release();
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int argc, char** argv)
+{
+    if (argc < 3) {
+        PrintUsageAndExit();
     }
     
-    result = WriteSamples(writer,
-                          audio_track, audio_reader, audio_stream,
-                          video_track, video_reader, video_stream,
-                          Options.segment_duration_threshold);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: failed to write samples (%d)\n", result);
+    // default options
+    Options.segment                    = 0;
+    Options.pmt_pid                    = 0x100;
+    Options.audio_pid                  = 0x101;
+    Options.video_pid                  = 0x102;
+    Options.verbose                    = false;
+    Options.playlist                   = NULL;
+    Options.master_playlist            = NULL;
+    Options.shared_audio               = false;
+    Options.thread_count               = 0;
+    Options.segment_duration_threshold = DefaultSegmentDurationThreshold;
+    
+    // parse command line
+    AP4_Array<const char*> filenames;
+    char** args = argv+1;
+    while (const char* arg = *args++) {
+        if (!strcmp(arg, "--segment")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --segment requires a number\n");
+                return 1;
+            }
+            Options.segment = strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--segment-duration-threshold")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --segment-duration-threshold requires a number\n");
+                return 1;
+            }
+            Options.segment_duration_threshold = strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--verbose")) {
+            Options.verbose = true;
+        } else if (!strcmp(arg, "--pmt-pid")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --pmt-pid requires a number\n");
+                return 1;
+            }
+            Options.pmt_pid = strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--audio-pid")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --audio-pid requires a number\n");
+                return 1;
+            }
+            Options.audio_pid = strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--video-pid")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --video-pid requires a number\n");
+                return 1;
+            }
+            Options.video_pid = strtoul(*args++, NULL, 10);
+        } else if (!strcmp(arg, "--playlist")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --playlist requires a filename\n");
+                return 1;
+            }
+            Options.playlist = *args++;
+        } else if (!strcmp(arg, "--master-playlist")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --master-playlist requires a filename\n");
+                return 1;
+            }
+            Options.master_playlist = *args++;
+        } else if (!strcmp(arg, "--shared-audio")) {
+            Options.shared_audio = true;
+        } else if (!strcmp(arg, "--threads")) {
+            if (*args == NULL) {
+                fprintf(stderr, "ERROR: --threads requires a number\n");
+                return 1;
+            }
+            Options.thread_count = strtoul(*args++, NULL, 10);
+        } else {
+            filenames.Append(arg);
+        }
+    }
+
+    // check args
+    if (filenames.ItemCount() == 0) {
+        fprintf(stderr, "ERROR: missing input file name\n");
+        return 1;
+    }
+    if (filenames.ItemCount()%2) {
+        fprintf(stderr, "ERROR: missing output file name\n");
+        return 1;
+    }
+    unsigned int rendition_count = filenames.ItemCount()/2;
+    if (Options.playlist && rendition_count > 1) {
+        char name_0[1024];
+        char name_1[1024];
+        sprintf(name_0, Options.playlist, 0);
+        sprintf(name_1, Options.playlist, 1);
+        if (!strcmp(name_0, name_1)) {
+            fprintf(stderr, "ERROR: with more than one input, --playlist requires a 'printf' template\n");
+            return 1;
+        }
+    }
+    if (Options.master_playlist && Options.playlist == NULL) {
+        fprintf(stderr, "ERROR: --master-playlist requires the --playlist option\n");
+        return 1;
+    }
+    
+    // open all the inputs
+    AP4_Array<Rendition*> renditions;
+    SampleCache           shared_audio;
+    AP4_Result            result = AP4_SUCCESS;
+    for (unsigned int i=0; i<rendition_count; i++) {
+        Rendition* rendition = new Rendition(i, filenames[2*i], filenames[2*i+1]);
+        renditions.Append(rendition);
+        if (Options.playlist) {
+            sprintf(rendition->playlist_name, Options.playlist, i);
+            
+            // a single media playlist keeps the segment names as given
+            rendition->relative_uris = rendition_count > 1 || Options.master_playlist != NULL;
+        }
+        if (rendition_count > 1) {
+            AP4_FormatString(rendition->label, sizeof(rendition->label), "[%d] ", i);
+        }
+        result = OpenRendition(*rendition,
+                               Options.shared_audio?&shared_audio:NULL,
+                               i?renditions[0]:NULL);
+        if (AP4_FAILED(result)) goto end;
+    }
+
+    // convert them, on as many threads as needed
+    {
+        SegmentBoundaries  boundaries;
+        RenditionQueue     queue(renditions, rendition_count > 1 ? &boundaries : NULL);
+        AP4_Cardinal       thread_count = Options.thread_count?Options.thread_count:AP4_Thread::GetProcessorCount();
+        if (thread_count > rendition_count) thread_count = rendition_count;
+        AP4_Array<RenditionThread*> threads;
+        if (thread_count > 1) {
+            for (unsigned int i=0; i<thread_count; i++) {
+                RenditionThread* thread = new RenditionThread(queue);
+                if (AP4_FAILED(thread->Start())) {
+                    delete thread;
+                    break;
+                }
+                threads.Append(thread);
+            }
+        }
+        if (threads.ItemCount() == 0) {
+            // no threads, convert them here, one after the other
+            queue.Run();
+        }
+        for (unsigned int i=0; i<threads.ItemCount(); i++) {
+            threads[i]->Wait();
+            delete threads[i];
+        }
+    }
+    for (unsigned int i=0; i<rendition_count; i++) {
+        if (AP4_FAILED(renditions[i]->result)) result = renditions[i]->result;
+    }
+
+    // write the master playlist
+    if (AP4_SUCCEEDED(result) && Options.master_playlist) {
+        result = WriteMasterPlaylist(renditions);
     }
 
 end:
-    delete input_file;
-    input->Release();
-    delete linear_reader;
-    delete audio_reader;
-    delete video_reader;
+    for (unsigned int i=0; i<renditions.ItemCount(); i++) {
+        delete renditions[i];
+    }
     
     return result == AP4_SUCCESS?0:1;
 }
-
@@ -77,6 +77,7 @@ public:
                                          AP4_DataBuffer& data_out) {
             return data_out.SetData(data_in.GetData(), data_in.GetDataSize());
         }
+        virtual bool IsStatelessPerSample() { return true; }
     private:
         AP4_CompactingProcessor& m_Outer;
         AP4_TrakAtom*            m_TrakAtom;
@@ -61,6 +61,14 @@ PrintUsageAndExit()
             "  --fragments-info <filename>\n"
             "      Decrypt the fragments read from <input>, with track info read\n"
             "      from <filename>.\n"
+            "  --threads <n>\n"
+            "      Use <n> threads to decrypt the samples (0 for one per processor).\n"
+            "      The samples of CTR-mode and Marlin tracks are decrypted in parallel.\n"
+            "      The output is the same for any <n>.\n"
+            "      (default: 1)\n"
+            "\n"
+            "<input> can be -stdin to decrypt a fragmented MPEG-CENC or PIFF file read\n"
+            "from a pipe, one fragment at a time.\n"
             );
     exit(1);
 }
@@ -95,10 +103,11 @@ main(int argc, char** argv)
     AP4_ProtectionKeyMap key_map;
     
     // parse options
-    const char* input_filename = NULL;
-    const char* output_filename = NULL;
-    const char* fragments_info_filename = NULL;
-    bool        show_progress = false;
+    const char*  input_filename = NULL;
+    const char*  output_filename = NULL;
+    const char*  fragments_info_filename = NULL;
+    bool         show_progress = false;
+    unsigned int thread_count = 1;
 
     char* arg;
     while ((arg = *++argv)) {
@@ -129,6 +138,13 @@ main(int argc, char** argv)
                 return 1;
             }
             fragments_info_filename = arg;
+        } else if (!strcmp(arg, "--threads")) {
+            arg = *++argv;
+            if (arg == NULL) {
+                fprintf(stderr, "ERROR: missing argument for --threads option\n");
+                return 1;
+            }
+            thread_count = (unsigned int)strtoul(arg, NULL, 10);
         } else if (!strcmp(arg, "--show-progress")) {
             show_progress = true;
         } else if (input_filename == NULL) {
@@ -154,7 +170,7 @@ main(int argc, char** argv)
     // create the input stream
     AP4_Result result;
     AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s) %d\n", input_filename, result);
         return 1;
@@ -180,8 +196,13 @@ main(int argc, char** argv)
 
     // create the decrypting processor
     AP4_Processor* processor = NULL;
-    AP4_File* input_file = new AP4_File(fragments_info?*fragments_info:*input);
-    AP4_FtypAtom* ftyp = input_file->GetFileType();
+    if (fragments_info == NULL && !strcmp(input_filename, "-stdin")) {
+        // the standard input cannot be read twice, so it cannot be inspected
+        // first: assume that it is a fragmented stream
+        processor = new AP4_CencDecryptingProcessor(&key_map);
+    }
+    AP4_File* input_file = processor?NULL:new AP4_File(fragments_info?*fragments_info:*input);
+    AP4_FtypAtom* ftyp = input_file?input_file->GetFileType():NULL;
     if (ftyp) {
         if (ftyp->GetMajorBrand() == AP4_OMA_DCF_BRAND_ODCF || ftyp->HasCompatibleBrand(AP4_OMA_DCF_BRAND_ODCF)) {
             processor = new AP4_OmaDcfDecryptingProcessor(&key_map);
@@ -220,15 +241,18 @@ main(int argc, char** argv)
         processor = new AP4_StandardDecryptingProcessor(&key_map);
     }
     
-    delete input_file;
-    input_file = NULL;
-    if (fragments_info) {
-        fragments_info->Seek(0);
-    } else {
-        input->Seek(0);
+    if (input_file) {
+        delete input_file;
+        input_file = NULL;
+        if (fragments_info) {
+            fragments_info->Seek(0);
+        } else {
+            input->Seek(0);
+        }
     }
     
     // process/decrypt the file
+    processor->SetThreadCount(thread_count);
     ProgressListener listener;
     if (fragments_info) {
         result = processor->Process(*input, *output, *fragments_info, show_progress?&listener:NULL);
@@ -80,6 +80,16 @@ PrintUsageAndExit()
         "      (several --pssh options can be used, with a different system ID for each)\n"
         "  --kms-uri <uri>\n"
         "      Specifies the KMS URI for the ISMA-IAEC method\n"
+        "  --threads <n>\n"
+        "      Use <n> threads to encrypt the samples (0 for one per processor).\n"
+        "      With OMA-PDCF-CTR, ISMA-IAEC and MARLIN-IPMP-ACBC, the samples are\n"
+        "      encrypted in parallel. With PIFF-CTR and MPEG-CENC, whole fragments\n"
+        "      of fragmented files are encrypted in parallel. The output is the\n"
+        "      same for any <n>.\n"
+        "      (default: 1)\n"
+        "\n"
+        "  <input> can be -stdin to encrypt a fragmented file read from a pipe, one\n"
+        "  fragment at a time (the input checks done by --strict are then skipped).\n"
         "\n"
         "  Method Specifics:\n"
         "    OMA-PDCF-CBC, MARLIN-IPMP-ACBC, MARLIN-IPMP-ACGK, PIFF-CBC: \n"
@@ -209,6 +219,7 @@ main(int argc, char** argv)
     AP4_TrackPropertyMap     property_map;
     bool                     show_progress = false;
     bool                     strict = false;
+    unsigned int             thread_count = 1;
     AP4_Array<AP4_PsshAtom*> pssh_atoms;
     AP4_Result               result;
     
@@ -412,6 +423,13 @@ main(int argc, char** argv)
             }
             // set the property in the map
             property_map.SetProperty(track, name, value);
+        } else if (!strcmp(arg, "--threads")) {
+            arg = *++argv;
+            if (arg == NULL) {
+                fprintf(stderr, "ERROR: missing argument for --threads option\n");
+                return 1;
+            }
+            thread_count = (unsigned int)strtoul(arg, NULL, 10);
         } else if (!strcmp(arg, "--global-option")) {
             arg = *++argv;
             char* name = NULL;
@@ -518,7 +536,7 @@ main(int argc, char** argv)
     
     // create the input stream
     AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s)\n", input_filename);
         return 1;
@@ -543,14 +561,18 @@ main(int argc, char** argv)
     }
     
     // process/decrypt the file
+    processor->SetThreadCount(thread_count);
     ProgressListener listener;
     if (fragments_info) {
         bool check = CheckWarning(*fragments_info, key_map, method);
         if (strict && check) return 1;
         result = processor->Process(*input, *output, *fragments_info, show_progress?&listener:NULL);
     } else {
-        bool check = CheckWarning(*input, key_map, method);
-        if (strict && check) return 1;
+        // the standard input cannot be read twice, so skip the checks
+        if (strcmp(input_filename, "-stdin")) {
+            bool check = CheckWarning(*input, key_map, method);
+            if (strict && check) return 1;
+        }
         result = processor->Process(*input, *output, show_progress?&listener:NULL);
     }
     if (AP4_FAILED(result)) {
@@ -46,6 +46,7 @@
 +---------------------------------------------------------------------*/
 const unsigned int AP4_FRAGMENTER_DEFAULT_FRAGMENT_DURATION   = 2000; // ms
 const unsigned int AP4_FRAGMENTER_MAX_AUTO_FRAGMENT_DURATION  = 15000; 
+#define AP4_FRAGMENTER_DEFAULT_PATTERN_PARAMS "IN"
 
 /*----------------------------------------------------------------------
 |   options
@@ -69,6 +70,20 @@ PrintUsageAndExit()
             "  --debug enable debugging information output\n"
             "  --fragment-duration <milliseconds> (default = automatic)\n"
             "  --timescale <n> (use 10000000 for Smooth Streaming compatibility)\n"
+            "  --no-mfra do not write an 'mfra' index at the end of the output\n"
+            "  --streaming write each fragment out as soon as it is produced\n"
+            "    (implied when <output> is -stdout, which can be used to write\n"
+            "    to a pipe; combine with --no-mfra for a memory use that does\n"
+            "    not grow with the number of fragments)\n"
+            "  --sidx add a segment index: a top-level 'sidx' atom when writing a single\n"
+            "    output file (which must then be seekable), or a 'sidx' atom at the\n"
+            "    start of each media segment when used with --media-segment\n"
+            "  --media-segment <filename-pattern> write each fragment to a separate media\n"
+            "    segment file, and only the init segment to <output>\n"
+            "    (ex: segment-%%llu.%%04llu.m4s)\n"
+            "  --pattern-parameters <params> one or more selector letter (default: IN)\n"
+            "    I: track ID\n"
+            "    N: segment number, starting with 0\n"
             );
     exit(1);
 }
@@ -134,6 +149,8 @@ public:
     
     AP4_Result    Init();
     AP4_Result    SetSampleIndex(AP4_Ordinal sample_index);
+    AP4_Ordinal   GetFragmentEnd(AP4_Ordinal sample_index, AP4_UI64 target_dts);
+    AP4_Cardinal  GetAnchorFragmentCount();
     
     AP4_Track*    m_Track;
     SampleArray*  m_Samples;
@@ -144,6 +161,11 @@ public:
     bool          m_Eos;
     AP4_UI64      m_TargetDuration;
     AP4_TfraAtom* m_Tfra;
+    
+    // index and DTS of the sync samples, followed by the sample count 
+    // and the DTS of the end of the track
+    AP4_Array<AP4_UI32> m_SyncSampleIndexes;
+    AP4_Array<AP4_UI64> m_SyncSampleDts;
 };
 
 /*----------------------------------------------------------------------
@@ -176,6 +198,23 @@ TrackCursor::~TrackCursor()
 AP4_Result
 TrackCursor::Init()
 {
+    // build the table of sync samples, so that fragment boundaries can be
+    // found without going through all the samples
+    AP4_Cardinal sample_count = m_Samples->GetSampleCount();
+    AP4_Sample   sample;
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_Result result = m_Samples->GetSample(i, sample);
+        if (AP4_FAILED(result)) return result;
+        if (sample.IsSync()) {
+            m_SyncSampleIndexes.Append(i);
+            m_SyncSampleDts.Append(sample.GetDts());
+        }
+    }
+    if (sample_count) {
+        m_SyncSampleIndexes.Append(sample_count);
+        m_SyncSampleDts.Append(sample.GetDts()+sample.GetDuration());
+    }
+    
     return m_Samples->GetSample(0, m_Sample);
 }
 
@@ -200,6 +239,110 @@ TrackCursor::SetSampleIndex(AP4_Ordinal sample_index)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   TrackCursor::GetFragmentEnd
++---------------------------------------------------------------------*/
+AP4_Ordinal
+TrackCursor::GetFragmentEnd(AP4_Ordinal sample_index, AP4_UI64 target_dts)
+{
+    // find the first sync sample at or after the first sample of the fragment
+    AP4_Ordinal first = 0;
+    AP4_Ordinal last  = m_SyncSampleIndexes.ItemCount();
+    while (first < last) {
+        AP4_Ordinal middle = first+(last-first)/2;
+        if (m_SyncSampleIndexes[middle] < sample_index) {
+            first = middle+1;
+        } else {
+            last = middle;
+        }
+    }
+    
+    // find the first one that is not before the target
+    AP4_Ordinal after = first;
+    last = m_SyncSampleDts.ItemCount();
+    while (after < last) {
+        AP4_Ordinal middle = after+(last-after)/2;
+        if (m_SyncSampleDts[middle] < target_dts) {
+            after = middle+1;
+        } else {
+            last = middle;
+        }
+    }
+    
+    // pick the closest of that one and the one before it (the earliest one,
+    // if more than one have the same DTS), the one before it on a tie
+    if (after > first) {
+        AP4_UI64    before_dts = m_SyncSampleDts[after-1];
+        AP4_Ordinal before     = first;
+        last = after-1;
+        while (before < last) {
+            AP4_Ordinal middle = before+(last-before)/2;
+            if (m_SyncSampleDts[middle] < before_dts) {
+                before = middle+1;
+            } else {
+                last = middle;
+            }
+        }
+        if (after == m_SyncSampleDts.ItemCount() ||
+            target_dts-before_dts <= m_SyncSampleDts[after]-target_dts) {
+            return m_SyncSampleIndexes[before];
+        }
+    }
+    if (after < m_SyncSampleIndexes.ItemCount()) {
+        return m_SyncSampleIndexes[after];
+    }
+    
+    return m_Samples->GetSampleCount();
+}
+
+/*----------------------------------------------------------------------
+|   TrackCursor::GetAnchorFragmentCount
++---------------------------------------------------------------------*/
+AP4_Cardinal
+TrackCursor::GetAnchorFragmentCount()
+{
+    // the fragments of the anchor track only depend on its own samples
+    AP4_Cardinal fragment_count = 0;
+    AP4_Cardinal sample_count   = m_Samples->GetSampleCount();
+    AP4_Sample   sample;
+    for (AP4_Ordinal start = 0; start < sample_count; ++fragment_count) {
+        if (AP4_FAILED(m_Samples->GetSample(start, sample))) break;
+        AP4_Ordinal end = GetFragmentEnd(start, sample.GetDts()+m_TargetDuration);
+        start = end > start ? end : start+1; // at least one sample per fragment
+    }
+    
+    return fragment_count;
+}
+
+/*----------------------------------------------------------------------
+|   OpenMediaSegment
++---------------------------------------------------------------------*/
+static AP4_Result
+OpenMediaSegment(const char*      pattern,
+                 const char*      pattern_params,
+                 AP4_UI32         track_id,
+                 AP4_Ordinal      segment_number,
+                 AP4_ByteStream*& stream)
+{
+    AP4_UI64 p[2] = {0,0};
+    unsigned int params_len = (unsigned int)strlen(pattern_params);
+    for (unsigned int i=0; i<params_len && i<2; i++) {
+        if (pattern_params[i] == 'I') {
+            p[i] = track_id;
+        } else if (pattern_params[i] == 'N') {
+            p[i] = segment_number;
+        }
+    }
+    char segment_name[4096];
+    AP4_FormatString(segment_name, sizeof(segment_name), pattern, p[0], p[1]);
+    
+    AP4_Result result = AP4_FileByteStream::Create(segment_name, AP4_FileByteStream::STREAM_MODE_WRITE, stream);
+    if (AP4_FAILED(result)) {
+        fprintf(stderr, "ERROR: cannot open media segment %s (%d)\n", segment_name, result);
+    }
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   Fragment
 +---------------------------------------------------------------------*/
@@ -208,7 +351,12 @@ Fragment(AP4_File&                input_file,
          AP4_ByteStream&          output_stream,
          AP4_Array<TrackCursor*>& cursors,
          unsigned int             fragment_duration,
-         AP4_UI32                 timescale)
+         AP4_UI32                 timescale,
+         bool                     create_mfra,
+         bool                     streaming,
+         bool                     create_sidx,
+         const char*              media_segment_pattern,
+         const char*              pattern_params)
 {
     AP4_Result result;
     
@@ -312,6 +460,33 @@ Fragment(AP4_File&                input_file,
     // write the moov atom
     output_movie->GetMoovAtom()->Write(output_stream);
     
+    // reserve space for the top-level segment index, indexing the fragments
+    // of the anchor track, which will be filled in at the end
+    TrackCursor*  index_cursor = anchor_cursor;
+    AP4_SidxAtom* sidx = NULL;
+    AP4_Position  sidx_position = 0;
+    AP4_Cardinal  sidx_reference_count = 0;
+    AP4_Array<AP4_Position> sidx_reference_offsets;
+    if (create_sidx && media_segment_pattern == NULL) {
+        AP4_Track* index_track = index_cursor->m_Track;
+        AP4_UI64   ept = index_cursor->m_Sample.GetCtsDelta();
+        if (timescale) {
+            ept = AP4_ConvertTime(ept, index_track->GetMediaTimeScale(), timescale);
+        }
+        sidx = new AP4_SidxAtom(index_track->GetId(),
+                                timescale?timescale:index_track->GetMediaTimeScale(),
+                                ept,
+                                0);
+        sidx->SetReferenceCount(index_cursor->GetAnchorFragmentCount());
+        output_stream.Tell(sidx_position);
+        result = sidx->Write(output_stream);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to write 'sidx' (%d)\n", result);
+            delete sidx;
+            return;
+        }
+    }
+    
     // write all the fragments
     unsigned int sequence_number = 1;
     for(;;) {
@@ -362,39 +537,8 @@ Fragment(AP4_File&                input_file,
             }
         }
 
-        unsigned int end_sample_index = cursor->m_Samples->GetSampleCount();
-        AP4_UI64 smallest_diff = (AP4_UI64)(0xFFFFFFFFFFFFFFFFULL);
-        AP4_Sample sample;
-        for (unsigned int i=cursor->m_SampleIndex; i<=cursor->m_Samples->GetSampleCount(); i++) {
-            AP4_UI64 dts;
-            if (i < cursor->m_Samples->GetSampleCount()) {
-                result = cursor->m_Samples->GetSample(i, sample);
-                if (AP4_FAILED(result)) {
-                    fprintf(stderr, "ERROR: failed to get sample %d (%d)\n", i, result);
-                    return;
-                }
-                if (!sample.IsSync()) continue; // only look for sync samples
-                dts = sample.GetDts();
-            } else {
-                result = cursor->m_Samples->GetSample(i-1, sample);
-                if (AP4_FAILED(result)) {
-                    fprintf(stderr, "ERROR: failed to get sample %d (%d)\n", i-1, result);
-                    return;
-                }
-                dts = sample.GetDts()+sample.GetDuration();
-            }
-            AP4_SI64 diff = dts-target_dts;
-            AP4_UI64 abs_diff = diff<0?-diff:diff;
-            if (abs_diff < smallest_diff) {
-                // this sample is the closest to the target so far
-                end_sample_index = i;
-                smallest_diff = abs_diff;
-                if (diff >= 0) {
-                    // this sample is past the target, it is not going to get any better, stop looking
-                    break;
-                }
-            }
-        }
+        // end the fragment at the sync sample that is the closest to the target
+        unsigned int end_sample_index = cursor->GetFragmentEnd(cursor->m_SampleIndex, target_dts);
         if (cursor->m_Eos) continue;
         
         if (Options.debug) {
@@ -418,9 +562,11 @@ Fragment(AP4_File&                input_file,
         }
 
         // remember the time and position of this fragment
-        AP4_Position moof_offset = 0;
-        output_stream.Tell(moof_offset);
-        cursor->m_Tfra->AddEntry(cursor->m_Timestamp, moof_offset);
+        if (create_mfra) {
+            AP4_Position moof_offset = 0;
+            output_stream.Tell(moof_offset);
+            cursor->m_Tfra->AddEntry(cursor->m_Timestamp, moof_offset);
+        }
         
         // decide which sample description index to use
         // (this is not very sophisticated, we only look at the sample description
@@ -467,6 +613,10 @@ Fragment(AP4_File&                input_file,
         traf->AddChild(trun);
         moof->AddChild(traf);
         
+        // remember where the fragment starts, for the segment index
+        AP4_UI64 fragment_start  = cursor->m_Timestamp;
+        bool     starts_with_sap = cursor->m_Sample.IsSync();
+        
         // add samples to the fragment
         AP4_Array<AP4_UI32>            sample_indexes;
         unsigned int                   sample_count = 0;
@@ -523,12 +673,56 @@ Fragment(AP4_File&                input_file,
         trun->SetEntries(trun_entries);
         trun->SetDataOffset((AP4_UI32)moof->GetSize()+AP4_ATOM_HEADER_SIZE);
         
+        // open a new media segment for this fragment if needed
+        AP4_ByteStream* fragment_stream = &output_stream;
+        AP4_ByteStream* media_segment   = NULL;
+        if (media_segment_pattern) {
+            result = OpenMediaSegment(media_segment_pattern, 
+                                      pattern_params, 
+                                      cursor->m_Track->GetId(), 
+                                      cursor->m_FragmentIndex,
+                                      media_segment);
+            if (AP4_FAILED(result)) return;
+            fragment_stream = media_segment;
+        }
+        
+        // index the fragment
+        AP4_UI32 subsegment_duration = (AP4_UI32)(cursor->m_Timestamp-fragment_start);
+        AP4_UI64 fragment_ept        = fragment_start+trun_entries[0].sample_composition_time_offset;
+        if (create_sidx && media_segment) {
+            AP4_SidxAtom segment_sidx(cursor->m_Track->GetId(),
+                                      timescale?timescale:cursor->m_Track->GetMediaTimeScale(),
+                                      fragment_ept,
+                                      0);
+            segment_sidx.SetReferenceCount(1);
+            AP4_SidxAtom::Reference& reference = segment_sidx.GetReferences()[0];
+            reference.m_ReferencedSize     = (AP4_UI32)moof->GetSize()+mdat_size;
+            reference.m_SubsegmentDuration = subsegment_duration;
+            reference.m_StartsWithSap      = starts_with_sap;
+            reference.m_SapType            = starts_with_sap?1:0;
+            result = segment_sidx.Write(*fragment_stream);
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to write 'sidx' (%d)\n", result);
+                media_segment->Release();
+                return;
+            }
+        } else if (sidx && cursor == index_cursor && sidx_reference_count < sidx->GetReferences().ItemCount()) {
+            AP4_SidxAtom::Reference& reference = sidx->GetReferences()[sidx_reference_count++];
+            reference.m_SubsegmentDuration = subsegment_duration;
+            reference.m_StartsWithSap      = starts_with_sap;
+            reference.m_SapType            = starts_with_sap?1:0;
+            AP4_Position moof_offset = 0;
+            output_stream.Tell(moof_offset);
+            sidx_reference_offsets.Append(moof_offset);
+        }
+        
         // write moof
-        moof->Write(output_stream);
+        moof->Write(*fragment_stream);
         
         // write mdat
-        output_stream.WriteUI32(mdat_size);
-        output_stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+        fragment_stream->WriteUI32(mdat_size);
+        fragment_stream->WriteUI32(AP4_ATOM_TYPE_MDAT);
+        AP4_Sample     sample;
         AP4_DataBuffer sample_data;
         for (unsigned int i=0; i<sample_indexes.ItemCount(); i++) {
             // get the sample
@@ -539,39 +733,75 @@ Fragment(AP4_File&                input_file,
             }
 
             // read the sample data
-            result = sample.ReadData(sample_data);
+            result = sample.ReadDataView(sample_data);
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: failed to read sample data for sample %d (%d)\n", sample_indexes[i], result);
                 return;
             }
             
             // write the sample data
-            result = output_stream.Write(sample_data.GetData(), sample_data.GetDataSize());
+            result = fragment_stream->Write(sample_data.GetData(), sample_data.GetDataSize());
             if (AP4_FAILED(result)) {
                 fprintf(stderr, "ERROR: failed to write sample data (%d)\n", result);
+                if (media_segment) media_segment->Release();
                 return;
             }
         }
+        if (media_segment) media_segment->Release();
         
         // advance the cursor's fragment index
         ++cursor->m_FragmentIndex;
         
         // cleanup
         delete moof;
+        
+        // send the fragment on its way
+        if (streaming) {
+            result = output_stream.Flush();
+            if (AP4_FAILED(result)) {
+                fprintf(stderr, "ERROR: failed to flush the output (%d)\n", result);
+                return;
+            }
+        }
     }
     
-    // create an mfra container and write out the index
-    AP4_ContainerAtom mfra(AP4_ATOM_TYPE_MFRA);
-    for (unsigned int i=0; i<cursors.ItemCount(); i++) {
-        mfra.AddChild(cursors[i]->m_Tfra);
-        cursors[i]->m_Tfra = NULL;
+    // fill in the segment index now that we know where the fragments are
+    if (sidx) {
+        if (sidx_reference_count != sidx->GetReferences().ItemCount()) {
+            fprintf(stderr, "ERROR: unexpected number of fragments for the 'sidx' atom\n");
+            delete sidx;
+            return;
+        }
+        AP4_Position end_offset = 0;
+        output_stream.Tell(end_offset);
+        for (unsigned int i=0; i<sidx_reference_count; i++) {
+            AP4_Position next_offset = i+1 < sidx_reference_count ? sidx_reference_offsets[i+1] : end_offset;
+            sidx->GetReferences()[i].m_ReferencedSize = (AP4_UI32)(next_offset-sidx_reference_offsets[i]);
+        }
+        output_stream.Seek(sidx_position);
+        result = sidx->Write(output_stream);
+        output_stream.Seek(end_offset);
+        delete sidx;
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to write 'sidx' (%d)\n", result);
+            return;
+        }
     }
-    AP4_MfroAtom* mfro = new AP4_MfroAtom((AP4_UI32)mfra.GetSize()+16);
-    mfra.AddChild(mfro);
-    result = mfra.Write(output_stream);
-    if (AP4_FAILED(result)) {
-        fprintf(stderr, "ERROR: failed to write 'mfra' (%d)\n", result);
-        return;
+    
+    // create an mfra container and write out the index
+    if (create_mfra) {
+        AP4_ContainerAtom mfra(AP4_ATOM_TYPE_MFRA);
+        for (unsigned int i=0; i<cursors.ItemCount(); i++) {
+            mfra.AddChild(cursors[i]->m_Tfra);
+            cursors[i]->m_Tfra = NULL;
+        }
+        AP4_MfroAtom* mfro = new AP4_MfroAtom((AP4_UI32)mfra.GetSize()+16);
+        mfra.AddChild(mfro);
+        result = mfra.Write(output_stream);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to write 'mfra' (%d)\n", result);
+            return;
+        }
     }
     
     // cleanup
@@ -649,6 +879,11 @@ main(int argc, char** argv)
     unsigned int fragment_duration             = 0;
     bool         auto_detect_fragment_duration = true;
     AP4_UI32     timescale = 0;
+    bool         create_mfra = true;
+    bool         streaming = false;
+    bool         create_sidx = false;
+    const char*  media_segment_pattern = NULL;
+    const char*  pattern_params = AP4_FRAGMENTER_DEFAULT_PATTERN_PARAMS;
     AP4_Result   result;
 
     Options.verbosity = 0;
@@ -682,6 +917,26 @@ main(int argc, char** argv)
                 return 1;
             }
             timescale = strtoul(arg, NULL, 10);
+        } else if (!strcmp(arg, "--no-mfra")) {
+            create_mfra = false;
+        } else if (!strcmp(arg, "--streaming")) {
+            streaming = true;
+        } else if (!strcmp(arg, "--sidx")) {
+            create_sidx = true;
+        } else if (!strcmp(arg, "--media-segment")) {
+            arg = *argv++;
+            if (arg == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --media-segment option\n");
+                return 1;
+            }
+            media_segment_pattern = arg;
+        } else if (!strcmp(arg, "--pattern-parameters")) {
+            arg = *argv++;
+            if (arg == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --pattern-parameters option\n");
+                return 1;
+            }
+            pattern_params = arg;
         } else {
             if (input_filename == NULL) {
                 input_filename = arg;
@@ -696,6 +951,20 @@ main(int argc, char** argv)
     if (Options.debug && Options.verbosity == 0) {
         Options.verbosity = 1;
     }
+    if (strlen(pattern_params) < 1 || strlen(pattern_params) > 2) {
+        fprintf(stderr, "ERROR: --pattern-parameters argument must be 1 or 2 letters long\n");
+        return 1;
+    }
+    for (const char* param = pattern_params; *param; param++) {
+        if (*param != 'I' && *param != 'N') {
+            fprintf(stderr, "ERROR: invalid pattern parameter '%c'\n", *param);
+            return 1;
+        }
+    }
+    if (media_segment_pattern) {
+        // the index of each segment is in the segment itself
+        create_mfra = false;
+    }
     
     if (input_filename == NULL) {
         fprintf(stderr, "ERROR: no input specified\n");
@@ -703,7 +972,7 @@ main(int argc, char** argv)
     }
     AP4_ByteStream* input_stream = NULL;
     result = AP4_FileByteStream::Create(input_filename, 
-                                        AP4_FileByteStream::STREAM_MODE_READ, 
+                                        AP4_FileByteStream::STREAM_MODE_READ_MAPPED, 
                                         input_stream);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
@@ -713,6 +982,18 @@ main(int argc, char** argv)
         fprintf(stderr, "ERROR: no output specified\n");
         return 1;
     }
+    if (!strcmp(output_filename, "-stdout")) {
+        // the progress and debug messages would be mixed with the output
+        if (Options.verbosity) {
+            fprintf(stderr, "ERROR: --verbosity and --debug cannot be used with -stdout\n");
+            return 1;
+        }
+        streaming = true;
+    }
+    if (create_sidx && streaming && media_segment_pattern == NULL) {
+        fprintf(stderr, "ERROR: a top-level 'sidx' cannot be written in streaming mode\n");
+        return 1;
+    }
     AP4_ByteStream* output_stream = NULL;
     result = AP4_FileByteStream::Create(output_filename, 
                                         AP4_FileByteStream::STREAM_MODE_WRITE,
@@ -837,7 +1118,16 @@ main(int argc, char** argv)
     }
     
     // fragment the file
-    Fragment(input_file, *output_stream, cursors, fragment_duration, timescale);
+    Fragment(input_file, 
+             *output_stream, 
+             cursors, 
+             fragment_duration, 
+             timescale, 
+             create_mfra, 
+             streaming, 
+             create_sidx, 
+             media_segment_pattern,
+             pattern_params);
     
     // cleanup and exit
     if (input_stream)  input_stream->Release();
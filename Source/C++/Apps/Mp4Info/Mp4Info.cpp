@@ -1386,7 +1386,11 @@ main(int argc, char** argv)
 
     if (Options.format == JSON_FORMAT) printf("{\n");
     
-    AP4_File* file = new AP4_File(*input, AP4_DefaultAtomFactory::Instance, true);
+    // in fast mode, the sample tables are only read if needed, using
+    // a factory of our own so that the shared instance is left alone
+    AP4_DefaultAtomFactory atom_factory;
+    atom_factory.SetLazySampleTables(fast);
+    AP4_File* file = new AP4_File(*input, atom_factory, true);
     input->Release();
     
 
@@ -49,7 +49,8 @@ const unsigned int AP4_MUX_DEFAULT_VIDEO_FRAME_RATE = 24;
 |   globals
 +---------------------------------------------------------------------*/
 static struct {
-    bool verbose;
+    bool         verbose;
+    unsigned int interleave;
 } Options;
 
 /*----------------------------------------------------------------------
@@ -96,7 +97,9 @@ PrintUsageAndExit()
             "If no type is specified for an input, the type will be inferred from the file extension\n"
             "\n"
             "Options:\n"
-            "  --verbose: show more details\n");
+            "  --verbose: show more details\n"
+            "  --interleave <duration>: interleave the tracks in chunks of <duration> milliseconds\n"
+            "    (default: the samples of each track are written one track after the other)\n");
     exit(1);
 }
 
@@ -652,7 +655,8 @@ main(int argc, char** argv)
     if (argc < 2) {
         PrintUsageAndExit();
     }
-    Options.verbose = false;
+    Options.verbose    = false;
+    Options.interleave = 0;
     
     const char* output_filename = NULL;
     AP4_Array<char*> input_names;
@@ -660,6 +664,16 @@ main(int argc, char** argv)
     while (char* arg = *++argv) {
         if (!strcmp(arg, "--verbose")) {
             Options.verbose = true;
+        } else if (!strcmp(arg, "--interleave")) {
+            if (*++argv == NULL) {
+                fprintf(stderr, "ERROR: missing argument after --interleave option\n");
+                return 1;
+            }
+            Options.interleave = (unsigned int)strtoul(*argv, NULL, 10);
+            if (Options.interleave == 0) {
+                fprintf(stderr, "ERROR: invalid value for --interleave option\n");
+                return 1;
+            }
         } else if (!strcmp(arg, "--track")) {
             input_names.Append(*++argv);
         } else if (output_filename == NULL) {
@@ -772,7 +786,14 @@ main(int argc, char** argv)
     file.SetFileType(AP4_FILE_BRAND_MP42, 1, &brands[0], brands.ItemCount());
 
     // write the file to the output
-    AP4_FileWriter::Write(file, *output);
+    if (Options.interleave) {
+        result = AP4_FileWriter::Write(file, *output, AP4_FileWriter::INTERLEAVING_TIME, Options.interleave);
+    } else {
+        result = AP4_FileWriter::Write(file, *output);
+    }
+    if (AP4_FAILED(result)) {
+        fprintf(stderr, "ERROR: failed to write the output (%d)\n", result);
+    }
     
     // cleanup
     delete sample_storage;
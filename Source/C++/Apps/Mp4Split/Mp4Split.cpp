@@ -109,6 +109,286 @@ NextFragmentIndex(unsigned int track_id)
     return TrackCounters[track_index]++;
 }
 
+/*----------------------------------------------------------------------
+|   OpenMediaSegment
++---------------------------------------------------------------------*/
+static AP4_Result
+OpenMediaSegment(unsigned int track_id, AP4_ByteStream*& output)
+{
+    char segment_name[4096];
+    AP4_UI64 p[2] = {0,0};
+    unsigned int params_len = strlen(Options.pattern_params);
+    for (unsigned int i=0; i<params_len; i++) {
+        if (Options.pattern_params[i] == 'I') {
+            p[i] = track_id;
+        } else if (Options.pattern_params[i] == 'N') {
+            p[i] = NextFragmentIndex(track_id);
+        }
+    }
+    switch (params_len) {
+        case 1:
+            sprintf(segment_name, Options.media_segment_name, p[0]);
+            break;
+        case 2:
+            sprintf(segment_name, Options.media_segment_name, p[0], p[1]);
+            break;
+        default:
+            segment_name[0] = 0;
+            break;
+    }
+    AP4_Result result = AP4_FileByteStream::Create(segment_name, AP4_FileByteStream::STREAM_MODE_WRITE, output);
+    if (AP4_FAILED(result)) {
+        fprintf(stderr, "ERROR: cannot open output file (%d)\n", result);
+    }
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   CheckFragmentTrack
++---------------------------------------------------------------------*/
+static AP4_Result
+CheckFragmentTrack(unsigned int traf_count, unsigned int& track_id)
+{
+    // check if this fragment has more than one traf
+    if (traf_count > 1) {
+        if (Options.audio_only) {
+            fprintf(stderr, "ERROR: --audio option incompatible with multi-track fragments");
+            return AP4_ERROR_INVALID_FORMAT;
+        }
+        if (Options.video_only) {
+            fprintf(stderr, "ERROR: --video option incompatible with multi-track fragments");
+            return AP4_ERROR_INVALID_FORMAT;
+        }
+        track_id = 0;
+    }
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   IndexedFragment
++---------------------------------------------------------------------*/
+struct IndexedFragment {
+    AP4_Position  m_Offset;
+    AP4_LargeSize m_Size;
+    unsigned int  m_TrackId;
+};
+
+/*----------------------------------------------------------------------
+|   ReadAtomHeader
++---------------------------------------------------------------------*/
+static AP4_Result
+ReadAtomHeader(AP4_ByteStream& input, 
+               AP4_Position    offset, 
+               AP4_LargeSize   max_size,
+               AP4_UI32&       type, 
+               AP4_LargeSize&  size)
+{
+    AP4_UI08 header[16];
+    AP4_Result result = input.Seek(offset);
+    if (AP4_FAILED(result)) return result;
+    result = input.Read(header, 8);
+    if (AP4_FAILED(result)) return result;
+    size = AP4_BytesToUInt32BE(header);
+    type = AP4_BytesToUInt32BE(header+4);
+    if (size == 0) {
+        // the atom extends to the end of the range
+        size = max_size;
+    } else if (size == 1) {
+        result = input.Read(header+8, 8);
+        if (AP4_FAILED(result)) return result;
+        size = AP4_BytesToUInt64BE(header+8);
+    }
+    if (size < 8 || size > max_size) return AP4_ERROR_INVALID_FORMAT;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   ReadFragmentTrack
++---------------------------------------------------------------------*/
+static AP4_Result
+ReadFragmentTrack(AP4_ByteStream& input, 
+                  AP4_Position    moof_offset,
+                  AP4_LargeSize   moof_size,
+                  unsigned int&   traf_count,
+                  unsigned int&   track_id)
+{
+    // read the moof payload and look for the 'tfhd' atoms of its 'traf'
+    // atoms directly in the bytes, without creating the atoms
+    traf_count = 0;
+    track_id   = 0;
+    if (moof_size > 0x1000000) return AP4_ERROR_NOT_SUPPORTED;
+    AP4_DataBuffer moof((AP4_Size)moof_size);
+    AP4_Result result = input.Seek(moof_offset);
+    if (AP4_FAILED(result)) return result;
+    result = input.Read(moof.UseData(), (AP4_Size)moof_size);
+    if (AP4_FAILED(result)) return result;
+    const AP4_UI08* data = moof.GetData();
+    if (AP4_BytesToUInt32BE(data) != moof_size) return AP4_ERROR_NOT_SUPPORTED;
+    for (AP4_Size offset = AP4_ATOM_HEADER_SIZE; offset+8 <= moof_size;) {
+        AP4_UI32 size = AP4_BytesToUInt32BE(data+offset);
+        if (size < 8 || offset+size > moof_size) return AP4_ERROR_NOT_SUPPORTED;
+        if (AP4_BytesToUInt32BE(data+offset+4) == AP4_ATOM_TYPE_TRAF) {
+            for (AP4_Size child = offset+8; child+8 <= offset+size;) {
+                AP4_UI32 child_size = AP4_BytesToUInt32BE(data+child);
+                if (child_size < 8 || child+child_size > offset+size) return AP4_ERROR_NOT_SUPPORTED;
+                if (AP4_BytesToUInt32BE(data+child+4) == AP4_ATOM_TYPE_TFHD) {
+                    if (child_size < AP4_FULL_ATOM_HEADER_SIZE+4) return AP4_ERROR_NOT_SUPPORTED;
+                    track_id = AP4_BytesToUInt32BE(data+child+AP4_FULL_ATOM_HEADER_SIZE);
+                    break;
+                }
+                child += child_size;
+            }
+            if (track_id == 0) {
+                fprintf(stderr, "ERROR: invalid media format\n");
+                return AP4_ERROR_INVALID_FORMAT;
+            }
+            ++traf_count;
+        }
+        offset += size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   GetIndexedFragments
++---------------------------------------------------------------------*/
+static AP4_Result
+GetIndexedFragments(AP4_ByteStream&              input, 
+                    AP4_Position                 start,
+                    AP4_Array<IndexedFragment>&  fragments,
+                    AP4_Position&                index_offset)
+{
+    // find the 'mfra' atom from the 'mfro' atom at the end of the file
+    AP4_LargeSize input_size = 0;
+    AP4_Result result = input.GetSize(input_size);
+    if (AP4_FAILED(result) || input_size < start+16) return AP4_ERROR_NOT_SUPPORTED;
+    result = input.Seek(input_size-16);
+    if (AP4_FAILED(result)) return result;
+    AP4_Atom* atom = NULL;
+    result = AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(input, atom);
+    if (AP4_FAILED(result)) return AP4_ERROR_NOT_SUPPORTED;
+    AP4_UI32 mfra_size = 0;
+    if (atom->GetType() == AP4_ATOM_TYPE_MFRO) {
+        mfra_size = ((AP4_MfroAtom*)atom)->GetMfraSize();
+    }
+    delete atom;
+    if (mfra_size < 16 || mfra_size > input_size-start) return AP4_ERROR_NOT_SUPPORTED;
+    index_offset = input_size-mfra_size;
+    result = input.Seek(index_offset);
+    if (AP4_FAILED(result)) return result;
+    result = AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(input, atom);
+    if (AP4_FAILED(result)) return AP4_ERROR_NOT_SUPPORTED;
+    AP4_ContainerAtom* mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+    if (mfra == NULL || mfra->GetType() != AP4_ATOM_TYPE_MFRA) {
+        delete atom;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    
+    // merge the moof offsets of all the 'tfra' atoms, in file order
+    AP4_Array<AP4_TfraAtom*> tfras;
+    AP4_Array<unsigned int>  positions;
+    for (AP4_List<AP4_Atom>::Item* child = mfra->GetChildren().FirstItem(); child; child = child->GetNext()) {
+        AP4_TfraAtom* tfra = AP4_DYNAMIC_CAST(AP4_TfraAtom, child->GetData());
+        if (tfra && tfra->GetEntries().ItemCount()) {
+            tfras.Append(tfra);
+            positions.Append(0);
+        }
+    }
+    AP4_Array<AP4_Position> moof_offsets;
+    for (;;) {
+        int next = -1;
+        for (unsigned int i=0; i<tfras.ItemCount(); i++) {
+            if (positions[i] < tfras[i]->GetEntries().ItemCount() &&
+                (next < 0 || tfras[i]->GetEntries()[positions[i]].m_MoofOffset <
+                             tfras[next]->GetEntries()[positions[next]].m_MoofOffset)) {
+                next = i;
+            }
+        }
+        if (next < 0) break;
+        AP4_Position offset = tfras[next]->GetEntries()[positions[next]++].m_MoofOffset;
+        if (moof_offsets.ItemCount() && offset <= moof_offsets[moof_offsets.ItemCount()-1]) {
+            if (offset == moof_offsets[moof_offsets.ItemCount()-1]) continue;
+            
+            // the entries of a 'tfra' are not in file order
+            result = AP4_ERROR_NOT_SUPPORTED;
+            break;
+        }
+        moof_offsets.Append(offset);
+    }
+    delete mfra;
+    if (AP4_FAILED(result)) return result;
+    if (moof_offsets.ItemCount() == 0 || moof_offsets[0] < start) return AP4_ERROR_NOT_SUPPORTED;
+    
+    // check that the index lists all the fragments: each indexed range must
+    // start with a 'moof' atom and not contain another one
+    fragments.SetItemCount(moof_offsets.ItemCount());
+    for (unsigned int i=0; i<moof_offsets.ItemCount(); i++) {
+        AP4_Position end = i+1 < moof_offsets.ItemCount() ? moof_offsets[i+1] : index_offset;
+        if (end <= moof_offsets[i]) return AP4_ERROR_NOT_SUPPORTED;
+        for (AP4_Position offset = moof_offsets[i]; offset < end;) {
+            AP4_UI32      type = 0;
+            AP4_LargeSize size = 0;
+            result = ReadAtomHeader(input, offset, end-offset, type, size);
+            if (AP4_FAILED(result)) return AP4_ERROR_NOT_SUPPORTED;
+            if ((type == AP4_ATOM_TYPE_MOOF) != (offset == moof_offsets[i])) {
+                return AP4_ERROR_NOT_SUPPORTED;
+            }
+            if (type == AP4_ATOM_TYPE_MOOF) {
+                unsigned int traf_count = 0;
+                result = ReadFragmentTrack(input, offset, size, traf_count, fragments[i].m_TrackId);
+                if (AP4_FAILED(result)) return result;
+                result = CheckFragmentTrack(traf_count, fragments[i].m_TrackId);
+                if (AP4_FAILED(result)) return result;
+            }
+            offset += size;
+        }
+        fragments[i].m_Offset = moof_offsets[i];
+        fragments[i].m_Size   = end-moof_offsets[i];
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   SplitIndexedFragments
++---------------------------------------------------------------------*/
+static AP4_Result
+SplitIndexedFragments(AP4_ByteStream&                   input, 
+                      AP4_Position                      start,
+                      const AP4_Array<IndexedFragment>& fragments,
+                      AP4_ByteStream*&                  output)
+{
+    // anything between the 'moov' and the first 'moof' goes with the init 
+    // segment
+    AP4_Result result = input.Seek(start);
+    if (AP4_FAILED(result)) return result;
+    result = input.CopyTo(*output, fragments[0].m_Offset-start);
+    if (AP4_FAILED(result)) return result;
+    
+    // copy each fragment to its own file
+    for (unsigned int i=0; i<fragments.ItemCount(); i++) {
+        if (output) {
+            output->Release();
+            output = NULL;
+        }
+        unsigned int track_id = fragments[i].m_TrackId;
+        if (Options.track_filter && Options.track_filter != track_id) continue;
+        result = OpenMediaSegment(track_id, output);
+        if (AP4_FAILED(result)) return result;
+        result = input.Seek(fragments[i].m_Offset);
+        if (AP4_FAILED(result)) return result;
+        result = input.CopyTo(*output, fragments[i].m_Size);
+        if (AP4_FAILED(result)) {
+            fprintf(stderr, "ERROR: failed to copy fragment (%d)\n", result);
+            return result;
+        }
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -201,7 +481,7 @@ main(int argc, char** argv)
     
 	// create the input stream
     AP4_ByteStream* input = NULL;
-    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ, input);
+    result = AP4_FileByteStream::Create(Options.input, AP4_FileByteStream::STREAM_MODE_READ_MAPPED, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input (%d)\n", result);
         return 1;
@@ -294,7 +574,29 @@ main(int argc, char** argv)
         fprintf(stderr, "ERROR: cannot write init segment (%d)\n", result);
         return 1;
     }
-        
+    
+    // when the file has a complete fragment index, the fragments can be 
+    // copied as byte ranges without parsing them
+    if (!Options.init_only) {
+        AP4_Position start = 0;
+        input->Tell(start);
+        AP4_Array<IndexedFragment> fragments;
+        AP4_Position index_offset = 0;
+        result = GetIndexedFragments(*input, start, fragments, index_offset);
+        if (AP4_SUCCEEDED(result)) {
+            if (Options.verbose) {
+                printf("using the fragment index (%d fragments)\n", fragments.ItemCount());
+            }
+            result = SplitIndexedFragments(*input, start, fragments, output);
+            if (AP4_FAILED(result)) return 1;
+            Options.init_only = true;
+        } else if (result != AP4_ERROR_NOT_SUPPORTED) {
+            return 1;
+        } else {
+            input->Seek(start);
+        }
+    }
+    
     AP4_Atom* atom = NULL;
     unsigned int track_id = 0;
     for (;!Options.init_only;) {
@@ -320,50 +622,17 @@ main(int argc, char** argv)
             } while (traf);
     
             // check if this fragment has more than one traf
-            if (traf_count > 1) {
-                if (Options.audio_only) {
-                    fprintf(stderr, "ERROR: --audio option incompatible with multi-track fragments");
-                    return 1;
-                }
-                if (Options.video_only) {
-                    fprintf(stderr, "ERROR: --video option incompatible with multi-track fragments");
-                    return 1;
-                }
-                track_id = 0;
-            }
+            result = CheckFragmentTrack(traf_count, track_id);
+            if (AP4_FAILED(result)) return 1;
             
             // open a new file for this fragment
             if (output) {
                 output->Release();
                 output = NULL;
             }
-            char segment_name[4096];
             if (Options.track_filter == 0 || Options.track_filter == track_id) {
-                AP4_UI64 p[2] = {0,0};
-                unsigned int params_len = strlen(Options.pattern_params);
-                for (unsigned int i=0; i<params_len; i++) {
-                    if (Options.pattern_params[i] == 'I') {
-                        p[i] = track_id;
-                    } else if (Options.pattern_params[i] == 'N') {
-                        p[i] = NextFragmentIndex(track_id);
-                    }
-                }
-                switch (params_len) {
-                    case 1:
-                        sprintf(segment_name, Options.media_segment_name, p[0]);
-                        break;
-                    case 2:
-                        sprintf(segment_name, Options.media_segment_name, p[0], p[1]);
-                        break;
-                    default:
-                        segment_name[0] = 0;
-                        break;
-                }
-                result = AP4_FileByteStream::Create(segment_name, AP4_FileByteStream::STREAM_MODE_WRITE, output);
-                if (AP4_FAILED(result)) {
-                    fprintf(stderr, "ERROR: cannot open output file (%d)\n", result);
-                    return 1;
-                }
+                result = OpenMediaSegment(track_id, output);
+                if (AP4_FAILED(result)) return 1;
             }
         }
         
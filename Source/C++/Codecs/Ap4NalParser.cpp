@@ -32,6 +32,112 @@
 #include "Ap4AvcParser.h"
 #include "Ap4Utils.h"
 
+/*----------------------------------------------------------------------
+|   vector instructions
++---------------------------------------------------------------------*/
+// start codes are searched 16 bytes at a time when the baseline instruction
+// set has vector registers. On x86, the AVX2 code is compiled with a 
+// per-function target attribute and only used when the processor 
+// supports it, so that the rest of the library does not require it.
+#if !defined(AP4_CONFIG_NO_NAL_PARSER_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AP4_NAL_PARSER_SSE2
+#include <emmintrin.h>
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define AP4_NAL_PARSER_AVX2
+#define AP4_NAL_PARSER_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AP4_NAL_PARSER_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/*----------------------------------------------------------------------
+|   AP4_FindZeroPairGeneric
++---------------------------------------------------------------------*/
+// returns the offset of the first byte that is 0 and is followed by a 0 
+// or is the last byte of the buffer, or data_size if there is none. 
+// None of the bytes before that offset can be part of a start code.
+static AP4_Size
+AP4_FindZeroPairGeneric(const AP4_UI08* data, AP4_Size data_size, AP4_Size offset)
+{
+    // a byte of (a|b) is 0 only when the same byte of a and of b is 0, so
+    // a pair of 0 bytes is found by looking for a 0 byte in the or'ed words
+    for (; offset+9 <= data_size; offset += 8) {
+        AP4_UI64 a, b;
+        AP4_CopyMemory(&a, data+offset,   8);
+        AP4_CopyMemory(&b, data+offset+1, 8);
+        AP4_UI64 x = a|b;
+        if ((x-0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) break;
+    }
+    for (; offset<data_size; offset++) {
+        if (data[offset] == 0 && (offset+1 == data_size || data[offset+1] == 0)) {
+            return offset;
+        }
+    }
+    return data_size;
+}
+
+#if defined(AP4_NAL_PARSER_AVX2)
+/*----------------------------------------------------------------------
+|   AP4_FindZeroPairAvx2
++---------------------------------------------------------------------*/
+AP4_NAL_PARSER_AVX2_TARGET
+static AP4_Size
+AP4_FindZeroPairAvx2(const AP4_UI08* data, AP4_Size data_size)
+{
+    AP4_Size offset = 0;
+    const __m256i zero = _mm256_setzero_si256();
+    for (; offset+33 <= data_size; offset += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data+offset));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data+offset+1));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(a, b), zero))) break;
+    }
+    return AP4_FindZeroPairGeneric(data, data_size, offset);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_NalParserDetectAvx2
++---------------------------------------------------------------------*/
+static bool
+AP4_NalParserDetectAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+static const bool AP4_NalParserHasAvx2 = AP4_NalParserDetectAvx2();
+#endif
+
+/*----------------------------------------------------------------------
+|   AP4_FindZeroPair
++---------------------------------------------------------------------*/
+static AP4_Size
+AP4_FindZeroPair(const AP4_UI08* data, AP4_Size data_size)
+{
+    AP4_Size offset = 0;
+#if defined(AP4_NAL_PARSER_AVX2)
+    if (AP4_NalParserHasAvx2) return AP4_FindZeroPairAvx2(data, data_size);
+#endif
+#if defined(AP4_NAL_PARSER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; offset+17 <= data_size; offset += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data+offset));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data+offset+1));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a, b), zero))) break;
+    }
+#elif defined(AP4_NAL_PARSER_NEON)
+    for (; offset+17 <= data_size; offset += 16) {
+        uint8x16_t a = vld1q_u8(data+offset);
+        uint8x16_t b = vld1q_u8(data+offset+1);
+        uint64x2_t z = vreinterpretq_u64_u8(vceqq_u8(vorrq_u8(a, b), vdupq_n_u8(0)));
+        if (vgetq_lane_u64(z, 0) | vgetq_lane_u64(z, 1)) break;
+    }
+#endif
+    return AP4_FindZeroPairGeneric(data, data_size, offset);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_NalParser::AP4_NalParser
 +---------------------------------------------------------------------*/
@@ -92,6 +198,10 @@ AP4_NalParser::Feed(const void*            data,
             case STATE_RESET:
                 if (byte == 0) {
                     m_State = STATE_START_CODE_1;
+                } else {
+                    // skip to the next pair of 0 bytes
+                    data_offset += AP4_FindZeroPair((const unsigned char*)data+data_offset+1,
+                                                    data_size-data_offset-1);
                 }
                 break;
                 
@@ -137,6 +247,15 @@ AP4_NalParser::Feed(const void*            data,
                     ++payload_end;
                 }
                 m_ZeroTrail = 0; 
+                
+                // skip to the next pair of 0 bytes: the bytes before it
+                // are all part of the payload
+                {
+                    AP4_Size skipped = AP4_FindZeroPair((const unsigned char*)data+data_offset+1,
+                                                        data_size-data_offset-1);
+                    data_offset += skipped;
+                    payload_end += skipped;
+                }
                 break;
         }
     }
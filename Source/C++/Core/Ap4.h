@@ -232,6 +232,9 @@
 #include "Ap4Utils.h"
 #include "Ap4DynamicCast.h"
 #include "Ap4FileByteStream.h"
+#include "Ap4ReadAheadInputStream.h"
+#include "Ap4Threads.h"
+#include "Ap4Arena.h"
 #include "Ap4Movie.h"
 #include "Ap4Track.h"
 #include "Ap4File.h"
@@ -297,6 +300,7 @@
 #include "Ap4TfhdAtom.h"
 #include "Ap4SampleSource.h"
 #include "Ap4Mpeg2Ts.h"
+#include "Ap4Crc32.h"
 #include "Ap4Piff.h"
 #include "Ap4TrunAtom.h"
 #include "Ap4TfdtAtom.h"
@@ -0,0 +1,197 @@
+/*****************************************************************
+|
+|    AP4 - Arena Allocator
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <new>
+
+#include "Ap4Arena.h"
+
+/*----------------------------------------------------------------------
+|   types
++---------------------------------------------------------------------*/
+// header placed before each allocation, padded to keep the alignment
+union AP4_ArenaHeader {
+    AP4_Arena* m_Arena; // NULL for heap allocations
+    AP4_UI64   m_Padding;
+};
+
+/*----------------------------------------------------------------------
+|   globals
++---------------------------------------------------------------------*/
+static AP4_CONFIG_THREAD_LOCAL AP4_Arena* AP4_CurrentArena = NULL;
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Allocate
++---------------------------------------------------------------------*/
+void*
+AP4_Arena::Allocate(AP4_Size size)
+{
+    AP4_Arena*       arena = AP4_CurrentArena;
+    AP4_ArenaHeader* header;
+    if (arena) {
+        header = (AP4_ArenaHeader*)arena->AllocateLocal(sizeof(AP4_ArenaHeader)+size);
+    } else {
+        header = (AP4_ArenaHeader*)::operator new(sizeof(AP4_ArenaHeader)+size);
+    }
+    header->m_Arena = arena;
+    
+    return header+1;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Free
++---------------------------------------------------------------------*/
+void
+AP4_Arena::Free(void* memory)
+{
+    if (memory == NULL) return;
+    AP4_ArenaHeader* header = ((AP4_ArenaHeader*)memory)-1;
+    if (header->m_Arena) {
+        header->m_Arena->FreeLocal();
+    } else {
+        ::operator delete((void*)header);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::GetCurrent
++---------------------------------------------------------------------*/
+AP4_Arena*
+AP4_Arena::GetCurrent()
+{
+    return AP4_CurrentArena;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Scope::Scope
++---------------------------------------------------------------------*/
+AP4_Arena::Scope::Scope(AP4_Arena* arena) :
+    m_PreviousArena(AP4_CurrentArena)
+{
+    AP4_CurrentArena = arena;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Scope::~Scope
++---------------------------------------------------------------------*/
+AP4_Arena::Scope::~Scope()
+{
+    AP4_CurrentArena = m_PreviousArena;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::AP4_Arena
++---------------------------------------------------------------------*/
+AP4_Arena::AP4_Arena(AP4_Size block_size) :
+    m_BlockSize(block_size),
+    m_Blocks(NULL),
+    m_CurrentBlock(NULL),
+    m_CurrentOffset(0),
+    m_ReferenceCount(1),
+    m_AllocationCount(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::~AP4_Arena
++---------------------------------------------------------------------*/
+AP4_Arena::~AP4_Arena()
+{
+    Block* block = m_Blocks;
+    while (block) {
+        Block* next = block->m_Next;
+        ::operator delete((void*)block);
+        block = next;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::Release
++---------------------------------------------------------------------*/
+void
+AP4_Arena::Release()
+{
+    if (--m_ReferenceCount == 0 && m_AllocationCount == 0) {
+        delete this;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::AllocateLocal
++---------------------------------------------------------------------*/
+void*
+AP4_Arena::AllocateLocal(AP4_Size size)
+{
+    // keep all allocations aligned on 8 bytes
+    size = (size+7)&~7;
+    
+    for (;;) {
+        // allocate from the current block if it has enough room left
+        if (m_CurrentBlock && m_CurrentOffset+size <= m_CurrentBlock->m_Size) {
+            void* memory = ((AP4_UI08*)(m_CurrentBlock+1))+m_CurrentOffset;
+            m_CurrentOffset += size;
+            ++m_AllocationCount;
+            return memory;
+        }
+        
+        // move on to the next block, inserting a new one if it is too small
+        Block* next = m_CurrentBlock ? m_CurrentBlock->m_Next : m_Blocks;
+        if (next == NULL || next->m_Size < size) {
+            AP4_Size block_size = size > m_BlockSize ? size : m_BlockSize;
+            Block* block = (Block*)::operator new(sizeof(Block)+block_size);
+            block->m_Next = next;
+            block->m_Size = block_size;
+            if (m_CurrentBlock) {
+                m_CurrentBlock->m_Next = block;
+            } else {
+                m_Blocks = block;
+            }
+            next = block;
+        }
+        m_CurrentBlock  = next;
+        m_CurrentOffset = 0;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Arena::FreeLocal
++---------------------------------------------------------------------*/
+void
+AP4_Arena::FreeLocal()
+{
+    if (--m_AllocationCount) return;
+    if (m_ReferenceCount == 0) {
+        delete this;
+    } else {
+        // everything has been freed: start again from the first block
+        m_CurrentBlock  = NULL;
+        m_CurrentOffset = 0;
+    }
+}
@@ -0,0 +1,134 @@
+/*****************************************************************
+|
+|    AP4 - Arena Allocator
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_ARENA_H_
+#define _AP4_ARENA_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stddef.h>
+
+#include "Ap4Types.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_ARENA_DEFAULT_BLOCK_SIZE = 16*1024;
+const AP4_Size AP4_ARENA_MAX_BLOCK_SIZE     = 1024*1024;
+
+/*----------------------------------------------------------------------
+|   AP4_Arena
++---------------------------------------------------------------------*/
+/**
+ * Region allocator for short-lived trees of atoms, such as the tree of a
+ * 'moof' atom.
+ * While an arena is the current arena of a thread (see AP4_Arena::Scope),
+ * the atoms, list items and array buffers allocated by that thread are
+ * carved out of large blocks owned by the arena, instead of being allocated
+ * one by one from the heap. Freeing one of those objects only decrements a 
+ * counter. When all the objects allocated from an arena have been freed, 
+ * its blocks are reused for the next allocations, and when, in addition, 
+ * the arena has been released by all its owners, its blocks are freed. 
+ * So objects allocated from an arena may safely outlive the code that 
+ * created it, and may be deleted in any order.
+ * An arena may only be used by one thread at a time.
+ */
+class AP4_Arena {
+public:
+    // class methods
+    /**
+     * Allocate memory from the current arena of the calling thread, or 
+     * from the heap if the thread has no current arena. The memory is
+     * aligned on 8 bytes.
+     */
+    static void* Allocate(AP4_Size size);
+
+    /**
+     * Free memory obtained from Allocate(), whichever arena it was 
+     * allocated from. NULL is ignored.
+     */
+    static void Free(void* memory);
+
+    /**
+     * Return the current arena of the calling thread, or NULL.
+     */
+    static AP4_Arena* GetCurrent();
+
+    /**
+     * Make an arena the current arena of the calling thread for the
+     * lifetime of the Scope object. A NULL arena means that the memory
+     * is allocated from the heap.
+     */
+    class Scope {
+    public:
+        Scope(AP4_Arena* arena);
+       ~Scope();
+
+    private:
+        AP4_Arena* m_PreviousArena;
+    };
+
+    /**
+     * Construct an arena with one reference, owned by the caller.
+     * @param block_size Size of the blocks allocated by the arena. Larger
+     * allocations get a block of their own.
+     */
+    AP4_Arena(AP4_Size block_size = AP4_ARENA_DEFAULT_BLOCK_SIZE);
+
+    // methods
+    void         AddReference() { ++m_ReferenceCount; }
+    void         Release();
+    AP4_Cardinal GetAllocationCount() { return m_AllocationCount; }
+
+private:
+    // types
+    struct Block {
+        Block*   m_Next;
+        AP4_Size m_Size;
+    };
+
+    // methods
+    ~AP4_Arena(); // use Release()
+    void* AllocateLocal(AP4_Size size);
+    void  FreeLocal();
+
+    // members
+    AP4_Size     m_BlockSize;
+    Block*       m_Blocks;
+    Block*       m_CurrentBlock;
+    AP4_Size     m_CurrentOffset;
+    AP4_Cardinal m_ReferenceCount;
+    AP4_Cardinal m_AllocationCount;
+
+    // no copy
+    AP4_Arena(const AP4_Arena&);
+    AP4_Arena& operator=(const AP4_Arena&);
+};
+
+#endif // _AP4_ARENA_H_
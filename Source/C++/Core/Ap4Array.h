@@ -42,6 +42,7 @@
 #endif
 #include "Ap4Types.h"
 #include "Ap4Results.h"
+#include "Ap4Arena.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -84,7 +85,7 @@ template <typename T>
 AP4_Array<T>::AP4_Array(const T* items, AP4_Size count) :
     m_AllocatedCount(count),
     m_ItemCount(count),
-    m_Items((T*)::operator new(count*sizeof(T)))
+    m_Items((T*)AP4_Arena::Allocate(count*sizeof(T)))
 {
     for (unsigned int i=0; i<count; i++) {
         new ((void*)&m_Items[i]) T(items[i]);
@@ -115,7 +116,7 @@ template <typename T>
 AP4_Array<T>::~AP4_Array()
 {
     Clear();
-    ::operator delete((void*)m_Items);
+    AP4_Arena::Free((void*)m_Items);
 }
 
 /*----------------------------------------------------------------------
@@ -169,7 +170,7 @@ AP4_Array<T>::EnsureCapacity(AP4_Cardinal count)
     if (count <= m_AllocatedCount) return AP4_SUCCESS;
 
     // (re)allocate the items
-    T* new_items = (T*) ::operator new (count*sizeof(T));
+    T* new_items = (T*)AP4_Arena::Allocate(count*sizeof(T));
     if (new_items == NULL) {
         return AP4_ERROR_OUT_OF_MEMORY;
     }
@@ -178,7 +179,7 @@ AP4_Array<T>::EnsureCapacity(AP4_Cardinal count)
             new ((void*)&new_items[i]) T(m_Items[i]);
             m_Items[i].~T();
         }
-        ::operator delete((void*)m_Items);
+        AP4_Arena::Free((void*)m_Items);
     }
     m_Items = new_items;
     m_AllocatedCount = count;
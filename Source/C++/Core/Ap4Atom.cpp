@@ -447,6 +447,58 @@ AP4_UnknownAtom::Clone()
     return new AP4_UnknownAtom(*this);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_DeferredAtomData::Defer
++---------------------------------------------------------------------*/
+void
+AP4_DeferredAtomData::Defer(AP4_ByteStream& stream)
+{
+    Release();
+    if (AP4_FAILED(stream.Tell(m_SourcePosition))) return;
+    m_SourceStream = &stream;
+    m_SourceStream->AddReference();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DeferredAtomData::Begin
++---------------------------------------------------------------------*/
+AP4_ByteStream*
+AP4_DeferredAtomData::Begin()
+{
+    if (m_SourceStream == NULL) return NULL;
+    
+    // remember the stream position, so that it can be restored
+    // (if the seek fails, reading the data will fail too, as it would
+    // have when parsing the atom from a truncated stream)
+    m_SourceStream->Tell(m_StreamPosition);
+    m_SourceStream->Seek(m_SourcePosition);
+    
+    return m_SourceStream;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DeferredAtomData::End
++---------------------------------------------------------------------*/
+void
+AP4_DeferredAtomData::End()
+{
+    if (m_SourceStream == NULL) return;
+    m_SourceStream->Seek(m_StreamPosition);
+    Release();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DeferredAtomData::Release
++---------------------------------------------------------------------*/
+void
+AP4_DeferredAtomData::Release()
+{
+    if (m_SourceStream) {
+        m_SourceStream->Release();
+        m_SourceStream = NULL;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_NullTerminatedStringAtom::AP4_NullTerminatedStringAtom
 +---------------------------------------------------------------------*/
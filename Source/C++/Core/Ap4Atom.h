@@ -43,6 +43,7 @@
 #include "Ap4Debug.h"
 #include "Ap4DynamicCast.h"
 #include "Ap4Array.h"
+#include "Ap4Arena.h"
 
 /*----------------------------------------------------------------------
 |   macros
@@ -239,6 +240,10 @@ public:
 
     // destructor
     virtual ~AP4_Atom() {}
+
+    // memory management (atoms are allocated from the current arena, if any)
+    static void* operator new(size_t size) { return AP4_Arena::Allocate((AP4_Size)size); }
+    static void  operator delete(void* memory) { AP4_Arena::Free(memory); }
     
     // methods
     AP4_UI32           GetFlags() const { return m_Flags; }
@@ -355,6 +360,55 @@ private:
     AP4_DataBuffer  m_Payload;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_DeferredAtomData
++---------------------------------------------------------------------*/
+/**
+ * Helper for atoms that can postpone reading part of their payload until
+ * it is first needed (see AP4_AtomFactory::SetLazySampleTables()).
+ * Like AP4_UnknownAtom, it keeps a reference to the source stream and 
+ * the position of the data that has not been read yet.
+ * Reading the deferred data changes the state of the atom, so atoms 
+ * that use this must not be accessed from more than one thread at a 
+ * time until their data has been read.
+ */
+class AP4_DeferredAtomData {
+public:
+    // constructor and destructor
+    AP4_DeferredAtomData() : m_SourceStream(NULL), m_SourcePosition(0), m_StreamPosition(0) {}
+    ~AP4_DeferredAtomData() { Release(); }
+
+    // methods
+    /**
+     * Remember the current position of a stream, and keep a reference
+     * to it, so that the data can be read later.
+     */
+    void Defer(AP4_ByteStream& stream);
+    bool IsPending() const { return m_SourceStream != NULL; }
+
+    /**
+     * Seek to the deferred data and return the stream from which to
+     * read it, or NULL if there is no pending data. After reading the 
+     * data, call End() to restore the stream position and release the
+     * stream.
+     */
+    AP4_ByteStream* Begin();
+    void            End();
+
+private:
+    // methods
+    void Release();
+
+    // members
+    AP4_ByteStream* m_SourceStream;
+    AP4_Position    m_SourcePosition;
+    AP4_Position    m_StreamPosition; // position of the stream before Begin()
+
+    // forbid copies
+    AP4_DeferredAtomData(const AP4_DeferredAtomData&);
+    AP4_DeferredAtomData& operator=(const AP4_DeferredAtomData&);
+};
+
 /*----------------------------------------------------------------------
 |   AP4_NullTerminatedStringAtom
 +---------------------------------------------------------------------*/
@@ -109,6 +109,18 @@
 AP4_AtomFactory::~AP4_AtomFactory()
 {
     m_TypeHandlers.DeleteReferences();
+    if (m_Arena) m_Arena->Release();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomFactory::SetArena
++---------------------------------------------------------------------*/
+void
+AP4_AtomFactory::SetArena(AP4_Arena* arena)
+{
+    if (arena) arena->AddReference();
+    if (m_Arena) m_Arena->Release();
+    m_Arena = arena;
 }
 
 /*----------------------------------------------------------------------
@@ -161,6 +173,9 @@ AP4_AtomFactory::CreateAtomFromStream(AP4_ByteStream& stream,
     // NULL by default
     atom = NULL;
 
+    // allocate from our own arena, if we have one
+    AP4_Arena::Scope arena_scope(m_Arena?m_Arena:AP4_Arena::GetCurrent());
+
     // check that there are enough bytes for at least a header
     if (bytes_available < 8) return AP4_ERROR_EOS;
 
@@ -418,42 +433,42 @@ AP4_AtomFactory::CreateAtomFromStream(AP4_ByteStream& stream,
 
           case AP4_ATOM_TYPE_STSC:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StscAtom::Create(size_32, stream);
+            atom = AP4_StscAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_STCO:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StcoAtom::Create(size_32, stream);
+            atom = AP4_StcoAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_CO64:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_Co64Atom::Create(size_32, stream);
+            atom = AP4_Co64Atom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_STSZ:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StszAtom::Create(size_32, stream);
+            atom = AP4_StszAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_STZ2:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_Stz2Atom::Create(size_32, stream);
+            atom = AP4_Stz2Atom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_STTS:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_SttsAtom::Create(size_32, stream);
+            atom = AP4_SttsAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_CTTS:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_CttsAtom::Create(size_32, stream);
+            atom = AP4_CttsAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_STSS:
             if (atom_is_large) return AP4_ERROR_INVALID_FORMAT;
-            atom = AP4_StssAtom::Create(size_32, stream);
+            atom = AP4_StssAtom::Create(size_32, stream, m_LazySampleTables);
             break;
 
           case AP4_ATOM_TYPE_IODS:
@@ -807,6 +822,8 @@ AP4_AtomFactory::CreateAtomsFromStream(AP4_ByteStream& stream,
 void
 AP4_AtomFactory::PushContext(AP4_Atom::Type context) 
 {
+    // the context stack outlives the atoms, so it must not use their arena
+    AP4_Arena::Scope arena_scope(NULL);
     m_ContextStack.Append(context);
 }
 
@@ -58,7 +58,7 @@ class AP4_AtomFactory {
     };
 
     // constructor
-    AP4_AtomFactory() {}
+    AP4_AtomFactory() : m_LazySampleTables(false), m_Arena(NULL) {}
 
     // destructor
     virtual ~AP4_AtomFactory();
@@ -82,6 +82,34 @@ class AP4_AtomFactory {
                                      AP4_LargeSize   bytes_available,
                                      AP4_AtomParent& atoms);
 
+    /**
+     * Enable or disable lazy parsing of the sample tables. When enabled,
+     * the 'stsz', 'stz2', 'stco', 'co64', 'stts', 'ctts', 'stss' and 
+     * 'stsc' atoms only read their header when they are created. Their
+     * entries are read from the source stream the first time they are 
+     * accessed, so parsing a 'moov' atom takes the same time and memory
+     * regardless of the number of samples. The atoms keep a reference to
+     * the source stream until their entries have been read.
+     * Lazy parsing is disabled by default. Since the setting applies to
+     * every parse done with the factory, enable it on a factory of your
+     * own rather than on AP4_DefaultAtomFactory::Instance.
+     */
+    void SetLazySampleTables(bool lazy) { m_LazySampleTables = lazy; }
+    bool GetLazySampleTables()          { return m_LazySampleTables; }
+
+    /**
+     * Set the arena from which the atoms created by this factory are
+     * allocated, or NULL to allocate them from the current arena of the
+     * calling thread (see AP4_Arena), which is the default. The factory
+     * keeps a reference to the arena. Using a private factory with its own
+     * arena to parse a file makes the deletion of the whole atom tree 
+     * release all its memory at once. Since an arena may only be used by
+     * one thread at a time, the factory may then only be used by one 
+     * thread at a time.
+     */
+    void       SetArena(AP4_Arena* arena);
+    AP4_Arena* GetArena() { return m_Arena; }
+
     // context
     void PushContext(AP4_Atom::Type context);
     void PopContext();
@@ -91,6 +119,8 @@ private:
     // members
     AP4_Array<AP4_Atom::Type> m_ContextStack;
     AP4_List<TypeHandler>     m_TypeHandlers;
+    bool                      m_LazySampleTables;
+    AP4_Arena*                m_Arena;
 };
 
 /*----------------------------------------------------------------------
@@ -66,6 +66,11 @@ AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom* stbl,
     m_StsdAtom = AP4_DYNAMIC_CAST(AP4_StsdAtom, stbl->GetChild(AP4_ATOM_TYPE_STSD));
     m_Co64Atom = AP4_DYNAMIC_CAST(AP4_Co64Atom, stbl->GetChild(AP4_ATOM_TYPE_CO64));
 
+    // the index is built on demand
+    m_Index             = NULL;
+    m_IndexMemoryBudget = AP4_ATOM_SAMPLE_TABLE_DEFAULT_INDEX_MEMORY_BUDGET;
+    m_IndexPending      = true;
+
     // keep a reference to the sample stream
     m_SampleStream.AddReference();
 }
@@ -75,9 +80,221 @@ AP4_AtomSampleTable::AP4_AtomSampleTable(AP4_ContainerAtom* stbl,
 +---------------------------------------------------------------------*/
 AP4_AtomSampleTable::~AP4_AtomSampleTable()
 {
+    delete m_Index;
     m_SampleStream.Release();
 }
 
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::SampleIndex::SampleIndex
++---------------------------------------------------------------------*/
+AP4_AtomSampleTable::SampleIndex::SampleIndex(AP4_Cardinal sample_count, 
+                                              bool         has_cts_offsets) :
+    m_SampleCount(sample_count),
+    m_Offsets(new AP4_UI64[sample_count]),
+    m_Dts(new AP4_UI64[sample_count+1]),
+    m_Sizes(new AP4_UI32[sample_count]),
+    m_CtsOffsets(has_cts_offsets?new AP4_UI32[sample_count]:NULL),
+    m_Flags(new AP4_UI08[sample_count])
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::SampleIndex::~SampleIndex
++---------------------------------------------------------------------*/
+AP4_AtomSampleTable::SampleIndex::~SampleIndex()
+{
+    delete[] m_Offsets;
+    delete[] m_Dts;
+    delete[] m_Sizes;
+    delete[] m_CtsOffsets;
+    delete[] m_Flags;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::SampleIndex::GetDescriptionIndex
++---------------------------------------------------------------------*/
+AP4_Ordinal
+AP4_AtomSampleTable::SampleIndex::GetDescriptionIndex(AP4_Ordinal sample_index)
+{
+    // find the last run that starts at or before the sample
+    AP4_Ordinal lo = 0;
+    AP4_Ordinal hi = m_DescriptionRuns.ItemCount();
+    while (hi-lo > 1) {
+        AP4_Ordinal mid = lo+(hi-lo)/2;
+        if (m_DescriptionRuns[mid].m_FirstSample <= sample_index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return m_DescriptionRuns.ItemCount()?m_DescriptionRuns[lo].m_DescriptionIndex:0;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::SetIndexMemoryBudget
++---------------------------------------------------------------------*/
+void
+AP4_AtomSampleTable::SetIndexMemoryBudget(AP4_Size budget)
+{
+    m_IndexMemoryBudget = budget;
+    if (m_Index && GetIndexMemorySize(m_Index->m_SampleCount) > budget) {
+        ReleaseIndex();
+    }
+    m_IndexPending = (m_Index == NULL);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::GetIndexMemorySize
++---------------------------------------------------------------------*/
+AP4_LargeSize
+AP4_AtomSampleTable::GetIndexMemorySize(AP4_Cardinal sample_count)
+{
+    AP4_LargeSize per_sample = sizeof(AP4_UI64)+ // offset
+                               sizeof(AP4_UI64)+ // dts
+                               sizeof(AP4_UI32)+ // size
+                               sizeof(AP4_UI08); // flags
+    if (m_CttsAtom) per_sample += sizeof(AP4_UI32);
+    
+    return (AP4_LargeSize)sample_count*per_sample+sizeof(AP4_UI64)+sizeof(SampleIndex);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::ReleaseIndex
++---------------------------------------------------------------------*/
+void
+AP4_AtomSampleTable::ReleaseIndex()
+{
+    delete m_Index;
+    m_Index = NULL;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::UseIndex
++---------------------------------------------------------------------*/
+bool
+AP4_AtomSampleTable::UseIndex()
+{
+    if (m_Index) return true;
+    if (!m_IndexPending) return false;
+    
+    // only try once, until the table or the budget changes
+    m_IndexPending = false;
+    if (m_IndexMemoryBudget == 0 ||
+        GetIndexMemorySize(GetSampleCount()) > m_IndexMemoryBudget) {
+        return false;
+    }
+    return AP4_SUCCEEDED(BuildIndex());
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomSampleTable::BuildIndex
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomSampleTable::BuildIndex()
+{
+    AP4_Result result;
+    
+    // start fresh
+    ReleaseIndex();
+
+    // check that we have all the tables we need
+    if (m_StscAtom == NULL || 
+        m_SttsAtom == NULL ||
+        (m_StcoAtom == NULL && m_Co64Atom == NULL) ||
+        (m_StszAtom == NULL && m_Stz2Atom == NULL)) {
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    
+    // walk all the tables in one pass, in sample order (the atoms cache
+    // their last lookup position, so this is linear in the number of samples)
+    AP4_Cardinal sample_count = GetSampleCount();
+    SampleIndex* index = new SampleIndex(sample_count, m_CttsAtom != NULL);
+    AP4_Ordinal  current_chunk = 0;
+    AP4_UI64     offset        = 0;
+    AP4_UI64     dts           = 0;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        // MP4 uses 1-based indexes internally
+        AP4_Ordinal sample = i+1;
+        
+        // chunk and sample description
+        AP4_Ordinal chunk, skip, desc;
+        result = m_StscAtom->GetChunkForSample(sample, chunk, skip, desc);
+        if (AP4_FAILED(result)) goto fail;
+        if (skip > sample) {
+            result = AP4_ERROR_INTERNAL;
+            goto fail;
+        }
+        if (i == 0 || skip == 0 || chunk != current_chunk) {
+            // first sample of a chunk
+            current_chunk = chunk;
+            if (m_StcoAtom) {
+                AP4_UI32 offset_32;
+                result = m_StcoAtom->GetChunkOffset(chunk, offset_32);
+                offset = offset_32;
+            } else {
+                result = m_Co64Atom->GetChunkOffset(chunk, offset);
+            }
+            if (AP4_FAILED(result)) goto fail;
+            
+            // the first sample of the chunk may not be this one
+            for (AP4_Ordinal j = sample-skip; j < sample; j++) {
+                AP4_Size size = 0;
+                if (m_StszAtom) {
+                    result = m_StszAtom->GetSampleSize(j, size); 
+                } else {
+                    result = m_Stz2Atom->GetSampleSize(j, size); 
+                }
+                if (AP4_FAILED(result)) goto fail;
+                offset += size;
+            }
+        }
+        if (index->m_DescriptionRuns.ItemCount() == 0 ||
+            index->m_DescriptionRuns[index->m_DescriptionRuns.ItemCount()-1].m_DescriptionIndex != desc-1) {
+            index->m_DescriptionRuns.Append(DescriptionRun(i, desc-1));
+        }
+        
+        // size
+        AP4_Size size = 0;
+        if (m_StszAtom) {
+            result = m_StszAtom->GetSampleSize(sample, size); 
+        } else {
+            result = m_Stz2Atom->GetSampleSize(sample, size); 
+        }
+        if (AP4_FAILED(result)) goto fail;
+        index->m_Offsets[i] = offset;
+        index->m_Sizes[i]   = size;
+        offset += size;
+        
+        // timestamps
+        AP4_UI64 sample_dts = 0;
+        AP4_UI32 duration   = 0;
+        result = m_SttsAtom->GetDts(sample, sample_dts, &duration);
+        if (AP4_FAILED(result)) goto fail;
+        index->m_Dts[i] = dts;
+        dts += duration;
+        if (m_CttsAtom) {
+            AP4_UI32 cts_offset = 0;
+            result = m_CttsAtom->GetCtsOffset(sample, cts_offset);
+            if (AP4_FAILED(result)) goto fail;
+            index->m_CtsOffsets[i] = cts_offset;
+        }
+        
+        // flags
+        index->m_Flags[i] = 0;
+        if (m_StssAtom == NULL || m_StssAtom->IsSampleSync(sample)) {
+            index->m_Flags[i] |= INDEX_FLAG_SYNC;
+        }
+    }
+    index->m_Dts[sample_count] = dts;
+    
+    m_Index = index;
+    return AP4_SUCCESS;
+    
+fail:
+    delete index;
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AtomSampleTable::GetSample
 +---------------------------------------------------------------------*/
@@ -92,6 +309,25 @@ AP4_AtomSampleTable::GetSample(AP4_Ordinal index,
         return AP4_ERROR_INVALID_FORMAT;
     }
 
+    // use the index if we have one
+    if (UseIndex()) {
+        if (index >= m_Index->m_SampleCount) return AP4_ERROR_OUT_OF_RANGE;
+        sample.SetDescriptionIndex(m_Index->GetDescriptionIndex(index));
+        sample.SetDuration((AP4_UI32)(m_Index->m_Dts[index+1]-m_Index->m_Dts[index]));
+        sample.SetDts(m_Index->m_Dts[index]);
+        if (m_Index->m_CtsOffsets) {
+            sample.SetCtsDelta(m_Index->m_CtsOffsets[index]);
+        } else {
+            sample.SetCts(m_Index->m_Dts[index]);
+        }
+        sample.SetSize(m_Index->m_Sizes[index]);
+        sample.SetSync((m_Index->m_Flags[index] & INDEX_FLAG_SYNC) != 0);
+        sample.SetOffset(m_Index->m_Offsets[index]);
+        sample.SetDataStream(m_SampleStream);
+        
+        return AP4_SUCCESS;
+    }
+    
     // MP4 uses 1-based indexes internally, so adjust by one
     index++;
 
@@ -291,6 +527,12 @@ AP4_Result
 AP4_AtomSampleTable::SetChunkOffset(AP4_Ordinal  chunk_index, 
                                     AP4_Position offset)
 {
+    // the index is now out of date
+    if (m_Index) {
+        ReleaseIndex();
+        m_IndexPending = true;
+    }
+    
     if (m_StcoAtom) {
         if ((offset >> 32) != 0) return AP4_ERROR_OUT_OF_RANGE;
         return m_StcoAtom->SetChunkOffset(chunk_index+1, (AP4_UI32)offset);
@@ -307,6 +549,12 @@ AP4_AtomSampleTable::SetChunkOffset(AP4_Ordinal  chunk_index,
 AP4_Result 
 AP4_AtomSampleTable::SetSampleSize(AP4_Ordinal sample_index, AP4_Size size)
 {
+    // the index is now out of date
+    if (m_Index) {
+        ReleaseIndex();
+        m_IndexPending = true;
+    }
+    
     if (m_StszAtom) {
         return m_StszAtom->SetSampleSize(sample_index+1, size);
     } else if (m_Stz2Atom) {
@@ -323,6 +571,25 @@ AP4_Result
 AP4_AtomSampleTable::GetSampleIndexForTimeStamp(AP4_UI64     ts, 
                                                 AP4_Ordinal& sample_index)
 {
+    if (m_SttsAtom && UseIndex()) {
+        // find the last sample with a DTS less than or equal to ts, as
+        // AP4_SttsAtom::GetSampleIndexForTimeStamp() does
+        sample_index = 0;
+        if (ts >= m_Index->m_Dts[m_Index->m_SampleCount]) return AP4_FAILURE;
+        AP4_Ordinal lo = 0;
+        AP4_Ordinal hi = m_Index->m_SampleCount;
+        while (hi-lo > 1) {
+            AP4_Ordinal mid = lo+(hi-lo)/2;
+            if (m_Index->m_Dts[mid] <= ts) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        sample_index = lo;
+        return AP4_SUCCESS;
+    }
+    
     return m_SttsAtom ? m_SttsAtom->GetSampleIndexForTimeStamp(ts, sample_index) 
                       : AP4_FAILURE;
 }
@@ -337,25 +604,20 @@ AP4_AtomSampleTable::GetNearestSyncSampleIndex(AP4_Ordinal sample_index, bool be
     if (m_StssAtom == NULL) return sample_index;
     
     sample_index += 1; // the table is 1-based
-    AP4_Cardinal entry_count = m_StssAtom->GetEntries().ItemCount();
+    const AP4_Array<AP4_UI32>& entries = m_StssAtom->GetEntries();
+    AP4_Cardinal entry_count = entries.ItemCount();
+    
+    // find the first entry that is greater than or equal to the sample
+    AP4_Ordinal entry_index = m_StssAtom->GetEntryIndexForSample(sample_index);
+    
     if (before) {
-        AP4_Ordinal cursor = 0;    
-        for (unsigned int i=0; i<entry_count; i++) {
-            if (m_StssAtom->GetEntries()[i] >= sample_index) return cursor;
-            if (m_StssAtom->GetEntries()[i]) cursor = m_StssAtom->GetEntries()[i]-1;
-        }
-
-        // not found?
-        return cursor;
+        // the sync sample is the one just before that entry
+        if (entry_index == 0 || entries[entry_index-1] == 0) return 0;
+        return entries[entry_index-1]-1;
     } else {
-        for (unsigned int i=0; i<entry_count; i++) {
-            if (m_StssAtom->GetEntries()[i] >= sample_index) {
-                return m_StssAtom->GetEntries()[i]?m_StssAtom->GetEntries()[i]-1:sample_index-1;
-            }
-        }
-
         // not found?
-        return GetSampleCount();
+        if (entry_index == entry_count) return GetSampleCount();
+        
+        return entries[entry_index]-1;
     }
 }
-
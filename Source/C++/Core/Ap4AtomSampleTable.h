@@ -33,6 +33,7 @@
 |   includes
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
+#include "Ap4Array.h"
 #include "Ap4SampleTable.h"
 
 /*----------------------------------------------------------------------
@@ -50,6 +51,11 @@ class AP4_StssAtom;
 class AP4_StsdAtom;
 class AP4_Co64Atom;
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_ATOM_SAMPLE_TABLE_DEFAULT_INDEX_MEMORY_BUDGET = 32*1024*1024;
+
 /*----------------------------------------------------------------------
 |   AP4_AtomSampleTable
 +---------------------------------------------------------------------*/
@@ -83,7 +89,55 @@ class AP4_AtomSampleTable : public AP4_SampleTable
     virtual AP4_Result SetChunkOffset(AP4_Ordinal chunk_index, AP4_Position offset);
     virtual AP4_Result SetSampleSize(AP4_Ordinal sample_index, AP4_Size size);
 
+    /**
+     * Set the maximum number of bytes that the sample index may use.
+     * The index is built lazily, on the first sample lookup, only if
+     * its size fits within this budget. A budget of 0 disables the index.
+     */
+    void          SetIndexMemoryBudget(AP4_Size budget);
+    AP4_Size      GetIndexMemoryBudget() { return m_IndexMemoryBudget; }
+
+    /**
+     * Build the sample index now, regardless of the memory budget.
+     * The index holds the offset, DTS, size, CTS offset and flags of each
+     * sample, so that sample lookups do not need to walk the atom tables.
+     * It is discarded when the table is modified through SetChunkOffset()
+     * or SetSampleSize(), and rebuilt on the next lookup.
+     */
+    AP4_Result    BuildIndex();
+    void          ReleaseIndex();
+    bool          HasIndex() { return m_Index != NULL; }
+    AP4_LargeSize GetIndexMemorySize(AP4_Cardinal sample_count);
+
 private:
+    // types
+    struct DescriptionRun {
+        DescriptionRun() : m_FirstSample(0), m_DescriptionIndex(0) {}
+        DescriptionRun(AP4_Ordinal first_sample, AP4_Ordinal description_index) :
+            m_FirstSample(first_sample), m_DescriptionIndex(description_index) {}
+        AP4_Ordinal m_FirstSample;       // 0-based
+        AP4_Ordinal m_DescriptionIndex;  // 0-based
+    };
+    struct SampleIndex {
+        SampleIndex(AP4_Cardinal sample_count, bool has_cts_offsets);
+        ~SampleIndex();
+        AP4_Ordinal GetDescriptionIndex(AP4_Ordinal sample_index);
+
+        AP4_Cardinal              m_SampleCount;
+        AP4_UI64*                 m_Offsets;
+        AP4_UI64*                 m_Dts;        // sample_count+1 entries
+        AP4_UI32*                 m_Sizes;
+        AP4_UI32*                 m_CtsOffsets; // NULL when there is no ctts
+        AP4_UI08*                 m_Flags;
+        AP4_Array<DescriptionRun> m_DescriptionRuns;
+    };
+    enum {
+        INDEX_FLAG_SYNC = 0x01
+    };
+
+    // methods
+    bool UseIndex();
+
     // members
     AP4_ByteStream& m_SampleStream;
     AP4_StscAtom*   m_StscAtom;
@@ -95,6 +149,9 @@ private:
     AP4_StsdAtom*   m_StsdAtom;
     AP4_StssAtom*   m_StssAtom;
     AP4_Co64Atom*   m_Co64Atom;
+    SampleIndex*    m_Index;
+    AP4_Size        m_IndexMemoryBudget;
+    bool            m_IndexPending;
 };
 
 #endif // _AP4_ATOM_SAMPLE_TABLE_H_
@@ -519,6 +519,19 @@ AP4_SubStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SubStream::BorrowData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_SubStream::BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data)
+{
+    data = NULL;
+    if (position > m_Size || size > m_Size-position) return AP4_ERROR_OUT_OF_RANGE;
+    return m_Container.BorrowData(m_Offset+position, size, data);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SubStream::AddReference
 +---------------------------------------------------------------------*/
@@ -805,6 +818,21 @@ AP4_MemoryByteStream::Seek(AP4_Position position)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MemoryByteStream::BorrowData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_MemoryByteStream::BorrowData(AP4_Position     position,
+                                 AP4_Size         size,
+                                 const AP4_UI08*& data)
+{
+    data = NULL;
+    AP4_Size data_size = m_Buffer->GetDataSize();
+    if (position > data_size || size > data_size-position) return AP4_ERROR_OUT_OF_RANGE;
+    data = m_Buffer->GetData()+position;
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_MemoryByteStream::AddReference
 +---------------------------------------------------------------------*/
@@ -77,6 +77,22 @@ class AP4_ByteStream : public AP4_Referenceable
     virtual AP4_Result GetSize(AP4_LargeSize& size) = 0;
     virtual AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
     virtual AP4_Result Flush() { return AP4_SUCCESS; }
+
+    /**
+     * Get a pointer to the stream's data at a given position, without
+     * copying it and without changing the current position. 
+     * Only streams that hold their data in memory support this, other
+     * streams return AP4_ERROR_NOT_SUPPORTED, in which case the caller 
+     * should fall back to Seek()/Read().
+     * The data is read-only, and remains valid for as long as the caller
+     * holds a reference to the stream.
+     */
+    virtual AP4_Result BorrowData(AP4_Position     /* position */,
+                                  AP4_Size         /* size     */,
+                                  const AP4_UI08*& data) {
+        data = NULL;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
 };
 
 /*----------------------------------------------------------------------
@@ -105,6 +121,9 @@ class AP4_SubStream : public AP4_ByteStream
         size = m_Size;
         return AP4_SUCCESS;
     }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data);
 
     // AP4_Referenceable methods
     void AddReference();
@@ -144,6 +163,11 @@ class AP4_DupStream : public AP4_ByteStream
     AP4_Result GetSize(AP4_LargeSize& size) {
         return m_OriginalStream.GetSize(size);
     }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data) {
+        return m_OriginalStream.BorrowData(position, size, data);
+    }
 
     // AP4_Referenceable methods
     void AddReference();
@@ -185,6 +209,9 @@ public:
         size = m_Buffer->GetDataSize();
         return AP4_SUCCESS;
     }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data); // valid until the stream is written to
 
     // AP4_Referenceable methods
     void AddReference();
@@ -225,6 +252,11 @@ public:
     AP4_Result Seek(AP4_Position position);
     AP4_Result Tell(AP4_Position& position);
     AP4_Result GetSize(AP4_LargeSize& size) { return m_Source.GetSize(size); }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data) {
+        return m_Source.BorrowData(position, size, data);
+    }
 
     // AP4_Referenceable methods
     void AddReference();
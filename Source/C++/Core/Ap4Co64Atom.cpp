@@ -42,13 +42,13 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_Co64Atom)
 |   AP4_Co64Atom::Create
 +---------------------------------------------------------------------*/
 AP4_Co64Atom*
-AP4_Co64Atom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_Co64Atom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_Co64Atom(size, version, flags, stream);
+    return new AP4_Co64Atom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
@@ -70,19 +70,46 @@ AP4_Atom(AP4_ATOM_TYPE_CO64,
 AP4_Co64Atom::AP4_Co64Atom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_CO64, size, version, flags)
 {
     stream.ReadUI32(m_EntryCount);
     if (m_EntryCount > (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8) {
         m_EntryCount = (size-AP4_FULL_ATOM_HEADER_SIZE-4)/8;
     }
+    if (lazy) {
+        m_Entries = NULL;
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Co64Atom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_Co64Atom::ReadEntries(AP4_ByteStream& stream)
+{
     m_Entries = new AP4_UI64[m_EntryCount];
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         stream.ReadUI64(m_Entries[i]);
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Co64Atom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_Co64Atom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Co64Atom::~AP4_Co64Atom
 +---------------------------------------------------------------------*/
@@ -103,6 +130,7 @@ AP4_Co64Atom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI64& chunk_offset)
     }
 
     // get the chunk offset
+    LoadEntries();
     chunk_offset = m_Entries[chunk - 1]; // m_Entries is zero index based
 
     return AP4_SUCCESS;
@@ -120,6 +148,7 @@ AP4_Co64Atom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI64 chunk_offset)
     }
 
     // get the chunk offset
+    LoadEntries();
     m_Entries[chunk - 1] = chunk_offset; // m_Entries is zero index based
 
     return AP4_SUCCESS;
@@ -131,6 +160,7 @@ AP4_Co64Atom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI64 chunk_offset)
 AP4_Result
 AP4_Co64Atom::AdjustChunkOffsets(AP4_SI64 delta)
 {
+    LoadEntries();
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         m_Entries[i] += delta;
     }
@@ -146,6 +176,9 @@ AP4_Co64Atom::WriteFields(AP4_ByteStream& stream)
 {
     AP4_Result result;
 
+    // make sure the entries have been read
+    LoadEntries();
+
     // entry count
     result = stream.WriteUI32(m_EntryCount);
     if (AP4_FAILED(result)) return result;
@@ -167,6 +200,7 @@ AP4_Co64Atom::InspectFields(AP4_AtomInspector& inspector)
 {
     inspector.AddField("entry_count", m_EntryCount);
     if (inspector.GetVerbosity() >= 1) {
+        LoadEntries();
         char header[32];
         for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
             AP4_FormatString(header, sizeof(header), "entry %8d", i);
@@ -51,6 +51,7 @@
 #include "Ap4TrunAtom.h"
 #include "Ap4Marlin.h"
 #include "Ap4PsshAtom.h"
+#include "Ap4Threads.h"
 
 /*----------------------------------------------------------------------
 |   AP4_CencSampleEncrypter::~AP4_CencSampleEncrypter
@@ -60,6 +61,76 @@ AP4_CencSampleEncrypter::~AP4_CencSampleEncrypter()
     delete m_Cipher;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencAppendSampleInfo
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_CencAppendSampleInfo(AP4_DataBuffer&       sample_infos,
+                         AP4_Array<AP4_UI08>&  sample_info_sizes,
+                         const AP4_UI08*       iv,
+                         AP4_UI08              iv_size,
+                         const AP4_DataBuffer& subsample_info)
+{
+    AP4_Size   entry_size = iv_size+subsample_info.GetDataSize();
+    AP4_Size   position   = sample_infos.GetDataSize();
+    AP4_Result result     = sample_infos.Reserve(position+entry_size);
+    if (AP4_FAILED(result)) return result;
+    sample_infos.SetDataSize(position+entry_size);
+    AP4_UI08* entry = sample_infos.UseData()+position;
+    AP4_CopyMemory(entry, iv, iv_size);
+    if (subsample_info.GetDataSize()) {
+        AP4_CopyMemory(entry+iv_size, subsample_info.GetData(), subsample_info.GetDataSize());
+    }
+    
+    return sample_info_sizes.Append((AP4_UI08)entry_size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSampleEncrypter::EncryptSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencSampleEncrypter::EncryptSamples(const AP4_DataBuffer&      data_in,
+                                        const AP4_Array<AP4_UI32>& sample_sizes,
+                                        AP4_UI08                   iv_size,
+                                        AP4_DataBuffer&            data_out,
+                                        AP4_DataBuffer&            sample_infos,
+                                        AP4_Array<AP4_UI08>&       sample_info_sizes)
+{
+    // check the parameters
+    if (iv_size > 16) return AP4_ERROR_INVALID_PARAMETERS;
+    
+    // the output has the same size as the input
+    AP4_Result result = data_out.SetDataSize(data_in.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    AP4_UI08* out = data_out.UseData();
+    
+    // encrypt the samples one at a time, reusing the same buffers
+    AP4_DataBuffer sample_in;
+    AP4_DataBuffer sample_out;
+    AP4_DataBuffer subsample_info;
+    AP4_Size       offset = 0;
+    for (unsigned int i=0; i<sample_sizes.ItemCount(); i++) {
+        AP4_Size sample_size = sample_sizes[i];
+        if (offset+sample_size > data_in.GetDataSize()) {
+            return AP4_ERROR_INVALID_PARAMETERS;
+        }
+        sample_in.SetDataView(data_in.GetData()+offset, sample_size);
+        subsample_info.SetDataSize(0);
+        AP4_UI08 iv[16];
+        AP4_CopyMemory(iv, m_Iv, 16);
+        result = EncryptSampleData(sample_in, sample_out, subsample_info);
+        if (AP4_FAILED(result)) return result;
+        if (sample_size) {
+            AP4_CopyMemory(out+offset, sample_out.GetData(), sample_size);
+        }
+        result = AP4_CencAppendSampleInfo(sample_infos, sample_info_sizes, iv, iv_size, subsample_info);
+        if (AP4_FAILED(result)) return result;
+        offset += sample_size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencCtrSampleEncrypter::EncryptSampleData
 +---------------------------------------------------------------------*/
@@ -100,6 +171,104 @@ AP4_CencCtrSampleEncrypter::EncryptSampleData(AP4_DataBuffer& data_in,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSampleEncrypter::EncryptSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSampleEncrypter::EncryptSamples(const AP4_DataBuffer&      data_in,
+                                           const AP4_Array<AP4_UI32>& sample_sizes,
+                                           AP4_UI08                   iv_size,
+                                           AP4_DataBuffer&            data_out,
+                                           AP4_DataBuffer&            sample_infos,
+                                           AP4_Array<AP4_UI08>&       sample_info_sizes)
+{
+    // check the parameters
+    if (iv_size > 16) return AP4_ERROR_INVALID_PARAMETERS;
+    if (m_IvSize != 8 && m_IvSize != 16) return AP4_ERROR_INTERNAL;
+    
+    // the output has the same size as the input
+    AP4_Result result = data_out.SetDataSize(data_in.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    const AP4_UI08* in  = data_in.GetData();
+    AP4_UI08*       out = data_out.UseData();
+    
+    // with 16-byte IVs, the counter of a sample starts at the block that 
+    // follows the last block of the previous sample, so the cipher can keep
+    // running from one sample to the next instead of being reset with a
+    // new IV. This is only true as long as the lower half of the IV does 
+    // not wrap around, because the IV never carries into its upper half
+    AP4_DataBuffer no_subsamples;
+    AP4_UI64       stream_offset = 0;
+    bool           stream_valid  = false;
+    AP4_Size       offset        = 0;
+    for (unsigned int i=0; i<sample_sizes.ItemCount(); i++) {
+        AP4_Size sample_size = sample_sizes[i];
+        if (offset+sample_size > data_in.GetDataSize()) {
+            return AP4_ERROR_INVALID_PARAMETERS;
+        }
+
+        // record the IV for this sample
+        result = AP4_CencAppendSampleInfo(sample_infos, sample_info_sizes, m_Iv, iv_size, no_subsamples);
+        if (AP4_FAILED(result)) return result;
+        
+        // process the sample data
+        if (stream_valid) {
+            AP4_Cardinal preroll = 0; // always 0 in CTR mode
+            result = m_Cipher->SetStreamOffset(stream_offset, &preroll);
+        } else {
+            result = m_Cipher->SetIV(m_Iv);
+            stream_offset = 0;
+            stream_valid  = (m_IvSize == 16);
+        }
+        if (AP4_FAILED(result)) return result;
+        if (sample_size) {
+            AP4_Size out_size = sample_size;
+            result = m_Cipher->ProcessBuffer(in+offset, sample_size, out+offset, &out_size, false);
+            if (AP4_FAILED(result)) return result;
+        }
+        
+        // update the IV
+        if (m_IvSize == 16) {
+            unsigned int block_count = (sample_size+15)/16;
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
+            AP4_BytesFromUInt64BE(&m_Iv[8], counter+block_count);
+            stream_offset += block_count*16;
+            if (counter+block_count < counter) stream_valid = false;
+        } else {
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
+            AP4_BytesFromUInt64BE(&m_Iv[0], counter+1);
+        }
+        
+        offset += sample_size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSampleEncrypter::SkipSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSampleEncrypter::SkipSamples(const AP4_DataBuffer&      /* data_in */,
+                                        const AP4_Array<AP4_UI32>& sample_sizes)
+{
+    if (m_IvSize != 8 && m_IvSize != 16) return AP4_ERROR_INTERNAL;
+
+    // update the IV as EncryptSamples() would
+    if (m_IvSize == 16) {
+        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
+        for (unsigned int i=0; i<sample_sizes.ItemCount(); i++) {
+            counter += (sample_sizes[i]+15)/16;
+        }
+        AP4_BytesFromUInt64BE(&m_Iv[8], counter);
+    } else {
+        AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
+        AP4_BytesFromUInt64BE(&m_Iv[0], counter+sample_sizes.ItemCount());
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencCtrSubSampleEncrypter::GetSubSampleMap
 +---------------------------------------------------------------------*/
@@ -225,6 +394,160 @@ AP4_CencCtrSubSampleEncrypter::EncryptSampleData(AP4_DataBuffer& data_in,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSubSampleEncrypter::EncryptSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSubSampleEncrypter::EncryptSamples(const AP4_DataBuffer&      data_in,
+                                              const AP4_Array<AP4_UI32>& sample_sizes,
+                                              AP4_UI08                   iv_size,
+                                              AP4_DataBuffer&            data_out,
+                                              AP4_DataBuffer&            sample_infos,
+                                              AP4_Array<AP4_UI08>&       sample_info_sizes)
+{
+    // check the parameters
+    if (iv_size > 16) return AP4_ERROR_INVALID_PARAMETERS;
+    
+    // the output has the same size as the input
+    AP4_Result result = data_out.SetDataSize(data_in.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    const AP4_UI08* in  = data_in.GetData();
+    AP4_UI08*       out = data_out.UseData();
+    
+    // as in AP4_CencCtrSampleEncrypter::EncryptSamples, the cipher keeps 
+    // running from one sample to the next with 16-byte IVs
+    AP4_DataBuffer      sample;
+    AP4_DataBuffer      subsample_info;
+    AP4_Array<AP4_UI16> bytes_of_cleartext_data;
+    AP4_Array<AP4_UI32> bytes_of_encrypted_data;
+    AP4_UI64            stream_offset = 0;
+    bool                stream_valid  = false;
+    AP4_Size            offset        = 0;
+    for (unsigned int i=0; i<sample_sizes.ItemCount(); i++) {
+        AP4_Size sample_size = sample_sizes[i];
+        if (offset+sample_size > data_in.GetDataSize()) {
+            return AP4_ERROR_INVALID_PARAMETERS;
+        }
+        
+        // empty samples have no subsamples and don't use up an IV
+        if (sample_size == 0) {
+            subsample_info.SetDataSize(0);
+            result = AP4_CencAppendSampleInfo(sample_infos, sample_info_sizes, m_Iv, iv_size, subsample_info);
+            if (AP4_FAILED(result)) return result;
+            continue;
+        }
+        
+        // get the subsample map
+        sample.SetDataView(in+offset, sample_size);
+        bytes_of_cleartext_data.SetItemCount(0);
+        bytes_of_encrypted_data.SetItemCount(0);
+        result = GetSubSampleMap(sample, bytes_of_cleartext_data, bytes_of_encrypted_data);
+        if (AP4_FAILED(result)) return result;
+        
+        // encode the sample info
+        unsigned int subsample_count = bytes_of_cleartext_data.ItemCount();
+        subsample_info.SetDataSize(2+subsample_count*6);
+        AP4_UI08* infos = subsample_info.UseData();
+        AP4_BytesFromUInt16BE(infos, (AP4_UI16)subsample_count);
+        for (unsigned int j=0; j<subsample_count; j++) {
+            AP4_BytesFromUInt16BE(&infos[2+j*6],   bytes_of_cleartext_data[j]);
+            AP4_BytesFromUInt32BE(&infos[2+j*6+2], bytes_of_encrypted_data[j]);
+        }
+        result = AP4_CencAppendSampleInfo(sample_infos, sample_info_sizes, m_Iv, iv_size, subsample_info);
+        if (AP4_FAILED(result)) return result;
+        
+        // process the data
+        if (stream_valid) {
+            AP4_Cardinal preroll = 0; // always 0 in CTR mode
+            result = m_Cipher->SetStreamOffset(stream_offset, &preroll);
+        } else {
+            result = m_Cipher->SetIV(m_Iv);
+            stream_offset = 0;
+            stream_valid  = (m_IvSize == 16);
+        }
+        if (AP4_FAILED(result)) return result;
+        const AP4_UI08* sample_in       = in+offset;
+        AP4_UI08*       sample_out      = out+offset;
+        AP4_UI64        total_encrypted = 0;
+        for (unsigned int j=0; j<subsample_count; j++) {
+            AP4_CopyMemory(sample_out, sample_in, bytes_of_cleartext_data[j]);
+            sample_in  += bytes_of_cleartext_data[j];
+            sample_out += bytes_of_cleartext_data[j];
+            if (bytes_of_encrypted_data[j]) {
+                AP4_Size out_size = bytes_of_encrypted_data[j];
+                result = m_Cipher->ProcessBuffer(sample_in, bytes_of_encrypted_data[j], sample_out, &out_size);
+                if (AP4_FAILED(result)) return result;
+                sample_in       += bytes_of_encrypted_data[j];
+                sample_out      += bytes_of_encrypted_data[j];
+                total_encrypted += bytes_of_encrypted_data[j];
+            }
+        }
+        
+        // any bytes after the last subsample remain in the clear
+        AP4_Size remaining = (AP4_Size)((in+offset+sample_size)-sample_in);
+        if (remaining) AP4_CopyMemory(sample_out, sample_in, remaining);
+        
+        // update the IV
+        if (m_IvSize == 16) {
+            AP4_UI64 block_count = (total_encrypted+15)/16;
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
+            AP4_BytesFromUInt64BE(&m_Iv[8], counter+block_count);
+            stream_offset += block_count*16;
+            if (counter+block_count < counter) stream_valid = false;
+        } else {
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
+            AP4_BytesFromUInt64BE(&m_Iv[0], counter+1);
+        }
+        
+        offset += sample_size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencCtrSubSampleEncrypter::SkipSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencCtrSubSampleEncrypter::SkipSamples(const AP4_DataBuffer&      data_in,
+                                           const AP4_Array<AP4_UI32>& sample_sizes)
+{
+    // update the IV as EncryptSamples() would, which, with 16-byte IVs, 
+    // depends on the subsample map of each sample
+    AP4_DataBuffer      sample;
+    AP4_Array<AP4_UI16> bytes_of_cleartext_data;
+    AP4_Array<AP4_UI32> bytes_of_encrypted_data;
+    AP4_Size            offset = 0;
+    for (unsigned int i=0; i<sample_sizes.ItemCount(); i++) {
+        AP4_Size sample_size = sample_sizes[i];
+        if (offset+sample_size > data_in.GetDataSize()) {
+            return AP4_ERROR_INVALID_PARAMETERS;
+        }
+        if (sample_size == 0) continue;
+        
+        if (m_IvSize == 16) {
+            sample.SetDataView(data_in.GetData()+offset, sample_size);
+            bytes_of_cleartext_data.SetItemCount(0);
+            bytes_of_encrypted_data.SetItemCount(0);
+            AP4_Result result = GetSubSampleMap(sample, bytes_of_cleartext_data, bytes_of_encrypted_data);
+            if (AP4_FAILED(result)) return result;
+            AP4_UI64 total_encrypted = 0;
+            for (unsigned int j=0; j<bytes_of_encrypted_data.ItemCount(); j++) {
+                total_encrypted += bytes_of_encrypted_data[j];
+            }
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[8]);
+            AP4_BytesFromUInt64BE(&m_Iv[8], counter+(total_encrypted+15)/16);
+        } else {
+            AP4_UI64 counter = AP4_BytesToUInt64BE(&m_Iv[0]);
+            AP4_BytesFromUInt64BE(&m_Iv[0], counter+1);
+        }
+        
+        offset += sample_size;
+    }
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencCbcSubSampleEncrypter::GetSubSampleMap
 +---------------------------------------------------------------------*/
@@ -395,6 +718,7 @@ public:
     virtual AP4_Result ProcessTrack();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
 
 private:
     // members
@@ -500,16 +824,28 @@ public:
     // constructor
     AP4_CencFragmentEncrypter(AP4_CencVariant                         variant,
                               AP4_ContainerAtom*                      traf,
-                              AP4_CencEncryptingProcessor::Encrypter* encrypter);
+                              AP4_CencEncryptingProcessor::Encrypter* encrypter,
+                              AP4_CencSampleEncrypter*                fragment_sample_encrypter);
+   ~AP4_CencFragmentEncrypter();
 
     // methods
     virtual AP4_Result ProcessFragment();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                            AP4_DataBuffer& data_in,
+                                            AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
     virtual AP4_Result PrepareForSamples(AP4_FragmentSampleTable* sample_table);
+    virtual AP4_Result ProcessSamples();
+    virtual AP4_Result GetSampleData(AP4_Ordinal index, AP4_DataBuffer& data);
     virtual AP4_Result FinishFragment();
     
 private:
+    // methods
+    AP4_Result EncryptSamples(AP4_CencSampleEncrypter* sample_encrypter,
+                              const AP4_DataBuffer&    sample_data);
+    
     // members
     AP4_CencVariant                         m_Variant;
     AP4_ContainerAtom*                      m_Traf;
@@ -518,6 +854,12 @@ private:
     AP4_SaizAtom*                           m_Saiz;
     AP4_SaioAtom*                           m_Saio;
     AP4_CencEncryptingProcessor::Encrypter* m_Encrypter;
+    AP4_CencSampleEncrypter*                m_FragmentSampleEncrypter; // NULL unless encrypting in parallel
+    AP4_DataBuffer                          m_ClearSampleData; // the fragment's samples, before encryption
+    AP4_DataBuffer                          m_SampleData;      // the fragment's samples, encrypted
+    AP4_Array<AP4_SampleSpan>               m_SampleSpans;     // where each sample is in both buffers
+    AP4_Array<AP4_UI32>                     m_SampleSizes;
+    AP4_Ordinal                             m_SampleCursor;    // for ProcessSample() only
 };
 
 /*----------------------------------------------------------------------
@@ -525,15 +867,29 @@ private:
 +---------------------------------------------------------------------*/
 AP4_CencFragmentEncrypter::AP4_CencFragmentEncrypter(AP4_CencVariant                         variant,
                                                      AP4_ContainerAtom*                      traf,
-                                                     AP4_CencEncryptingProcessor::Encrypter* encrypter) :
+                                                     AP4_CencEncryptingProcessor::Encrypter* encrypter,
+                                                     AP4_CencSampleEncrypter*                fragment_sample_encrypter) :
     m_Variant(variant),
     m_Traf(traf),
     m_SampleEncryptionAtom(NULL),
     m_SampleEncryptionAtomShadow(NULL),
     m_Saiz(NULL),
     m_Saio(NULL),
-    m_Encrypter(encrypter)
+    m_Encrypter(encrypter),
+    m_FragmentSampleEncrypter(fragment_sample_encrypter),
+    m_SampleCursor(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::~AP4_CencFragmentEncrypter
++---------------------------------------------------------------------*/
+AP4_CencFragmentEncrypter::~AP4_CencFragmentEncrypter()
 {
+    // give the sample encrypter back so that it can be used for another fragment
+    if (m_FragmentSampleEncrypter) {
+        m_Encrypter->m_FragmentSampleEncrypters.Add(m_FragmentSampleEncrypter);
+    }
 }
 
 /*----------------------------------------------------------------------
@@ -624,49 +980,90 @@ AP4_CencFragmentEncrypter::PrepareForSamples(AP4_FragmentSampleTable* sample_tab
         m_Saio->AddEntry(0); // we'll compute the offset later
     }
     
-    if (!m_Encrypter->m_SampleEncrypter->UseSubSamples()) {
-        m_SampleEncryptionAtom->SetSampleInfosSize(sample_count*m_SampleEncryptionAtom->GetIvSize());
-        if (m_SampleEncryptionAtomShadow) {
-            m_SampleEncryptionAtomShadow->SetSampleInfosSize(sample_count*m_SampleEncryptionAtomShadow->GetIvSize());
-        }
-        if (m_Saiz) {
-            m_Saiz->SetDefaultSampleInfoSize(m_SampleEncryptionAtom->GetIvSize());
-            m_Saiz->SetSampleCount(sample_count);
-        }
-        return AP4_SUCCESS;
+    // read all the samples of the fragment
+    AP4_Result result = sample_table->ReadSamples(0, sample_count, m_ClearSampleData, m_SampleSpans);
+    if (AP4_FAILED(result)) return result;
+    if (m_SampleSpans.ItemCount() != sample_count) return AP4_ERROR_INTERNAL;
+    m_SampleSizes.SetItemCount(0);
+    m_SampleSizes.EnsureCapacity(sample_count);
+    for (unsigned int i=0; i<sample_count; i++) {
+        m_SampleSizes.Append(m_SampleSpans[i].m_Size);
     }
-        
-    // resize the saiz atom if we have one
-    if (m_Saiz) {
-        m_Saiz->SetSampleCount(sample_count);
+    
+    m_SampleCursor = 0;
+    
+    // when encrypting in parallel, give the fragment's sample encrypter the
+    // IV of the first sample and skip the shared one past the last sample, 
+    // so that ProcessSamples() can encrypt the samples on its own
+    if (m_FragmentSampleEncrypter) {
+        m_FragmentSampleEncrypter->SetIv(m_Encrypter->m_SampleEncrypter->GetIv());
+        result = m_Encrypter->m_SampleEncrypter->SkipSamples(m_ClearSampleData, m_SampleSizes);
+        if (result != AP4_ERROR_NOT_SUPPORTED) return result;
+        m_Encrypter->m_FragmentSampleEncrypters.Add(m_FragmentSampleEncrypter);
+        m_FragmentSampleEncrypter = NULL;
     }
+    
+    // encrypt them all at once, now that the size of the sample infos 
+    // must be known
+    return EncryptSamples(m_Encrypter->m_SampleEncrypter, m_ClearSampleData);
+}
 
-    // prepare for samples
-    AP4_Sample          sample;
-    AP4_DataBuffer      sample_data;
-    AP4_Array<AP4_UI16> bytes_of_cleartext_data;
-    AP4_Array<AP4_UI32> bytes_of_encrypted_data;
-    AP4_Size            sample_info_size = sample_count*(m_SampleEncryptionAtom->GetIvSize());
-    for (unsigned int i=0; i<sample_count; i++) {
-        AP4_Result result = sample_table->GetSample(i, sample);
-        if (AP4_FAILED(result)) return result;
-        result = sample.ReadData(sample_data);
-        if (AP4_FAILED(result)) return result;
-        bytes_of_cleartext_data.SetItemCount(0);
-        bytes_of_encrypted_data.SetItemCount(0);
-        result = m_Encrypter->m_SampleEncrypter->GetSubSampleMap(sample_data, 
-                                                                 bytes_of_cleartext_data,
-                                                                 bytes_of_encrypted_data);
-        if (AP4_FAILED(result)) return result;
-        sample_info_size += 2+bytes_of_cleartext_data.ItemCount()*6;
-        
-        if (m_Saiz) {
-            m_Saiz->SetSampleInfoSize(i, (AP4_UI08)(m_SampleEncryptionAtom->GetIvSize()+2+bytes_of_cleartext_data.ItemCount()*6));
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::ProcessSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentEncrypter::ProcessSamples()
+{
+    if (m_FragmentSampleEncrypter == NULL) return AP4_SUCCESS;
+    return EncryptSamples(m_FragmentSampleEncrypter, m_ClearSampleData);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::GetSampleData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentEncrypter::GetSampleData(AP4_Ordinal index, AP4_DataBuffer& data)
+{
+    // the clear samples were read by PrepareForSamples
+    if (index >= m_SampleSpans.ItemCount()) return AP4_ERROR_OUT_OF_RANGE;
+    return data.SetDataView(m_ClearSampleData.GetData()+m_SampleSpans[index].m_Offset, 
+                            m_SampleSpans[index].m_Size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::EncryptSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentEncrypter::EncryptSamples(AP4_CencSampleEncrypter* sample_encrypter,
+                                          const AP4_DataBuffer&    sample_data)
+{
+    AP4_Cardinal        sample_count = m_SampleSizes.ItemCount();
+    AP4_DataBuffer      sample_infos;
+    AP4_Array<AP4_UI08> sample_info_sizes;
+    AP4_Result result = sample_encrypter->EncryptSamples(sample_data,
+                                                         m_SampleSizes,
+                                                         m_SampleEncryptionAtom->GetIvSize(),
+                                                         m_SampleData,
+                                                         sample_infos,
+                                                         sample_info_sizes);
+    if (AP4_FAILED(result)) return result;
+    
+    // update the sample info atoms (the 'saiz' atom first, because its size 
+    // changes are only propagated to the 'traf' atom with those of 'senc')
+    if (m_Saiz) {
+        if (sample_encrypter->UseSubSamples()) {
+            m_Saiz->SetSampleCount(sample_count);
+            for (unsigned int i=0; i<sample_count; i++) {
+                m_Saiz->SetSampleInfoSize(i, sample_info_sizes[i]);
+            }
+        } else {
+            m_Saiz->SetDefaultSampleInfoSize(m_SampleEncryptionAtom->GetIvSize());
+            m_Saiz->SetSampleCount(sample_count);
         }
     }
-    m_SampleEncryptionAtom->SetSampleInfosSize(sample_info_size);
+    m_SampleEncryptionAtom->SetSampleInfos(sample_count, sample_infos);
     if (m_SampleEncryptionAtomShadow) {
-        m_SampleEncryptionAtomShadow->SetSampleInfosSize(sample_info_size);
+        m_SampleEncryptionAtomShadow->SetSampleInfos(sample_count, sample_infos);
     }
     
     return AP4_SUCCESS;
@@ -679,22 +1076,26 @@ AP4_Result
 AP4_CencFragmentEncrypter::ProcessSample(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out)
 {
-    // copy the current IV
-    AP4_UI08 iv[16];
-    AP4_CopyMemory(iv, m_Encrypter->m_SampleEncrypter->GetIv(), 16);
-    
-    // encrypt the sample
-    AP4_DataBuffer sample_infos;
-    AP4_Result result = m_Encrypter->m_SampleEncrypter->EncryptSampleData(data_in, data_out, sample_infos);
-    if (AP4_FAILED(result)) return result;
+    return ProcessIndexedSample(m_SampleCursor++, data_in, data_out);
+}
 
-    // update the sample info
-    m_SampleEncryptionAtom->AddSampleInfo(iv, sample_infos);
-    if (m_SampleEncryptionAtomShadow) {
-        m_SampleEncryptionAtomShadow->AddSampleInfo(iv, sample_infos);
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentEncrypter::ProcessIndexedSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentEncrypter::ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                                AP4_DataBuffer& data_in,
+                                                AP4_DataBuffer& data_out)
+{
+    // the samples were encrypted by PrepareForSamples or ProcessSamples, 
+    // without changing their size, so each encrypted sample is at the 
+    // same offset as the clear one
+    if (sample_index >= m_SampleSpans.ItemCount() ||
+        data_in.GetDataSize() != m_SampleSpans[sample_index].m_Size) {
+        return AP4_ERROR_INTERNAL;
     }
-    
-    return AP4_SUCCESS;
+    const AP4_SampleSpan& span = m_SampleSpans[sample_index];
+    return data_out.SetDataView(m_SampleData.GetData()+span.m_Offset, span.m_Size);
 }
 
 /*----------------------------------------------------------------------
@@ -982,7 +1383,6 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
     }
         
     // create the encrypter
-    AP4_Processor::TrackHandler* track_encrypter;
     AP4_UI32 algorithm_id = 0;
     AP4_UI08 iv_size = 16;
     switch (m_Variant) {
@@ -1007,19 +1407,56 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
         default:
             return NULL;
     }
-    track_encrypter = new AP4_CencTrackEncrypter(m_Variant,
-                                                 algorithm_id, 
-                                                 iv_size,
-                                                 kid,
-                                                 entries, 
-                                                 format);
-        
+    
+    // get the NALU length size if the samples are made of NAL units
+    AP4_Size nalu_length_size = 0;
+    if (entries[0]->GetType() == AP4_ATOM_TYPE_AVC1 ||
+        entries[0]->GetType() == AP4_ATOM_TYPE_AVC2 ||
+        entries[0]->GetType() == AP4_ATOM_TYPE_AVC3 ||
+        entries[0]->GetType() == AP4_ATOM_TYPE_AVC4) {
+        AP4_AvccAtom* avcc = AP4_DYNAMIC_CAST(AP4_AvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_AVCC));
+        if (avcc == NULL) return NULL;
+        nalu_length_size = avcc->GetNaluLengthSize();
+    } else if (entries[0]->GetType() == AP4_ATOM_TYPE_HEV1 ||
+               entries[0]->GetType() == AP4_ATOM_TYPE_HVC1) {
+        AP4_HvccAtom* hvcc = AP4_DYNAMIC_CAST(AP4_HvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_HVCC));
+        if (hvcc == NULL) return NULL;
+        nalu_length_size = hvcc->GetNaluLengthSize();
+    }
+    
+    // add a new cipher state for this track
+    Encrypter* encrypter = new Encrypter(trak->GetId(), algorithm_id, iv_size, nalu_length_size, *key);
+    if (AP4_FAILED(CreateSampleEncrypter(*encrypter, encrypter->m_SampleEncrypter))) {
+        delete encrypter;
+        return NULL;
+    }
+    encrypter->m_SampleEncrypter->SetIv(iv->GetData());
+    m_Encrypters.Add(encrypter);
+
+    return new AP4_CencTrackEncrypter(m_Variant,
+                                      algorithm_id, 
+                                      iv_size,
+                                      kid,
+                                      entries, 
+                                      format);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencEncryptingProcessor:CreateSampleEncrypter
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_CencEncryptingProcessor::CreateSampleEncrypter(const Encrypter&          encrypter,
+                                                   AP4_CencSampleEncrypter*& sample_encrypter)
+{
+    // default return value
+    sample_encrypter = NULL;
+    
     // create a block cipher
     AP4_BlockCipher*            block_cipher = NULL;
     AP4_BlockCipher::CipherMode mode;
     AP4_BlockCipher::CtrParams  ctr_params;
     const void*                 mode_params = NULL;
-    switch (algorithm_id) {
+    switch (encrypter.m_AlgorithmId) {
         case AP4_CENC_ALGORITHM_ID_CBC:
             mode = AP4_BlockCipher::CBC;
             break;
@@ -1030,35 +1467,24 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             mode_params = &ctr_params;
             break;
             
-        default: return NULL;
+        default: return AP4_ERROR_INVALID_PARAMETERS;
     }
     AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128, 
                                                            AP4_BlockCipher::ENCRYPT, 
                                                            mode,
                                                            mode_params,
-                                                           key->GetData(), 
-                                                           key->GetDataSize(), 
+                                                           encrypter.m_Key.GetData(), 
+                                                           encrypter.m_Key.GetDataSize(), 
                                                            block_cipher);
-    if (AP4_FAILED(result)) return NULL;
+    if (AP4_FAILED(result)) return result;
     
-    // add a new cipher state for this track
-    AP4_CencSampleEncrypter* sample_encrypter = NULL;
+    // create the sample encrypter
     AP4_StreamCipher* stream_cipher = NULL;
-    switch (algorithm_id) {
+    switch (encrypter.m_AlgorithmId) {
         case AP4_CENC_ALGORITHM_ID_CBC:
             stream_cipher = new AP4_CbcStreamCipher(block_cipher);
-            if (entries[0]->GetType() == AP4_ATOM_TYPE_AVC1 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC2 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC3 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC4) {
-                AP4_AvccAtom* avcc = AP4_DYNAMIC_CAST(AP4_AvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_AVCC));
-                if (avcc == NULL) return NULL;
-                sample_encrypter = new AP4_CencCbcSubSampleEncrypter(stream_cipher, avcc->GetNaluLengthSize());
-            } else if (entries[0]->GetType() == AP4_ATOM_TYPE_HEV1 ||
-                       entries[0]->GetType() == AP4_ATOM_TYPE_HVC1) {
-                AP4_HvccAtom* hvcc = AP4_DYNAMIC_CAST(AP4_HvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_HVCC));
-                if (hvcc == NULL) return NULL;
-                sample_encrypter = new AP4_CencCbcSubSampleEncrypter(stream_cipher, hvcc->GetNaluLengthSize());
+            if (encrypter.m_NaluLengthSize) {
+                sample_encrypter = new AP4_CencCbcSubSampleEncrypter(stream_cipher, encrypter.m_NaluLengthSize);
             } else {
                 sample_encrypter = new AP4_CencCbcSampleEncrypter(stream_cipher);
             }
@@ -1066,27 +1492,15 @@ AP4_CencEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             
         case AP4_CENC_ALGORITHM_ID_CTR:
             stream_cipher = new AP4_CtrStreamCipher(block_cipher, 16);
-            if (entries[0]->GetType() == AP4_ATOM_TYPE_AVC1 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC2 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC3 ||
-                entries[0]->GetType() == AP4_ATOM_TYPE_AVC4) {
-                AP4_AvccAtom* avcc = AP4_DYNAMIC_CAST(AP4_AvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_AVCC));
-                if (avcc == NULL) return NULL;
-                sample_encrypter = new AP4_CencCtrSubSampleEncrypter(stream_cipher, avcc->GetNaluLengthSize(), iv_size);
-            } else if (entries[0]->GetType() == AP4_ATOM_TYPE_HEV1 ||
-                       entries[0]->GetType() == AP4_ATOM_TYPE_HVC1) {
-                AP4_HvccAtom* hvcc = AP4_DYNAMIC_CAST(AP4_HvccAtom, entries[0]->GetChild(AP4_ATOM_TYPE_HVCC));
-                if (hvcc == NULL) return NULL;
-                sample_encrypter = new AP4_CencCtrSubSampleEncrypter(stream_cipher, hvcc->GetNaluLengthSize(), iv_size);
+            if (encrypter.m_NaluLengthSize) {
+                sample_encrypter = new AP4_CencCtrSubSampleEncrypter(stream_cipher, encrypter.m_NaluLengthSize, encrypter.m_IvSize);
             } else {
-                sample_encrypter = new AP4_CencCtrSampleEncrypter(stream_cipher, iv_size);
+                sample_encrypter = new AP4_CencCtrSampleEncrypter(stream_cipher, encrypter.m_IvSize);
             }
             break;
     }
-    sample_encrypter->SetIv(iv->GetData());
-    m_Encrypters.Add(new Encrypter(trak->GetId(), sample_encrypter));
-
-    return track_encrypter;
+    
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -1113,7 +1527,18 @@ AP4_CencEncryptingProcessor::CreateFragmentHandler(AP4_TrexAtom*      /* trex */
         }
     }
     if (encrypter == NULL) return NULL;
-    return new AP4_CencFragmentEncrypter(m_Variant, traf, encrypter);
+    
+    // with more than one thread, each fragment gets its own sample encrypter
+    // so that fragments can be encrypted in parallel, when the IVs of the 
+    // samples do not depend on the encrypted data of the previous ones
+    AP4_CencSampleEncrypter* fragment_sample_encrypter = NULL;
+    if (GetThreadCount() != 1 && encrypter->m_AlgorithmId == AP4_CENC_ALGORITHM_ID_CTR) {
+        if (AP4_FAILED(encrypter->m_FragmentSampleEncrypters.PopHead(fragment_sample_encrypter))) {
+            CreateSampleEncrypter(*encrypter, fragment_sample_encrypter);
+        }
+    }
+    
+    return new AP4_CencFragmentEncrypter(m_Variant, traf, encrypter, fragment_sample_encrypter);
 }
 
 /*----------------------------------------------------------------------
@@ -1400,7 +1825,7 @@ AP4_CencSampleDecrypter::Create(AP4_CencSampleInfoTable*  sample_info_table,
     if (AP4_FAILED(result)) return result;
 
     // create the decrypter
-    decrypter = new AP4_CencSampleDecrypter(single_sample_decrypter, sample_info_table);
+    decrypter = new AP4_CencSampleDecrypter(single_sample_decrypter, sample_info_table, algorithm_id);
 
     return AP4_SUCCESS;
 }
@@ -1435,10 +1860,23 @@ AP4_CencSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     // increment the sample cursor
     unsigned int sample_cursor = m_SampleCursor++;
 
+    return DecryptSampleData(sample_cursor, *m_SingleSampleDecrypter, data_in, data_out, iv);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_CencSampleDecrypter::DecryptSampleData
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencSampleDecrypter::DecryptSampleData(AP4_Ordinal                    sample_index,
+                                           AP4_CencSingleSampleDecrypter& single_sample_decrypter,
+                                           AP4_DataBuffer&                data_in,
+                                           AP4_DataBuffer&                data_out,
+                                           const AP4_UI08*                iv)
+{
     // setup the IV
     unsigned char iv_block[16];
     if (iv == NULL) {
-        iv = m_SampleInfoTable->GetIv(sample_cursor);
+        iv = m_SampleInfoTable->GetIv(sample_index);
     }
     if (iv == NULL) return AP4_ERROR_INVALID_FORMAT;
     unsigned int iv_size = m_SampleInfoTable->GetIvSize();
@@ -1450,12 +1888,12 @@ AP4_CencSampleDecrypter::DecryptSampleData(AP4_DataBuffer& data_in,
     const AP4_UI16* bytes_of_cleartext_data = NULL;
     const AP4_UI32* bytes_of_encrypted_data = NULL;
     if (m_SampleInfoTable) {
-        AP4_Result result = m_SampleInfoTable->GetSampleInfo(sample_cursor, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+        AP4_Result result = m_SampleInfoTable->GetSampleInfo(sample_index, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
         if (AP4_FAILED(result)) return result;
     }
     
     // decrypt the sample
-    return m_SingleSampleDecrypter->DecryptSampleData(data_in, data_out, iv_block, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
+    return single_sample_decrypter.DecryptSampleData(data_in, data_out, iv_block, subsample_count, bytes_of_cleartext_data, bytes_of_encrypted_data);
 }
 
 /*----------------------------------------------------------------------
@@ -1476,6 +1914,7 @@ public:
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
     virtual AP4_Result ProcessTrack();
+    virtual bool       IsStatelessPerSample() { return true; }
 
     // accessors
     AP4_ProtectedSampleDescription* GetSampleDescription(unsigned int i) {
@@ -1576,24 +2015,36 @@ public:
     AP4_CencFragmentDecrypter(AP4_CencSampleDecrypter*  sample_decrypter,
                               AP4_SaioAtom*             saio_atom,
                               AP4_SaizAtom*             saiz_atom,
-                              AP4_CencSampleEncryption* sample_encryption_atom) :
+                              AP4_CencSampleEncryption* sample_encryption_atom,
+                              const AP4_DataBuffer&     key) :
     m_SampleDecrypter(sample_decrypter),
     m_SaioAtom(saio_atom),
     m_SaizAtom(saiz_atom),
-    m_SampleEncryptionAtom(sample_encryption_atom) {}
+    m_SampleEncryptionAtom(sample_encryption_atom),
+    m_Key(key) {}
 
     // methods
     virtual AP4_Result ProcessFragment();
     virtual AP4_Result FinishFragment();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                            AP4_DataBuffer& data_in,
+                                            AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() {
+        // each sample has its own IV, and with CTR no state is carried 
+        // from one sample to the next
+        return m_SampleDecrypter->GetAlgorithmId() == AP4_CENC_ALGORITHM_ID_CTR;
+    }
 
 private:
     // members
-    AP4_CencSampleDecrypter*  m_SampleDecrypter;
-    AP4_SaioAtom*             m_SaioAtom;
-    AP4_SaizAtom*             m_SaizAtom;
-    AP4_CencSampleEncryption* m_SampleEncryptionAtom;
+    AP4_CencSampleDecrypter*                      m_SampleDecrypter;
+    AP4_SaioAtom*                                 m_SaioAtom;
+    AP4_SaizAtom*                                 m_SaizAtom;
+    AP4_CencSampleEncryption*                     m_SampleEncryptionAtom;
+    AP4_DataBuffer                                m_Key;
+    AP4_ObjectPool<AP4_CencSingleSampleDecrypter> m_SpareDecrypters; // one per thread
 };
 
 /*----------------------------------------------------------------------
@@ -1640,6 +2091,37 @@ AP4_CencFragmentDecrypter::ProcessSample(AP4_DataBuffer& data_in,
     return m_SampleDecrypter->DecryptSampleData(data_in, data_out, NULL);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencFragmentDecrypter::ProcessIndexedSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_CencFragmentDecrypter::ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                                AP4_DataBuffer& data_in,
+                                                AP4_DataBuffer& data_out)
+{
+    // samples processed in order use the fragment's own decrypter
+    if (!IsStatelessPerSample()) return ProcessSample(data_in, data_out);
+    
+    // get a single-sample decrypter that no other thread is using
+    AP4_CencSingleSampleDecrypter* single_sample_decrypter = m_SpareDecrypters.Get();
+    if (single_sample_decrypter == NULL) {
+        AP4_Result result = AP4_CencSingleSampleDecrypter::Create(m_SampleDecrypter->GetAlgorithmId(),
+                                                                  m_Key.GetData(),
+                                                                  m_Key.GetDataSize(),
+                                                                  NULL,
+                                                                  single_sample_decrypter);
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    // decrypt the sample
+    AP4_Result result = m_SampleDecrypter->DecryptSampleData(sample_index, 
+                                                             *single_sample_decrypter, 
+                                                             data_in, 
+                                                             data_out);
+    m_SpareDecrypters.Put(single_sample_decrypter);
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencDecryptingProcessor::AP4_CencDecryptingProcessor
 +---------------------------------------------------------------------*/
@@ -1759,7 +2241,7 @@ AP4_CencDecryptingProcessor::CreateFragmentHandler(AP4_TrexAtom*      trex,
         sample_decrypter);
     if (AP4_FAILED(result)) return NULL;
     
-    return new AP4_CencFragmentDecrypter(sample_decrypter, saio, saiz, sample_encryption_atom);
+    return new AP4_CencFragmentDecrypter(sample_decrypter, saio, saiz, sample_encryption_atom, *key);
 }
     
 /*----------------------------------------------------------------------
@@ -2406,6 +2888,24 @@ AP4_CencSampleEncryption::SetSampleInfosSize(AP4_Size size)
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CencSampleEncryption::SetSampleInfos
++---------------------------------------------------------------------*/
+AP4_Result      
+AP4_CencSampleEncryption::SetSampleInfos(AP4_Cardinal          sample_info_count,
+                                         const AP4_DataBuffer& sample_infos)
+{
+    AP4_Result result = SetSampleInfosSize(sample_infos.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    if (sample_infos.GetDataSize()) {
+        AP4_CopyMemory(m_SampleInfos.UseData(), sample_infos.GetData(), sample_infos.GetDataSize());
+    }
+    m_SampleInfoCursor = sample_infos.GetDataSize();
+    m_SampleInfoCount  = sample_info_count;
+    
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CencSampleEncryption::CreateSampleInfoTable
 +---------------------------------------------------------------------*/
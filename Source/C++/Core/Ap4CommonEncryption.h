@@ -121,6 +121,7 @@ public:
     AP4_Cardinal    GetSampleInfoCount()    { return m_SampleInfoCount; }
     AP4_Result      AddSampleInfo(const AP4_UI08* iv, AP4_DataBuffer& subsample_info);
     AP4_Result      SetSampleInfosSize(AP4_Size size);
+    AP4_Result      SetSampleInfos(AP4_Cardinal sample_info_count, const AP4_DataBuffer& sample_infos);
     AP4_Result      CreateSampleInfoTable(AP4_Size                  default_iv_size,
                                           AP4_CencSampleInfoTable*& table);
     
@@ -306,6 +307,38 @@ public:
                                          AP4_DataBuffer& data_out, 
                                          AP4_DataBuffer& sample_infos) = 0;    
 
+    /**
+     * Encrypt the data of consecutive samples, typically all the samples of
+     * a fragment, in one call. The samples are stored back to back in 
+     * data_in, as in an 'mdat' payload, with their sizes in sample_sizes, 
+     * and are returned encrypted in data_out with the same layout.
+     * For each sample, an entry with the first iv_size bytes of its IV, 
+     * followed by its subsample info when subsamples are used, is appended
+     * to sample_infos (the format of the entries of a 'senc' atom) and the 
+     * size of that entry is appended to sample_info_sizes (the entries of a
+     * 'saiz' atom). The result is the same as calling EncryptSampleData()
+     * for each sample in turn.
+     */
+    virtual AP4_Result EncryptSamples(const AP4_DataBuffer&      data_in,
+                                      const AP4_Array<AP4_UI32>& sample_sizes,
+                                      AP4_UI08                   iv_size,
+                                      AP4_DataBuffer&            data_out,
+                                      AP4_DataBuffer&            sample_infos,
+                                      AP4_Array<AP4_UI08>&       sample_info_sizes);
+
+    /**
+     * Advance the IV past consecutive samples, stored as for 
+     * EncryptSamples(), without encrypting them, so that a copy of this 
+     * encrypter with the original IV can encrypt those samples while this
+     * one goes on with the next ones. This is only possible when the IVs 
+     * do not depend on the encrypted data, as is the case in CTR mode.
+     * Returns AP4_ERROR_NOT_SUPPORTED otherwise.
+     */
+    virtual AP4_Result SkipSamples(const AP4_DataBuffer&      /* data_in      */,
+                                   const AP4_Array<AP4_UI32>& /* sample_sizes */) {
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+
     void            SetIv(const AP4_UI08* iv) { AP4_CopyMemory(m_Iv, iv, 16); }
     const AP4_UI08* GetIv()                   { return m_Iv;                  }
     virtual bool    UseSubSamples()           { return false;                 }
@@ -335,6 +368,14 @@ public:
     virtual AP4_Result EncryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          AP4_DataBuffer& sample_infos);
+    virtual AP4_Result EncryptSamples(const AP4_DataBuffer&      data_in,
+                                      const AP4_Array<AP4_UI32>& sample_sizes,
+                                      AP4_UI08                   iv_size,
+                                      AP4_DataBuffer&            data_out,
+                                      AP4_DataBuffer&            sample_infos,
+                                      AP4_Array<AP4_UI08>&       sample_info_sizes);
+    virtual AP4_Result SkipSamples(const AP4_DataBuffer&      data_in,
+                                   const AP4_Array<AP4_UI32>& sample_sizes);
     
 protected:
     unsigned int m_IvSize;
@@ -395,6 +436,14 @@ public:
     virtual AP4_Result EncryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          AP4_DataBuffer& sample_infos);
+    virtual AP4_Result EncryptSamples(const AP4_DataBuffer&      data_in,
+                                      const AP4_Array<AP4_UI32>& sample_sizes,
+                                      AP4_UI08                   iv_size,
+                                      AP4_DataBuffer&            data_out,
+                                      AP4_DataBuffer&            sample_infos,
+                                      AP4_Array<AP4_UI08>&       sample_info_sizes);
+    virtual AP4_Result SkipSamples(const AP4_DataBuffer&      data_in,
+                                   const AP4_Array<AP4_UI32>& sample_sizes);
     
 protected:
     unsigned int m_IvSize;
@@ -428,12 +477,28 @@ class AP4_CencEncryptingProcessor : public AP4_Processor
 public:
     // types
     struct Encrypter {
-        Encrypter(AP4_UI32 track_id, AP4_CencSampleEncrypter* sample_encrypter) :
+        Encrypter(AP4_UI32              track_id, 
+                  AP4_UI32              algorithm_id,
+                  AP4_UI08              iv_size,
+                  AP4_Size              nalu_length_size,
+                  const AP4_DataBuffer& key) :
             m_TrackId(track_id),
-            m_SampleEncrypter(sample_encrypter) {}
-        ~Encrypter() { delete m_SampleEncrypter; }
-        AP4_UI32                 m_TrackId;
-        AP4_CencSampleEncrypter* m_SampleEncrypter;
+            m_SampleEncrypter(NULL),
+            m_AlgorithmId(algorithm_id),
+            m_IvSize(iv_size),
+            m_NaluLengthSize(nalu_length_size),
+            m_Key(key) {}
+        ~Encrypter() { 
+            delete m_SampleEncrypter; 
+            m_FragmentSampleEncrypters.DeleteReferences();
+        }
+        AP4_UI32                          m_TrackId;
+        AP4_CencSampleEncrypter*          m_SampleEncrypter;
+        AP4_UI32                          m_AlgorithmId;
+        AP4_UI08                          m_IvSize;
+        AP4_Size                          m_NaluLengthSize; // 0 if the samples are not NAL units
+        AP4_DataBuffer                    m_Key;
+        AP4_List<AP4_CencSampleEncrypter> m_FragmentSampleEncrypters; // unused copies, for fragments
     };
 
     // constructor
@@ -457,6 +522,10 @@ public:
                                                                   AP4_Position       moof_offset);
     
 protected:    
+    // methods
+    AP4_Result CreateSampleEncrypter(const Encrypter&          encrypter, 
+                                     AP4_CencSampleEncrypter*& sample_encrypter);
+    
     // members
     AP4_CencVariant          m_Variant;
     AP4_BlockCipherFactory*  m_BlockCipherFactory;
@@ -566,20 +635,36 @@ public:
     
     // methods
     AP4_CencSampleDecrypter(AP4_CencSingleSampleDecrypter* single_sample_decrypter,
-                            AP4_CencSampleInfoTable*       sample_info_table) :
+                            AP4_CencSampleInfoTable*       sample_info_table,
+                            AP4_UI32                       algorithm_id = AP4_CENC_ALGORITHM_ID_NONE) :
         m_SingleSampleDecrypter(single_sample_decrypter),
         m_SampleInfoTable(sample_info_table),
-        m_SampleCursor(0) {}
+        m_SampleCursor(0),
+        m_AlgorithmId(algorithm_id) {}
     virtual ~AP4_CencSampleDecrypter();
     virtual AP4_Result SetSampleIndex(AP4_Ordinal sample_index);
     virtual AP4_Result DecryptSampleData(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out,
                                          const AP4_UI08* iv);
+    
+    // decrypts the sample at sample_index with the given single-sample 
+    // decrypter, without moving the sample cursor, so that several threads
+    // may decrypt samples at the same time, each with its own single-sample
+    // decrypter
+    AP4_Result DecryptSampleData(AP4_Ordinal                    sample_index,
+                                 AP4_CencSingleSampleDecrypter& single_sample_decrypter,
+                                 AP4_DataBuffer&                data_in,
+                                 AP4_DataBuffer&                data_out,
+                                 const AP4_UI08*                iv = NULL);
+    
+    // accessors
+    AP4_UI32 GetAlgorithmId() { return m_AlgorithmId; }
                                              
 protected:
     AP4_CencSingleSampleDecrypter* m_SingleSampleDecrypter;
     AP4_CencSampleInfoTable*       m_SampleInfoTable;
     AP4_Ordinal                    m_SampleCursor;
+    AP4_UI32                       m_AlgorithmId;
 };
 
 #endif // _AP4_COMMON_ENCRYPTION_H_
@@ -115,6 +115,16 @@
 #define AP4_CONFIG_NO_EXCEPTIONS
 #endif
 
+/* POSIX Platforms */
+#if defined(__unix__) || defined(__APPLE__)
+#if !defined(AP4_CONFIG_NO_MMAP)
+#define AP4_CONFIG_HAVE_MMAP
+#endif
+#if !defined(AP4_CONFIG_NO_THREADS)
+#define AP4_CONFIG_HAVE_THREADS
+#endif
+#endif
+
 /*----------------------------------------------------------------------
 |    defaults
 +---------------------------------------------------------------------*/
@@ -129,6 +139,17 @@
 #define AP4_ftell ftello
 #endif
 
+/* storage class of per-thread variables */
+#if !defined(AP4_CONFIG_THREAD_LOCAL)
+#if defined(_MSC_VER)
+#define AP4_CONFIG_THREAD_LOCAL __declspec(thread)
+#elif defined(AP4_CONFIG_HAVE_THREADS) && defined(__GNUC__)
+#define AP4_CONFIG_THREAD_LOCAL __thread
+#else
+#define AP4_CONFIG_THREAD_LOCAL
+#endif
+#endif
+
 /* some compilers (ex: MSVC 8) deprecate those, so we rename them */
 #if !defined(AP4_snprintf)
 #define AP4_snprintf snprintf
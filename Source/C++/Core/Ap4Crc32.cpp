@@ -0,0 +1,274 @@
+/*****************************************************************
+|
+|    AP4 - CRC-32
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Crc32.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   hardware acceleration
++---------------------------------------------------------------------*/
+// the x86 code is compiled for PCLMULQDQ and SSSE3 with a per-function 
+// target attribute, so that the rest of the library does not require them
+#if !defined(AP4_CONFIG_NO_CRC32_HARDWARE)
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define AP4_CRC32_HARDWARE_X86
+#define AP4_CRC32_HARDWARE_TARGET __attribute__((target("pclmul,ssse3,sse2")))
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <cpuid.h>
+#endif
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define AP4_CRC32_HARDWARE_X86
+#define AP4_CRC32_HARDWARE_TARGET
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <intrin.h>
+#endif
+#endif
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_UI64 AP4_CRC32_MPEG2_POLYNOMIAL = 0x104C11DB7ULL;
+
+// below this size, the setup of the carry-less multiplication path costs
+// more than it saves
+const AP4_Size AP4_CRC32_HARDWARE_MIN_SIZE = 64;
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32Tables
++---------------------------------------------------------------------*/
+/**
+ * Tables for the slice-by-8 implementation, and constants for the 
+ * carry-less multiplication implementation, computed from the polynomial
+ * when the library is loaded.
+ */
+class AP4_Crc32Tables
+{
+public:
+    AP4_Crc32Tables();
+    
+    // x^n mod P
+    static AP4_UI32 PowerMod(unsigned int n);
+    
+    // members
+    AP4_UI32 m_Tables[8][256]; // m_Tables[k][b] = b.x^(32+8k) mod P
+    AP4_UI32 m_Fold512[2];     // x^(512+64) mod P, x^512 mod P
+    AP4_UI32 m_Fold128[2];     // x^(128+64) mod P, x^128 mod P
+    bool     m_HardwareAvailable;
+    bool     m_HardwareEnabled;
+};
+
+static AP4_Crc32Tables Crc32Tables;
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32Tables::PowerMod
++---------------------------------------------------------------------*/
+AP4_UI32
+AP4_Crc32Tables::PowerMod(unsigned int n)
+{
+    AP4_UI64 r = 1;
+    while (n--) {
+        r <<= 1;
+        if (r & 0x100000000ULL) r ^= AP4_CRC32_MPEG2_POLYNOMIAL;
+    }
+    return (AP4_UI32)r;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32Tables::AP4_Crc32Tables
++---------------------------------------------------------------------*/
+AP4_Crc32Tables::AP4_Crc32Tables() :
+    m_HardwareAvailable(false),
+    m_HardwareEnabled(true)
+{
+    for (unsigned int b=0; b<256; b++) {
+        AP4_UI32 crc = b<<24;
+        for (unsigned int i=0; i<8; i++) {
+            crc = (crc & 0x80000000) ? (crc<<1)^(AP4_UI32)AP4_CRC32_MPEG2_POLYNOMIAL : (crc<<1);
+        }
+        m_Tables[0][b] = crc;
+    }
+    for (unsigned int k=1; k<8; k++) {
+        for (unsigned int b=0; b<256; b++) {
+            AP4_UI32 crc = m_Tables[k-1][b];
+            m_Tables[k][b] = (crc<<8) ^ m_Tables[0][crc>>24];
+        }
+    }
+    m_Fold512[0] = PowerMod(512+64);
+    m_Fold512[1] = PowerMod(512);
+    m_Fold128[0] = PowerMod(128+64);
+    m_Fold128[1] = PowerMod(128);
+    
+#if defined(AP4_CRC32_HARDWARE_X86)
+    // CPUID leaf 1: ECX bit 1 is PCLMULQDQ, ECX bit 9 is SSSE3, EDX bit 26 is SSE2
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    unsigned int ecx = (unsigned int)info[2];
+    unsigned int edx = (unsigned int)info[3];
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+#endif
+    {
+        m_HardwareAvailable = (ecx & (1<<1)) && (ecx & (1<<9)) && (edx & (1<<26));
+    }
+#endif
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32ComputeWithTables
++---------------------------------------------------------------------*/
+static AP4_UI32
+AP4_Crc32ComputeWithTables(const AP4_UI08* data, AP4_Size data_size, AP4_UI32 crc)
+{
+    const AP4_UI32 (*t)[256] = Crc32Tables.m_Tables;
+    
+    // 8 bytes at a time: the first 4 are combined with the current CRC
+    while (data_size >= 8) {
+        crc ^= AP4_BytesToUInt32BE(data);
+        crc = t[7][crc>>24]        ^ t[6][(crc>>16)&0xFF] ^ 
+              t[5][(crc>>8)&0xFF]  ^ t[4][crc&0xFF]       ^
+              t[3][data[4]]        ^ t[2][data[5]]        ^ 
+              t[1][data[6]]        ^ t[0][data[7]];
+        data      += 8;
+        data_size -= 8;
+    }
+    
+    // the rest one byte at a time
+    while (data_size--) {
+        crc = (crc<<8) ^ t[0][(crc>>24) ^ *data++];
+    }
+    
+    return crc;
+}
+
+#if defined(AP4_CRC32_HARDWARE_X86)
+/*----------------------------------------------------------------------
+|   AP4_Crc32Fold
++---------------------------------------------------------------------*/
+// with the bytes in reverse order, bit i of a 128-bit value is the 
+// coefficient of x^i, so a value X = H.x^64+L followed by n more bits is 
+// congruent to H.(x^(n+64) mod P) + L.(x^n mod P), which fits in 96 bits
+AP4_CRC32_HARDWARE_TARGET
+static inline __m128i
+AP4_Crc32Fold(__m128i value, __m128i constants, __m128i next)
+{
+    __m128i high = _mm_clmulepi64_si128(value, constants, 0x11);
+    __m128i low  = _mm_clmulepi64_si128(value, constants, 0x00);
+    return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32ComputeWithClmul
++---------------------------------------------------------------------*/
+AP4_CRC32_HARDWARE_TARGET
+static AP4_UI32
+AP4_Crc32ComputeWithClmul(const AP4_UI08* data, AP4_Size data_size, AP4_UI32 crc)
+{
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i fold512 = _mm_set_epi32(0, (int)Crc32Tables.m_Fold512[0], 0, (int)Crc32Tables.m_Fold512[1]);
+    const __m128i fold128 = _mm_set_epi32(0, (int)Crc32Tables.m_Fold128[0], 0, (int)Crc32Tables.m_Fold128[1]);
+    
+    // the initial value is combined with the first 4 bytes
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data)),    reverse);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+16)), reverse);
+    __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+32)), reverse);
+    __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+48)), reverse);
+    x0 = _mm_xor_si128(x0, _mm_set_epi32((int)crc, 0, 0, 0));
+    data      += 64;
+    data_size -= 64;
+    
+    // fold 64 bytes at a time, in 4 independent lanes
+    while (data_size >= 64) {
+        x0 = AP4_Crc32Fold(x0, fold512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data)),    reverse));
+        x1 = AP4_Crc32Fold(x1, fold512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+16)), reverse));
+        x2 = AP4_Crc32Fold(x2, fold512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+32)), reverse));
+        x3 = AP4_Crc32Fold(x3, fold512, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+48)), reverse));
+        data      += 64;
+        data_size -= 64;
+    }
+    
+    // fold the lanes into one, then the remaining 16-byte blocks
+    x1 = AP4_Crc32Fold(x0, fold128, x1);
+    x2 = AP4_Crc32Fold(x1, fold128, x2);
+    x3 = AP4_Crc32Fold(x2, fold128, x3);
+    while (data_size >= 16) {
+        x3 = AP4_Crc32Fold(x3, fold128, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), reverse));
+        data      += 16;
+        data_size -= 16;
+    }
+    
+    // the CRC of what has been folded is the CRC, with an initial value 
+    // of 0, of the 128-bit remainder
+    AP4_UI08 remainder[16];
+    _mm_storeu_si128((__m128i*)remainder, _mm_shuffle_epi8(x3, reverse));
+    crc = AP4_Crc32ComputeWithTables(remainder, 16, 0);
+    
+    return AP4_Crc32ComputeWithTables(data, data_size, crc);
+}
+#endif
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32::Compute
++---------------------------------------------------------------------*/
+AP4_UI32
+AP4_Crc32::Compute(const AP4_UI08* data, AP4_Size data_size, AP4_UI32 crc)
+{
+#if defined(AP4_CRC32_HARDWARE_X86)
+    if (data_size >= AP4_CRC32_HARDWARE_MIN_SIZE && 
+        Crc32Tables.m_HardwareAvailable          &&
+        Crc32Tables.m_HardwareEnabled) {
+        return AP4_Crc32ComputeWithClmul(data, data_size, crc);
+    }
+#endif
+    return AP4_Crc32ComputeWithTables(data, data_size, crc);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32::IsHardwareAccelerationAvailable
++---------------------------------------------------------------------*/
+bool
+AP4_Crc32::IsHardwareAccelerationAvailable()
+{
+    return Crc32Tables.m_HardwareAvailable;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32::EnableHardwareAcceleration
++---------------------------------------------------------------------*/
+void
+AP4_Crc32::EnableHardwareAcceleration(bool enable)
+{
+    Crc32Tables.m_HardwareEnabled = enable;
+}
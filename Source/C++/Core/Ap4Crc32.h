@@ -0,0 +1,80 @@
+/*****************************************************************
+|
+|    AP4 - CRC-32
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_CRC32_H_
+#define _AP4_CRC32_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_UI32 AP4_CRC32_MPEG2_INITIAL_VALUE = 0xFFFFFFFF;
+
+/*----------------------------------------------------------------------
+|   AP4_Crc32
++---------------------------------------------------------------------*/
+/**
+ * CRC-32 of MPEG-2 PSI sections (polynomial 0x04C11DB7, most significant
+ * bit first, no final xor), computed 8 bytes at a time with tables, or 
+ * with carry-less multiplication instructions when the processor has 
+ * them (PCLMULQDQ on x86).
+ */
+class AP4_Crc32
+{
+public:
+    /**
+     * Compute the CRC of a buffer.
+     * @param data Data of which to compute the CRC.
+     * @param data_size Size of the data.
+     * @param crc Initial value, or the CRC returned for the preceding 
+     * data when the data is split into more than one buffer.
+     */
+    static AP4_UI32 Compute(const AP4_UI08* data, 
+                            AP4_Size        data_size, 
+                            AP4_UI32        crc = AP4_CRC32_MPEG2_INITIAL_VALUE);
+
+    /**
+     * Returns true if the processor has carry-less multiplication 
+     * instructions that can be used by this implementation.
+     */
+    static bool IsHardwareAccelerationAvailable();
+
+    /**
+     * Enable or disable the use of carry-less multiplication instructions.
+     * It is enabled by default. When it is disabled, or when the 
+     * instructions are not available, the table-based implementation is
+     * used.
+     */
+    static void EnableHardwareAcceleration(bool enable);
+};
+
+#endif // _AP4_CRC32_H_
@@ -42,23 +42,22 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_CttsAtom)
 |   AP4_CttsAtom::Create
 +---------------------------------------------------------------------*/
 AP4_CttsAtom*
-AP4_CttsAtom::Create(AP4_UI32 size, AP4_ByteStream& stream)
+AP4_CttsAtom::Create(AP4_UI32 size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version > 1) return NULL;
-    return new AP4_CttsAtom(size, version, flags, stream);
+    return new AP4_CttsAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::AP4_CttsAtom
 +---------------------------------------------------------------------*/
 AP4_CttsAtom::AP4_CttsAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_CTTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_CTTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_LookupCache(0)
 {
-    m_LookupCache.sample      = 0;
-    m_LookupCache.entry_index = 0;
 }
 
 /*----------------------------------------------------------------------
@@ -67,12 +66,24 @@ AP4_CttsAtom::AP4_CttsAtom() :
 AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_CTTS, size, version, flags)
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
+    AP4_Atom(AP4_ATOM_TYPE_CTTS, size, version, flags),
+    m_LookupCache(0)
 {
-    m_LookupCache.sample      = 0;
-    m_LookupCache.entry_index = 0;
+    if (lazy) {
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
 
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_CttsAtom::ReadEntries(AP4_ByteStream& stream)
+{
     AP4_UI32 entry_count;
     stream.ReadUI32(entry_count);
     m_Entries.SetItemCount(entry_count);
@@ -93,6 +104,7 @@ AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size,
         //    if (noffset < quicktime_min_offset) quicktime_min_offset = noffset;
         //}
         m_Entries[i].m_SampleOffset = offset;
+        SetRunTotals(i);
     }
     delete[] buffer;
     
@@ -105,59 +117,94 @@ AP4_CttsAtom::AP4_CttsAtom(AP4_UI32        size,
     //}
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_CttsAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::AddEntry
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_CttsAtom::AddEntry(AP4_UI32 count, AP4_UI32 cts_offset)
 {
+    LoadEntries();
     m_Entries.Append(AP4_CttsTableEntry(count, cts_offset));
+    SetRunTotals(m_Entries.ItemCount()-1);
     m_Size32 += 8;
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CttsAtom::SetRunTotals
++---------------------------------------------------------------------*/
+void
+AP4_CttsAtom::SetRunTotals(AP4_Ordinal entry_index)
+{
+    if (entry_index == 0) {
+        m_Entries[0].m_FirstSample = 0;
+    } else {
+        m_Entries[entry_index].m_FirstSample = m_Entries[entry_index-1].m_FirstSample+
+                                               m_Entries[entry_index-1].m_SampleCount;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_CttsAtom::GetCtsOffset
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_CttsAtom::GetCtsOffset(AP4_Ordinal sample, AP4_UI32& cts_offset)
 {
+    LoadEntries();
     // default value
     cts_offset = 0;
     
     // sample indexes start at 1
     if (sample == 0) return AP4_ERROR_OUT_OF_RANGE;
     
-    // check the lookup cache
-    AP4_Ordinal lookup_start = 0;
-    AP4_Ordinal sample_start = 0;
-    if (sample >= m_LookupCache.sample) {
-        // start from the cached entry
-        lookup_start = m_LookupCache.entry_index;
-        sample_start = m_LookupCache.sample;
+    // check the cached entry and the one after it first, so that
+    // sequential access does not need to search
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    AP4_Ordinal  entry_index = entry_count;
+    for (AP4_Ordinal i = m_LookupCache; i < entry_count && i <= m_LookupCache+1; i++) {
+        if (sample >  m_Entries[i].m_FirstSample &&
+            sample <= m_Entries[i].m_FirstSample+m_Entries[i].m_SampleCount) {
+            entry_index = i;
+            break;
+        }
     }
 
-    for (AP4_Ordinal i = lookup_start; i < m_Entries.ItemCount(); i++) {
-        AP4_CttsTableEntry& entry = m_Entries[i];
-
-        // check if we have reached the sample
-        if (sample <= sample_start+entry.m_SampleCount) {
-            // we are within the sample range for the current entry
-            cts_offset = entry.m_SampleOffset;
-
-            // update the lookup cache
-            m_LookupCache.entry_index = i;
-            m_LookupCache.sample      = sample_start;
-
-            return AP4_SUCCESS;
+    // binary search for the last entry that starts before the sample
+    if (entry_index == entry_count) {
+        AP4_Ordinal lo = 0;
+        AP4_Ordinal hi = entry_count;
+        while (lo < hi) {
+            AP4_Ordinal mid = lo+(hi-lo)/2;
+            if (m_Entries[mid].m_FirstSample < sample) {
+                lo = mid+1;
+            } else {
+                hi = mid;
+            }
         }
 
-        // update the upper bound
-        sample_start += entry.m_SampleCount;        
+        // sample is greater than the number of samples
+        if (lo == 0) return AP4_ERROR_OUT_OF_RANGE;
+        entry_index = lo-1;
+        if (sample > m_Entries[entry_index].m_FirstSample+m_Entries[entry_index].m_SampleCount) {
+            return AP4_ERROR_OUT_OF_RANGE;
+        }
     }
+    m_LookupCache = entry_index;
 
-    // sample is greater than the number of samples
-    return AP4_ERROR_OUT_OF_RANGE;
+    cts_offset = m_Entries[entry_index].m_SampleOffset;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -166,6 +213,9 @@ AP4_CttsAtom::GetCtsOffset(AP4_Ordinal sample, AP4_UI32& cts_offset)
 AP4_Result
 AP4_CttsAtom::WriteFields(AP4_ByteStream& stream)
 {
+    // make sure the entries have been read
+    LoadEntries();
+
     AP4_Result result;
 
     // write the entry count
@@ -193,6 +243,7 @@ AP4_CttsAtom::WriteFields(AP4_ByteStream& stream)
 AP4_Result
 AP4_CttsAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     if (inspector.GetVerbosity() >= 2) {
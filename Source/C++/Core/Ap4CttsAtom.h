@@ -48,14 +48,17 @@ class AP4_CttsTableEntry {
  public:
     AP4_CttsTableEntry() : 
         m_SampleCount(0), 
-        m_SampleOffset(0) {}
+        m_SampleOffset(0),
+        m_FirstSample(0) {}
     AP4_CttsTableEntry(AP4_UI32 sample_count,
                        AP4_UI32 sample_offset) :
         m_SampleCount(sample_count),
-        m_SampleOffset(sample_offset) {}
+        m_SampleOffset(sample_offset),
+        m_FirstSample(0) {}
 
     AP4_UI32 m_SampleCount;
     AP4_UI32 m_SampleOffset;
+    AP4_UI64 m_FirstSample; // computed (not in file), 0-based
 };
 
 /*----------------------------------------------------------------------
@@ -67,7 +70,7 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_CttsAtom, AP4_Atom)
 
     // class methods
-    static AP4_CttsAtom* Create(AP4_UI32 size, AP4_ByteStream& stream);
+    static AP4_CttsAtom* Create(AP4_UI32 size, AP4_ByteStream& stream, bool lazy = false);
 
     // constructor
     AP4_CttsAtom();
@@ -83,14 +86,17 @@ private:
     AP4_CttsAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
+    void SetRunTotals(AP4_Ordinal entry_index);
 
     // members
     AP4_Array<AP4_CttsTableEntry> m_Entries;
-    struct {
-        AP4_Ordinal sample;
-        AP4_Ordinal entry_index;
-    } m_LookupCache;
+    AP4_Ordinal                   m_LookupCache; // index of the last entry found
+    AP4_DeferredAtomData          m_DeferredEntries;
 };
 
 #endif // _AP4_CTTS_ATOM_H_
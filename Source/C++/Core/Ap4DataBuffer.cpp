@@ -37,6 +37,7 @@
 +---------------------------------------------------------------------*/
 AP4_DataBuffer::AP4_DataBuffer() :
     m_BufferIsLocal(true),
+    m_BufferIsView(false),
     m_Buffer(NULL),
     m_BufferSize(0),
     m_DataSize(0)
@@ -48,6 +49,7 @@ AP4_DataBuffer::AP4_DataBuffer() :
 +---------------------------------------------------------------------*/
 AP4_DataBuffer::AP4_DataBuffer(AP4_Size buffer_size) :
     m_BufferIsLocal(true),
+    m_BufferIsView(false),
     m_Buffer(NULL),
     m_BufferSize(buffer_size),
     m_DataSize(0)
@@ -60,6 +62,7 @@ AP4_DataBuffer::AP4_DataBuffer(AP4_Size buffer_size) :
 +---------------------------------------------------------------------*/
 AP4_DataBuffer::AP4_DataBuffer(const void* data, AP4_Size data_size) :
     m_BufferIsLocal(true),
+    m_BufferIsView(false),
     m_Buffer(NULL),
     m_BufferSize(data_size),
     m_DataSize(data_size)
@@ -75,6 +78,7 @@ AP4_DataBuffer::AP4_DataBuffer(const void* data, AP4_Size data_size) :
 +---------------------------------------------------------------------*/
 AP4_DataBuffer::AP4_DataBuffer(const AP4_DataBuffer& other) :
     m_BufferIsLocal(true),
+    m_BufferIsView(false),
     m_Buffer(NULL),
     m_BufferSize(other.m_DataSize),
     m_DataSize(other.m_DataSize)
@@ -99,6 +103,7 @@ AP4_DataBuffer::~AP4_DataBuffer()
 AP4_Result
 AP4_DataBuffer::Reserve(AP4_Size size)
 {
+    if (m_BufferIsView) ReleaseDataView();
     if (size <= m_BufferSize) return AP4_SUCCESS;
 
     // try doubling the buffer to accomodate for the new size
@@ -120,18 +125,59 @@ AP4_DataBuffer::SetBuffer(AP4_Byte* buffer, AP4_Size buffer_size)
 
     // we're now using an external buffer
     m_BufferIsLocal = false;
+    m_BufferIsView  = false;
     m_Buffer = buffer;
     m_BufferSize = buffer_size;
 
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_DataBuffer::SetDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_DataBuffer::SetDataView(const AP4_Byte* data, AP4_Size data_size)
+{
+    if (m_BufferIsLocal) {
+        // destroy the local buffer
+        delete[] m_Buffer;
+    }
+
+    // we're now viewing someone else's data (it will never be written to)
+    m_BufferIsLocal = false;
+    m_BufferIsView  = true;
+    m_Buffer        = const_cast<AP4_Byte*>(data);
+    m_BufferSize    = data_size;
+    m_DataSize      = data_size;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DataBuffer::ReleaseDataView
++---------------------------------------------------------------------*/
+void
+AP4_DataBuffer::ReleaseDataView()
+{
+    // replace the view with a local copy of the data
+    const AP4_Byte* data = m_Buffer;
+    m_Buffer        = NULL;
+    m_BufferIsLocal = true;
+    m_BufferIsView  = false;
+    m_BufferSize    = m_DataSize;
+    if (m_DataSize) {
+        m_Buffer = new AP4_Byte[m_DataSize];
+        AP4_CopyMemory(m_Buffer, data, m_DataSize);
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_DataBuffer::SetBufferSize
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_DataBuffer::SetBufferSize(AP4_Size buffer_size)
 {
+    if (m_BufferIsView) ReleaseDataView();
     if (m_BufferIsLocal) {
         return ReallocateBuffer(buffer_size);
     } else {
@@ -146,6 +192,8 @@ AP4_DataBuffer::SetBufferSize(AP4_Size buffer_size)
 AP4_Result
 AP4_DataBuffer::SetDataSize(AP4_Size size)
 {
+    // a view can shrink, but growing it would expose bytes we don't own
+    if (m_BufferIsView && size > m_DataSize) ReleaseDataView();
     if (size > m_BufferSize) {
         if (m_BufferIsLocal) {
             AP4_Result result = ReallocateBuffer(size);
@@ -164,6 +212,15 @@ AP4_DataBuffer::SetDataSize(AP4_Size size)
 AP4_Result
 AP4_DataBuffer::SetData(const AP4_Byte* data, AP4_Size size)
 {
+    if (m_BufferIsView) {
+        // drop the view, its data is about to be replaced anyway
+        // (the viewed memory isn't ours, so data may still point into it)
+        m_Buffer        = NULL;
+        m_BufferSize    = 0;
+        m_DataSize      = 0;
+        m_BufferIsLocal = true;
+        m_BufferIsView  = false;
+    }
     if (size > m_BufferSize) {
         if (m_BufferIsLocal) {
             AP4_Result result = ReallocateBuffer(size);
@@ -52,9 +52,22 @@ class AP4_DataBuffer
     AP4_Result SetBufferSize(AP4_Size buffer_size);
     AP4_Size   GetBufferSize() const { return m_BufferSize; }
 
+    /**
+     * Make this buffer a read-only view of data owned by someone else,
+     * without copying it. The data must remain valid for as long as the
+     * view is used. Methods that modify the buffer (UseData, SetData,
+     * SetDataSize to a larger size, Reserve, SetBufferSize) first replace 
+     * the view with a local copy, so the viewed data is never written to.
+     */
+    AP4_Result SetDataView(const AP4_Byte* data, AP4_Size data_size);
+    bool       IsDataView() const { return m_BufferIsView; }
+
     // data handling methods
     const AP4_Byte* GetData() const { return m_Buffer; }
-    AP4_Byte*       UseData() { return m_Buffer; };
+    AP4_Byte*       UseData() { 
+        if (m_BufferIsView) ReleaseDataView();
+        return m_Buffer; 
+    }
     AP4_Size        GetDataSize() const { return m_DataSize; }
     AP4_Result      SetDataSize(AP4_Size size);
     AP4_Result      SetData(const AP4_Byte* data, AP4_Size data_size);
@@ -65,12 +78,14 @@ class AP4_DataBuffer
  protected:
     // members
     bool      m_BufferIsLocal;
+    bool      m_BufferIsView;
     AP4_Byte* m_Buffer;
     AP4_Size  m_BufferSize;
     AP4_Size  m_DataSize;
 
     // methods
     AP4_Result ReallocateBuffer(AP4_Size size);
+    void       ReleaseDataView();
 
 private:
     // forbid this
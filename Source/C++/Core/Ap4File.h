@@ -96,6 +96,9 @@ public:
      * @param moov_only indicates whether parsing of the atoms should stop
      * when the moov atom is found or if all atoms should be parsed until the
      * end of the file. 
+     * To read the entries of the sample tables only when they are first
+     * accessed, pass a factory of your own on which 
+     * AP4_AtomFactory::SetLazySampleTables() has been called.
      */
     AP4_File(AP4_ByteStream&  stream, 
              AP4_AtomFactory& atom_factory = AP4_DefaultAtomFactory::Instance,
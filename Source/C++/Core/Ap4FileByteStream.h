@@ -46,7 +46,9 @@ public:
     typedef enum {
         STREAM_MODE_READ        = 0,
         STREAM_MODE_WRITE       = 1,
-        STREAM_MODE_READ_WRITE  = 2
+        STREAM_MODE_READ_WRITE  = 2,
+        STREAM_MODE_READ_MAPPED = 3  // read-only, memory-mapped when the platform
+                                     // supports it (falls back to STREAM_MODE_READ)
     } Mode;
 
     /**
@@ -86,6 +88,14 @@ public:
     AP4_Result Tell(AP4_Position& position) { return m_Delegate->Tell(position); }
     AP4_Result GetSize(AP4_LargeSize& size) { return m_Delegate->GetSize(size);  }
     AP4_Result Flush()                      { return m_Delegate->Flush();        }
+    AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size) {
+        return m_Delegate->CopyTo(stream, size);
+    }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data) {
+        return m_Delegate->BorrowData(position, size, data);
+    }
 
     // AP4_Referenceable methods
     void AddReference() { m_Delegate->AddReference(); }
@@ -101,6 +111,65 @@ protected:
     AP4_ByteStream* m_Delegate;
 };
 
+#if defined(AP4_CONFIG_HAVE_MMAP)
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream
++---------------------------------------------------------------------*/
+/**
+ * Read-only file stream that maps the whole file in memory, so that reads 
+ * are plain memory copies and BorrowData() can return pointers into the
+ * file without copying.
+ * (implemented in System/Posix/Ap4PosixMmapFileByteStream.cpp)
+ */
+class AP4_MmapFileByteStream: public AP4_ByteStream
+{
+public:
+    // class methods
+    static AP4_Result Create(AP4_FileByteStream* delegator,
+                             const char*         name,
+                             AP4_ByteStream*&    stream);
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer, 
+                           AP4_Size  bytes_to_read, 
+                           AP4_Size& bytes_read);
+    AP4_Result WritePartial(const void* buffer, 
+                            AP4_Size    bytes_to_write, 
+                            AP4_Size&   bytes_written);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position) {
+        position = m_Position;
+        return AP4_SUCCESS;
+    }
+    AP4_Result GetSize(AP4_LargeSize& size) {
+        size = m_Size;
+        return AP4_SUCCESS;
+    }
+    AP4_Result CopyTo(AP4_ByteStream& stream, AP4_LargeSize size);
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data);
+
+    // AP4_Referenceable methods
+    void AddReference();
+    void Release();
+
+private:
+    // methods
+    AP4_MmapFileByteStream(AP4_FileByteStream* delegator,
+                           AP4_UI08*           data,
+                           AP4_LargeSize       size);
+    ~AP4_MmapFileByteStream();
+
+    // members
+    AP4_ByteStream* m_Delegator;
+    AP4_Cardinal    m_ReferenceCount;
+    AP4_UI08*       m_Data;
+    AP4_LargeSize   m_Size;
+    AP4_Position    m_Position;
+};
+#endif
+
 #endif // _AP4_FILE_BYTE_STREAM_H_
 
 
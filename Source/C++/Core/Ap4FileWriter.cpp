@@ -39,13 +39,141 @@
 #include "Ap4DataBuffer.h"
 #include "Ap4FtypAtom.h"
 #include "Ap4SampleTable.h"
+#include "Ap4ContainerAtom.h"
+#include "Ap4StscAtom.h"
+#include "Ap4StcoAtom.h"
+#include "Ap4Co64Atom.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   AP4_InterleavedChunk
++---------------------------------------------------------------------*/
+struct AP4_InterleavedChunk {
+    AP4_Ordinal   m_FirstSample;
+    AP4_Cardinal  m_SampleCount;
+    AP4_Ordinal   m_DescriptionIndex; // 0-based
+    AP4_UI64      m_Slot;             // start time, in units of the chunk duration
+    AP4_LargeSize m_Size;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_InterleavedTrack
++---------------------------------------------------------------------*/
+class AP4_InterleavedTrack {
+public:
+    AP4_InterleavedTrack(AP4_Track* track) :
+        m_Track(track),
+        m_Stbl(NULL),
+        m_Stsc(NULL),
+        m_ChunkOffsets(NULL),
+        m_NewStsc(NULL),
+        m_NewChunkOffsets(NULL),
+        m_NewAtomsInstalled(false),
+        m_NextChunk(0) {}
+    ~AP4_InterleavedTrack() {
+        RestoreAtoms();
+        delete m_NewStsc;
+        delete m_NewChunkOffsets;
+    }
+    AP4_Result InstallAtoms();
+    void       RestoreAtoms();
+
+    AP4_Track*                      m_Track;
+    AP4_ContainerAtom*              m_Stbl;
+    AP4_Atom*                       m_Stsc;
+    AP4_Atom*                       m_ChunkOffsets;
+    AP4_Atom*                       m_NewStsc;
+    AP4_Atom*                       m_NewChunkOffsets;
+    bool                            m_NewAtomsInstalled;
+    AP4_Array<AP4_InterleavedChunk> m_Chunks;
+    AP4_Array<AP4_UI64>             m_Offsets; // relative to the start of the mdat payload
+    AP4_Ordinal                     m_NextChunk;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ReplaceChild
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_ReplaceChild(AP4_ContainerAtom* parent, AP4_Atom* child, AP4_Atom* replacement)
+{
+    // find the position of the child, so that the replacement takes its place
+    int position = 0;
+    AP4_List<AP4_Atom>::Item* item = parent->GetChildren().FirstItem();
+    while (item && item->GetData() != child) {
+        item = item->GetNext();
+        ++position;
+    }
+    if (item == NULL) return AP4_ERROR_NO_SUCH_ITEM;
+
+    AP4_Result result = parent->RemoveChild(child);
+    if (AP4_FAILED(result)) return result;
+    return parent->AddChild(replacement, position);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_InterleavedTrack::InstallAtoms
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_InterleavedTrack::InstallAtoms()
+{
+    AP4_Result result = AP4_ReplaceChild(m_Stbl, m_Stsc, m_NewStsc);
+    if (AP4_FAILED(result)) return result;
+    result = AP4_ReplaceChild(m_Stbl, m_ChunkOffsets, m_NewChunkOffsets);
+    if (AP4_FAILED(result)) {
+        AP4_ReplaceChild(m_Stbl, m_NewStsc, m_Stsc);
+        return result;
+    }
+    m_NewAtomsInstalled = true;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_InterleavedTrack::RestoreAtoms
++---------------------------------------------------------------------*/
+void
+AP4_InterleavedTrack::RestoreAtoms()
+{
+    if (!m_NewAtomsInstalled) return;
+    AP4_ReplaceChild(m_Stbl, m_NewStsc, m_Stsc);
+    AP4_ReplaceChild(m_Stbl, m_NewChunkOffsets, m_ChunkOffsets);
+    m_NewAtomsInstalled = false;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_NextInterleavedChunk
++---------------------------------------------------------------------*/
+static AP4_InterleavedTrack*
+AP4_NextInterleavedChunk(AP4_Array<AP4_InterleavedTrack*>& tracks)
+{
+    // the next chunk is the one with the earliest start, the first track winning ties
+    AP4_InterleavedTrack* next = NULL;
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        AP4_InterleavedTrack* track = tracks[i];
+        if (track->m_NextChunk >= track->m_Chunks.ItemCount()) continue;
+        if (next == NULL ||
+            track->m_Chunks[track->m_NextChunk].m_Slot < next->m_Chunks[next->m_NextChunk].m_Slot) {
+            next = track;
+        }
+    }
+    
+    return next;
+}
 
 /*----------------------------------------------------------------------
 |   AP4_FileWriter::Write
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_FileWriter::Write(AP4_File& file, AP4_ByteStream& stream, Interleaving /* interleaving */)
+AP4_FileWriter::Write(AP4_File&       file, 
+                      AP4_ByteStream& stream, 
+                      Interleaving    interleaving, 
+                      AP4_UI32        chunk_duration)
 {
+    // check the parameters
+    if (interleaving == INTERLEAVING_TIME && chunk_duration == 0) {
+        return AP4_ERROR_INVALID_PARAMETERS;
+    }
+    
     // get the file type
     AP4_FtypAtom* file_type = file.GetFileType();
 
@@ -72,6 +200,10 @@ AP4_FileWriter::Write(AP4_File& file, AP4_ByteStream& stream, Interleaving /* in
     AP4_Position position;
     stream.Tell(position);
     
+    if (interleaving == INTERLEAVING_TIME) {
+        return WriteTimeInterleaved(*movie, stream, position, chunk_duration);
+    }
+
     // backup and recompute all the chunk offsets
     unsigned int t=0;
     AP4_Result result = AP4_SUCCESS;
@@ -131,12 +263,17 @@ AP4_FileWriter::Write(AP4_File& file, AP4_ByteStream& stream, Interleaving /* in
         // restore the backed-up chunk offsets
         result = trak->SetChunkOffsets(*trak_chunk_offsets_backup[t]);
 
-        // write all the track's samples
-        AP4_Cardinal   sample_count = track->GetSampleCount();
-        AP4_Sample     sample;
-        AP4_DataBuffer sample_data;
-        for (AP4_Ordinal i=0; i<sample_count; i++) {
-            track->ReadSample(i, sample, sample_data);
+        // write all the track's samples, reading contiguous samples together
+        AP4_Cardinal              sample_count = track->GetSampleCount();
+        AP4_DataBuffer            sample_data;
+        AP4_Array<AP4_SampleSpan> sample_spans;
+        for (AP4_Ordinal i=0; i<sample_count; i += sample_spans.ItemCount()) {
+            result = track->ReadSamples(i, 
+                                        sample_count-i, 
+                                        sample_data, 
+                                        sample_spans,
+                                        AP4_FILE_WRITER_MAX_READ_SIZE);
+            if (AP4_FAILED(result)) goto end;
             stream.Write(sample_data.GetData(), sample_data.GetDataSize());
         }
     }
@@ -148,3 +285,207 @@ end:
     
     return result;
 }
+
+/*----------------------------------------------------------------------
+|   AP4_FileWriter::WriteTimeInterleaved
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FileWriter::WriteTimeInterleaved(AP4_Movie&      movie,
+                                     AP4_ByteStream& stream,
+                                     AP4_Position    position,
+                                     AP4_UI32        chunk_duration)
+{
+    AP4_MoovAtom*                    moov = movie.GetMoovAtom();
+    AP4_Array<AP4_InterleavedTrack*> tracks;
+    AP4_LargeSize                    payload_size = 0;
+    AP4_LargeSize                    tables_size  = 0;
+    AP4_Size                         mdat_header_size = AP4_ATOM_HEADER_SIZE;
+    AP4_LargeSize                    moov_size;
+    AP4_UI64                         payload_position;
+    AP4_UI64                         offset;
+    bool                             use_co64;
+    AP4_DataBuffer                   pending;
+    AP4_DataBuffer                   sample_data;
+    AP4_Array<AP4_SampleSpan>        sample_spans;
+    AP4_Result                       result = AP4_SUCCESS;
+
+    // group the samples of each track in chunks that start on a multiple of
+    // the chunk duration (a new chunk also starts when the description changes)
+    for (AP4_List<AP4_Track>::Item* track_item = movie.GetTracks().FirstItem();
+         track_item;
+         track_item = track_item->GetNext()) {
+        AP4_Track* track = track_item->GetData();
+        AP4_InterleavedTrack* itrack = new AP4_InterleavedTrack(track);
+        tracks.Append(itrack);
+        
+        // find the sample table atoms that will be replaced
+        itrack->m_Stbl = AP4_DYNAMIC_CAST(AP4_ContainerAtom, track->GetTrakAtom()->FindChild("mdia/minf/stbl"));
+        if (itrack->m_Stbl == NULL) {
+            result = AP4_ERROR_INVALID_FORMAT;
+            goto end;
+        }
+        itrack->m_Stsc         = itrack->m_Stbl->GetChild(AP4_ATOM_TYPE_STSC);
+        itrack->m_ChunkOffsets = itrack->m_Stbl->GetChild(AP4_ATOM_TYPE_STCO);
+        if (itrack->m_ChunkOffsets == NULL) {
+            itrack->m_ChunkOffsets = itrack->m_Stbl->GetChild(AP4_ATOM_TYPE_CO64);
+        }
+        if (itrack->m_Stsc == NULL || itrack->m_ChunkOffsets == NULL) {
+            result = AP4_ERROR_INVALID_FORMAT;
+            goto end;
+        }
+        AP4_UI32 timescale = track->GetMediaTimeScale();
+        if (timescale == 0) {
+            result = AP4_ERROR_INVALID_FORMAT;
+            goto end;
+        }
+        
+        AP4_Cardinal sample_count = track->GetSampleCount();
+        AP4_Sample   sample;
+        for (AP4_Ordinal i=0; i<sample_count; i++) {
+            result = track->GetSample(i, sample);
+            if (AP4_FAILED(result)) goto end;
+            AP4_UI64 slot = AP4_ConvertTime(sample.GetDts(), timescale, 1000)/chunk_duration;
+            AP4_Cardinal chunk_count = itrack->m_Chunks.ItemCount();
+            if (chunk_count == 0 ||
+                itrack->m_Chunks[chunk_count-1].m_Slot != slot ||
+                itrack->m_Chunks[chunk_count-1].m_DescriptionIndex != sample.GetDescriptionIndex()) {
+                AP4_InterleavedChunk chunk = { i, 0, sample.GetDescriptionIndex(), slot, 0 };
+                itrack->m_Chunks.Append(chunk);
+                ++chunk_count;
+            }
+            AP4_InterleavedChunk& chunk = itrack->m_Chunks[chunk_count-1];
+            ++chunk.m_SampleCount;
+            chunk.m_Size += sample.GetSize();
+            payload_size += sample.GetSize();
+        }
+        
+        // build the new stsc table, with one entry per run of similar chunks
+        AP4_StscAtom* stsc = new AP4_StscAtom();
+        itrack->m_NewStsc = stsc;
+        for (unsigned int j=0; j<itrack->m_Chunks.ItemCount();) {
+            const AP4_InterleavedChunk& chunk = itrack->m_Chunks[j];
+            unsigned int run = 1;
+            while (j+run < itrack->m_Chunks.ItemCount() &&
+                   itrack->m_Chunks[j+run].m_SampleCount      == chunk.m_SampleCount &&
+                   itrack->m_Chunks[j+run].m_DescriptionIndex == chunk.m_DescriptionIndex) {
+                ++run;
+            }
+            stsc->AddEntry(run, chunk.m_SampleCount, chunk.m_DescriptionIndex+1);
+            j += run;
+        }
+        
+        // assume 64-bit chunk offsets when estimating the size of the moov atom
+        tables_size += stsc->GetSize()+AP4_FULL_ATOM_HEADER_SIZE+4+8*itrack->m_Chunks.ItemCount();
+    }
+    
+    // see if the mdat atom and the chunk offsets need to be 64-bit
+    if (payload_size+AP4_ATOM_HEADER_SIZE > 0xFFFFFFFF) {
+        mdat_header_size += 8;
+    }
+    use_co64 = (position+moov->GetSize()+tables_size+mdat_header_size+payload_size > 0xFFFFFFFF);
+    
+    // compute the chunk offsets, relative to the start of the mdat payload,
+    // with the chunks of all the tracks in time order
+    offset = 0;
+    for (AP4_InterleavedTrack* itrack; (itrack = AP4_NextInterleavedChunk(tracks)) != NULL;) {
+        itrack->m_Offsets.Append(offset);
+        offset += itrack->m_Chunks[itrack->m_NextChunk++].m_Size;
+    }
+    
+    // create the new chunk offset atoms and put them in the moov atom
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        AP4_InterleavedTrack* itrack = tracks[i];
+        AP4_Cardinal chunk_count = itrack->m_Offsets.ItemCount();
+        if (use_co64) {
+            itrack->m_NewChunkOffsets = new AP4_Co64Atom(chunk_count ? &itrack->m_Offsets[0] : NULL, chunk_count);
+        } else {
+            AP4_UI32* offsets = new AP4_UI32[chunk_count];
+            for (unsigned int j=0; j<chunk_count; j++) {
+                offsets[j] = (AP4_UI32)itrack->m_Offsets[j];
+            }
+            itrack->m_NewChunkOffsets = new AP4_StcoAtom(offsets, chunk_count);
+            delete[] offsets;
+        }
+        result = itrack->InstallAtoms();
+        if (AP4_FAILED(result)) goto end;
+    }
+    
+    // now that the size of the moov atom is known, make the chunk offsets absolute
+    moov_size = moov->GetSize();
+    payload_position = position+moov_size+mdat_header_size;
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        AP4_InterleavedTrack* itrack = tracks[i];
+        for (unsigned int j=0; j<itrack->m_Offsets.ItemCount(); j++) {
+            AP4_UI64 chunk_offset = payload_position+itrack->m_Offsets[j];
+            if (use_co64) {
+                AP4_DYNAMIC_CAST(AP4_Co64Atom, itrack->m_NewChunkOffsets)->SetChunkOffset(j+1, chunk_offset);
+            } else {
+                AP4_DYNAMIC_CAST(AP4_StcoAtom, itrack->m_NewChunkOffsets)->SetChunkOffset(j+1, (AP4_UI32)chunk_offset);
+            }
+        }
+    }
+    
+    // write the moov atom and put the original atoms back
+    result = moov->Write(stream);
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        tracks[i]->RestoreAtoms();
+    }
+    if (AP4_FAILED(result)) goto end;
+    
+    // write the mdat header
+    if (mdat_header_size == AP4_ATOM_HEADER_SIZE) {
+        stream.WriteUI32((AP4_UI32)(payload_size+AP4_ATOM_HEADER_SIZE));
+        stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+    } else {
+        stream.WriteUI32(1);
+        stream.WriteUI32(AP4_ATOM_TYPE_MDAT);
+        stream.WriteUI64(payload_size+mdat_header_size);
+    }
+    
+    // write the chunks in the same order, reading contiguous samples together
+    // and grouping small reads so that the output is written in large blocks
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        tracks[i]->m_NextChunk = 0;
+    }
+    pending.Reserve(AP4_FILE_WRITER_MAX_WRITE_SIZE);
+    for (AP4_InterleavedTrack* itrack; (itrack = AP4_NextInterleavedChunk(tracks)) != NULL;) {
+        const AP4_InterleavedChunk& chunk = itrack->m_Chunks[itrack->m_NextChunk++];
+        for (AP4_Ordinal i=0; i<chunk.m_SampleCount; i += sample_spans.ItemCount()) {
+            result = itrack->m_Track->ReadSamples(chunk.m_FirstSample+i,
+                                                  chunk.m_SampleCount-i,
+                                                  sample_data,
+                                                  sample_spans,
+                                                  AP4_FILE_WRITER_MAX_READ_SIZE);
+            if (AP4_FAILED(result)) goto end;
+            if (sample_spans.ItemCount() == 0) {
+                result = AP4_ERROR_INTERNAL;
+                goto end;
+            }
+            AP4_Size data_size    = sample_data.GetDataSize();
+            AP4_Size pending_size = pending.GetDataSize();
+            if (pending_size && pending_size+data_size > AP4_FILE_WRITER_MAX_WRITE_SIZE) {
+                result = stream.Write(pending.GetData(), pending_size);
+                if (AP4_FAILED(result)) goto end;
+                pending.SetDataSize(0);
+                pending_size = 0;
+            }
+            if (data_size >= AP4_FILE_WRITER_MAX_WRITE_SIZE) {
+                result = stream.Write(sample_data.GetData(), data_size);
+                if (AP4_FAILED(result)) goto end;
+            } else if (data_size) {
+                pending.SetDataSize(pending_size+data_size);
+                AP4_CopyMemory(pending.UseData()+pending_size, sample_data.GetData(), data_size);
+            }
+        }
+    }
+    if (pending.GetDataSize()) {
+        result = stream.Write(pending.GetData(), pending.GetDataSize());
+    }
+
+end:
+    for (unsigned int i=0; i<tracks.ItemCount(); i++) {
+        delete tracks[i];
+    }
+
+    return result;
+}
@@ -39,6 +39,14 @@
 +---------------------------------------------------------------------*/
 class AP4_ByteStream;
 class AP4_File;
+class AP4_Movie;
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_FILE_WRITER_MAX_READ_SIZE          = 1024*1024; // max bytes read at once
+const AP4_Size AP4_FILE_WRITER_MAX_WRITE_SIZE         = 1024*1024; // max bytes buffered before a write
+const AP4_UI32 AP4_FILE_WRITER_DEFAULT_CHUNK_DURATION = 500;       // milliseconds
 
 /*----------------------------------------------------------------------
 |   AP4_FileWriter
@@ -47,15 +55,36 @@ class AP4_FileWriter {
 public:
     // types
     typedef enum {
-        INTERLEAVING_SEQUENTIAL
+        INTERLEAVING_SEQUENTIAL,
+        INTERLEAVING_TIME
     } Interleaving;
     
     // class methods
+    /**
+     * Write a file, with the 'moov' atom before the media data.
+     * With INTERLEAVING_SEQUENTIAL, the chunks of the tracks are kept as 
+     * they are, and all the samples of one track are written before those
+     * of the next track.
+     * With INTERLEAVING_TIME, the samples of each track are regrouped in
+     * chunks that start on multiples of chunk_duration, and the chunks of 
+     * all the tracks are written in time order, so that a player reading 
+     * the file progressively finds the samples of all the tracks close
+     * together.
+     * @param chunk_duration Duration of the chunks, in milliseconds, with
+     * INTERLEAVING_TIME.
+     */
     static AP4_Result Write(AP4_File&       file, 
                             AP4_ByteStream& stream, 
-                            Interleaving    interleaving = INTERLEAVING_SEQUENTIAL);
+                            Interleaving    interleaving = INTERLEAVING_SEQUENTIAL,
+                            AP4_UI32        chunk_duration = AP4_FILE_WRITER_DEFAULT_CHUNK_DURATION);
                             
 private:
+    // class methods
+    static AP4_Result WriteTimeInterleaved(AP4_Movie&      movie,
+                                           AP4_ByteStream& stream,
+                                           AP4_Position    position,
+                                           AP4_UI32        chunk_duration);
+
     // don't instantiate this class
     AP4_FileWriter() {}
 };
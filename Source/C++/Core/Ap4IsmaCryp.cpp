@@ -237,7 +237,7 @@ AP4_IsmaCipher::DecryptSampleData(AP4_DataBuffer& data_in,
 AP4_Result 
 AP4_IsmaCipher::EncryptSampleData(AP4_DataBuffer& data_in,
                                   AP4_DataBuffer& data_out,
-                                  AP4_UI32        block_counter)
+                                  AP4_UI64        block_counter)
 {
     // setup the buffers
     const unsigned char* in = data_in.GetData();
@@ -281,6 +281,9 @@ AP4_IsmaTrackDecrypter::Create(const AP4_UI08*                 key,
 
     // instanciate the object
     decrypter = new AP4_IsmaTrackDecrypter(cipher, 
+                                           key,
+                                           key_size,
+                                           block_cipher_factory,
                                            sample_entry, 
                                            sample_description->GetOriginalFormat());
     return AP4_SUCCESS;
@@ -289,10 +292,15 @@ AP4_IsmaTrackDecrypter::Create(const AP4_UI08*                 key,
 /*----------------------------------------------------------------------
 |   AP4_IsmaTrackDecrypter::AP4_IsmaTrackDecrypter
 +---------------------------------------------------------------------*/
-AP4_IsmaTrackDecrypter::AP4_IsmaTrackDecrypter(AP4_IsmaCipher*   cipher,
-                                               AP4_SampleEntry*  sample_entry,
-                                               AP4_UI32          original_format) :
+AP4_IsmaTrackDecrypter::AP4_IsmaTrackDecrypter(AP4_IsmaCipher*         cipher,
+                                               const AP4_UI08*         key,
+                                               AP4_Size                key_size,
+                                               AP4_BlockCipherFactory* block_cipher_factory,
+                                               AP4_SampleEntry*        sample_entry,
+                                               AP4_UI32                original_format) :
     m_Cipher(cipher),
+    m_Key(key, key_size),
+    m_BlockCipherFactory(block_cipher_factory),
     m_SampleEntry(sample_entry),
     m_OriginalFormat(original_format)
 {
@@ -326,6 +334,32 @@ AP4_IsmaTrackDecrypter::ProcessTrack()
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_IsmaTrackDecrypter::CreateCipher
++---------------------------------------------------------------------*/
+AP4_Result   
+AP4_IsmaTrackDecrypter::CreateCipher(AP4_IsmaCipher*& cipher)
+{
+    // create a cipher with the same parameters as the track cipher
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = 8;
+    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128,
+                                                           AP4_BlockCipher::DECRYPT,
+                                                           AP4_BlockCipher::CTR,
+                                                           &ctr_params,
+                                                           m_Key.GetData(),
+                                                           m_Key.GetDataSize(),
+                                                           block_cipher);
+    if (AP4_FAILED(result)) return result;
+    cipher = new AP4_IsmaCipher(block_cipher,
+                                m_Cipher->GetSalt(),
+                                m_Cipher->GetIvLength(),
+                                m_Cipher->GetKeyIndicatorLength(),
+                                m_Cipher->GetSelectiveEncryption());
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_IsmaDecrypter::ProcessSample
 +---------------------------------------------------------------------*/
@@ -333,7 +367,16 @@ AP4_Result
 AP4_IsmaTrackDecrypter::ProcessSample(AP4_DataBuffer& data_in,
                                       AP4_DataBuffer& data_out)
 {
-    return m_Cipher->DecryptSampleData(data_in, data_out);
+    // the IV is in the sample, so all we need is a cipher that no other 
+    // thread is using
+    AP4_IsmaCipher* cipher = m_SpareCiphers.Get();
+    if (cipher == NULL) {
+        AP4_Result result = CreateCipher(cipher);
+        if (AP4_FAILED(result)) return result;
+    }
+    AP4_Result result = cipher->DecryptSampleData(data_in, data_out);
+    m_SpareCiphers.Put(cipher);
+    return result;
 }
 
 /*----------------------------------------------------------------------
@@ -342,11 +385,13 @@ AP4_IsmaTrackDecrypter::ProcessSample(AP4_DataBuffer& data_in,
 class AP4_IsmaTrackEncrypter : public AP4_Processor::TrackHandler {
 public:
     // constructor
-    AP4_IsmaTrackEncrypter(const char*      kms_uri,
-                           AP4_BlockCipher* block_cipher,
-                           const AP4_UI08*  salt,
-                           AP4_SampleEntry* sample_entry,
-                           AP4_UI32         format);
+    AP4_IsmaTrackEncrypter(const char*             kms_uri,
+                           AP4_BlockCipher*        block_cipher,
+                           const AP4_DataBuffer&   key,
+                           AP4_BlockCipherFactory* block_cipher_factory,
+                           const AP4_UI08*         salt,
+                           AP4_SampleEntry*        sample_entry,
+                           AP4_UI32                format);
     virtual ~AP4_IsmaTrackEncrypter();
 
     // methods
@@ -354,34 +399,70 @@ public:
     virtual AP4_Result ProcessTrack();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                            AP4_DataBuffer& data_in,
+                                            AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
 
 private:
+    // methods
+    AP4_Result CreateCipher(AP4_IsmaCipher*& cipher);
+
     // members
-    AP4_String       m_KmsUri;
-    AP4_IsmaCipher*  m_Cipher;
-    AP4_SampleEntry* m_SampleEntry;
-    AP4_UI32         m_Format;
-    AP4_UI32         m_BlockCounter;
+    AP4_String                     m_KmsUri;
+    AP4_DataBuffer                 m_Key;
+    AP4_BlockCipherFactory*        m_BlockCipherFactory;
+    AP4_IsmaCipher*                m_Cipher;
+    AP4_ObjectPool<AP4_IsmaCipher> m_SpareCiphers; // one per thread
+    AP4_SampleEntry*               m_SampleEntry;
+    AP4_UI32                       m_Format;
+    AP4_Ordinal                    m_SampleIndex;  // for ProcessSample() only
 };
 
 /*----------------------------------------------------------------------
 |   AP4_IsmaTrackEncrypter::AP4_IsmaTrackEncrypter
 +---------------------------------------------------------------------*/
 AP4_IsmaTrackEncrypter::AP4_IsmaTrackEncrypter(
-    const char*      kms_uri,
-    AP4_BlockCipher* block_cipher,
-    const AP4_UI08*  salt,
-    AP4_SampleEntry* sample_entry,
-    AP4_UI32         format) :
+    const char*             kms_uri,
+    AP4_BlockCipher*        block_cipher,
+    const AP4_DataBuffer&   key,
+    AP4_BlockCipherFactory* block_cipher_factory,
+    const AP4_UI08*         salt,
+    AP4_SampleEntry*        sample_entry,
+    AP4_UI32                format) :
     m_KmsUri(kms_uri),
+    m_Key(key),
+    m_BlockCipherFactory(block_cipher_factory),
     m_SampleEntry(sample_entry),
     m_Format(format),
-    m_BlockCounter(0)
+    m_SampleIndex(0)
 {
     // instantiate the cipher (fixed params for now)
     m_Cipher = new AP4_IsmaCipher(block_cipher, salt, 8, 0, false);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_IsmaTrackEncrypter::CreateCipher
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_IsmaTrackEncrypter::CreateCipher(AP4_IsmaCipher*& cipher)
+{
+    // create a cipher with the same parameters as the track cipher
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = 8;
+    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128, 
+                                                           AP4_BlockCipher::ENCRYPT, 
+                                                           AP4_BlockCipher::CTR,
+                                                           &ctr_params,
+                                                           m_Key.GetData(), 
+                                                           m_Key.GetDataSize(), 
+                                                           block_cipher);
+    if (AP4_FAILED(result)) return result;
+    cipher = new AP4_IsmaCipher(block_cipher, m_Cipher->GetSalt(), 8, 0, false);
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_IsmaTrackEncrypter::~AP4_IsmaTrackEncrypter
 +---------------------------------------------------------------------*/
@@ -446,11 +527,31 @@ AP4_Result
 AP4_IsmaTrackEncrypter::ProcessSample(AP4_DataBuffer& data_in,
                                       AP4_DataBuffer& data_out)
 {
-    AP4_Result result = m_Cipher->EncryptSampleData(data_in, data_out, m_BlockCounter);
-    if (AP4_FAILED(result)) return result;
+    return ProcessIndexedSample(m_SampleIndex++, data_in, data_out);
+}
 
-    m_BlockCounter += (data_in.GetDataSize()+AP4_CIPHER_BLOCK_SIZE-1)/AP4_CIPHER_BLOCK_SIZE;
-    return AP4_SUCCESS;
+/*----------------------------------------------------------------------
+|   AP4_IsmaTrackEncrypter::ProcessIndexedSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_IsmaTrackEncrypter::ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                             AP4_DataBuffer& data_in,
+                                             AP4_DataBuffer& data_out)
+{
+    // get a cipher that no other thread is using
+    AP4_IsmaCipher* cipher = m_SpareCiphers.Get();
+    if (cipher == NULL) {
+        AP4_Result result = CreateCipher(cipher);
+        if (AP4_FAILED(result)) return result;
+    }
+
+    // start each sample at a block counter derived from its index rather
+    // than from the size of the samples before it, so that the samples 
+    // can be encrypted in any order (a sample is less than 2^32 blocks 
+    // long, so the counters of two samples never overlap)
+    AP4_Result result = cipher->EncryptSampleData(data_in, data_out, ((AP4_UI64)sample_index)<<32);
+    m_SpareCiphers.Put(cipher);
+    return result;
 }
 
 /*----------------------------------------------------------------------
@@ -533,6 +634,8 @@ AP4_IsmaEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             // create the encrypter
             return new AP4_IsmaTrackEncrypter(m_KmsUri.GetChars(), 
                                               block_cipher, 
+                                              *key,
+                                              m_BlockCipherFactory,
                                               salt->GetData(), 
                                               entry,
                                               format);
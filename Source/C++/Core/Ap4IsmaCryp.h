@@ -38,6 +38,8 @@
 #include "Ap4AtomFactory.h"
 #include "Ap4SampleDescription.h"
 #include "Ap4Processor.h"
+#include "Ap4DataBuffer.h"
+#include "Ap4Threads.h"
 #include "Ap4Protection.h"
 
 /*----------------------------------------------------------------------
@@ -73,7 +75,7 @@ public:
    ~AP4_IsmaCipher();
     AP4_Result EncryptSampleData(AP4_DataBuffer& data_in,
                                  AP4_DataBuffer& data_out,
-                                 AP4_UI32        block_counter);
+                                 AP4_UI64        block_counter);
     AP4_Result DecryptSampleData(AP4_DataBuffer& data_in,
                                  AP4_DataBuffer& data_out,
                                  const AP4_UI08* iv = NULL);
@@ -113,17 +115,27 @@ public:
     virtual AP4_Result ProcessTrack();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
 
 private:
     // constructor
-    AP4_IsmaTrackDecrypter(AP4_IsmaCipher*  cipher,
-                           AP4_SampleEntry* sample_entry,
-                           AP4_UI32         original_format);
+    AP4_IsmaTrackDecrypter(AP4_IsmaCipher*         cipher,
+                           const AP4_UI08*         key,
+                           AP4_Size                key_size,
+                           AP4_BlockCipherFactory* block_cipher_factory,
+                           AP4_SampleEntry*        sample_entry,
+                           AP4_UI32                original_format);
+
+    // methods
+    AP4_Result CreateCipher(AP4_IsmaCipher*& cipher);
 
     // members
-    AP4_IsmaCipher*  m_Cipher;
-    AP4_SampleEntry* m_SampleEntry;
-    AP4_UI32         m_OriginalFormat;
+    AP4_IsmaCipher*                 m_Cipher;
+    AP4_DataBuffer                  m_Key;
+    AP4_BlockCipherFactory*         m_BlockCipherFactory;
+    AP4_ObjectPool<AP4_IsmaCipher>  m_SpareCiphers; // one per thread
+    AP4_SampleEntry*                m_SampleEntry;
+    AP4_UI32                        m_OriginalFormat;
 };
 
 /*----------------------------------------------------------------------
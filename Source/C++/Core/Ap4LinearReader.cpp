@@ -40,9 +40,10 @@
 /*----------------------------------------------------------------------
 |   AP4_LinearReader::AP4_LinearReader
 +---------------------------------------------------------------------*/
-AP4_LinearReader::AP4_LinearReader(AP4_Movie&      movie, 
-                                   AP4_ByteStream* fragment_stream,
-                                   AP4_Size        max_buffer) :
+AP4_LinearReader::AP4_LinearReader(AP4_Movie&       movie, 
+                                   AP4_ByteStream*  fragment_stream,
+                                   AP4_Size         max_buffer,
+                                   AP4_AtomFactory& atom_factory) :
     m_Movie(movie),
     m_Fragment(NULL),
     m_FragmentStream(fragment_stream),
@@ -50,7 +51,8 @@ AP4_LinearReader::AP4_LinearReader(AP4_Movie&      movie,
     m_BufferFullness(0),
     m_BufferFullnessPeak(0),
     m_MaxBufferFullness(max_buffer),
-    m_Mfra(NULL)
+    m_Mfra(NULL),
+    m_AtomFactory(atom_factory)
 {
     m_HasFragments = movie.HasFragments();
     if (fragment_stream) {
@@ -183,7 +185,7 @@ AP4_LinearReader::SeekTo(AP4_UI32 time_ms, AP4_UI32* actual_time_ms)
                         if (AP4_SUCCEEDED(result)) {
                             AP4_Atom* mfra = NULL;
                             AP4_LargeSize available = mfra_size;
-                            AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(*m_FragmentStream, available, mfra);
+                            m_AtomFactory.CreateAtomFromStream(*m_FragmentStream, available, mfra);
                             m_Mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, mfra);
                         }
                     }
@@ -342,7 +344,14 @@ AP4_LinearReader::AdvanceFragment()
     if (!m_FragmentStream) return AP4_ERROR_INVALID_STATE;
     do {
         AP4_Atom* atom = NULL;
-        result = AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(*m_FragmentStream, atom);
+        // allocate the fragment's atoms from an arena of their own, so 
+        // that they are all freed at once when the fragment is replaced
+        AP4_Arena* arena = new AP4_Arena();
+        {
+            AP4_Arena::Scope arena_scope(arena);
+            result = m_AtomFactory.CreateAtomFromStream(*m_FragmentStream, atom);
+        }
+        arena->Release();
         if (AP4_SUCCEEDED(result)) {
             if (atom->GetType() == AP4_ATOM_TYPE_MOOF) {
                 AP4_ContainerAtom* moof = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
@@ -452,7 +461,7 @@ AP4_LinearReader::Advance(bool read_data)
             if (next_tracker->m_Reader) {
                 result = next_tracker->m_Reader->ReadSampleData(*buffer->m_Sample, buffer->m_Data);
             } else {
-                result = buffer->m_Sample->ReadData(buffer->m_Data);
+                result = buffer->m_Sample->ReadDataView(buffer->m_Data);
             }
             if (AP4_FAILED(result)) return result;
 
@@ -623,7 +632,7 @@ AP4_Result
 AP4_DecryptingSampleReader::ReadSampleData(AP4_Sample&     sample, 
                                            AP4_DataBuffer& sample_data)
 {
-    AP4_Result result = sample.ReadData(m_DataBuffer);
+    AP4_Result result = sample.ReadDataView(m_DataBuffer);
     if (AP4_FAILED(result)) return result;
 
     return m_Decrypter->DecryptSampleData(m_DataBuffer, sample_data);
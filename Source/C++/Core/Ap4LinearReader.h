@@ -37,6 +37,7 @@
 #include "Ap4Movie.h"
 #include "Ap4Sample.h"
 #include "Ap4Protection.h"
+#include "Ap4AtomFactory.h"
 
 /*----------------------------------------------------------------------
 |   class references
@@ -57,7 +58,15 @@ const unsigned int AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE = 16*1024*1024;
 +---------------------------------------------------------------------*/
 class AP4_LinearReader {
 public:
-    AP4_LinearReader(AP4_Movie& movie, AP4_ByteStream* fragment_stream = NULL, AP4_Size max_buffer=AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE);
+    /**
+     * The atom factory is used to parse the movie fragments. Readers that
+     * run concurrently in different threads must each use a factory of 
+     * their own, because a factory keeps some parsing state.
+     */
+    AP4_LinearReader(AP4_Movie&       movie, 
+                     AP4_ByteStream*  fragment_stream = NULL, 
+                     AP4_Size         max_buffer = AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE,
+                     AP4_AtomFactory& atom_factory = AP4_DefaultAtomFactory::Instance);
     virtual ~AP4_LinearReader();
     
     AP4_Result EnableTrack(AP4_UI32 track_id);
@@ -184,6 +193,7 @@ protected:
     AP4_Size            m_BufferFullnessPeak;
     AP4_Size            m_MaxBufferFullness;
     AP4_ContainerAtom*  m_Mfra;
+    AP4_AtomFactory&    m_AtomFactory;
 };
 
 /*----------------------------------------------------------------------
@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
 #include "Ap4Results.h"
+#include "Ap4Arena.h"
 
 /*----------------------------------------------------------------------
 |   forward references
@@ -71,6 +72,8 @@ public:
         // methods
         Item(T* data) : m_Data(data), m_Next(0), m_Prev(0) {}
        ~Item() {}
+        static void* operator new(size_t size) { return AP4_Arena::Allocate((AP4_Size)size); }
+        static void  operator delete(void* memory) { AP4_Arena::Free(memory); }
         Item* GetNext() { return m_Next; }
         Item* GetPrev() { return m_Prev; }
         T*    GetData() { return m_Data; }
@@ -601,7 +601,7 @@ AP4_MarlinIpmpTrackDecrypter::Create(AP4_BlockCipherFactory&        cipher_facto
     if (AP4_FAILED(result)) return result;
     
     // create the track decrypter
-    decrypter = new AP4_MarlinIpmpTrackDecrypter(sample_decrypter);
+    decrypter = new AP4_MarlinIpmpTrackDecrypter(sample_decrypter, key, key_size, &cipher_factory);
     
     return AP4_SUCCESS;
 }
@@ -630,7 +630,21 @@ AP4_Result
 AP4_MarlinIpmpTrackDecrypter::ProcessSample(AP4_DataBuffer& data_in,
                                             AP4_DataBuffer& data_out)
 {
-    return m_SampleDecrypter->DecryptSampleData(data_in, data_out);
+    // the IV is in the sample, so all we need is a sample decrypter that 
+    // no other thread is using
+    AP4_SampleDecrypter* sample_decrypter = m_SpareSampleDecrypters.Get();
+    if (sample_decrypter == NULL) {
+        AP4_MarlinIpmpSampleDecrypter* marlin_decrypter = NULL;
+        AP4_Result result = AP4_MarlinIpmpSampleDecrypter::Create(m_Key.GetData(), 
+                                                                  m_Key.GetDataSize(), 
+                                                                  m_CipherFactory, 
+                                                                  marlin_decrypter);
+        if (AP4_FAILED(result)) return result;
+        sample_decrypter = marlin_decrypter;
+    }
+    AP4_Result result = sample_decrypter->DecryptSampleData(data_in, data_out);
+    m_SpareSampleDecrypters.Put(sample_decrypter);
+    return result;
 }
 
 /*----------------------------------------------------------------------
@@ -1010,7 +1024,7 @@ AP4_MarlinIpmpTrackEncrypter::Create(AP4_BlockCipherFactory&        cipher_facto
     AP4_CbcStreamCipher* cbc_cipher = new AP4_CbcStreamCipher(block_cipher);
     
     // create the track encrypter
-    encrypter = new AP4_MarlinIpmpTrackEncrypter(cbc_cipher, iv);
+    encrypter = new AP4_MarlinIpmpTrackEncrypter(cbc_cipher, iv, key, key_size, cipher_factory);
     
     return AP4_SUCCESS;
 }
@@ -1018,12 +1032,19 @@ AP4_MarlinIpmpTrackEncrypter::Create(AP4_BlockCipherFactory&        cipher_facto
 /*----------------------------------------------------------------------
 |   AP4_MarlinIpmpTrackEncrypter::AP4_MarlinIpmpTrackEncrypter
 +---------------------------------------------------------------------*/
-AP4_MarlinIpmpTrackEncrypter::AP4_MarlinIpmpTrackEncrypter(AP4_StreamCipher* cipher, 
-                                                           const AP4_UI08*   iv) :
-    m_Cipher(cipher)
+AP4_MarlinIpmpTrackEncrypter::AP4_MarlinIpmpTrackEncrypter(AP4_StreamCipher*       cipher, 
+                                                           const AP4_UI08*         iv,
+                                                           const AP4_UI08*         key,
+                                                           AP4_Size                key_size,
+                                                           AP4_BlockCipherFactory& cipher_factory) :
+    m_Key(key, key_size),
+    m_CipherFactory(cipher_factory)
 {
     // copy the IV
     AP4_CopyMemory(m_IV, iv, AP4_AES_BLOCK_SIZE);    
+    
+    // the cipher is the first of the ciphers used to process the samples
+    m_SpareCiphers.Put(cipher);
 }
 
 /*----------------------------------------------------------------------
@@ -1031,7 +1052,6 @@ AP4_MarlinIpmpTrackEncrypter::AP4_MarlinIpmpTrackEncrypter(AP4_StreamCipher* cip
 +---------------------------------------------------------------------*/
 AP4_MarlinIpmpTrackEncrypter::~AP4_MarlinIpmpTrackEncrypter()
 {
-    delete m_Cipher;
 }
 
 /*----------------------------------------------------------------------
@@ -1043,6 +1063,26 @@ AP4_MarlinIpmpTrackEncrypter::GetProcessedSampleSize(AP4_Sample& sample)
     return AP4_CIPHER_BLOCK_SIZE*(2+(sample.GetSize()/AP4_CIPHER_BLOCK_SIZE));
 }
 
+/*----------------------------------------------------------------------
+|   AP4_MarlinIpmpTrackEncrypter:CreateCipher
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_MarlinIpmpTrackEncrypter::CreateCipher(AP4_StreamCipher*& cipher)
+{
+    // create a cipher with the same parameters as the track cipher
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_Result result = m_CipherFactory.CreateCipher(AP4_BlockCipher::AES_128, 
+                                                     AP4_BlockCipher::ENCRYPT, 
+                                                     AP4_BlockCipher::CBC,
+                                                     NULL,
+                                                     m_Key.GetData(), 
+                                                     m_Key.GetDataSize(), 
+                                                     block_cipher);
+    if (AP4_FAILED(result)) return result;
+    cipher = new AP4_CbcStreamCipher(block_cipher);
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_MarlinIpmpTrackEncrypter:ProcessSample
 +---------------------------------------------------------------------*/
@@ -1067,13 +1107,21 @@ AP4_MarlinIpmpTrackEncrypter::ProcessSample(AP4_DataBuffer& data_in,
     AP4_CopyMemory(out, m_IV, AP4_CIPHER_BLOCK_SIZE);
     out_size -= AP4_CIPHER_BLOCK_SIZE;
     
+    // get a cipher that no other thread is using
+    AP4_StreamCipher* cipher = m_SpareCiphers.Get();
+    if (cipher == NULL) {
+        result = CreateCipher(cipher);
+        if (AP4_FAILED(result)) return result;
+    }
+    
     // encrypt the data
-    m_Cipher->SetIV(m_IV);
-    result = m_Cipher->ProcessBuffer(in, 
-                                     in_size, 
-                                     out+AP4_AES_BLOCK_SIZE,
-                                     &out_size,
-                                     true);
+    cipher->SetIV(m_IV);
+    result = cipher->ProcessBuffer(in, 
+                                   in_size, 
+                                   out+AP4_AES_BLOCK_SIZE,
+                                   &out_size,
+                                   true);
+    m_SpareCiphers.Put(cipher);
     if (AP4_FAILED(result)) return result;
     
     // update the payload size
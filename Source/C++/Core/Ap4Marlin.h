@@ -44,6 +44,8 @@
 #include "Ap4Command.h"
 #include "Ap4UuidAtom.h"
 #include "Ap4OmaDcf.h"
+#include "Ap4DataBuffer.h"
+#include "Ap4Threads.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -169,22 +171,31 @@ public:
                              AP4_MarlinIpmpTrackDecrypter*& decrypter);
                              
     // constructor and destructor
-     AP4_MarlinIpmpTrackDecrypter() : m_SampleDecrypter(NULL) {};
+     AP4_MarlinIpmpTrackDecrypter() : m_SampleDecrypter(NULL), m_CipherFactory(NULL) {};
     ~AP4_MarlinIpmpTrackDecrypter();
     
     // AP4_Processor::TrackHandler methods
     virtual AP4_Size GetProcessedSampleSize(AP4_Sample& sample);
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
 
 
 private:
     // constructor
-    AP4_MarlinIpmpTrackDecrypter(AP4_SampleDecrypter* sample_decrypter) : 
-        m_SampleDecrypter(sample_decrypter) {}
+    AP4_MarlinIpmpTrackDecrypter(AP4_SampleDecrypter*    sample_decrypter,
+                                 const AP4_UI08*         key,
+                                 AP4_Size                key_size,
+                                 AP4_BlockCipherFactory* cipher_factory) : 
+        m_SampleDecrypter(sample_decrypter),
+        m_Key(key, key_size),
+        m_CipherFactory(cipher_factory) {}
 
     // members
-    AP4_SampleDecrypter* m_SampleDecrypter;
+    AP4_SampleDecrypter*                m_SampleDecrypter;
+    AP4_DataBuffer                      m_Key;
+    AP4_BlockCipherFactory*             m_CipherFactory;
+    AP4_ObjectPool<AP4_SampleDecrypter> m_SpareSampleDecrypters; // one per thread
 };
 
 /*----------------------------------------------------------------------
@@ -237,15 +248,25 @@ public:
     virtual AP4_Size GetProcessedSampleSize(AP4_Sample& sample);
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return true; }
 
 
 private:
     // constructor
-    AP4_MarlinIpmpTrackEncrypter(AP4_StreamCipher* cipher, const AP4_UI08* iv);
+    AP4_MarlinIpmpTrackEncrypter(AP4_StreamCipher*       cipher, 
+                                 const AP4_UI08*         iv,
+                                 const AP4_UI08*         key,
+                                 AP4_Size                key_size,
+                                 AP4_BlockCipherFactory& cipher_factory);
+
+    // methods
+    AP4_Result CreateCipher(AP4_StreamCipher*& cipher);
 
     // members
-    AP4_UI08          m_IV[16];
-    AP4_StreamCipher* m_Cipher;
+    AP4_UI08                         m_IV[16];
+    AP4_DataBuffer                   m_Key;
+    AP4_BlockCipherFactory&          m_CipherFactory;
+    AP4_ObjectPool<AP4_StreamCipher> m_SpareCiphers; // one per thread
 };
 
 /*----------------------------------------------------------------------
@@ -78,6 +78,18 @@ public:
         virtual ~Stream() {}
         
         AP4_UI16 GetPID() { return m_PID; }
+        
+        /**
+         * Make the header of the next packet of this stream, including the 
+         * adaptation field, in a buffer of at least 188 bytes.
+         * @return The size of the header. The payload, of payload_size
+         * bytes, follows the header, and completes the packet.
+         */
+        unsigned int MakePacketHeader(bool           payload_start, 
+                                      unsigned int&  payload_size,
+                                      bool           with_pcr,
+                                      AP4_UI64       pcr,
+                                      unsigned char* header);
         void WritePacketHeader(bool            payload_start, 
                                unsigned int&   payload_size,
                                bool            with_pcr,
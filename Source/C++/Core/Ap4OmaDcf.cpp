@@ -796,8 +796,18 @@ AP4_OmaDcfTrackDecrypter::Create(
                                                           cipher);
     if (AP4_FAILED(result)) return result;
 
+    // in CTR mode, the samples can be decrypted in parallel, each thread 
+    // with its own cipher (the sample decrypter was created, so the 
+    // scheme info atoms are there)
+    AP4_OhdrAtom* ohdr = AP4_DYNAMIC_CAST(AP4_OhdrAtom, sample_description->GetSchemeInfo()->GetSchiAtom()->FindChild("odkm/ohdr"));
+    bool is_ctr = (ohdr->GetEncryptionMethod() == AP4_OMA_DCF_ENCRYPTION_METHOD_AES_CTR);
+    
     // instantiate the object
     decrypter = new AP4_OmaDcfTrackDecrypter(cipher, 
+                                             is_ctr,
+                                             key,
+                                             key_size,
+                                             block_cipher_factory,
                                              sample_entry, 
                                              sample_description->GetOriginalFormat());
     return AP4_SUCCESS;
@@ -807,9 +817,16 @@ AP4_OmaDcfTrackDecrypter::Create(
 |   AP4_OmaDcfTrackDecrypter::AP4_OmaDcfTrackDecrypter
 +---------------------------------------------------------------------*/
 AP4_OmaDcfTrackDecrypter::AP4_OmaDcfTrackDecrypter(AP4_OmaDcfSampleDecrypter* cipher,
+                                                   bool                       is_ctr,
+                                                   const AP4_UI08*            key,
+                                                   AP4_Size                   key_size,
+                                                   AP4_BlockCipherFactory*    block_cipher_factory,
                                                    AP4_SampleEntry*           sample_entry,
                                                    AP4_UI32                   original_format) :
     m_Cipher(cipher),
+    m_IsCtr(is_ctr),
+    m_Key(key, key_size),
+    m_BlockCipherFactory(block_cipher_factory),
     m_SampleEntry(sample_entry),
     m_OriginalFormat(original_format)
 {
@@ -844,6 +861,30 @@ AP4_OmaDcfTrackDecrypter::ProcessTrack()
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_OmaDcfTrackDecrypter::CreateCtrCipher
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_OmaDcfTrackDecrypter::CreateCtrCipher(AP4_OmaDcfSampleDecrypter*& cipher)
+{
+    // create a cipher with the same parameters as the track cipher
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = m_Cipher->GetIvLength();
+    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128, 
+                                                           AP4_BlockCipher::DECRYPT, 
+                                                           AP4_BlockCipher::CTR,
+                                                           &ctr_params,
+                                                           m_Key.GetData(), 
+                                                           m_Key.GetDataSize(), 
+                                                           block_cipher);
+    if (AP4_FAILED(result)) return result;
+    cipher = new AP4_OmaDcfCtrSampleDecrypter(block_cipher, 
+                                              m_Cipher->GetIvLength(), 
+                                              m_Cipher->GetSelectiveEncryption());
+    return AP4_SUCCESS;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_OmaDcfDecrypter::ProcessSample
 +---------------------------------------------------------------------*/
@@ -851,7 +892,18 @@ AP4_Result
 AP4_OmaDcfTrackDecrypter::ProcessSample(AP4_DataBuffer& data_in,
                                         AP4_DataBuffer& data_out)
 {
-    return m_Cipher->DecryptSampleData(data_in, data_out);
+    if (!m_IsCtr) return m_Cipher->DecryptSampleData(data_in, data_out);
+    
+    // the IV is in the sample, so all we need is a cipher that no other 
+    // thread is using
+    AP4_OmaDcfSampleDecrypter* cipher = m_SpareCiphers.Get();
+    if (cipher == NULL) {
+        AP4_Result result = CreateCtrCipher(cipher);
+        if (AP4_FAILED(result)) return result;
+    }
+    AP4_Result result = cipher->DecryptSampleData(data_in, data_out);
+    m_SpareCiphers.Put(cipher);
+    return result;
 }
 
 /*----------------------------------------------------------------------
@@ -860,15 +912,17 @@ AP4_OmaDcfTrackDecrypter::ProcessSample(AP4_DataBuffer& data_in,
 class AP4_OmaDcfTrackEncrypter : public AP4_Processor::TrackHandler {
 public:
     // constructor
-    AP4_OmaDcfTrackEncrypter(AP4_OmaDcfCipherMode cipher_mode,
-                             AP4_BlockCipher*     block_cipher,
-                             const AP4_UI08*      iv,
-                             AP4_SampleEntry*     sample_entry,
-                             AP4_UI32             format,
-                             const char*          content_id,
-                             const char*          rights_issuer_url,
-                             const AP4_Byte*      textual_headers, 
-                             AP4_Size             textual_headers_size);
+    AP4_OmaDcfTrackEncrypter(AP4_OmaDcfCipherMode    cipher_mode,
+                             AP4_BlockCipher*        block_cipher,
+                             const AP4_DataBuffer&   key,
+                             AP4_BlockCipherFactory* block_cipher_factory,
+                             const AP4_UI08*         iv,
+                             AP4_SampleEntry*        sample_entry,
+                             AP4_UI32                format,
+                             const char*             content_id,
+                             const char*             rights_issuer_url,
+                             const AP4_Byte*         textual_headers, 
+                             AP4_Size                textual_headers_size);
     virtual ~AP4_OmaDcfTrackEncrypter();
 
     // methods
@@ -876,40 +930,61 @@ public:
     virtual AP4_Result ProcessTrack();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                            AP4_DataBuffer& data_in,
+                                            AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { 
+        return m_CipherMode == AP4_OMA_DCF_ENCRYPTION_METHOD_AES_CTR; 
+    }
 
 private:
+    // methods
+    AP4_Result CreateCtrCipher(AP4_OmaDcfSampleEncrypter*& cipher);
+
     // members
-    AP4_OmaDcfSampleEncrypter* m_Cipher;
-    AP4_UI08                   m_CipherMode;
-    AP4_UI08                   m_CipherPadding;
-    AP4_SampleEntry*           m_SampleEntry;
-    AP4_UI32                   m_Format;
-    AP4_String                 m_ContentId;
-    AP4_String                 m_RightsIssuerUrl;
-    AP4_DataBuffer             m_TextualHeaders;
-    AP4_UI64                   m_Counter;
+    AP4_OmaDcfSampleEncrypter*                m_Cipher;
+    AP4_UI08                                  m_CipherMode;
+    AP4_UI08                                  m_CipherPadding;
+    AP4_DataBuffer                            m_Key;
+    AP4_BlockCipherFactory*                   m_BlockCipherFactory;
+    AP4_UI08                                  m_Salt[8];
+    AP4_ObjectPool<AP4_OmaDcfSampleEncrypter> m_SpareCiphers; // CTR only, one per thread
+    AP4_SampleEntry*                          m_SampleEntry;
+    AP4_UI32                                  m_Format;
+    AP4_String                                m_ContentId;
+    AP4_String                                m_RightsIssuerUrl;
+    AP4_DataBuffer                            m_TextualHeaders;
+    AP4_UI64                                  m_Counter;     // CBC only
+    AP4_Ordinal                               m_SampleIndex; // CTR only, for ProcessSample()
 };
 
 /*----------------------------------------------------------------------
 |   AP4_OmaDcfTrackEncrypter::AP4_OmaDcfTrackEncrypter
 +---------------------------------------------------------------------*/
 AP4_OmaDcfTrackEncrypter::AP4_OmaDcfTrackEncrypter(
-    AP4_OmaDcfCipherMode cipher_mode,
-    AP4_BlockCipher*     block_cipher,
-    const AP4_UI08*      salt,
-    AP4_SampleEntry*     sample_entry,
-    AP4_UI32             format,
-    const char*          content_id,
-    const char*          rights_issuer_url,
-    const AP4_Byte*      textual_headers, 
-    AP4_Size             textual_headers_size) :
+    AP4_OmaDcfCipherMode    cipher_mode,
+    AP4_BlockCipher*        block_cipher,
+    const AP4_DataBuffer&   key,
+    AP4_BlockCipherFactory* block_cipher_factory,
+    const AP4_UI08*         salt,
+    AP4_SampleEntry*        sample_entry,
+    AP4_UI32                format,
+    const char*             content_id,
+    const char*             rights_issuer_url,
+    const AP4_Byte*         textual_headers, 
+    AP4_Size                textual_headers_size) :
+    m_Key(key),
+    m_BlockCipherFactory(block_cipher_factory),
     m_SampleEntry(sample_entry),
     m_Format(format),
     m_ContentId(content_id),
     m_RightsIssuerUrl(rights_issuer_url),
     m_TextualHeaders(textual_headers, textual_headers_size),
-    m_Counter(0)
+    m_Counter(0),
+    m_SampleIndex(0)
 {
+    AP4_CopyMemory(m_Salt, salt, 8);
+
     // instantiate the cipher (fixed params for now)
     if (cipher_mode == AP4_OMA_DCF_CIPHER_MODE_CBC) {
         m_Cipher        = new AP4_OmaDcfCbcSampleEncrypter(block_cipher, salt);
@@ -991,6 +1066,10 @@ AP4_Result
 AP4_OmaDcfTrackEncrypter::ProcessSample(AP4_DataBuffer& data_in,
                                         AP4_DataBuffer& data_out)
 {
+    if (m_CipherMode == AP4_OMA_DCF_ENCRYPTION_METHOD_AES_CTR) {
+        return ProcessIndexedSample(m_SampleIndex++, data_in, data_out);
+    }
+    
     AP4_Result result = m_Cipher->EncryptSampleData(data_in, 
                                                     data_out, 
                                                     m_Counter, 
@@ -1001,6 +1080,60 @@ AP4_OmaDcfTrackEncrypter::ProcessSample(AP4_DataBuffer& data_in,
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_OmaDcfTrackEncrypter::CreateCtrCipher
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_OmaDcfTrackEncrypter::CreateCtrCipher(AP4_OmaDcfSampleEncrypter*& cipher)
+{
+    // create a cipher with the same parameters as the track cipher
+    AP4_BlockCipher* block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = 16;
+    AP4_Result result = m_BlockCipherFactory->CreateCipher(AP4_BlockCipher::AES_128, 
+                                                           AP4_BlockCipher::ENCRYPT, 
+                                                           AP4_BlockCipher::CTR,
+                                                           &ctr_params,
+                                                           m_Key.GetData(), 
+                                                           m_Key.GetDataSize(), 
+                                                           block_cipher);
+    if (AP4_FAILED(result)) return result;
+    cipher = new AP4_OmaDcfCtrSampleEncrypter(block_cipher, m_Salt);
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_OmaDcfTrackEncrypter::ProcessIndexedSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_OmaDcfTrackEncrypter::ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                               AP4_DataBuffer& data_in,
+                                               AP4_DataBuffer& data_out)
+{
+    // in CBC mode, the counter follows the size of the previous samples
+    if (m_CipherMode != AP4_OMA_DCF_ENCRYPTION_METHOD_AES_CTR) {
+        return ProcessSample(data_in, data_out);
+    }
+    
+    // get a cipher that no other thread is using
+    AP4_OmaDcfSampleEncrypter* cipher = m_SpareCiphers.Get();
+    if (cipher == NULL) {
+        AP4_Result result = CreateCtrCipher(cipher);
+        if (AP4_FAILED(result)) return result;
+    }
+
+    // start each sample at a counter derived from its index rather than 
+    // from the size of the samples before it, so that the samples can be
+    // encrypted in any order (a sample is less than 2^32 blocks long, so
+    // the counters of two samples never overlap)
+    AP4_Result result = cipher->EncryptSampleData(data_in, 
+                                                  data_out, 
+                                                  ((AP4_UI64)sample_index)<<32, 
+                                                  false);
+    m_SpareCiphers.Put(cipher);
+    return result;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_OmaDcfDecryptingProcessor:AP4_OmaDcfDecryptingProcessor
 +---------------------------------------------------------------------*/
@@ -1181,6 +1314,8 @@ AP4_OmaDcfEncryptingProcessor::CreateTrackHandler(AP4_TrakAtom* trak)
             if (AP4_FAILED(result)) return NULL;
             return new AP4_OmaDcfTrackEncrypter(m_CipherMode, 
                                                 block_cipher, 
+                                                *key,
+                                                m_BlockCipherFactory,
                                                 iv->GetData(), 
                                                 entry, 
                                                 format, 
@@ -40,6 +40,8 @@
 #include "Ap4Processor.h"
 #include "Ap4Protection.h"
 #include "Ap4DynamicCast.h"
+#include "Ap4DataBuffer.h"
+#include "Ap4Threads.h"
 
 /*----------------------------------------------------------------------
 |   class references
@@ -114,6 +116,10 @@ public:
         m_KeyIndicatorLength(0),
         m_SelectiveEncryption(selective_encryption) {}
 
+    // accessors
+    AP4_Size GetIvLength()            { return m_IvLength;            }
+    bool     GetSelectiveEncryption() { return m_SelectiveEncryption; }
+
 protected:
     AP4_Size m_IvLength;
     AP4_Size m_KeyIndicatorLength;
@@ -184,17 +190,29 @@ public:
     virtual AP4_Result ProcessTrack();
     virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                      AP4_DataBuffer& data_out);
+    virtual bool       IsStatelessPerSample() { return m_IsCtr; }
 
 private:
     // constructor
     AP4_OmaDcfTrackDecrypter(AP4_OmaDcfSampleDecrypter* cipher,
+                             bool                       is_ctr,
+                             const AP4_UI08*            key,
+                             AP4_Size                   key_size,
+                             AP4_BlockCipherFactory*    block_cipher_factory,
                              AP4_SampleEntry*           sample_entry,
                              AP4_UI32                   original_format);
 
+    // methods
+    AP4_Result CreateCtrCipher(AP4_OmaDcfSampleDecrypter*& cipher);
+
     // members
-    AP4_OmaDcfSampleDecrypter* m_Cipher;
-    AP4_SampleEntry*           m_SampleEntry;
-    AP4_UI32                   m_OriginalFormat;
+    AP4_OmaDcfSampleDecrypter*                m_Cipher;
+    bool                                      m_IsCtr;
+    AP4_DataBuffer                            m_Key;
+    AP4_BlockCipherFactory*                   m_BlockCipherFactory;
+    AP4_ObjectPool<AP4_OmaDcfSampleDecrypter> m_SpareCiphers; // CTR only, one per thread
+    AP4_SampleEntry*                          m_SampleEntry;
+    AP4_UI32                                  m_OriginalFormat;
 };
 
 /*----------------------------------------------------------------------
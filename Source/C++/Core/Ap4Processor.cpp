@@ -44,98 +44,1583 @@
 #include "Ap4TrexAtom.h"
 #include "Ap4DataBuffer.h"
 #include "Ap4Debug.h"
+#include "Ap4Threads.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size     AP4_PROCESSOR_MAX_READ_SIZE          = 1024*1024; // max bytes read at once
+const AP4_Cardinal AP4_PROCESSOR_PIPELINE_SLOTS_PER_THREAD = 4;       // samples in flight per worker
+const AP4_Cardinal AP4_PROCESSOR_PIPELINE_FRAGMENTS_PER_THREAD = 2;   // fragments in flight per worker
 
 /*----------------------------------------------------------------------
 |   types
 +---------------------------------------------------------------------*/
-struct AP4_SampleLocator {
-    AP4_SampleLocator() : 
-        m_TrakIndex(0), 
-        m_SampleTable(NULL), 
-        m_SampleIndex(0), 
-        m_ChunkIndex(0) {}
-    AP4_Ordinal          m_TrakIndex;
-    AP4_AtomSampleTable* m_SampleTable;
-    AP4_Ordinal          m_SampleIndex;
-    AP4_Ordinal          m_ChunkIndex;
-    AP4_Sample           m_Sample;
-};
+/**
+ * One entry of the output layout of a non-fragmented file. There is one 
+ * for every sample of every track, so it only holds what is needed to
+ * update the sample tables and copy the sample data; the rest of the
+ * sample information stays in the sample tables.
+ */
+struct AP4_SampleLocator {
+    AP4_UI64 m_Offset;        // offset of the sample data in the input
+    AP4_UI32 m_Size;          // size of the sample data in the input
+    AP4_UI32 m_ProcessedSize; // size of the sample data in the output
+    AP4_UI32 m_SampleIndex;
+    AP4_UI16 m_TrakIndex;
+    AP4_UI16 m_Flags;
+};
+
+const AP4_UI16 AP4_SAMPLE_LOCATOR_FLAG_NEW_CHUNK = 0x01; // first sample of an output chunk
+
+struct AP4_SampleCursor {
+    AP4_SampleCursor() : 
+        m_TrakIndex(0), 
+        m_SampleTable(NULL),
+        m_DataStream(NULL),
+        m_SampleIndex(0), 
+        m_ChunkIndex(0) {}
+    AP4_Ordinal          m_TrakIndex;
+    AP4_AtomSampleTable* m_SampleTable;
+    AP4_ByteStream*      m_DataStream;
+    AP4_Ordinal          m_SampleIndex;
+    AP4_Ordinal          m_ChunkIndex;
+    AP4_Sample           m_Sample;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SampleCursorHeap
++---------------------------------------------------------------------*/
+/**
+ * Min-heap of the cursors that have samples left, ordered by the offset of
+ * their current sample. When two samples have the same offset, the one of
+ * the track with the highest index comes first.
+ */
+class AP4_SampleCursorHeap {
+public:
+    AP4_SampleCursorHeap(AP4_SampleCursor* cursors, AP4_Cardinal max_count) :
+        m_Cursors(cursors), m_Heap(new AP4_Ordinal[max_count]), m_Count(0) {}
+   ~AP4_SampleCursorHeap() { delete[] m_Heap; }
+
+    AP4_Cardinal      GetCount() { return m_Count; }
+    AP4_SampleCursor& GetTop()   { return m_Cursors[m_Heap[0]]; }
+    void              Push(AP4_Ordinal cursor);
+    void              UpdateTop() { SiftDown(0); }
+    void              PopTop();
+
+private:
+    bool Before(AP4_Ordinal a, AP4_Ordinal b) {
+        AP4_Position offset_a = m_Cursors[a].m_Sample.GetOffset();
+        AP4_Position offset_b = m_Cursors[b].m_Sample.GetOffset();
+        return offset_a < offset_b || (offset_a == offset_b && a > b);
+    }
+    void SiftDown(AP4_Ordinal position);
+
+    AP4_SampleCursor* m_Cursors;
+    AP4_Ordinal*      m_Heap;
+    AP4_Cardinal      m_Count;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SampleCursorHeap::Push
++---------------------------------------------------------------------*/
+void
+AP4_SampleCursorHeap::Push(AP4_Ordinal cursor)
+{
+    AP4_Ordinal position = m_Count++;
+    while (position) {
+        AP4_Ordinal parent = (position-1)/2;
+        if (!Before(cursor, m_Heap[parent])) break;
+        m_Heap[position] = m_Heap[parent];
+        position = parent;
+    }
+    m_Heap[position] = cursor;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleCursorHeap::PopTop
++---------------------------------------------------------------------*/
+void
+AP4_SampleCursorHeap::PopTop()
+{
+    if (--m_Count) {
+        m_Heap[0] = m_Heap[m_Count];
+        SiftDown(0);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleCursorHeap::SiftDown
++---------------------------------------------------------------------*/
+void
+AP4_SampleCursorHeap::SiftDown(AP4_Ordinal position)
+{
+    AP4_Ordinal cursor = m_Heap[position];
+    for (;;) {
+        AP4_Ordinal child = 2*position+1;
+        if (child >= m_Count) break;
+        if (child+1 < m_Count && Before(m_Heap[child+1], m_Heap[child])) ++child;
+        if (!Before(m_Heap[child], cursor)) break;
+        m_Heap[position] = m_Heap[child];
+        position = child;
+    }
+    m_Heap[position] = cursor;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadSampleData
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_ReadSampleData(AP4_ByteStream& stream, 
+                   AP4_Position    offset, 
+                   AP4_Size        size, 
+                   AP4_DataBuffer& data)
+{
+    // try to borrow the data from the stream
+    const AP4_UI08* view = NULL;
+    if (size && AP4_SUCCEEDED(stream.BorrowData(offset, size, view))) {
+        return data.SetDataView(view, size);
+    }
+    
+    // fall back to a copy
+    data.SetDataSize(0);
+    if (size == 0) return AP4_SUCCESS;
+    AP4_Result result = data.SetDataSize(size);
+    if (AP4_FAILED(result)) return result;
+    result = stream.Seek(offset);
+    if (AP4_FAILED(result)) return result;
+    return stream.Read(data.UseData(), size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DefaultFragmentHandler
++---------------------------------------------------------------------*/
+class AP4_DefaultFragmentHandler: public AP4_Processor::FragmentHandler {
+public:
+    AP4_DefaultFragmentHandler(AP4_Processor::TrackHandler* track_handler,
+                               AP4_UI32&                    track_sample_count) :
+        m_TrackHandler(track_handler),
+        m_TrackSampleCount(track_sample_count),
+        m_FirstSampleIndex(0) {}
+    AP4_Result PrepareForSamples(AP4_FragmentSampleTable* sample_table);
+    AP4_Result ProcessSample(AP4_DataBuffer& data_in,
+                             AP4_DataBuffer& data_out);
+    AP4_Result ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                    AP4_DataBuffer& data_in,
+                                    AP4_DataBuffer& data_out);
+    bool       IsStatelessPerSample() {
+        return m_TrackHandler == NULL || m_TrackHandler->IsStatelessPerSample();
+    }
+                             
+private:
+    AP4_Processor::TrackHandler* m_TrackHandler;
+    AP4_UI32&                    m_TrackSampleCount;
+    AP4_UI32                     m_FirstSampleIndex;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_DefaultFragmentHandler::PrepareForSamples
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_DefaultFragmentHandler::PrepareForSamples(AP4_FragmentSampleTable* sample_table)
+{
+    // number the samples of this fragment after those of the track and 
+    // of the previous fragments (this is called for one fragment after 
+    // the other, in order)
+    m_FirstSampleIndex  = m_TrackSampleCount;
+    m_TrackSampleCount += sample_table->GetSampleCount();
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DefaultFragmentHandler::ProcessSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_DefaultFragmentHandler::ProcessSample(AP4_DataBuffer& data_in, AP4_DataBuffer& data_out)
+{
+    if (m_TrackHandler == NULL) return AP4_SUCCESS;
+    return m_TrackHandler->ProcessSample(data_in, data_out);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_DefaultFragmentHandler::ProcessIndexedSample
++---------------------------------------------------------------------*/
+AP4_Result 
+AP4_DefaultFragmentHandler::ProcessIndexedSample(AP4_Ordinal     sample_index,
+                                                 AP4_DataBuffer& data_in, 
+                                                 AP4_DataBuffer& data_out)
+{
+    if (m_TrackHandler == NULL) return AP4_SUCCESS;
+    return m_TrackHandler->ProcessIndexedSample(m_FirstSampleIndex+sample_index, data_in, data_out);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SampleStage
++---------------------------------------------------------------------*/
+/**
+ * Reads, processes and writes a sequence of samples.
+ * ReadSample() and WriteSample() are called in sample order, 
+ * ProcessSample() is called in sample order for samples read in 
+ * PROCESS_IN_ORDER mode, and in any order, possibly concurrently,
+ * for samples read in PROCESS_IN_PARALLEL mode.
+ */
+class AP4_SampleStage {
+public:
+    typedef enum {
+        PROCESS_NONE,        // the input data is written as is
+        PROCESS_IN_ORDER,
+        PROCESS_IN_PARALLEL
+    } Mode;
+
+    virtual ~AP4_SampleStage() {}
+    virtual AP4_Result ReadSample(AP4_Ordinal     index,
+                                  AP4_DataBuffer& data,
+                                  Mode&           mode) = 0;
+    virtual AP4_Result ProcessSample(AP4_Ordinal     index,
+                                     AP4_DataBuffer& data_in,
+                                     AP4_DataBuffer& data_out) = 0;
+    virtual AP4_Result WriteSample(AP4_Ordinal     index,
+                                   AP4_DataBuffer& data) = 0;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline
++---------------------------------------------------------------------*/
+/**
+ * Runs an AP4_SampleStage with one reader thread, a pool of worker 
+ * threads that process the samples read in PROCESS_IN_PARALLEL mode, and
+ * the calling thread writing the samples in order. At most a fixed number
+ * of samples are in flight at any time.
+ */
+class AP4_SamplePipeline {
+public:
+    // constructor and destructor
+    AP4_SamplePipeline(AP4_Cardinal worker_count);
+   ~AP4_SamplePipeline();
+
+    // methods
+    AP4_Result Start();
+    AP4_Result Run(AP4_SampleStage& stage, AP4_Cardinal sample_count);
+
+private:
+    // types
+    class Thread : public AP4_Thread {
+    public:
+        Thread(AP4_SamplePipeline& pipeline, bool reader) : 
+            m_Pipeline(pipeline), m_Reader(reader) {}
+    protected:
+        void Run() { 
+            if (m_Reader) {
+                m_Pipeline.RunReader();
+            } else {
+                m_Pipeline.RunWorker();
+            }
+        }
+    private:
+        AP4_SamplePipeline& m_Pipeline;
+        bool                m_Reader;
+    };
+    typedef enum {
+        SLOT_FREE,
+        SLOT_READ,
+        SLOT_PROCESSING,
+        SLOT_DONE
+    } SlotState;
+    struct Slot {
+        Slot() : m_State(SLOT_FREE), m_Mode(AP4_SampleStage::PROCESS_NONE), m_Result(AP4_SUCCESS) {}
+        SlotState             m_State;
+        AP4_SampleStage::Mode m_Mode;
+        AP4_Result            m_Result;
+        AP4_DataBuffer        m_DataIn;
+        AP4_DataBuffer        m_DataOut;
+    };
+
+    // methods
+    void RunReader();
+    void RunWorker();
+
+    // members
+    AP4_Cardinal     m_WorkerCount;
+    Thread*          m_Reader;
+    Thread**         m_Workers;
+    AP4_Cardinal     m_StartedWorkerCount;
+    Slot*            m_Slots;
+    AP4_Cardinal     m_SlotCount;
+    AP4_SampleStage* m_Stage;
+    AP4_Cardinal     m_SampleCount;
+    AP4_Ordinal      m_ReadIndex;    // next sample to read
+    AP4_Ordinal      m_ProcessIndex; // next sample to look at for processing
+    AP4_Ordinal      m_WriteIndex;   // next sample to write
+    AP4_Cardinal     m_BusyCount;    // reader and workers inside the stage
+    bool             m_Running;
+    bool             m_Terminating;
+    AP4_Mutex        m_Lock;
+    AP4_Condition    m_CanRead;
+    AP4_Condition    m_CanProcess;
+    AP4_Condition    m_CanWrite;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::AP4_SamplePipeline
++---------------------------------------------------------------------*/
+AP4_SamplePipeline::AP4_SamplePipeline(AP4_Cardinal worker_count) :
+    m_WorkerCount(worker_count),
+    m_Reader(NULL),
+    m_Workers(NULL),
+    m_StartedWorkerCount(0),
+    m_Slots(NULL),
+    m_SlotCount(0),
+    m_Stage(NULL),
+    m_SampleCount(0),
+    m_ReadIndex(0),
+    m_ProcessIndex(0),
+    m_WriteIndex(0),
+    m_BusyCount(0),
+    m_Running(false),
+    m_Terminating(false)
+{
+    if (m_WorkerCount == 0) m_WorkerCount = 1;
+    m_SlotCount = m_WorkerCount*AP4_PROCESSOR_PIPELINE_SLOTS_PER_THREAD;
+    m_Slots     = new Slot[m_SlotCount];
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::~AP4_SamplePipeline
++---------------------------------------------------------------------*/
+AP4_SamplePipeline::~AP4_SamplePipeline()
+{
+    // tell the threads to exit
+    m_Lock.Lock();
+    m_Terminating = true;
+    m_CanRead.Broadcast();
+    m_CanProcess.Broadcast();
+    m_Lock.Unlock();
+
+    // wait for them
+    if (m_Reader) {
+        m_Reader->Wait();
+        delete m_Reader;
+    }
+    for (unsigned int i=0; i<m_StartedWorkerCount; i++) {
+        m_Workers[i]->Wait();
+        delete m_Workers[i];
+    }
+    delete[] m_Workers;
+    delete[] m_Slots;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::Start
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SamplePipeline::Start()
+{
+    // start the reader
+    m_Reader = new Thread(*this, true);
+    AP4_Result result = m_Reader->Start();
+    if (AP4_FAILED(result)) {
+        delete m_Reader;
+        m_Reader = NULL;
+        return result;
+    }
+    
+    // start the workers
+    m_Workers = new Thread*[m_WorkerCount];
+    for (unsigned int i=0; i<m_WorkerCount; i++) {
+        Thread* worker = new Thread(*this, false);
+        result = worker->Start();
+        if (AP4_FAILED(result)) {
+            delete worker;
+            break;
+        }
+        m_Workers[m_StartedWorkerCount++] = worker;
+    }
+    
+    return m_StartedWorkerCount?AP4_SUCCESS:result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::RunReader
++---------------------------------------------------------------------*/
+void
+AP4_SamplePipeline::RunReader()
+{
+    m_Lock.Lock();
+    for (;;) {
+        // wait until there is a sample to read and a free slot to read it in
+        while (!m_Terminating && 
+               !(m_Running                       && 
+                 m_ReadIndex < m_SampleCount     && 
+                 m_ReadIndex-m_WriteIndex < m_SlotCount)) {
+            m_CanRead.Wait(m_Lock);
+        }
+        if (m_Terminating) break;
+        
+        // read the sample
+        AP4_Ordinal index = m_ReadIndex;
+        Slot&       slot  = m_Slots[index%m_SlotCount];
+        ++m_BusyCount;
+        m_Lock.Unlock();
+        slot.m_Mode   = AP4_SampleStage::PROCESS_NONE;
+        slot.m_Result = m_Stage->ReadSample(index, slot.m_DataIn, slot.m_Mode);
+        m_Lock.Lock();
+        --m_BusyCount;
+        
+        // hand it over to the workers, or directly to the writer
+        ++m_ReadIndex;
+        if (AP4_SUCCEEDED(slot.m_Result) && 
+            slot.m_Mode == AP4_SampleStage::PROCESS_IN_PARALLEL) {
+            slot.m_State = SLOT_READ;
+            m_CanProcess.Signal();
+        } else {
+            slot.m_State = SLOT_DONE;
+        }
+        if (index == m_WriteIndex || !m_Running) m_CanWrite.Signal();
+    }
+    m_Lock.Unlock();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::RunWorker
++---------------------------------------------------------------------*/
+void
+AP4_SamplePipeline::RunWorker()
+{
+    m_Lock.Lock();
+    for (;;) {
+        // find the next sample that needs processing
+        if (m_ProcessIndex < m_WriteIndex) m_ProcessIndex = m_WriteIndex;
+        while (m_ProcessIndex < m_ReadIndex &&
+               m_Slots[m_ProcessIndex%m_SlotCount].m_State != SLOT_READ) {
+            ++m_ProcessIndex;
+        }
+        if (m_Terminating) break;
+        if (!m_Running || m_ProcessIndex == m_ReadIndex) {
+            m_CanProcess.Wait(m_Lock);
+            continue;
+        }
+        
+        // process it
+        AP4_Ordinal index = m_ProcessIndex++;
+        Slot&       slot  = m_Slots[index%m_SlotCount];
+        slot.m_State = SLOT_PROCESSING;
+        ++m_BusyCount;
+        m_Lock.Unlock();
+        slot.m_Result = m_Stage->ProcessSample(index, slot.m_DataIn, slot.m_DataOut);
+        m_Lock.Lock();
+        --m_BusyCount;
+        slot.m_State = SLOT_DONE;
+        if (index == m_WriteIndex || !m_Running) m_CanWrite.Signal();
+    }
+    m_Lock.Unlock();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SamplePipeline::Run
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SamplePipeline::Run(AP4_SampleStage& stage, AP4_Cardinal sample_count)
+{
+    AP4_Result result = AP4_SUCCESS;
+    
+    // start the reader
+    m_Lock.Lock();
+    m_Stage        = &stage;
+    m_SampleCount  = sample_count;
+    m_ReadIndex    = 0;
+    m_ProcessIndex = 0;
+    m_WriteIndex   = 0;
+    m_Running      = true;
+    m_CanRead.Signal();
+    
+    // write the samples in order as they become ready
+    while (m_WriteIndex < sample_count) {
+        Slot& slot = m_Slots[m_WriteIndex%m_SlotCount];
+        while (m_WriteIndex == m_ReadIndex || slot.m_State != SLOT_DONE) {
+            m_CanWrite.Wait(m_Lock);
+        }
+        m_Lock.Unlock();
+        result = slot.m_Result;
+        if (AP4_SUCCEEDED(result)) {
+            if (slot.m_Mode == AP4_SampleStage::PROCESS_NONE) {
+                result = stage.WriteSample(m_WriteIndex, slot.m_DataIn);
+            } else {
+                if (slot.m_Mode == AP4_SampleStage::PROCESS_IN_ORDER) {
+                    result = stage.ProcessSample(m_WriteIndex, slot.m_DataIn, slot.m_DataOut);
+                }
+                if (AP4_SUCCEEDED(result)) {
+                    result = stage.WriteSample(m_WriteIndex, slot.m_DataOut);
+                }
+            }
+        }
+        m_Lock.Lock();
+        slot.m_State = SLOT_FREE;
+        ++m_WriteIndex;
+        m_CanRead.Signal();
+        if (AP4_FAILED(result)) break;
+    }
+    
+    // wait for the reader and the workers to leave the stage
+    m_Running = false;
+    while (m_BusyCount) {
+        m_CanWrite.Wait(m_Lock);
+    }
+    for (unsigned int i=0; i<m_SlotCount; i++) {
+        m_Slots[i].m_State = SLOT_FREE;
+    }
+    m_Stage = NULL;
+    m_Lock.Unlock();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ProcessSamples
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_ProcessSamples(AP4_SampleStage&    stage, 
+                   AP4_Cardinal        sample_count, 
+                   AP4_SamplePipeline* pipeline)
+{
+    if (pipeline) return pipeline->Run(stage, sample_count);
+    
+    AP4_DataBuffer data_in;
+    AP4_DataBuffer data_out;
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_SampleStage::Mode mode = AP4_SampleStage::PROCESS_NONE;
+        AP4_Result result = stage.ReadSample(i, data_in, mode);
+        if (AP4_FAILED(result)) return result;
+        if (mode == AP4_SampleStage::PROCESS_NONE) {
+            result = stage.WriteSample(i, data_in);
+        } else {
+            result = stage.ProcessSample(i, data_in, data_out);
+            if (AP4_FAILED(result)) return result;
+            result = stage.WriteSample(i, data_out);
+        }
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FlatSampleStage
++---------------------------------------------------------------------*/
+class AP4_FlatSampleStage : public AP4_SampleStage {
+public:
+    AP4_FlatSampleStage(AP4_Array<AP4_SampleLocator>&            locators,
+                        AP4_SampleCursor*                        cursors,
+                        AP4_Array<AP4_Processor::TrackHandler*>& handlers,
+                        AP4_ByteStream&                          output,
+                        AP4_Processor::ProgressListener*         listener) :
+        m_Locators(locators),
+        m_Cursors(cursors),
+        m_Handlers(handlers),
+        m_Output(output),
+        m_Listener(listener) {}
+        
+    // AP4_SampleStage methods
+    AP4_Result ReadSample(AP4_Ordinal index, AP4_DataBuffer& data, Mode& mode);
+    AP4_Result ProcessSample(AP4_Ordinal     index,
+                             AP4_DataBuffer& data_in,
+                             AP4_DataBuffer& data_out) {
+        const AP4_SampleLocator& locator = m_Locators[index];
+        return m_Handlers[locator.m_TrakIndex]->ProcessIndexedSample(locator.m_SampleIndex, data_in, data_out);
+    }
+    AP4_Result WriteSample(AP4_Ordinal index, AP4_DataBuffer& data);
+    
+private:
+    AP4_Array<AP4_SampleLocator>&            m_Locators;
+    AP4_SampleCursor*                        m_Cursors;
+    AP4_Array<AP4_Processor::TrackHandler*>& m_Handlers;
+    AP4_ByteStream&                          m_Output;
+    AP4_Processor::ProgressListener*         m_Listener;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_FlatSampleStage::ReadSample
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FlatSampleStage::ReadSample(AP4_Ordinal index, AP4_DataBuffer& data, Mode& mode)
+{
+    AP4_SampleLocator&           locator = m_Locators[index];
+    AP4_Processor::TrackHandler* handler = m_Handlers[locator.m_TrakIndex];
+    if (handler) {
+        mode = handler->IsStatelessPerSample()?PROCESS_IN_PARALLEL:PROCESS_IN_ORDER;
+    } else {
+        mode = PROCESS_NONE;
+    }
+    data.SetDataSize(0);
+    return AP4_ReadSampleData(*m_Cursors[locator.m_TrakIndex].m_DataStream, 
+                              locator.m_Offset, 
+                              locator.m_Size, 
+                              data);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FlatSampleStage::WriteSample
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FlatSampleStage::WriteSample(AP4_Ordinal index, AP4_DataBuffer& data)
+{
+    AP4_Result result = m_Output.Write(data.GetData(), data.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+    
+    // notify the progress listener
+    if (m_Listener) {
+        m_Listener->OnProgress(index+1, m_Locators.ItemCount());
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentSampleStage
++---------------------------------------------------------------------*/
+class AP4_FragmentSampleStage : public AP4_SampleStage {
+public:
+    AP4_FragmentSampleStage(AP4_FragmentSampleTable*        sample_table,
+                            AP4_Processor::FragmentHandler* handler,
+                            AP4_Array<AP4_TrunAtom*>&       truns,
+                            AP4_ByteStream&                 output,
+                            AP4_Position                    mdat_out_start,
+                            AP4_UI64                        base_data_offset,
+                            AP4_UI64&                       mdat_size);
+                            
+    // AP4_SampleStage methods
+    AP4_Result ReadSample(AP4_Ordinal index, AP4_DataBuffer& data, Mode& mode);
+    AP4_Result ProcessSample(AP4_Ordinal     index,
+                             AP4_DataBuffer& data_in,
+                             AP4_DataBuffer& data_out) {
+        return m_Handler->ProcessIndexedSample(index, data_in, data_out);
+    }
+    AP4_Result WriteSample(AP4_Ordinal index, AP4_DataBuffer& data);
+
+    // accessors
+    AP4_TrunAtom* GetTrun() { return m_Trun; }
+    
+private:
+    AP4_FragmentSampleTable*        m_SampleTable;
+    AP4_Processor::FragmentHandler* m_Handler;
+    Mode                            m_Mode;
+    AP4_Sample                      m_Sample;
+    AP4_Array<AP4_TrunAtom*>&       m_Truns;
+    AP4_TrunAtom*                   m_Trun;
+    AP4_Ordinal                     m_TrunIndex;
+    AP4_Ordinal                     m_TrunSampleIndex;
+    AP4_ByteStream&                 m_Output;
+    AP4_Position                    m_MdatOutStart;
+    AP4_UI64                        m_BaseDataOffset;
+    AP4_UI64&                       m_MdatSize;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentSampleStage::AP4_FragmentSampleStage
++---------------------------------------------------------------------*/
+AP4_FragmentSampleStage::AP4_FragmentSampleStage(AP4_FragmentSampleTable*        sample_table,
+                                                 AP4_Processor::FragmentHandler* handler,
+                                                 AP4_Array<AP4_TrunAtom*>&       truns,
+                                                 AP4_ByteStream&                 output,
+                                                 AP4_Position                    mdat_out_start,
+                                                 AP4_UI64                        base_data_offset,
+                                                 AP4_UI64&                       mdat_size) :
+    m_SampleTable(sample_table),
+    m_Handler(handler),
+    m_Mode(PROCESS_NONE),
+    m_Truns(truns),
+    m_Trun(truns[0]),
+    m_TrunIndex(0),
+    m_TrunSampleIndex(0),
+    m_Output(output),
+    m_MdatOutStart(mdat_out_start),
+    m_BaseDataOffset(base_data_offset),
+    m_MdatSize(mdat_size)
+{
+    if (handler) {
+        m_Mode = handler->IsStatelessPerSample()?PROCESS_IN_PARALLEL:PROCESS_IN_ORDER;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentSampleStage::ReadSample
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FragmentSampleStage::ReadSample(AP4_Ordinal index, AP4_DataBuffer& data, Mode& mode)
+{
+    mode = m_Mode;
+
+    // use the data that the handler has already read, if any
+    if (m_Handler && AP4_SUCCEEDED(m_Handler->GetSampleData(index, data))) {
+        return AP4_SUCCESS;
+    }
+    
+    AP4_Result result = m_SampleTable->GetSample(index, m_Sample);
+    if (AP4_FAILED(result)) return result;
+    
+    return m_Sample.ReadDataView(data);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentSampleStage::WriteSample
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FragmentSampleStage::WriteSample(AP4_Ordinal /* index */, AP4_DataBuffer& data)
+{
+    // advance the trun index if necessary
+    if (m_TrunSampleIndex >= m_Trun->GetEntries().ItemCount()) {
+        m_Trun = m_Truns[++m_TrunIndex];
+        m_Trun->SetDataOffset((AP4_SI32)((m_MdatOutStart+m_MdatSize)-m_BaseDataOffset));
+        m_TrunSampleIndex = 0;
+    }
+    
+    // write the sample data
+    AP4_Result result = m_Output.Write(data.GetData(), data.GetDataSize());
+    if (AP4_FAILED(result)) return result;
+
+    // update the mdat size
+    m_MdatSize += data.GetDataSize();
+    
+    // update the trun entry
+    if (m_Handler) {
+        m_Trun->UseEntries()[m_TrunSampleIndex].sample_size = data.GetDataSize();
+    }
+    ++m_TrunSampleIndex;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomDataStream
++---------------------------------------------------------------------*/
+/**
+ * Read-only stream over a copy of a range of bytes of an input stream, 
+ * addressed with the same positions as in the input stream. Reads outside
+ * of the range are forwarded to the input stream, which only works if 
+ * the input stream is seekable.
+ */
+class AP4_AtomDataStream : public AP4_ByteStream {
+public:
+    // constructor
+    AP4_AtomDataStream(AP4_ByteStream& source, AP4_Position origin);
+    
+    // methods
+    AP4_DataBuffer& GetBuffer() { return m_Buffer; }
+    
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer, 
+                           AP4_Size  bytes_to_read, 
+                           AP4_Size& bytes_read);
+    AP4_Result WritePartial(const void* /* buffer         */, 
+                            AP4_Size    /* bytes_to_write */, 
+                            AP4_Size&   bytes_written) {
+        bytes_written = 0;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position) {
+        position = m_Position;
+        return AP4_SUCCESS;
+    }
+    AP4_Result GetSize(AP4_LargeSize& size) {
+        size = m_Origin+m_Buffer.GetDataSize();
+        return AP4_SUCCESS;
+    }
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data);
+
+    // AP4_Referenceable methods
+    void AddReference() { ++m_ReferenceCount; }
+    void Release()      { if (--m_ReferenceCount == 0) delete this; }
+
+private:
+    // methods
+    ~AP4_AtomDataStream() { m_Source.Release(); }
+    bool IsInRange(AP4_Position position) {
+        return position >= m_Origin && position-m_Origin <= m_Buffer.GetDataSize();
+    }
+    
+    // members
+    AP4_ByteStream& m_Source;
+    AP4_Position    m_Origin;
+    AP4_DataBuffer  m_Buffer;
+    AP4_Position    m_Position;
+    AP4_Cardinal    m_ReferenceCount;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_AtomDataStream::AP4_AtomDataStream
++---------------------------------------------------------------------*/
+AP4_AtomDataStream::AP4_AtomDataStream(AP4_ByteStream& source, AP4_Position origin) :
+    m_Source(source),
+    m_Origin(origin),
+    m_Position(origin),
+    m_ReferenceCount(1)
+{
+    m_Source.AddReference();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomDataStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomDataStream::ReadPartial(void*     buffer, 
+                                AP4_Size  bytes_to_read, 
+                                AP4_Size& bytes_read)
+{
+    bytes_read = 0;
+    if (!IsInRange(m_Position)) {
+        AP4_Result result = m_Source.Seek(m_Position);
+        if (AP4_FAILED(result)) return result;
+        result = m_Source.ReadPartial(buffer, bytes_to_read, bytes_read);
+        m_Position += bytes_read;
+        return result;
+    }
+    
+    AP4_Size available = (AP4_Size)(m_Origin+m_Buffer.GetDataSize()-m_Position);
+    if (available == 0) return AP4_ERROR_EOS;
+    if (bytes_to_read > available) bytes_to_read = available;
+    AP4_CopyMemory(buffer, m_Buffer.GetData()+(m_Position-m_Origin), bytes_to_read);
+    m_Position += bytes_to_read;
+    bytes_read = bytes_to_read;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomDataStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomDataStream::Seek(AP4_Position position)
+{
+    if (!IsInRange(position)) {
+        // check that we will be able to read from there
+        AP4_Result result = m_Source.Seek(position);
+        if (AP4_FAILED(result)) return result;
+    }
+    m_Position = position;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AtomDataStream::BorrowData
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_AtomDataStream::BorrowData(AP4_Position     position,
+                               AP4_Size         size,
+                               const AP4_UI08*& data)
+{
+    if (!IsInRange(position) || size > m_Origin+m_Buffer.GetDataSize()-position) {
+        return m_Source.BorrowData(position, size, data);
+    }
+    data = m_Buffer.GetData()+(position-m_Origin);
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader
++---------------------------------------------------------------------*/
+/**
+ * Reads the top-level atoms of a stream one at a time, using only 
+ * sequential reads, so that the stream does not need to be seekable.
+ * Each atom is parsed from an in-memory copy of its bytes. The 'mdat' 
+ * atom that immediately follows a 'moof' atom is copied along with it, 
+ * so that the samples of the fragment can be read from the same copy, 
+ * and other 'mdat' atoms are skipped. An 'mfra' atom may be kept aside
+ * instead of being returned.
+ */
+class AP4_TopLevelAtomReader {
+public:
+    // constructor and destructor
+    AP4_TopLevelAtomReader(AP4_ByteStream&  stream, 
+                           AP4_AtomFactory& atom_factory, 
+                           bool             keep_mfra);
+   ~AP4_TopLevelAtomReader();
+   
+    // methods
+    AP4_Result ReadAtom(AP4_Atom*&       atom, 
+                        AP4_Position&    offset, 
+                        AP4_ByteStream*& data);
+    void               PushBack(AP4_Atom* atom, AP4_Position offset, AP4_ByteStream* data);
+    AP4_ContainerAtom* GetMfra() { return m_Mfra; }
+
+private:
+    // methods
+    AP4_Result ReadHeader();
+    AP4_Result ReadPayload(AP4_DataBuffer& buffer);
+    AP4_Result SkipPayload();
+
+    // members
+    AP4_ByteStream&    m_Stream;
+    AP4_AtomFactory&   m_AtomFactory;
+    bool               m_KeepMfra;
+    AP4_ContainerAtom* m_Mfra;
+    AP4_Position       m_Position;          // position of the next unread byte
+    bool               m_HeaderIsValid;     // a header has been read but not its payload
+    AP4_UI08           m_Header[16];
+    AP4_Size           m_HeaderSize;
+    AP4_UI32           m_Type;
+    AP4_UI64           m_Size;              // 0 if the atom extends to the end of the stream
+    AP4_Atom*          m_PushedBackAtom;
+    AP4_Position       m_PushedBackOffset;
+    AP4_ByteStream*    m_PushedBackData;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::AP4_TopLevelAtomReader
++---------------------------------------------------------------------*/
+AP4_TopLevelAtomReader::AP4_TopLevelAtomReader(AP4_ByteStream&  stream, 
+                                               AP4_AtomFactory& atom_factory, 
+                                               bool             keep_mfra) :
+    m_Stream(stream),
+    m_AtomFactory(atom_factory),
+    m_KeepMfra(keep_mfra),
+    m_Mfra(NULL),
+    m_Position(0),
+    m_HeaderIsValid(false),
+    m_HeaderSize(0),
+    m_Type(0),
+    m_Size(0),
+    m_PushedBackAtom(NULL),
+    m_PushedBackOffset(0),
+    m_PushedBackData(NULL)
+{
+    m_Stream.Tell(m_Position);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::~AP4_TopLevelAtomReader
++---------------------------------------------------------------------*/
+AP4_TopLevelAtomReader::~AP4_TopLevelAtomReader()
+{
+    delete m_PushedBackAtom;
+    if (m_PushedBackData) m_PushedBackData->Release();
+    delete m_Mfra;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::ReadHeader
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_TopLevelAtomReader::ReadHeader()
+{
+    if (m_HeaderIsValid) return AP4_SUCCESS;
+    
+    // the stream may have been used by someone else since the last read
+    AP4_Result result = m_Stream.Seek(m_Position);
+    if (AP4_FAILED(result)) return result;
+    
+    result = m_Stream.Read(m_Header, AP4_ATOM_HEADER_SIZE);
+    if (AP4_FAILED(result)) return result;
+    m_HeaderSize = AP4_ATOM_HEADER_SIZE;
+    m_Size = AP4_BytesToUInt32BE(m_Header);
+    m_Type = AP4_BytesToUInt32BE(m_Header+4);
+    if (m_Size == 1) {
+        result = m_Stream.Read(m_Header+AP4_ATOM_HEADER_SIZE, 8);
+        if (AP4_FAILED(result)) return result;
+        m_HeaderSize += 8;
+        m_Size = AP4_BytesToUInt64BE(m_Header+AP4_ATOM_HEADER_SIZE);
+    }
+    if (m_Size && m_Size < m_HeaderSize) return AP4_ERROR_INVALID_FORMAT;
+    m_HeaderIsValid = true;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::ReadPayload
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_TopLevelAtomReader::ReadPayload(AP4_DataBuffer& buffer)
+{
+    // append the header and the payload to the buffer
+    AP4_Size start = buffer.GetDataSize();
+    AP4_UI64 size  = m_Size?m_Size:m_HeaderSize;
+    if (size > (AP4_Size)(-1)-start) return AP4_ERROR_OUT_OF_RANGE;
+    AP4_Result result = buffer.Reserve((AP4_Size)(start+size));
+    if (AP4_FAILED(result)) return result;
+    buffer.SetDataSize((AP4_Size)(start+size));
+    AP4_CopyMemory(buffer.UseData()+start, m_Header, m_HeaderSize);
+    m_HeaderIsValid = false;
+    if (m_Size) {
+        result = m_Stream.Read(buffer.UseData()+start+m_HeaderSize, (AP4_Size)m_Size-m_HeaderSize);
+        if (AP4_FAILED(result)) return result;
+    } else {
+        // read until the end of the stream
+        for (;;) {
+            AP4_Size data_size = buffer.GetDataSize();
+            if (data_size > (AP4_Size)(-1)-AP4_PROCESSOR_MAX_READ_SIZE) return AP4_ERROR_OUT_OF_RANGE;
+            result = buffer.Reserve(data_size+AP4_PROCESSOR_MAX_READ_SIZE);
+            if (AP4_FAILED(result)) return result;
+            buffer.SetDataSize(data_size+AP4_PROCESSOR_MAX_READ_SIZE);
+            AP4_Size bytes_read = 0;
+            result = m_Stream.ReadPartial(buffer.UseData()+data_size, AP4_PROCESSOR_MAX_READ_SIZE, bytes_read);
+            buffer.SetDataSize(data_size+bytes_read);
+            if (result == AP4_ERROR_EOS || (AP4_SUCCEEDED(result) && bytes_read == 0)) break;
+            if (AP4_FAILED(result)) return result;
+        }
+        m_Size = buffer.GetDataSize()-start;
+    }
+    m_Position += m_Size;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::SkipPayload
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_TopLevelAtomReader::SkipPayload()
+{
+    m_HeaderIsValid = false;
+    
+    // an atom that extends to the end of the stream is the last one
+    if (m_Size == 0) return AP4_ERROR_EOS;
+    m_Position += m_Size;
+    
+    // seek if we can, read and discard otherwise
+    if (AP4_SUCCEEDED(m_Stream.Seek(m_Position))) return AP4_SUCCESS;
+    AP4_UI64 remaining = m_Size-m_HeaderSize;
+    AP4_DataBuffer buffer;
+    while (remaining) {
+        AP4_Size chunk = remaining < AP4_PROCESSOR_MAX_READ_SIZE ? (AP4_Size)remaining : AP4_PROCESSOR_MAX_READ_SIZE;
+        buffer.SetDataSize(chunk);
+        AP4_Result result = m_Stream.Read(buffer.UseData(), chunk);
+        if (AP4_FAILED(result)) return result;
+        remaining -= chunk;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::ReadAtom
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_TopLevelAtomReader::ReadAtom(AP4_Atom*&       atom, 
+                                 AP4_Position&    offset, 
+                                 AP4_ByteStream*& data)
+{
+    atom = NULL;
+    data = NULL;
+    
+    // return the pushed back atom first
+    if (m_PushedBackAtom) {
+        atom   = m_PushedBackAtom;
+        offset = m_PushedBackOffset;
+        data   = m_PushedBackData;
+        m_PushedBackAtom = NULL;
+        m_PushedBackData = NULL;
+        return AP4_SUCCESS;
+    }
+    
+    for (;;) {
+        AP4_Result result = ReadHeader();
+        if (AP4_FAILED(result)) return result;
+        
+        // skip mdat atoms that do not follow a moof
+        if (m_Type == AP4_ATOM_TYPE_MDAT) {
+            result = SkipPayload();
+            if (AP4_FAILED(result)) return result;
+            continue;
+        }
+        
+        // read the atom
+        offset = m_Position;
+        AP4_AtomDataStream* atom_data = new AP4_AtomDataStream(m_Stream, offset);
+        result = ReadPayload(atom_data->GetBuffer());
+        if (AP4_SUCCEEDED(result)) {
+            if (m_Type == AP4_ATOM_TYPE_MOOF) {
+                // allocate the fragment's atoms from an arena of their own, 
+                // so that they are all freed at once when the fragment is done
+                AP4_LargeSize block_size = 2*m_Size;
+                if (block_size < AP4_ARENA_DEFAULT_BLOCK_SIZE) block_size = AP4_ARENA_DEFAULT_BLOCK_SIZE;
+                if (block_size > AP4_ARENA_MAX_BLOCK_SIZE)     block_size = AP4_ARENA_MAX_BLOCK_SIZE;
+                AP4_Arena* arena = new AP4_Arena((AP4_Size)block_size);
+                {
+                    AP4_Arena::Scope arena_scope(arena);
+                    result = m_AtomFactory.CreateAtomFromStream(*atom_data, atom);
+                }
+                arena->Release();
+            } else {
+                result = m_AtomFactory.CreateAtomFromStream(*atom_data, atom);
+            }
+        }
+        if (AP4_FAILED(result)) {
+            atom_data->Release();
+            return result;
+        }
+        
+        // keep the mfra aside
+        if (m_KeepMfra && atom->GetType() == AP4_ATOM_TYPE_MFRA) {
+            delete m_Mfra;
+            m_Mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
+            if (m_Mfra == NULL) delete atom;
+            atom = NULL;
+            atom_data->Release();
+            continue;
+        }
+        
+        // read the mdat that follows a moof along with it
+        if (atom->GetType() == AP4_ATOM_TYPE_MOOF &&
+            AP4_SUCCEEDED(ReadHeader())                &&
+            m_Type == AP4_ATOM_TYPE_MDAT) {
+            result = ReadPayload(atom_data->GetBuffer());
+            if (AP4_FAILED(result)) {
+                delete atom;
+                atom = NULL;
+                atom_data->Release();
+                return result;
+            }
+        }
+        
+        data = atom_data;
+        return AP4_SUCCESS;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_TopLevelAtomReader::PushBack
++---------------------------------------------------------------------*/
+void
+AP4_TopLevelAtomReader::PushBack(AP4_Atom* atom, AP4_Position offset, AP4_ByteStream* data)
+{
+    delete m_PushedBackAtom;
+    if (m_PushedBackData) m_PushedBackData->Release();
+    m_PushedBackAtom   = atom;
+    m_PushedBackOffset = offset;
+    m_PushedBackData   = data;
+}
 
-struct AP4_SampleCursor {
-    AP4_SampleCursor() : m_EndReached(false) {}
-    AP4_SampleLocator m_Locator;
-    bool              m_EndReached;
+/*----------------------------------------------------------------------
+|   AP4_ProcessorFragment
++---------------------------------------------------------------------*/
+/**
+ * A fragment that is being processed: its moof atom, the stream from which
+ * it was read, its handlers and the sample tables used to read its samples.
+ */
+struct AP4_ProcessorFragment {
+    AP4_ProcessorFragment(AP4_Atom* moof, AP4_Position offset, AP4_ByteStream* data) :
+        m_Moof(AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof)),
+        m_Offset(offset),
+        m_Data(data),
+        m_Fragment(NULL),
+        m_Result(AP4_SUCCESS),
+        m_Done(false) {}
+    ~AP4_ProcessorFragment() {
+        delete m_Fragment;
+        for (unsigned int i=0; i<m_Handlers.ItemCount(); i++) {
+            delete m_Handlers[i];
+        }
+        for (unsigned int i=0; i<m_SampleTables.ItemCount(); i++) {
+            delete m_SampleTables[i];
+        }
+        m_Data->Release();
+    }
+    AP4_Result ProcessSamples() {
+        for (unsigned int i=0; i<m_Handlers.ItemCount(); i++) {
+            if (m_Handlers[i] == NULL) continue;
+            AP4_Result result = m_Handlers[i]->ProcessSamples();
+            if (AP4_FAILED(result)) return result;
+        }
+        return AP4_SUCCESS;
+    }
+    
+    AP4_ContainerAtom*                         m_Moof;
+    AP4_Position                               m_Offset; // offset of the moof in the input
+    AP4_ByteStream*                            m_Data;
+    AP4_MovieFragment*                         m_Fragment;
+    AP4_Array<AP4_Processor::FragmentHandler*> m_Handlers;
+    AP4_Array<AP4_FragmentSampleTable*>        m_SampleTables;
+    AP4_Result                                 m_Result; // set by the pipeline
+    bool                                       m_Done;   // set by the pipeline
 };
 
-struct AP4_AtomLocator {
-    AP4_AtomLocator(AP4_Atom* atom, AP4_UI64 offset) : 
-        m_Atom(atom),
-        m_Offset(offset) {}
-    AP4_Atom* m_Atom;
-    AP4_UI64  m_Offset;
+/*----------------------------------------------------------------------
+|   AP4_FragmentOffsets
++---------------------------------------------------------------------*/
+/**
+ * Maps the offsets of the moof atoms in the input to their offsets in 
+ * the output, so that the 'tfra' entries can be updated once the 'mfra'
+ * atom, which comes last, has been read.
+ */
+class AP4_FragmentOffsets {
+public:
+    void Add(AP4_Position input_offset, AP4_Position output_offset) {
+        m_InputOffsets.Append(input_offset);
+        m_OutputOffsets.Append(output_offset);
+    }
+    void Update(AP4_ContainerAtom* mfra);
+
+private:
+    AP4_Array<AP4_UI64> m_InputOffsets; // increasing
+    AP4_Array<AP4_UI64> m_OutputOffsets;
 };
 
 /*----------------------------------------------------------------------
-|   AP4_DefaultFragmentHandler
+|   AP4_FragmentOffsets::Update
 +---------------------------------------------------------------------*/
-class AP4_DefaultFragmentHandler: public AP4_Processor::FragmentHandler {
+void
+AP4_FragmentOffsets::Update(AP4_ContainerAtom* mfra)
+{
+    if (mfra == NULL) return;
+    for (AP4_List<AP4_Atom>::Item* mfra_item = mfra->GetChildren().FirstItem();
+                                   mfra_item;
+                                   mfra_item = mfra_item->GetNext()) {
+        if (mfra_item->GetData()->GetType() != AP4_ATOM_TYPE_TFRA) continue;
+        AP4_TfraAtom* tfra = AP4_DYNAMIC_CAST(AP4_TfraAtom, mfra_item->GetData());
+        if (tfra == NULL) continue;
+        AP4_Array<AP4_TfraAtom::Entry>& entries     = tfra->GetEntries();
+        AP4_Cardinal                    entry_count = entries.ItemCount();
+        for (unsigned int i=0; i<entry_count; i++) {
+            // binary search for the fragment
+            AP4_Ordinal lo = 0;
+            AP4_Ordinal hi = m_InputOffsets.ItemCount();
+            while (lo < hi) {
+                AP4_Ordinal mid = lo+(hi-lo)/2;
+                if (m_InputOffsets[mid] < entries[i].m_MoofOffset) {
+                    lo = mid+1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (lo < m_InputOffsets.ItemCount() && m_InputOffsets[lo] == entries[i].m_MoofOffset) {
+                entries[i].m_MoofOffset = m_OutputOffsets[lo];
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline
++---------------------------------------------------------------------*/
+/**
+ * Runs the ProcessSamples() method of the handlers of whole fragments on a
+ * pool of worker threads. Fragments are submitted in order, and the caller
+ * waits for each of them, in the same order, before writing it.
+ */
+class AP4_FragmentPipeline {
 public:
-    AP4_DefaultFragmentHandler(AP4_Processor::TrackHandler* track_handler) :
-        m_TrackHandler(track_handler) {}
-    AP4_Result ProcessSample(AP4_DataBuffer& data_in,
-                             AP4_DataBuffer& data_out);
-                             
+    // constructor and destructor
+    AP4_FragmentPipeline(AP4_Cardinal worker_count);
+   ~AP4_FragmentPipeline();
+
+    // methods
+    AP4_Result   Start();
+    AP4_Cardinal GetWindowSize() { 
+        return m_StartedWorkerCount*AP4_PROCESSOR_PIPELINE_FRAGMENTS_PER_THREAD; 
+    }
+    AP4_Result   Submit(AP4_ProcessorFragment* fragment);
+    AP4_Result   Wait(AP4_ProcessorFragment* fragment);
+
 private:
-    AP4_Processor::TrackHandler* m_TrackHandler;
+    // types
+    class Thread : public AP4_Thread {
+    public:
+        Thread(AP4_FragmentPipeline& pipeline) : m_Pipeline(pipeline) {}
+    protected:
+        void Run() { m_Pipeline.RunWorker(); }
+    private:
+        AP4_FragmentPipeline& m_Pipeline;
+    };
+
+    // methods
+    void RunWorker();
+
+    // members
+    AP4_Cardinal                    m_WorkerCount;
+    Thread**                        m_Workers;
+    AP4_Cardinal                    m_StartedWorkerCount;
+    AP4_List<AP4_ProcessorFragment> m_Queue;
+    bool                            m_Terminating;
+    AP4_Mutex                       m_Lock;
+    AP4_Condition                   m_CanProcess;
+    AP4_Condition                   m_Done;
 };
 
 /*----------------------------------------------------------------------
-|   AP4_DefaultFragmentHandler::ProcessSample
+|   AP4_FragmentPipeline::AP4_FragmentPipeline
 +---------------------------------------------------------------------*/
-AP4_Result 
-AP4_DefaultFragmentHandler::ProcessSample(AP4_DataBuffer& data_in, AP4_DataBuffer& data_out)
+AP4_FragmentPipeline::AP4_FragmentPipeline(AP4_Cardinal worker_count) :
+    m_WorkerCount(worker_count?worker_count:1),
+    m_Workers(NULL),
+    m_StartedWorkerCount(0),
+    m_Terminating(false)
 {
-    if (m_TrackHandler == NULL) return AP4_SUCCESS;
-    return m_TrackHandler->ProcessSample(data_in, data_out);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline::~AP4_FragmentPipeline
++---------------------------------------------------------------------*/
+AP4_FragmentPipeline::~AP4_FragmentPipeline()
+{
+    // tell the threads to exit
+    m_Lock.Lock();
+    m_Terminating = true;
+    m_CanProcess.Broadcast();
+    m_Lock.Unlock();
+
+    // wait for them
+    for (unsigned int i=0; i<m_StartedWorkerCount; i++) {
+        m_Workers[i]->Wait();
+        delete m_Workers[i];
+    }
+    delete[] m_Workers;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline::Start
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FragmentPipeline::Start()
+{
+    AP4_Result result = AP4_SUCCESS;
+    m_Workers = new Thread*[m_WorkerCount];
+    for (unsigned int i=0; i<m_WorkerCount; i++) {
+        Thread* worker = new Thread(*this);
+        result = worker->Start();
+        if (AP4_FAILED(result)) {
+            delete worker;
+            break;
+        }
+        m_Workers[m_StartedWorkerCount++] = worker;
+    }
+    
+    return m_StartedWorkerCount?AP4_SUCCESS:result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline::RunWorker
++---------------------------------------------------------------------*/
+void
+AP4_FragmentPipeline::RunWorker()
+{
+    m_Lock.Lock();
+    for (;;) {
+        // wait for a fragment to process
+        AP4_ProcessorFragment* fragment = NULL;
+        while (!m_Terminating && AP4_FAILED(m_Queue.PopHead(fragment))) {
+            m_CanProcess.Wait(m_Lock);
+        }
+        if (fragment == NULL) break;
+        
+        // process it
+        m_Lock.Unlock();
+        AP4_Result result = fragment->ProcessSamples();
+        m_Lock.Lock();
+        fragment->m_Result = result;
+        fragment->m_Done   = true;
+        m_Done.Broadcast();
+    }
+    m_Lock.Unlock();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline::Submit
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FragmentPipeline::Submit(AP4_ProcessorFragment* fragment)
+{
+    AP4_AutoLock lock(m_Lock);
+    fragment->m_Done = false;
+    AP4_Result result = m_Queue.Add(fragment);
+    if (AP4_FAILED(result)) return result;
+    m_CanProcess.Signal();
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_FragmentPipeline::Wait
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_FragmentPipeline::Wait(AP4_ProcessorFragment* fragment)
+{
+    AP4_AutoLock lock(m_Lock);
+    while (!fragment->m_Done) {
+        m_Done.Wait(m_Lock);
+    }
+    
+    return fragment->m_Result;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_WriteFragment
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_WriteFragment(AP4_ProcessorFragment& fragment,
+                  AP4_ByteStream&        output,
+                  AP4_SamplePipeline*    pipeline,
+                  AP4_FragmentOffsets&   offsets)
+{
+    AP4_ContainerAtom* moof = fragment.m_Moof;
+    AP4_Result         result;
+    
+    // write the moof
+    AP4_UI64 moof_out_start = 0;
+    output.Tell(moof_out_start);
+    offsets.Add(fragment.m_Offset, moof_out_start);
+    moof->Write(output);
+        
+    // write an mdat header
+    AP4_Position mdat_out_start;
+    AP4_UI64 mdat_size = AP4_ATOM_HEADER_SIZE;
+    output.Tell(mdat_out_start);
+    output.WriteUI32(0);
+    output.WriteUI32(AP4_ATOM_TYPE_MDAT);
+
+    // process all track runs
+    for (unsigned int i=0; i<fragment.m_Handlers.ItemCount(); i++) {
+        AP4_Processor::FragmentHandler* handler = fragment.m_Handlers[i];
+
+        // get the track ID
+        AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof->GetChild(AP4_ATOM_TYPE_TRAF, i));
+        if (traf == NULL) continue;
+        AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
+        
+        // compute the base data offset
+        AP4_UI64 base_data_offset;
+        if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
+            base_data_offset = mdat_out_start+AP4_ATOM_HEADER_SIZE;
+        } else {
+            base_data_offset = moof_out_start;
+        }
+        
+        // build a list of all trun atoms
+        AP4_Array<AP4_TrunAtom*> truns;
+        for (AP4_List<AP4_Atom>::Item* child_item = traf->GetChildren().FirstItem();
+                                       child_item;
+                                       child_item = child_item->GetNext()) {
+            AP4_Atom* child_atom = child_item->GetData();
+            if (child_atom->GetType() == AP4_ATOM_TYPE_TRUN) {
+                AP4_TrunAtom* trun = AP4_DYNAMIC_CAST(AP4_TrunAtom, child_atom);
+                truns.Append(trun);
+            }
+        }    
+        truns[0]->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
+        
+        // write the mdat
+        AP4_FragmentSampleStage stage(fragment.m_SampleTables[i], 
+                                      handler, 
+                                      truns, 
+                                      output, 
+                                      mdat_out_start, 
+                                      base_data_offset, 
+                                      mdat_size);
+        result = AP4_ProcessSamples(stage, fragment.m_SampleTables[i]->GetSampleCount(), pipeline);
+        if (AP4_FAILED(result)) return result;
+        AP4_TrunAtom* trun = stage.GetTrun();
+
+        if (handler) {
+            // update the tfhd header
+            if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
+                tfhd->SetBaseDataOffset(mdat_out_start+AP4_ATOM_HEADER_SIZE);
+            }
+            if (tfhd->GetFlags() & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) {
+                tfhd->SetDefaultSampleSize(trun->GetEntries()[0].sample_size);
+            }
+            
+            // give the handler a chance to update the atoms
+            handler->FinishFragment();
+        }
+    }
+
+    // update the mdat header
+    AP4_Position mdat_out_end;
+    output.Tell(mdat_out_end);
+#if defined(AP4_DEBUG)
+    AP4_ASSERT(mdat_out_end-mdat_out_start == mdat_size);
+#endif
+    output.Seek(mdat_out_start);
+    output.WriteUI32((AP4_UI32)mdat_size);
+    output.Seek(mdat_out_end);
+    
+    // update the moof if needed
+    output.Seek(moof_out_start);
+    moof->Write(output);
+    output.Seek(mdat_out_end);
+            
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_WritePendingFragments
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_WritePendingFragments(AP4_List<AP4_ProcessorFragment>& pending,
+                          AP4_Cardinal                     max_pending,
+                          AP4_FragmentPipeline*            fragment_pipeline,
+                          AP4_ByteStream&                  output,
+                          AP4_SamplePipeline*              pipeline,
+                          AP4_FragmentOffsets&             offsets)
+{
+    while (pending.ItemCount() > max_pending) {
+        AP4_ProcessorFragment* fragment = NULL;
+        pending.PopHead(fragment);
+        AP4_Result result = fragment_pipeline?fragment_pipeline->Wait(fragment):fragment->m_Result;
+        if (AP4_SUCCEEDED(result)) {
+            result = AP4_WriteFragment(*fragment, output, pipeline, offsets);
+        }
+        delete fragment;
+        if (AP4_FAILED(result)) return result;
+    }
+    
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
 |   AP4_Processor::ProcessFragments
 +---------------------------------------------------------------------*/
 AP4_Result
-AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov, 
-                                AP4_List<AP4_AtomLocator>& atoms, 
-                                AP4_ContainerAtom*         mfra,
-                                AP4_ByteStream&            input, 
-                                AP4_ByteStream&            output)
-{
-    for (AP4_List<AP4_AtomLocator>::Item* item = atoms.FirstItem();
-                                          item;
-                                          item = item->GetNext()) {
-        AP4_AtomLocator*   locator     = item->GetData();
-        AP4_Atom*          atom        = locator->m_Atom;
-        AP4_UI64           atom_offset = locator->m_Offset;
-        AP4_UI64           mdat_payload_offset = atom_offset+atom->GetSize()+AP4_ATOM_HEADER_SIZE;
-        AP4_Sample         sample;
-        AP4_DataBuffer     sample_data_in;
-        AP4_DataBuffer     sample_data_out;
-        AP4_Result         result;
-    
-        // if this is not a moof atom, just write it back and continue
+AP4_Processor::ProcessFragments(AP4_MoovAtom*           moov, 
+                                AP4_TopLevelAtomReader& reader, 
+                                AP4_ByteStream&         output,
+                                AP4_SamplePipeline*     pipeline)
+{
+    // start the fragment pipeline if more than one thread was requested
+    AP4_FragmentPipeline* fragment_pipeline = NULL;
+    if (m_ThreadCount != 1) {
+        fragment_pipeline = new AP4_FragmentPipeline(m_ThreadCount?m_ThreadCount:AP4_Thread::GetProcessorCount());
+        if (AP4_FAILED(fragment_pipeline->Start())) {
+            delete fragment_pipeline;
+            fragment_pipeline = NULL;
+        }
+    }
+    AP4_Cardinal window = fragment_pipeline?fragment_pipeline->GetWindowSize():0;
+    
+    // fragments that have been prepared but not written out yet, in order
+    AP4_List<AP4_ProcessorFragment> pending;
+    AP4_FragmentOffsets             offsets;
+    
+    // read the atoms one at a time, so that only the fragments in the 
+    // window need to be kept in memory
+    AP4_Result result = AP4_SUCCESS;
+    AP4_Atom*       atom = NULL;
+    AP4_Position    atom_offset = 0;
+    AP4_ByteStream* atom_data = NULL;
+    while (AP4_SUCCEEDED(result) && AP4_SUCCEEDED(reader.ReadAtom(atom, atom_offset, atom_data))) {
+        AP4_UI64 mdat_payload_offset = atom_offset+atom->GetSize()+AP4_ATOM_HEADER_SIZE;
+    
+        // if this is not a moof atom, just write it back (after the fragments
+        // that precede it) and continue
         if (atom->GetType() != AP4_ATOM_TYPE_MOOF) {
-            result = atom->Write(output);
-            if (AP4_FAILED(result)) return result;
+            result = AP4_WritePendingFragments(pending, 0, fragment_pipeline, output, pipeline, offsets);
+            if (AP4_SUCCEEDED(result)) result = atom->Write(output);
+            delete atom;
+            atom_data->Release();
             continue;
         }
         
         // parse the moof
-        AP4_ContainerAtom* moof = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
-        AP4_MovieFragment* fragment = new AP4_MovieFragment(moof);
+        AP4_ProcessorFragment* fragment = new AP4_ProcessorFragment(atom, atom_offset, atom_data);
+        AP4_ContainerAtom*     moof     = fragment->m_Moof;
+        fragment->m_Fragment = new AP4_MovieFragment(moof);
 
         // process all the traf atoms
-        AP4_Array<AP4_Processor::FragmentHandler*> handlers;
-        AP4_Array<AP4_FragmentSampleTable*> sample_tables;
-        for (;AP4_Atom* child = moof->GetChild(AP4_ATOM_TYPE_TRAF, handlers.ItemCount());) {
+        for (;AP4_Atom* child = moof->GetChild(AP4_ATOM_TYPE_TRAF, fragment->m_Handlers.ItemCount());) {
             AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, child);
             AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
             
@@ -157,165 +1642,58 @@ AP4_Processor::ProcessFragments(AP4_MoovAtom*              moov,
             }
             
             // create the handler for this traf
-            AP4_Processor::FragmentHandler* handler = CreateFragmentHandler(trex, traf, input, atom_offset);
+            AP4_Processor::FragmentHandler* handler = CreateFragmentHandler(trex, traf, *atom_data, atom_offset);
+            fragment->m_Handlers.Append(handler);
             if (handler) {
                 result = handler->ProcessFragment();
-                if (AP4_FAILED(result)) return result;
+                if (AP4_FAILED(result)) break;
             }
-            handlers.Append(handler);
             
             // create a sample table object so we can read the sample data
             AP4_FragmentSampleTable* sample_table = NULL;
-            result = fragment->CreateSampleTable(moov, tfhd->GetTrackId(), &input, atom_offset, mdat_payload_offset, 0, sample_table);
-            if (AP4_FAILED(result)) return result;
-            sample_tables.Append(sample_table);
+            result = fragment->m_Fragment->CreateSampleTable(moov, tfhd->GetTrackId(), atom_data, atom_offset, mdat_payload_offset, 0, sample_table);
+            if (AP4_FAILED(result)) break;
+            fragment->m_SampleTables.Append(sample_table);
             
             // let the handler look at the samples before we process them
             if (handler) result = handler->PrepareForSamples(sample_table);
-            if (AP4_FAILED(result)) return result;
+            if (AP4_FAILED(result)) break;
         }
-             
-        // write the moof
-        AP4_UI64 moof_out_start = 0;
-        output.Tell(moof_out_start);
-        moof->Write(output);
-            
-        // write an mdat header
-        AP4_Position mdat_out_start;
-        AP4_UI64 mdat_size = AP4_ATOM_HEADER_SIZE;
-        output.Tell(mdat_out_start);
-        output.WriteUI32(0);
-        output.WriteUI32(AP4_ATOM_TYPE_MDAT);
-
-        // process all track runs
-        for (unsigned int i=0; i<handlers.ItemCount(); i++) {
-            AP4_Processor::FragmentHandler* handler = handlers[i];
-
-            // get the track ID
-            AP4_ContainerAtom* traf = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof->GetChild(AP4_ATOM_TYPE_TRAF, i));
-            if (traf == NULL) continue;
-            AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
-            
-            // compute the base data offset
-            AP4_UI64 base_data_offset;
-            if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
-                base_data_offset = mdat_out_start+AP4_ATOM_HEADER_SIZE;
+        
+        // let the handlers process the samples, on a worker thread if we can
+        if (AP4_SUCCEEDED(result)) {
+            if (fragment_pipeline) {
+                result = fragment_pipeline->Submit(fragment);
             } else {
-                base_data_offset = moof_out_start;
-            }
-            
-            // build a list of all trun atoms
-            AP4_Array<AP4_TrunAtom*> truns;
-            for (AP4_List<AP4_Atom>::Item* child_item = traf->GetChildren().FirstItem();
-                                           child_item;
-                                           child_item = child_item->GetNext()) {
-                AP4_Atom* child_atom = child_item->GetData();
-                if (child_atom->GetType() == AP4_ATOM_TYPE_TRUN) {
-                    AP4_TrunAtom* trun = AP4_DYNAMIC_CAST(AP4_TrunAtom, child_atom);
-                    truns.Append(trun);
-                }
-            }    
-            AP4_Ordinal   trun_index        = 0;
-            AP4_Ordinal   trun_sample_index = 0;
-            AP4_TrunAtom* trun = truns[0];
-            trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
-            
-            // write the mdat
-            for (unsigned int j=0; j<sample_tables[i]->GetSampleCount(); j++, trun_sample_index++) {
-                // advance the trun index if necessary
-                if (trun_sample_index >= trun->GetEntries().ItemCount()) {
-                    trun = truns[++trun_index];
-                    trun->SetDataOffset((AP4_SI32)((mdat_out_start+mdat_size)-base_data_offset));
-                    trun_sample_index = 0;
-                }
-                
-                // get the next sample
-                result = sample_tables[i]->GetSample(j, sample);
-                if (AP4_FAILED(result)) return result;
-                sample.ReadData(sample_data_in);
-                
-                // process the sample data
-                if (handler) {
-                    result = handler->ProcessSample(sample_data_in, sample_data_out);
-                    if (AP4_FAILED(result)) return result;
-
-                    // write the sample data
-                    result = output.Write(sample_data_out.GetData(), sample_data_out.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_out.GetDataSize();
-                    
-                    // update the trun entry
-                    trun->UseEntries()[trun_sample_index].sample_size = sample_data_out.GetDataSize();
-                } else {
-                    // write the sample data (unmodified)
-                    result = output.Write(sample_data_in.GetData(), sample_data_in.GetDataSize());
-                    if (AP4_FAILED(result)) return result;
-
-                    // update the mdat size
-                    mdat_size += sample_data_in.GetDataSize();
-                }
-            }
-
-            if (handler) {
-                // update the tfhd header
-                if (tfhd->GetFlags() & AP4_TFHD_FLAG_BASE_DATA_OFFSET_PRESENT) {
-                    tfhd->SetBaseDataOffset(mdat_out_start+AP4_ATOM_HEADER_SIZE);
-                }
-                if (tfhd->GetFlags() & AP4_TFHD_FLAG_DEFAULT_SAMPLE_SIZE_PRESENT) {
-                    tfhd->SetDefaultSampleSize(trun->GetEntries()[0].sample_size);
-                }
-                
-                // give the handler a chance to update the atoms
-                handler->FinishFragment();
+                fragment->m_Result = fragment->ProcessSamples();
+                fragment->m_Done   = true;
             }
         }
-
-        // update the mdat header
-        AP4_Position mdat_out_end;
-        output.Tell(mdat_out_end);
-#if defined(AP4_DEBUG)
-        AP4_ASSERT(mdat_out_end-mdat_out_start == mdat_size);
-#endif
-        output.Seek(mdat_out_start);
-        output.WriteUI32((AP4_UI32)mdat_size);
-        output.Seek(mdat_out_end);
-        
-        // update the moof if needed
-        output.Seek(moof_out_start);
-        moof->Write(output);
-        output.Seek(mdat_out_end);
-                
-        // update the mfra if we have one
-        if (mfra) {
-            for (AP4_List<AP4_Atom>::Item* mfra_item = mfra->GetChildren().FirstItem();
-                                           mfra_item;
-                                           mfra_item = mfra_item->GetNext()) {
-                if (mfra_item->GetData()->GetType() != AP4_ATOM_TYPE_TFRA) continue;
-                AP4_TfraAtom* tfra = AP4_DYNAMIC_CAST(AP4_TfraAtom, mfra_item->GetData());
-                if (tfra == NULL) continue;
-                AP4_Array<AP4_TfraAtom::Entry>& entries     = tfra->GetEntries();
-                AP4_Cardinal                    entry_count = entries.ItemCount();
-                for (unsigned int i=0; i<entry_count; i++) {
-                    if (entries[i].m_MoofOffset == locator->m_Offset) {
-                        entries[i].m_MoofOffset = moof_out_start;
-                    }
-                }
-            }
+        if (AP4_FAILED(result)) {
+            delete fragment;
+            break;
         }
-
-        delete fragment;
+        pending.Add(fragment);
         
-        for (unsigned int i=0; i<handlers.ItemCount(); i++) {
-            delete handlers[i];
-        }
-        for (unsigned int i=0; i<sample_tables.ItemCount(); i++) {
-            delete sample_tables[i];
-        }
+        // write out the fragments that no longer fit in the window
+        result = AP4_WritePendingFragments(pending, window, fragment_pipeline, output, pipeline, offsets);
+    }
+    if (AP4_SUCCEEDED(result)) {
+        result = AP4_WritePendingFragments(pending, 0, fragment_pipeline, output, pipeline, offsets);
+    }
+    
+    // update the mfra, if one was read
+    if (AP4_SUCCEEDED(result)) offsets.Update(reader.GetMfra());
+    
+    // after an error, wait for the fragments that are still being processed
+    // before deleting them
+    for (AP4_ProcessorFragment* fragment = NULL; AP4_SUCCEEDED(pending.PopHead(fragment));) {
+        if (fragment_pipeline) fragment_pipeline->Wait(fragment);
+        delete fragment;
     }
+    delete fragment_pipeline;
      
-    return AP4_SUCCESS;
+    return result;
 }
 
 /*----------------------------------------------------------------------
@@ -331,7 +1709,7 @@ AP4_Processor::CreateFragmentHandler(AP4_TrexAtom*      /* trex */,
     for (unsigned int i=0; i<m_TrackIds.ItemCount(); i++) {
         AP4_TfhdAtom* tfhd = AP4_DYNAMIC_CAST(AP4_TfhdAtom, traf->GetChild(AP4_ATOM_TYPE_TFHD));
         if (tfhd && m_TrackIds[i] == tfhd->GetTrackId()) {
-            return new AP4_DefaultFragmentHandler(m_TrackHandlers[i]);
+            return new AP4_DefaultFragmentHandler(m_TrackHandlers[i], m_TrackSampleCounts[i]);
         }
     }
     
@@ -348,50 +1726,31 @@ AP4_Processor::Process(AP4_ByteStream&   input,
                        ProgressListener* listener,
                        AP4_AtomFactory&  atom_factory)
 {
-    // read all atoms.
+    // read all atoms up to the first [moof], or up to [moov] if we have a
+    // fragments stream.
     // keep all atoms except [mdat]
     // keep a ref to [moov]
-    // put [moof] atoms in a separate list
-    AP4_AtomParent              top_level;
-    AP4_MoovAtom*               moov = NULL;
-    AP4_ContainerAtom*          mfra = NULL;
-    AP4_List<AP4_AtomLocator>   frags;
-    AP4_UI64                    stream_offset = 0;
-    bool                        in_fragments = false;
-    for (AP4_Atom* atom = NULL;
-        AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(input, atom));
-        input.Tell(stream_offset)) {
-        if (atom->GetType() == AP4_ATOM_TYPE_MDAT) {
-            delete atom;
-            continue;
-        } else if (atom->GetType() == AP4_ATOM_TYPE_MOOV) {
+    // the [mfra] atom is kept aside by the reader
+    // the [moof] atoms are read one at a time when processing the fragments
+    AP4_AtomParent         top_level;
+    AP4_MoovAtom*          moov = NULL;
+    AP4_TopLevelAtomReader reader(input, atom_factory, true);
+    AP4_Atom*              atom = NULL;
+    AP4_Position           atom_offset = 0;
+    AP4_ByteStream*        atom_data = NULL;
+    while (AP4_SUCCEEDED(reader.ReadAtom(atom, atom_offset, atom_data))) {
+        if (!fragments && atom->GetType() == AP4_ATOM_TYPE_MOOF) {
+            reader.PushBack(atom, atom_offset, atom_data);
+            break;
+        }
+        atom_data->Release();
+        top_level.AddChild(atom);
+        if (atom->GetType() == AP4_ATOM_TYPE_MOOV) {
             moov = AP4_DYNAMIC_CAST(AP4_MoovAtom, atom);
             if (fragments) break;
-        } else if (atom->GetType() == AP4_ATOM_TYPE_MFRA) {
-            mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, atom);
-            continue;
-        } else if (!fragments && (in_fragments || atom->GetType() == AP4_ATOM_TYPE_MOOF)) {
-            in_fragments = true;
-            frags.Add(new AP4_AtomLocator(atom, stream_offset));
-            continue;
         }
-        top_level.AddChild(atom);
     }
 
-    // if we have a fragments stream, get the fragment locators from there
-    if (fragments) {
-        stream_offset = 0;
-        for (AP4_Atom* atom = NULL;
-            AP4_SUCCEEDED(atom_factory.CreateAtomFromStream(*fragments, atom));
-            fragments->Tell(stream_offset)) {
-            if (atom->GetType() == AP4_ATOM_TYPE_MDAT) {
-                delete atom;
-                continue;
-            }
-            frags.Add(new AP4_AtomLocator(atom, stream_offset));
-        }
-    }
-    
     // initialize the processor
     AP4_Result result = Initialize(top_level, input);
     if (AP4_FAILED(result)) return result;
@@ -402,16 +1761,20 @@ AP4_Processor::Process(AP4_ByteStream&   input,
     AP4_List<AP4_TrakAtom>*      trak_atoms        = NULL;
     AP4_LargeSize                mdat_payload_size = 0;
     AP4_SampleCursor*            cursors           = NULL;
+    AP4_Cardinal                 sample_count      = 0;
     if (moov) {
         // build an array of track sample locators
         trak_atoms = &moov->GetTrakAtoms();
         track_count = trak_atoms->ItemCount();
+        if (track_count > 0xFFFF) return AP4_ERROR_NOT_SUPPORTED;
         cursors = new AP4_SampleCursor[track_count];
         m_TrackHandlers.SetItemCount(track_count);
         m_TrackIds.SetItemCount(track_count);
+        m_TrackSampleCounts.SetItemCount(track_count);
         for (AP4_Ordinal i=0; i<track_count; i++) {
             m_TrackHandlers[i] = NULL;
             m_TrackIds[i] = 0;
+            m_TrackSampleCounts[i] = 0;
         }
         
         unsigned int index = 0;
@@ -435,80 +1798,86 @@ AP4_Processor::Process(AP4_ByteStream&   input,
             // create the track handler    
             m_TrackHandlers[index] = CreateTrackHandler(trak);
             m_TrackIds[index]      = trak->GetId();
-            cursors[index].m_Locator.m_TrakIndex   = index;
-            cursors[index].m_Locator.m_SampleTable = new AP4_AtomSampleTable(stbl, *trak_data_stream);
-            cursors[index].m_Locator.m_SampleIndex = 0;
-            cursors[index].m_Locator.m_ChunkIndex  = 0;
-            if (cursors[index].m_Locator.m_SampleTable->GetSampleCount()) {
-                cursors[index].m_Locator.m_SampleTable->GetSample(0, cursors[index].m_Locator.m_Sample);
-            } else {
-                cursors[index].m_EndReached = true;
-            }
+            cursors[index].m_TrakIndex   = index;
+            cursors[index].m_SampleTable = new AP4_AtomSampleTable(stbl, *trak_data_stream);
+            cursors[index].m_DataStream  = trak_data_stream;
+            cursors[index].m_SampleIndex = 0;
+            cursors[index].m_ChunkIndex  = 0;
+            m_TrackSampleCounts[index]   = cursors[index].m_SampleTable->GetSampleCount();
+            sample_count += m_TrackSampleCounts[index];
 
             index++;            
         }
+        result = locators.EnsureCapacity(sample_count);
+        if (AP4_FAILED(result)) return result;
 
-        // figure out the layout of the chunks
-        for (;;) {
-            // see which is the next sample to write
-            AP4_UI64 min_offset = (AP4_UI64)(-1);
-            int cursor = -1;
-            for (unsigned int i=0; i<track_count; i++) {
-                if (!cursors[i].m_EndReached &&
-                    cursors[i].m_Locator.m_Sample.GetOffset() <= min_offset) {
-                    min_offset = cursors[i].m_Locator.m_Sample.GetOffset();
-                    cursor = i;
-                }
+        // figure out the layout of the chunks, by merging the tracks in the
+        // order of the sample offsets
+        AP4_SampleCursorHeap heap(cursors, track_count);
+        for (AP4_Ordinal i=0; i<index; i++) {
+            AP4_SampleCursor& cursor = cursors[i];
+            if (cursor.m_SampleTable->GetSampleCount()) {
+                cursor.m_SampleTable->GetSample(0, cursor.m_Sample);
+                heap.Push(i);
+            }
+        }
+        int current_track = -1;
+        int current_chunk = -1;
+        while (heap.GetCount()) {
+            // append the next sample to the layout
+            AP4_SampleCursor& cursor  = heap.GetTop();
+            TrackHandler*     handler = m_TrackHandlers[cursor.m_TrakIndex];
+            AP4_SampleLocator locator;
+            locator.m_Offset        = cursor.m_Sample.GetOffset();
+            locator.m_Size          = cursor.m_Sample.GetSize();
+            locator.m_ProcessedSize = handler?handler->GetProcessedSampleSize(cursor.m_Sample):locator.m_Size;
+            locator.m_SampleIndex   = cursor.m_SampleIndex;
+            locator.m_TrakIndex     = (AP4_UI16)cursor.m_TrakIndex;
+            locator.m_Flags         = 0;
+            if ((int)cursor.m_TrakIndex  != current_track ||
+                (int)cursor.m_ChunkIndex != current_chunk) {
+                // start a new chunk for this track
+                current_track = cursor.m_TrakIndex;
+                current_chunk = cursor.m_ChunkIndex;
+                locator.m_Flags |= AP4_SAMPLE_LOCATOR_FLAG_NEW_CHUNK;
             }
-
-            // stop if all cursors are exhausted
-            if (cursor == -1) break;
-
-            // append this locator to the layout list
-            AP4_SampleLocator& locator = cursors[cursor].m_Locator;
             locators.Append(locator);
 
             // move the cursor to the next sample
-            locator.m_SampleIndex++;
-            if (locator.m_SampleIndex == locator.m_SampleTable->GetSampleCount()) {
-                // mark this track as completed
-                cursors[cursor].m_EndReached = true;
+            cursor.m_SampleIndex++;
+            if (cursor.m_SampleIndex == cursor.m_SampleTable->GetSampleCount()) {
+                // this track is completed
+                heap.PopTop();
             } else {
                 // get the next sample info
-                locator.m_SampleTable->GetSample(locator.m_SampleIndex, locator.m_Sample);
+                cursor.m_SampleTable->GetSample(cursor.m_SampleIndex, cursor.m_Sample);
                 AP4_Ordinal skip, sdesc;
-                locator.m_SampleTable->GetChunkForSample(locator.m_SampleIndex,
-                                                         locator.m_ChunkIndex,
-                                                         skip, sdesc);
+                cursor.m_SampleTable->GetChunkForSample(cursor.m_SampleIndex,
+                                                        cursor.m_ChunkIndex,
+                                                        skip, sdesc);
+                heap.UpdateTop();
             }
         }
 
         // update the stbl atoms and compute the mdat size
-        int current_track = -1;
-        int current_chunk = -1;
         AP4_Position current_chunk_offset = 0;
         AP4_Size current_chunk_size = 0;
         for (AP4_Ordinal i=0; i<locators.ItemCount(); i++) {
-            AP4_SampleLocator& locator = locators[i];
-            if ((int)locator.m_TrakIndex  != current_track ||
-                (int)locator.m_ChunkIndex != current_chunk) {
+            const AP4_SampleLocator& locator = locators[i];
+            AP4_AtomSampleTable* sample_table = cursors[locator.m_TrakIndex].m_SampleTable;
+            if (locator.m_Flags & AP4_SAMPLE_LOCATOR_FLAG_NEW_CHUNK) {
                 // start a new chunk for this track
                 current_chunk_offset += current_chunk_size;
                 current_chunk_size = 0;
-                current_track = locator.m_TrakIndex;
-                current_chunk = locator.m_ChunkIndex;
-                locator.m_SampleTable->SetChunkOffset(locator.m_ChunkIndex, current_chunk_offset);
+                AP4_Ordinal chunk_index, skip, sdesc;
+                sample_table->GetChunkForSample(locator.m_SampleIndex, chunk_index, skip, sdesc);
+                sample_table->SetChunkOffset(chunk_index, current_chunk_offset);
             } 
-            AP4_Size sample_size;
-            TrackHandler* handler = m_TrackHandlers[locator.m_TrakIndex];
-            if (handler) {
-                sample_size = handler->GetProcessedSampleSize(locator.m_Sample);
-                locator.m_SampleTable->SetSampleSize(locator.m_SampleIndex, sample_size);
-            } else {
-                sample_size = locator.m_Sample.GetSize();
+            if (m_TrackHandlers[locator.m_TrakIndex]) {
+                sample_table->SetSampleSize(locator.m_SampleIndex, locator.m_ProcessedSize);
             }
-            current_chunk_size += sample_size;
-            mdat_payload_size  += sample_size;
+            current_chunk_size += locator.m_ProcessedSize;
+            mdat_payload_size  += locator.m_ProcessedSize;
         }
 
         // process the tracks (ex: sample descriptions processing)
@@ -560,30 +1929,83 @@ AP4_Processor::Process(AP4_ByteStream&   input,
     
     // write the samples
     if (moov) {
-        if (!fragments) {
+        // start the sample pipeline if more than one thread was requested
+        AP4_SamplePipeline* pipeline = NULL;
+        if (m_ThreadCount != 1) {
+            pipeline = new AP4_SamplePipeline(m_ThreadCount?m_ThreadCount:AP4_Thread::GetProcessorCount());
+            if (AP4_FAILED(pipeline->Start())) {
+                delete pipeline;
+                pipeline = NULL;
+            }
+        }
+        
+        if (!fragments && pipeline) {
+            AP4_FlatSampleStage stage(locators, cursors, m_TrackHandlers, output, listener);
+            result = pipeline->Run(stage, locators.ItemCount());
+            if (AP4_FAILED(result)) {
+                delete pipeline;
+                return result;
+            }
+        } else if (!fragments) {
 #if defined(AP4_DEBUG)
             AP4_Position before;
             output.Tell(before);
 #endif
-            AP4_Sample     sample;
+            AP4_DataBuffer run_data;
             AP4_DataBuffer data_in;
             AP4_DataBuffer data_out;
-            for (unsigned int i=0; i<locators.ItemCount(); i++) {
-                AP4_SampleLocator& locator = locators[i];
-                locator.m_Sample.ReadData(data_in);
+            for (unsigned int i=0; i<locators.ItemCount();) {
+                // find the run of samples of the same track that are contiguous
+                // in the input, so that they can be read all at once
+                const AP4_SampleLocator& locator = locators[i];
+                AP4_Position run_end   = locator.m_Offset+locator.m_Size;
+                AP4_Size     run_size  = locator.m_Size;
+                unsigned int run_count = 1;
+                while (i+run_count < locators.ItemCount()) {
+                    const AP4_SampleLocator& next = locators[i+run_count];
+                    AP4_Size next_size = next.m_Size;
+                    if (next.m_TrakIndex != locator.m_TrakIndex ||
+                        next.m_Offset != run_end                ||
+                        run_size >= AP4_PROCESSOR_MAX_READ_SIZE ||
+                        next_size > AP4_PROCESSOR_MAX_READ_SIZE-run_size) {
+                        break;
+                    }
+                    run_end  += next_size;
+                    run_size += next_size;
+                    ++run_count;
+                }
+                run_data.SetDataSize(0);
+                result = AP4_ReadSampleData(*cursors[locator.m_TrakIndex].m_DataStream,
+                                            locator.m_Offset,
+                                            run_size,
+                                            run_data);
+                if (AP4_FAILED(result)) return result;
+
                 TrackHandler* handler = m_TrackHandlers[locator.m_TrakIndex];
                 if (handler) {
-                    result = handler->ProcessSample(data_in, data_out);
-                    if (AP4_FAILED(result)) return result;
-                    output.Write(data_out.GetData(), data_out.GetDataSize());
-                } else {
-                    output.Write(data_in.GetData(), data_in.GetDataSize());            
-                }
+                    AP4_Size offset = 0;
+                    for (unsigned int j=0; j<run_count; j++) {
+                        AP4_Size sample_size = locators[i+j].m_Size;
+                        data_in.SetDataView(run_data.GetData()+offset, sample_size);
+                        offset += sample_size;
+                        result = handler->ProcessIndexedSample(locators[i+j].m_SampleIndex, data_in, data_out);
+                        if (AP4_FAILED(result)) return result;
+                        output.Write(data_out.GetData(), data_out.GetDataSize());
 
-                // notify the progress listener
-                if (listener) {
-                    listener->OnProgress(i+1, locators.ItemCount());
+                        // notify the progress listener
+                        if (listener) {
+                            listener->OnProgress(i+j+1, locators.ItemCount());
+                        }
+                    }
+                } else {
+                    output.Write(run_data.GetData(), run_data.GetDataSize());
+                    if (listener) {
+                        for (unsigned int j=0; j<run_count; j++) {
+                            listener->OnProgress(i+j+1, locators.ItemCount());
+                        }
+                    }
                 }
+                i += run_count;
             }
 
 #if defined(AP4_DEBUG)
@@ -594,29 +2016,31 @@ AP4_Processor::Process(AP4_ByteStream&   input,
         }
         
         // process the fragments, if any
-        result = ProcessFragments(moov, frags, mfra, fragments?*fragments:input, output);
+        if (fragments) {
+            AP4_TopLevelAtomReader fragments_reader(*fragments, atom_factory, false);
+            result = ProcessFragments(moov, fragments_reader, output, pipeline);
+        } else {
+            result = ProcessFragments(moov, reader, output, pipeline);
+        }
+        delete pipeline;
         if (AP4_FAILED(result)) return result;
         
         if (!fragments) {
             // write the mfra atom at the end if we have one
-            if (mfra) {
-                mfra->Write(output);
+            if (reader.GetMfra()) {
+                reader.GetMfra()->Write(output);
             }
         }
         
         // cleanup
         for (AP4_Ordinal i=0; i<track_count; i++) {
-            delete cursors[i].m_Locator.m_SampleTable;
+            delete cursors[i].m_SampleTable;
             delete m_TrackHandlers[i];
         }
         m_TrackHandlers.Clear();
         delete[] cursors;
     }
 
-    // cleanup
-    frags.DeleteReferences();
-    delete mfra;
-    
     return AP4_SUCCESS;
 }
 
@@ -47,7 +47,8 @@ class AP4_DataBuffer;
 class AP4_TrakAtom;
 class AP4_TrexAtom;
 class AP4_FragmentSampleTable;
-struct AP4_AtomLocator;
+class AP4_TopLevelAtomReader;
+class AP4_SamplePipeline;
 
 /*----------------------------------------------------------------------
 |   AP4_Processor
@@ -112,6 +113,37 @@ public:
          */
         virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out) = 0;
+
+        /**
+         * Process the data of one sample, given its index in the track.
+         * This is the method called by the processor. A track handler
+         * that needs the position of the sample, to derive an IV from it
+         * for example, may override it. The default implementation calls
+         * ProcessSample().
+         * @param sample_index Index of the sample in the track. For 
+         * fragmented inputs, the samples of the fragments are numbered
+         * after the samples of the track, in fragment order.
+         * @param data_in Data buffer with the data of the sample to process.
+         * @param data_out Data buffer in which the processed sample data is
+         * returned.
+         */
+        virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     /* sample_index */,
+                                                AP4_DataBuffer& data_in,
+                                                AP4_DataBuffer& data_out) {
+            return ProcessSample(data_in, data_out);
+        }
+
+        /**
+         * A track handler may override this method to return true if the
+         * result of ProcessIndexedSample() only depends on the sample data
+         * and the sample index passed to it, and ProcessIndexedSample() may
+         * be called concurrently from more than one thread. When the 
+         * processor runs with more than one thread (see 
+         * AP4_Processor::SetThreadCount()), the samples of such tracks are
+         * processed in parallel. The samples of other tracks are always 
+         * processed one at a time, in order.
+         */
+        virtual bool IsStatelessPerSample() { return false; }
     };
 
     /**
@@ -140,6 +172,36 @@ public:
             return AP4_SUCCESS; 
         }
 
+        /**
+         * A fragment handler that has already read the data of the samples
+         * of the fragment, in PrepareForSamples() for example, may override
+         * this method so that the processor does not read it again.
+         * @param index Index of the sample in the fragment.
+         * @param data Data buffer set to a view of the data of the sample,
+         * which must remain valid until the fragment is written out.
+         * @return AP4_SUCCESS, or AP4_ERROR_NOT_SUPPORTED if the processor 
+         * must read the data of the sample itself.
+         */
+        virtual AP4_Result GetSampleData(AP4_Ordinal     /* index */, 
+                                         AP4_DataBuffer& /* data  */) {
+            return AP4_ERROR_NOT_SUPPORTED;
+        }
+
+        /**
+         * A fragment handler may override this method if it needs to 
+         * process all the samples of the fragment at once, after 
+         * PrepareForSamples() and before the fragment is written out. 
+         * This method may change the size of the fragment atoms.
+         * When the processor uses more than one thread, this method is 
+         * called on a worker thread, concurrently with the same method of 
+         * the handlers of other fragments, so it may only use the state of 
+         * this handler and of its fragment atoms. Any state shared between
+         * fragments must be read and updated in ProcessFragment() or 
+         * PrepareForSamples(), which are always called for one fragment 
+         * after the other, in order, on the thread that called Process().
+         */
+        virtual AP4_Result ProcessSamples() { return AP4_SUCCESS; }
+
         /**
          * A fragment handler may override this method if it needs to modify
          * the fragment atoms after processing the fragment samples.
@@ -155,15 +217,67 @@ public:
          */
         virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in,
                                          AP4_DataBuffer& data_out) = 0;
+
+        /**
+         * Process the data of one sample, given its index in the fragment.
+         * See TrackHandler::ProcessIndexedSample().
+         */
+        virtual AP4_Result ProcessIndexedSample(AP4_Ordinal     /* sample_index */,
+                                                AP4_DataBuffer& data_in,
+                                                AP4_DataBuffer& data_out) {
+            return ProcessSample(data_in, data_out);
+        }
+
+        /**
+         * A fragment handler may override this method to return true if 
+         * its samples may be processed in parallel.
+         * See TrackHandler::IsStatelessPerSample().
+         */
+        virtual bool IsStatelessPerSample() { return false; }
     };
 
+    /**
+     * Default constructor
+     */
+    AP4_Processor() : m_ThreadCount(1) {}
+
     /**
      *  Default destructor
      */
     virtual ~AP4_Processor() { m_ExternalTrackData.DeleteReferences(); }
 
+    /**
+     * Set the number of threads used to process samples. With more than one
+     * thread, samples are read, processed and written by separate threads, 
+     * and the samples of handlers that return true from 
+     * IsStatelessPerSample() are processed by a pool of thread_count worker
+     * threads. For fragmented inputs, the FragmentHandler::ProcessSamples()
+     * method of the handlers of up to a few fragments per thread also runs
+     * on a pool of worker threads, which means that the handlers of the 
+     * following fragments may be created and prepared before the current 
+     * fragment is written out. The output is identical to that of 
+     * single-threaded processing. A value of 0 means one worker thread per
+     * processor. On platforms without thread support, this setting is 
+     * ignored.
+     * @param thread_count Number of sample processing threads. 
+     * The default is 1.
+     */
+    void SetThreadCount(AP4_Cardinal thread_count) { m_ThreadCount = thread_count; }
+
+    /**
+     * Get the number of threads set with SetThreadCount().
+     */
+    AP4_Cardinal GetThreadCount() { return m_ThreadCount; }
+
     /**
      * Process the input stream into an output stream.
+     * The fragments of a fragmented input are read, processed and written
+     * one at a time (or a few at a time, see SetThreadCount()), so the 
+     * memory used does not depend on the number of fragments. The input 
+     * stream is only read sequentially, so it does not need to be seekable
+     * as long as the media data of each 'moof' atom is in the 'mdat' atom 
+     * that immediately follows it, and the 'moov' atom does not reference
+     * any sample. The output stream must be seekable.
      * @param input Input stream from which to read the input file.
      * @param output Output stream to which the processed input
      * will be written.
@@ -179,6 +293,8 @@ public:
 
     /**
      * Process a fragment input stream into an output stream.
+     * The fragments are read sequentially, as with the other form of
+     * Process(), so the fragments stream does not need to be seekable.
      * @param fragments Input stream from which to read the fragments.
      * @param output Output stream to which the processed fragments
      * will be written.
@@ -256,16 +372,17 @@ protected:
                        ProgressListener* listener,
                        AP4_AtomFactory&  atom_factory);
 
-    AP4_Result ProcessFragments(AP4_MoovAtom*              moov, 
-                                AP4_List<AP4_AtomLocator>& atoms, 
-                                AP4_ContainerAtom*         mfra,
-                                AP4_ByteStream&            input, 
-                                AP4_ByteStream&            output);
+    AP4_Result ProcessFragments(AP4_MoovAtom*           moov, 
+                                AP4_TopLevelAtomReader& reader, 
+                                AP4_ByteStream&         output,
+                                AP4_SamplePipeline*     pipeline);
     
     
     AP4_List<ExternalTrackData> m_ExternalTrackData;
     AP4_Array<AP4_UI32>         m_TrackIds;
     AP4_Array<TrackHandler*>    m_TrackHandlers;
+    AP4_Array<AP4_UI32>         m_TrackSampleCounts; // samples numbered so far, per track
+    AP4_Cardinal                m_ThreadCount;
 };
 
 #endif // _AP4_PROCESSOR_H_
@@ -0,0 +1,401 @@
+/*****************************************************************
+|
+|    AP4 - Read-Ahead Input Stream
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4ReadAheadInputStream.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Position AP4_READ_AHEAD_UNKNOWN_POSITION = (AP4_Position)(-1);
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::AP4_ReadAheadInputStream
++---------------------------------------------------------------------*/
+AP4_ReadAheadInputStream::AP4_ReadAheadInputStream(AP4_ByteStream& source,
+                                                   AP4_Size        buffer_size,
+                                                   AP4_Cardinal    buffer_count,
+                                                   AP4_Size        seek_as_read_threshold) :
+    m_Source(source),
+    m_SourcePosition(AP4_READ_AHEAD_UNKNOWN_POSITION),
+    m_BufferSize(buffer_size?buffer_size:1),
+    m_SeekAsReadThreshold(seek_as_read_threshold),
+    m_ReferenceCount(1),
+    m_Windows(NULL),
+    m_WindowCount(buffer_count < 2 ? 2 : buffer_count),
+    m_WindowIndex(0),
+    m_FilledCount(0),
+    m_FillLimit(buffer_count < 2 ? 2 : buffer_count),
+    m_WindowPosition(0),
+    m_NextPosition(0),
+    m_SourceResult(AP4_SUCCESS),
+    m_Generation(0),
+    m_Filling(false),
+    m_Terminating(false),
+    m_Threaded(false),
+    m_Worker(*this),
+    m_BytesPrefetched(0),
+    m_StallCount(0),
+    m_StallTime(0)
+{
+    source.AddReference();
+    if (AP4_FAILED(source.Tell(m_SourcePosition))) {
+        m_SourcePosition = AP4_READ_AHEAD_UNKNOWN_POSITION;
+    }
+
+    // one window is being consumed while the others are being filled
+    m_Windows = new Window[m_WindowCount];
+    for (unsigned int i=0; i<m_WindowCount; i++) {
+        m_Windows[i].m_Data     = new AP4_UI08[m_BufferSize];
+        m_Windows[i].m_Position = 0;
+        m_Windows[i].m_Size     = 0;
+    }
+
+    // start reading ahead
+    m_Threaded = AP4_SUCCEEDED(m_Worker.Start());
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::~AP4_ReadAheadInputStream
++---------------------------------------------------------------------*/
+AP4_ReadAheadInputStream::~AP4_ReadAheadInputStream()
+{
+    // stop the worker
+    m_Lock.Lock();
+    m_Terminating = true;
+    m_CanFill.Signal();
+    m_Lock.Unlock();
+    if (m_Threaded) m_Worker.Wait();
+
+    for (unsigned int i=0; i<m_WindowCount; i++) {
+        delete[] m_Windows[i].m_Data;
+    }
+    delete[] m_Windows;
+    m_Source.Release();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::RunWorker
++---------------------------------------------------------------------*/
+void
+AP4_ReadAheadInputStream::RunWorker()
+{
+    m_Lock.Lock();
+    for (;;) {
+        // wait until there's a window to fill
+        while (!m_Terminating &&
+               (m_Filling || m_FilledCount >= m_FillLimit || AP4_FAILED(m_SourceResult))) {
+            m_CanFill.Wait(m_Lock);
+        }
+        if (m_Terminating) break;
+
+        FillWindow(m_BufferSize);
+    }
+    m_Lock.Unlock();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::FillWindow
++---------------------------------------------------------------------*/
+void
+AP4_ReadAheadInputStream::FillWindow(AP4_Size size)
+{
+    // this is called with m_Lock held. The window after the filled ones
+    // is not visible to the consumer, so it can be filled without the lock
+    Window&      window     = m_Windows[(m_WindowIndex+m_FilledCount)%m_WindowCount];
+    AP4_Position position   = m_NextPosition;
+    AP4_UI32     generation = m_Generation;
+    m_Filling = true;
+    m_Lock.Unlock();
+
+    m_SourceLock.Lock();
+    AP4_Result result = AP4_SUCCESS;
+    if (position != m_SourcePosition) {
+        if (m_SourcePosition != AP4_READ_AHEAD_UNKNOWN_POSITION &&
+            position > m_SourcePosition                        &&
+            position-m_SourcePosition <= m_SeekAsReadThreshold) {
+            // skip forward by reading
+            while (m_SourcePosition < position) {
+                AP4_Size chunk = m_BufferSize;
+                if (chunk > position-m_SourcePosition) {
+                    chunk = (AP4_Size)(position-m_SourcePosition);
+                }
+                result = m_Source.Read(window.m_Data, chunk);
+                if (AP4_FAILED(result)) break;
+                m_SourcePosition += chunk;
+            }
+        } else {
+            result = m_Source.Seek(position);
+            if (AP4_SUCCEEDED(result)) m_SourcePosition = position;
+        }
+    }
+    AP4_Size bytes_read = 0;
+    if (AP4_SUCCEEDED(result)) {
+        result = m_Source.ReadPartial(window.m_Data, size, bytes_read);
+        if (AP4_SUCCEEDED(result) && bytes_read == 0) result = AP4_ERROR_EOS;
+    }
+    if (AP4_SUCCEEDED(result)) {
+        m_SourcePosition += bytes_read;
+    } else if (result != AP4_ERROR_EOS) {
+        m_SourcePosition = AP4_READ_AHEAD_UNKNOWN_POSITION;
+    }
+    m_SourceLock.Unlock();
+
+    m_Lock.Lock();
+    m_Filling = false;
+    if (generation == m_Generation) {
+        // the consumer did not seek away in the meantime
+        if (AP4_SUCCEEDED(result)) {
+            window.m_Position  = position;
+            window.m_Size      = bytes_read;
+            m_NextPosition    += bytes_read;
+            m_BytesPrefetched += bytes_read;
+            ++m_FilledCount;
+        } else {
+            m_SourceResult = result;
+        }
+    }
+    m_Filled.Broadcast();
+    if (m_FilledCount < m_FillLimit && AP4_SUCCEEDED(m_SourceResult)) {
+        m_CanFill.Signal();
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::DropWindow
++---------------------------------------------------------------------*/
+void
+AP4_ReadAheadInputStream::DropWindow()
+{
+    // called with m_Lock held
+    m_WindowIndex = (m_WindowIndex+1)%m_WindowCount;
+    m_WindowPosition = 0;
+    --m_FilledCount;
+    if (m_FilledCount < m_FillLimit) m_CanFill.Signal();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ReadAheadInputStream::ReadPartial(void*     buffer,
+                                      AP4_Size  bytes_to_read,
+                                      AP4_Size& bytes_read)
+{
+    // check for shortcut
+    bytes_read = 0;
+    if (bytes_to_read == 0) return AP4_SUCCESS;
+
+    // get to a window with some data available
+    bool     stalled = false;
+    AP4_UI64 stall_start = 0;
+    m_Lock.Lock();
+    for (;;) {
+        if (m_FilledCount) {
+            if (m_WindowPosition < m_Windows[m_WindowIndex].m_Size) break;
+            if (m_FilledCount > 1) {
+                DropWindow();
+                continue;
+            }
+        }
+        if (AP4_FAILED(m_SourceResult)) {
+            AP4_Result result = m_SourceResult;
+            m_Lock.Unlock();
+            return result;
+        }
+
+        // reading on past a window: read ahead as far as we can
+        if (m_FilledCount && m_FillLimit != m_WindowCount) {
+            m_FillLimit = m_WindowCount;
+            m_CanFill.Signal();
+        }
+
+        // we need to wait for the source
+        if (!stalled) {
+            stalled = true;
+            stall_start = AP4_System_GetTimeStampUs();
+            ++m_StallCount;
+        }
+        if (m_Filling || (m_Threaded && m_FilledCount)) {
+            m_Filled.Wait(m_Lock);
+        } else {
+            // nobody is reading ahead for us. Right after a seek, only
+            // read what was asked for, in case this is a random access
+            AP4_Size size = m_BufferSize;
+            if (m_FillLimit == 0 && bytes_to_read < size) size = bytes_to_read;
+            FillWindow(size);
+        }
+    }
+    if (stalled) m_StallTime += AP4_System_GetTimeStampUs()-stall_start;
+
+    // the filled windows are only touched by the consumer
+    const Window& window = m_Windows[m_WindowIndex];
+    m_Lock.Unlock();
+
+    // copy the buffered data
+    AP4_Size available = window.m_Size-m_WindowPosition;
+    if (bytes_to_read > available) bytes_to_read = available;
+    AP4_CopyMemory(buffer, window.m_Data+m_WindowPosition, bytes_to_read);
+    m_WindowPosition += bytes_to_read;
+    bytes_read = bytes_to_read;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ReadAheadInputStream::WritePartial(const void* /*buffer*/,
+                                       AP4_Size    /*bytes_to_write*/,
+                                       AP4_Size&   /*bytes_written*/)
+{
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ReadAheadInputStream::Seek(AP4_Position position)
+{
+    AP4_AutoLock lock(m_Lock);
+    for (;;) {
+        // look for the position in the windows we already have
+        for (unsigned int i=0; i<m_FilledCount; i++) {
+            const Window& window = m_Windows[(m_WindowIndex+i)%m_WindowCount];
+            if (position >= window.m_Position &&
+                position <= window.m_Position+window.m_Size) {
+                for (unsigned int j=0; j<i; j++) {
+                    DropWindow();
+                }
+                m_WindowPosition = (AP4_Size)(position-window.m_Position);
+                return AP4_SUCCESS;
+            }
+        }
+
+        // if the position is in the window being filled, wait for it
+        if (m_Filling &&
+            position >= m_NextPosition &&
+            position <  m_NextPosition+m_BufferSize) {
+            m_Filled.Wait(m_Lock);
+            continue;
+        }
+        break;
+    }
+
+    // out of the buffers: start again from the new position, but don't read
+    // ahead until the reads look sequential again, so that random accesses
+    // don't pay for data they will never use
+    ++m_Generation;
+    m_FilledCount    = 0;
+    m_FillLimit      = 0;
+    m_WindowPosition = 0;
+    m_NextPosition   = position;
+    m_SourceResult   = AP4_SUCCESS;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::Tell
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ReadAheadInputStream::Tell(AP4_Position& position)
+{
+    AP4_AutoLock lock(m_Lock);
+    if (m_FilledCount) {
+        position = m_Windows[m_WindowIndex].m_Position+m_WindowPosition;
+    } else {
+        position = m_NextPosition;
+    }
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::GetSize
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_ReadAheadInputStream::GetSize(AP4_LargeSize& size)
+{
+    AP4_AutoLock lock(m_SourceLock);
+    return m_Source.GetSize(size);
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::GetBytesPrefetched
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_ReadAheadInputStream::GetBytesPrefetched()
+{
+    AP4_AutoLock lock(m_Lock);
+    return m_BytesPrefetched;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::GetStallCount
++---------------------------------------------------------------------*/
+AP4_Cardinal
+AP4_ReadAheadInputStream::GetStallCount()
+{
+    AP4_AutoLock lock(m_Lock);
+    return m_StallCount;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::GetStallTime
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_ReadAheadInputStream::GetStallTime()
+{
+    AP4_AutoLock lock(m_Lock);
+    return m_StallTime;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::AddReference
++---------------------------------------------------------------------*/
+void
+AP4_ReadAheadInputStream::AddReference()
+{
+    m_ReferenceCount++;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream::Release
++---------------------------------------------------------------------*/
+void
+AP4_ReadAheadInputStream::Release()
+{
+    if (--m_ReferenceCount == 0) {
+        delete this;
+    }
+}
@@ -0,0 +1,147 @@
+/*****************************************************************
+|
+|    AP4 - Read-Ahead Input Stream
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_READ_AHEAD_INPUT_STREAM_H_
+#define _AP4_READ_AHEAD_INPUT_STREAM_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+#include "Ap4ByteStream.h"
+#include "Ap4Threads.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size     AP4_READ_AHEAD_INPUT_STREAM_DEFAULT_BUFFER_SIZE  = 64*1024;
+const AP4_Cardinal AP4_READ_AHEAD_INPUT_STREAM_DEFAULT_BUFFER_COUNT = 3;
+
+/*----------------------------------------------------------------------
+|   AP4_ReadAheadInputStream
++---------------------------------------------------------------------*/
+/**
+ * Buffered input stream that reads the next buffers from its source on a
+ * background thread while the current one is being consumed.
+ *
+ * Like AP4_BufferedInputStream, a forward seek that lands less than
+ * seek_as_read_threshold bytes past what has already been read is done by
+ * reading and discarding data rather than by seeking the source. Seeks
+ * within the buffers already read never touch the source. A seek out of
+ * the buffers always succeeds; a failure to seek the source is reported
+ * by the next read.
+ *
+ * On platforms without threads, the buffers are filled synchronously
+ * when they run dry.
+ */
+class AP4_ReadAheadInputStream : public AP4_ByteStream
+{
+public:
+    AP4_ReadAheadInputStream(AP4_ByteStream& source,
+                             AP4_Size        buffer_size=AP4_READ_AHEAD_INPUT_STREAM_DEFAULT_BUFFER_SIZE,
+                             AP4_Cardinal    buffer_count=AP4_READ_AHEAD_INPUT_STREAM_DEFAULT_BUFFER_COUNT,
+                             AP4_Size        seek_as_read_threshold=1024*128);
+
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void*     buffer,
+                           AP4_Size  bytes_to_read,
+                           AP4_Size& bytes_read);
+    AP4_Result WritePartial(const void* buffer,
+                            AP4_Size    bytes_to_write,
+                            AP4_Size&   bytes_written);
+    AP4_Result Seek(AP4_Position position);
+    AP4_Result Tell(AP4_Position& position);
+    AP4_Result GetSize(AP4_LargeSize& size);
+    AP4_Result BorrowData(AP4_Position     position,
+                          AP4_Size         size,
+                          const AP4_UI08*& data) {
+        return m_Source.BorrowData(position, size, data);
+    }
+
+    // AP4_Referenceable methods
+    void AddReference();
+    void Release();
+
+    // statistics
+    AP4_UI64     GetBytesPrefetched(); // bytes read from the source into the buffers
+    AP4_Cardinal GetStallCount();      // reads that had to wait for the source
+    AP4_UI64     GetStallTime();       // time spent waiting, in microseconds
+
+protected:
+   ~AP4_ReadAheadInputStream();
+
+private:
+    // types
+    class Worker : public AP4_Thread {
+    public:
+        Worker(AP4_ReadAheadInputStream& stream) : m_Stream(stream) {}
+    protected:
+        void Run() { m_Stream.RunWorker(); }
+    private:
+        AP4_ReadAheadInputStream& m_Stream;
+    };
+    struct Window {
+        AP4_UI08*    m_Data;
+        AP4_Position m_Position;
+        AP4_Size     m_Size;
+    };
+
+    // methods
+    void RunWorker();
+    void FillWindow(AP4_Size size);
+    void DropWindow();
+
+    // members
+    AP4_ByteStream& m_Source;
+    AP4_Position    m_SourcePosition;
+    AP4_Size        m_BufferSize;
+    AP4_Size        m_SeekAsReadThreshold;
+    AP4_Cardinal    m_ReferenceCount;
+    Window*         m_Windows;
+    AP4_Cardinal    m_WindowCount;
+    AP4_Ordinal     m_WindowIndex;    // the window being consumed
+    AP4_Cardinal    m_FilledCount;    // windows with data, from m_WindowIndex
+    AP4_Cardinal    m_FillLimit;      // how many windows to fill ahead of time
+    AP4_Size        m_WindowPosition; // read position in the current window
+    AP4_Position    m_NextPosition;   // where the next window starts
+    AP4_Result      m_SourceResult;   // error or end of stream at m_NextPosition
+    AP4_UI32        m_Generation;     // incremented when the windows are reset
+    bool            m_Filling;
+    bool            m_Terminating;
+    bool            m_Threaded;
+    AP4_Mutex       m_Lock;
+    AP4_Mutex       m_SourceLock;
+    AP4_Condition   m_CanFill;        // signaled when the worker may have work
+    AP4_Condition   m_Filled;         // signaled when a window fill completes
+    Worker          m_Worker;
+    AP4_UI64        m_BytesPrefetched;
+    AP4_Cardinal    m_StallCount;
+    AP4_UI64        m_StallTime;
+};
+
+#endif // _AP4_READ_AHEAD_INPUT_STREAM_H_
@@ -143,7 +143,8 @@ AP4_Sample::ReadData(AP4_DataBuffer& data, AP4_Size size, AP4_Size offset)
     // check the size
     if (m_Size < size+offset) return AP4_FAILURE;
 
-    // set the buffer size
+    // set the buffer size (the previous contents don't need to be kept)
+    data.SetDataSize(0);
     AP4_Result result = data.SetDataSize(size);
     if (AP4_FAILED(result)) return result;
 
@@ -153,6 +154,25 @@ AP4_Sample::ReadData(AP4_DataBuffer& data, AP4_Size size, AP4_Size offset)
     return m_DataStream->Read(data.UseData(), size);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Sample::ReadDataView
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Sample::ReadDataView(AP4_DataBuffer& data)
+{
+    // check that we have a stream
+    if (m_DataStream == NULL) return AP4_FAILURE;
+
+    // try to borrow the data from the stream
+    const AP4_UI08* view = NULL;
+    if (m_Size && AP4_SUCCEEDED(m_DataStream->BorrowData(m_Offset, m_Size, view))) {
+        return data.SetDataView(view, m_Size);
+    }
+    
+    // fall back to a copy
+    return ReadData(data);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Sample::GetDataStream
 +---------------------------------------------------------------------*/
@@ -91,6 +91,15 @@ public:
     AP4_Result      ReadData(AP4_DataBuffer& data, 
                              AP4_Size        size, 
                              AP4_Size        offset = 0);
+    
+    /**
+     * Read the sample data without copying it when the data stream holds
+     * it in memory (see AP4_ByteStream::BorrowData), by making the buffer a
+     * read-only view (see AP4_DataBuffer::SetDataView) that remains valid
+     * for as long as the data stream does. Other streams are read as with
+     * ReadData().
+     */
+    AP4_Result      ReadDataView(AP4_DataBuffer& data);
     void            Detach();
     
     // sample properties accessors
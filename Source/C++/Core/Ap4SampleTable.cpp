@@ -40,6 +40,18 @@
 #include "Ap4StssAtom.h"
 #include "Ap4CttsAtom.h"
 #include "Ap4Sample.h"
+#include "Ap4DataBuffer.h"
+#include "Ap4ByteStream.h"
+
+/*----------------------------------------------------------------------
+|   AP4_SampleDataRun
++---------------------------------------------------------------------*/
+struct AP4_SampleDataRun {
+    AP4_ByteStream* m_Stream;
+    AP4_Position    m_Offset;
+    AP4_Size        m_Size;
+    AP4_Size        m_DataOffset; // where the run goes in the output buffer
+};
 
 /*----------------------------------------------------------------------
 |   AP4_SampleTable Dynamic Cast Anchor
@@ -212,3 +224,89 @@ AP4_SampleTable::GenerateStblAtom(AP4_ContainerAtom*& stbl)
 
     return AP4_SUCCESS;
 }
+
+/*----------------------------------------------------------------------
+|   AP4_SampleTable::ReadSamples
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_SampleTable::ReadSamples(AP4_Ordinal                first_sample,
+                             AP4_Cardinal               sample_count,
+                             AP4_DataBuffer&            data,
+                             AP4_Array<AP4_SampleSpan>& spans,
+                             AP4_Size                   max_size)
+{
+    // start empty
+    data.SetDataSize(0);
+    spans.Clear();
+
+    // check the range
+    AP4_Cardinal total_count = GetSampleCount();
+    if (sample_count == 0) return AP4_SUCCESS;
+    if (first_sample >= total_count) return AP4_ERROR_OUT_OF_RANGE;
+    if (sample_count > total_count-first_sample) {
+        sample_count = total_count-first_sample;
+    }
+
+    // group the samples into runs of contiguous data
+    AP4_Array<AP4_SampleDataRun> runs;
+    AP4_Sample sample;
+    AP4_Size   data_size = 0;
+    AP4_Result result = AP4_SUCCESS;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        result = GetSample(first_sample+i, sample);
+        if (AP4_FAILED(result)) break;
+        AP4_Size sample_size = sample.GetSize();
+        if (i) {
+            // stop when the buffer would get too large
+            if (data_size+sample_size < data_size) break;
+            if (max_size && data_size+sample_size > max_size) break;
+        }
+        AP4_ByteStream* stream = sample.GetDataStream();
+        if (stream == NULL) {
+            result = AP4_ERROR_INVALID_STATE;
+            break;
+        }
+        AP4_SampleDataRun* run = runs.ItemCount()?&runs[runs.ItemCount()-1]:NULL;
+        if (run && run->m_Stream == stream && run->m_Offset+run->m_Size == sample.GetOffset()) {
+            run->m_Size += sample_size;
+            stream->Release();
+        } else {
+            AP4_SampleDataRun new_run = { stream, sample.GetOffset(), sample_size, data_size };
+            runs.Append(new_run);
+        }
+        AP4_SampleSpan span = { data_size, sample_size };
+        spans.Append(span);
+        data_size += sample_size;
+    }
+
+    // read the runs
+    if (AP4_SUCCEEDED(result)) {
+        const AP4_UI08* view = NULL;
+        if (runs.ItemCount() == 1 && data_size &&
+            AP4_SUCCEEDED(runs[0].m_Stream->BorrowData(runs[0].m_Offset, data_size, view))) {
+            // all the data is in one place, no need to copy it
+            result = data.SetDataView(view, data_size);
+        } else {
+            result = data.SetDataSize(data_size);
+            for (unsigned int i=0; AP4_SUCCEEDED(result) && i<runs.ItemCount(); i++) {
+                AP4_SampleDataRun& run = runs[i];
+                if (run.m_Size == 0) continue;
+                result = run.m_Stream->Seek(run.m_Offset);
+                if (AP4_SUCCEEDED(result)) {
+                    result = run.m_Stream->Read(data.UseData()+run.m_DataOffset, run.m_Size);
+                }
+            }
+        }
+    }
+
+    // cleanup
+    for (unsigned int i=0; i<runs.ItemCount(); i++) {
+        runs[i].m_Stream->Release();
+    }
+    if (AP4_FAILED(result)) {
+        data.SetDataSize(0);
+        spans.Clear();
+    }
+
+    return result;
+}
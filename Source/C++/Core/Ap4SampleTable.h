@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
 #include "Ap4DynamicCast.h"
+#include "Ap4Array.h"
 
 /*----------------------------------------------------------------------
 |   class references
@@ -41,6 +42,19 @@
 class AP4_Sample;
 class AP4_ContainerAtom;
 class AP4_SampleDescription;
+class AP4_DataBuffer;
+
+/*----------------------------------------------------------------------
+|   AP4_SampleSpan
++---------------------------------------------------------------------*/
+/**
+ * Location of the data of one sample within the buffer returned by
+ * AP4_SampleTable::ReadSamples.
+ */
+struct AP4_SampleSpan {
+    AP4_Size m_Offset;
+    AP4_Size m_Size;
+};
 
 /*----------------------------------------------------------------------
 |   AP4_SampleTable
@@ -64,6 +78,21 @@ public:
     virtual AP4_Result   GetSampleIndexForTimeStamp(AP4_UI64     ts,
                                                     AP4_Ordinal& index) = 0;
     virtual AP4_Ordinal  GetNearestSyncSampleIndex(AP4_Ordinal index, bool before=true) = 0;
+
+    /**
+     * Read the data of consecutive samples, starting at first_sample, into
+     * one buffer. Samples that are contiguous in their data stream (typically
+     * the samples of a chunk) are read with a single seek and read.
+     * When max_size is not 0, reading stops before the first sample that
+     * would make the data larger than max_size, but at least one sample is
+     * always read. On return, spans has one entry per sample read, giving
+     * the position of that sample's data in data.
+     */
+    virtual AP4_Result   ReadSamples(AP4_Ordinal                first_sample,
+                                     AP4_Cardinal               sample_count,
+                                     AP4_DataBuffer&            data,
+                                     AP4_Array<AP4_SampleSpan>& spans,
+                                     AP4_Size                   max_size = 0);
 };
 
 #endif // _AP4_SAMPLE_TABLE_H_
@@ -51,6 +51,25 @@ AP4_SidxAtom::Create(AP4_Size size, AP4_ByteStream& stream)
     return new AP4_SidxAtom(size, version, flags, stream);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SidxAtom::AP4_SidxAtom
++---------------------------------------------------------------------*/
+AP4_SidxAtom::AP4_SidxAtom(AP4_UI32 reference_id,
+                           AP4_UI32 timescale,
+                           AP4_UI64 earliest_presentation_time,
+                           AP4_UI64 first_offset) :
+    AP4_Atom(AP4_ATOM_TYPE_SIDX, 0, 0, 0),
+    m_ReferenceId(reference_id),
+    m_TimeScale(timescale),
+    m_EarliestPresentationTime(earliest_presentation_time),
+    m_FirstOffset(first_offset)
+{
+    if (earliest_presentation_time > 0xFFFFFFFFULL || first_offset > 0xFFFFFFFFULL) {
+        m_Version = 1;
+    }
+    SetReferenceCount(0);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SidxAtom::AP4_SidxAtom
 +---------------------------------------------------------------------*/
@@ -95,6 +114,16 @@ AP4_SidxAtom::AP4_SidxAtom(AP4_UI32        size,
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SidxAtom::SetReferenceCount
++---------------------------------------------------------------------*/
+void
+AP4_SidxAtom::SetReferenceCount(unsigned int count)
+{
+    m_References.SetItemCount(count);
+    m_Size32 = AP4_FULL_ATOM_HEADER_SIZE+4+4+(m_Version==0?8:16)+2+2+count*12;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SidxAtom::WriteFields
 +---------------------------------------------------------------------*/
@@ -42,13 +42,13 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_StcoAtom)
 |   AP4_StcoAtom::Create
 +---------------------------------------------------------------------*/
 AP4_StcoAtom*
-AP4_StcoAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_StcoAtom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StcoAtom(size, version, flags, stream);
+    return new AP4_StcoAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
@@ -70,13 +70,28 @@ AP4_Atom(AP4_ATOM_TYPE_STCO,
 AP4_StcoAtom::AP4_StcoAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_STCO, size, version, flags)
 {
     stream.ReadUI32(m_EntryCount);
     if (m_EntryCount > (size-AP4_FULL_ATOM_HEADER_SIZE-4)/4) {
         m_EntryCount = (size-AP4_FULL_ATOM_HEADER_SIZE-4)/4;
     }
+    if (lazy) {
+        m_Entries = NULL;
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StcoAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_StcoAtom::ReadEntries(AP4_ByteStream& stream)
+{
     m_Entries = new AP4_UI32[m_EntryCount];
     unsigned char* buffer = new unsigned char[m_EntryCount*4];
     AP4_Result result = stream.Read(buffer, m_EntryCount*4);
@@ -90,6 +105,18 @@ AP4_StcoAtom::AP4_StcoAtom(AP4_UI32        size,
     delete[] buffer;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StcoAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_StcoAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StcoAtom::~AP4_StcoAtom
 +---------------------------------------------------------------------*/
@@ -110,6 +137,7 @@ AP4_StcoAtom::GetChunkOffset(AP4_Ordinal chunk, AP4_UI32& chunk_offset)
     }
 
     // get the chunk offset
+    LoadEntries();
     chunk_offset = m_Entries[chunk - 1]; // m_Entries is zero index based
 
     return AP4_SUCCESS;
@@ -127,6 +155,7 @@ AP4_StcoAtom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI32 chunk_offset)
     }
 
     // get the chunk offset
+    LoadEntries();
     m_Entries[chunk - 1] = chunk_offset; // m_Entries is zero index based
 
     return AP4_SUCCESS;
@@ -138,6 +167,7 @@ AP4_StcoAtom::SetChunkOffset(AP4_Ordinal chunk, AP4_UI32 chunk_offset)
 AP4_Result
 AP4_StcoAtom::AdjustChunkOffsets(int delta)
 {
+    LoadEntries();
     for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
         m_Entries[i] += delta;
     }
@@ -153,6 +183,9 @@ AP4_StcoAtom::WriteFields(AP4_ByteStream& stream)
 {
     AP4_Result result;
 
+    // make sure the entries have been read
+    LoadEntries();
+
     // entry count
     result = stream.WriteUI32(m_EntryCount);
     if (AP4_FAILED(result)) return result;
@@ -174,6 +207,7 @@ AP4_StcoAtom::InspectFields(AP4_AtomInspector& inspector)
 {
     inspector.AddField("entry_count", m_EntryCount);
     if (inspector.GetVerbosity() >= 1) {
+        LoadEntries();
         char header[32];
         for (AP4_Ordinal i=0; i<m_EntryCount; i++) {
             AP4_FormatString(header, sizeof(header), "entry %8d", i);
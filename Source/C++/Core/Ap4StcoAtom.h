@@ -44,7 +44,7 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_StcoAtom, AP4_Atom)
 
     // class methods
-    static AP4_StcoAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_StcoAtom* Create(AP4_Size size, AP4_ByteStream& stream, bool lazy = false);
 
     // methods
     AP4_StcoAtom(AP4_UI32* offsets, AP4_UI32 offset_count);
@@ -52,7 +52,7 @@ public:
     virtual AP4_Result InspectFields(AP4_AtomInspector& inspector);
     virtual AP4_Result WriteFields(AP4_ByteStream& stream);
     AP4_Cardinal GetChunkCount()   { return m_EntryCount;  }
-    AP4_UI32*    GetChunkOffsets() { return m_Entries;     }
+    AP4_UI32*    GetChunkOffsets() { LoadEntries(); return m_Entries; }
     AP4_Result   GetChunkOffset(AP4_Ordinal chunk, AP4_UI32& chunk_offset);
     AP4_Result   SetChunkOffset(AP4_Ordinal chunk, AP4_UI32  chunk_offset);
     AP4_Result   AdjustChunkOffsets(int delta);
@@ -62,11 +62,16 @@ private:
     AP4_StcoAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
 
     // members
-    AP4_UI32* m_Entries;
-    AP4_UI32  m_EntryCount;
+    AP4_UI32*            m_Entries;
+    AP4_UI32             m_EntryCount;
+    AP4_DeferredAtomData m_DeferredEntries;
 };
 
 #endif // _AP4_STCO_ATOM_H_
@@ -42,13 +42,13 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_StscAtom)
 |   AP4_StscAtom::Create
 +---------------------------------------------------------------------*/
 AP4_StscAtom*
-AP4_StscAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_StscAtom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StscAtom(size, version, flags, stream);
+    return new AP4_StscAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
@@ -66,9 +66,23 @@ AP4_StscAtom::AP4_StscAtom() :
 AP4_StscAtom::AP4_StscAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_STSC, size, version, flags),
     m_CachedChunkGroup(0)
+{
+    if (lazy) {
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StscAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_StscAtom::ReadEntries(AP4_ByteStream& stream)
 {
     AP4_UI32 first_sample = 1;
     AP4_UI32 entry_count;
@@ -98,12 +112,27 @@ AP4_StscAtom::AP4_StscAtom(AP4_UI32        size,
     delete[] buffer;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StscAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_StscAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StscAtom::WriteFields
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_StscAtom::WriteFields(AP4_ByteStream& stream)
 {
+    // make sure the entries have been read
+    LoadEntries();
+
     AP4_Result result;
 
     // entry count
@@ -131,6 +160,7 @@ AP4_StscAtom::AddEntry(AP4_Cardinal chunk_count,
                        AP4_Cardinal samples_per_chunk,
                        AP4_Ordinal  sample_description_index)
 {
+    LoadEntries();
     AP4_Ordinal first_chunk;
     AP4_Ordinal first_sample;
     AP4_Cardinal entry_count = m_Entries.ItemCount();
@@ -162,6 +192,7 @@ AP4_StscAtom::GetChunkForSample(AP4_Ordinal  sample,
                                 AP4_Ordinal& skip,
                                 AP4_Ordinal& sample_description_index)
 {
+    LoadEntries();
     // preconditions
     AP4_ASSERT(sample > 0);
 
@@ -228,6 +259,7 @@ AP4_StscAtom::GetChunkForSample(AP4_Ordinal  sample,
 AP4_Result
 AP4_StscAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     // dump table entries
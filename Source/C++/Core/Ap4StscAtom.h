@@ -82,7 +82,7 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_StscAtom, AP4_Atom)
     
     // class methods
-    static AP4_StscAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_StscAtom* Create(AP4_Size size, AP4_ByteStream& stream, bool lazy = false);
 
     // methods
     AP4_StscAtom();
@@ -101,11 +101,16 @@ private:
     AP4_StscAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
 
     // members
     AP4_Array<AP4_StscTableEntry> m_Entries;
     AP4_Ordinal                   m_CachedChunkGroup;
+    AP4_DeferredAtomData          m_DeferredEntries;
 };
 
 #endif // _AP4_STSC_ATOM_H_
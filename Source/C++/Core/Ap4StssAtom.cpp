@@ -42,20 +42,27 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_StssAtom)
 |   AP4_StssAtom::Create
 +---------------------------------------------------------------------*/
 AP4_StssAtom*
-AP4_StssAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_StssAtom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StssAtom(size, version, flags, stream);
+    return new AP4_StssAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
 |   AP4_StssAtom::AP4_StssAtom
 +---------------------------------------------------------------------*/
 AP4_StssAtom::AP4_StssAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_STSS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_LookupCache(0),
+    m_Sorted(true),
+    m_UseBitmap(false),
+    m_BitmapPending(false),
+    m_Bitmap(NULL),
+    m_BitmapRanks(NULL),
+    m_BitmapWordCount(0)
 {
 }
 
@@ -65,15 +72,35 @@ AP4_StssAtom::AP4_StssAtom() :
 AP4_StssAtom::AP4_StssAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_STSS, size, version, flags),
-    m_LookupCache(0)
+    m_LookupCache(0),
+    m_Sorted(true),
+    m_UseBitmap(false),
+    m_BitmapPending(false),
+    m_Bitmap(NULL),
+    m_BitmapRanks(NULL),
+    m_BitmapWordCount(0)
+{
+    if (lazy) {
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_StssAtom::ReadEntries(AP4_ByteStream& stream)
 {
     AP4_UI32 entry_count;
     stream.ReadUI32(entry_count);
     
     // check for bogus values
-    if (entry_count*4 > size) return;
+    if (entry_count*4 > m_Size32) return;
     
     // read the table into a local array for conversion
     unsigned char* buffer = new unsigned char[entry_count*4];
@@ -85,16 +112,40 @@ AP4_StssAtom::AP4_StssAtom(AP4_UI32        size,
     m_Entries.SetItemCount(entry_count);
     for (unsigned int i=0; i<entry_count; i++) {
         m_Entries[i] = AP4_BytesToUInt32BE(&buffer[i*4]);
+        if (i && m_Entries[i] <= m_Entries[i-1]) m_Sorted = false;
     }
     delete[] buffer;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_StssAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::~AP4_StssAtom
++---------------------------------------------------------------------*/
+AP4_StssAtom::~AP4_StssAtom()
+{
+    ReleaseBitmap();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StssAtom::WriteFields
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_StssAtom::WriteFields(AP4_ByteStream& stream)
 {
+    // make sure the entries have been read
+    LoadEntries();
+
     AP4_Result result;
 
     // entry count
@@ -117,23 +168,188 @@ AP4_StssAtom::WriteFields(AP4_ByteStream& stream)
 AP4_Result
 AP4_StssAtom::AddEntry(AP4_UI32 sample)
 {
+    LoadEntries();
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    if (entry_count && sample <= m_Entries[entry_count-1]) m_Sorted = false;
     m_Entries.Append(sample);
     m_Size32 += 4;
+
+    // the bitmap, if used, will be rebuilt on the next lookup
+    ReleaseBitmap();
+    m_BitmapPending = m_UseBitmap;
     
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_PopCount
++---------------------------------------------------------------------*/
+static inline AP4_UI32
+AP4_PopCount(AP4_UI64 x)
+{
+#if defined(__GNUC__)
+    return (AP4_UI32)__builtin_popcountll(x);
+#else
+    x = x-((x>>1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL)+((x>>2) & 0x3333333333333333ULL);
+    x = (x+(x>>4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (AP4_UI32)((x*0x0101010101010101ULL)>>56);
+#endif
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::UseBitmap
++---------------------------------------------------------------------*/
+void
+AP4_StssAtom::UseBitmap(bool use_bitmap)
+{
+    m_UseBitmap     = use_bitmap;
+    m_BitmapPending = use_bitmap && m_Bitmap == NULL;
+    if (!use_bitmap) ReleaseBitmap();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::HasBitmap
++---------------------------------------------------------------------*/
+bool
+AP4_StssAtom::HasBitmap()
+{
+    if (m_Bitmap) return true;
+    if (!m_BitmapPending) return false;
+
+    // only try once
+    m_BitmapPending = false;
+    return AP4_SUCCEEDED(BuildBitmap());
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::BuildBitmap
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_StssAtom::BuildBitmap()
+{
+    ReleaseBitmap();
+    
+    // we need strictly increasing entries for the ranks to be meaningful
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    if (!m_Sorted) return AP4_ERROR_NOT_SUPPORTED;
+    
+    // check the size
+    AP4_UI64 word_count = 1;
+    if (entry_count) word_count += m_Entries[entry_count-1]/64;
+    if (word_count*(sizeof(AP4_UI64)+sizeof(AP4_UI32)) > AP4_STSS_ATOM_MAX_BITMAP_SIZE) {
+        return AP4_ERROR_OUT_OF_RANGE;
+    }
+    m_BitmapWordCount = (AP4_Cardinal)word_count;
+    m_Bitmap          = new AP4_UI64[m_BitmapWordCount];
+    m_BitmapRanks     = new AP4_UI32[m_BitmapWordCount];
+    AP4_SetMemory(m_Bitmap, 0, m_BitmapWordCount*sizeof(AP4_UI64));
+    
+    // set the bits
+    for (unsigned int i=0; i<entry_count; i++) {
+        AP4_UI32 sample = m_Entries[i];
+        m_Bitmap[sample/64] |= ((AP4_UI64)1)<<(sample%64);
+    }
+    
+    // compute the ranks
+    AP4_UI32 rank = 0;
+    for (unsigned int i=0; i<m_BitmapWordCount; i++) {
+        m_BitmapRanks[i] = rank;
+        rank += AP4_PopCount(m_Bitmap[i]);
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::ReleaseBitmap
++---------------------------------------------------------------------*/
+void
+AP4_StssAtom::ReleaseBitmap()
+{
+    delete[] m_Bitmap;
+    delete[] m_BitmapRanks;
+    m_Bitmap          = NULL;
+    m_BitmapRanks     = NULL;
+    m_BitmapWordCount = 0;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StssAtom::GetEntryIndexForSample
++---------------------------------------------------------------------*/
+AP4_Ordinal
+AP4_StssAtom::GetEntryIndexForSample(AP4_Ordinal sample)
+{
+    LoadEntries();
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+
+    // if the table is not sorted, we can only do a linear search
+    if (!m_Sorted) {
+        for (unsigned int i=0; i<entry_count; i++) {
+            if (m_Entries[i] >= sample) return i;
+        }
+        return entry_count;
+    }
+    
+    // with a bitmap, the index is the number of bits set before the sample
+    if (HasBitmap()) {
+        AP4_UI32 word = sample/64;
+        if (word >= m_BitmapWordCount) return entry_count;
+        AP4_UI64 mask = (((AP4_UI64)1)<<(sample%64))-1;
+        return m_BitmapRanks[word]+AP4_PopCount(m_Bitmap[word] & mask);
+    }
+
+    // binary search
+    AP4_Ordinal lo = 0;
+    AP4_Ordinal hi = entry_count;
+    while (lo < hi) {
+        AP4_Ordinal mid = lo+(hi-lo)/2;
+        if (m_Entries[mid] < sample) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_StssAtom::IsSampleSync
 +---------------------------------------------------------------------*/
 bool
 AP4_StssAtom::IsSampleSync(AP4_Ordinal sample)
 {
+    LoadEntries();
     unsigned int entry_index = 0;
 
     // check bounds
     if (sample == 0 || m_Entries.ItemCount() == 0) return false;
 
+    // use the bitmap or a binary search when we can
+    if (m_Sorted) {
+        if (HasBitmap()) {
+            AP4_UI32 word = sample/64;
+            return word < m_BitmapWordCount && 
+                   (m_Bitmap[word] & (((AP4_UI64)1)<<(sample%64))) != 0;
+        }
+        
+        // check the cached entry first, sequential access hits it or the next one
+        if (m_LookupCache+1 < m_Entries.ItemCount() &&
+            m_Entries[m_LookupCache] <= sample &&
+            m_Entries[m_LookupCache+1] > sample) {
+            return m_Entries[m_LookupCache] == sample;
+        }
+        entry_index = GetEntryIndexForSample(sample);
+        if (entry_index == m_Entries.ItemCount()) return false;
+        if (m_Entries[entry_index] == sample) {
+            m_LookupCache = entry_index;
+            return true;
+        }
+        if (entry_index) m_LookupCache = entry_index-1;
+        return false;
+    }
+
     // see if we can start from the cached index
     if (m_Entries[m_LookupCache] <= sample) {
         entry_index = m_LookupCache;
@@ -158,6 +374,7 @@ AP4_StssAtom::IsSampleSync(AP4_Ordinal sample)
 AP4_Result
 AP4_StssAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     return AP4_SUCCESS;
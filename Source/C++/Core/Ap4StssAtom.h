@@ -35,6 +35,11 @@
 #include "Ap4Array.h"
 #include "Ap4Atom.h"
 
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_STSS_ATOM_MAX_BITMAP_SIZE = 16*1024*1024;
+
 /*----------------------------------------------------------------------
 |   AP4_StssAtom
 +---------------------------------------------------------------------*/
@@ -44,29 +49,63 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_StssAtom, AP4_Atom)
 
     // class methods
-    static AP4_StssAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_StssAtom* Create(AP4_Size size, AP4_ByteStream& stream, bool lazy = false);
 
-    // constructor
+    // constructor and destructor
     AP4_StssAtom();
+    ~AP4_StssAtom();
     
     // methods
-    // methods
-    const AP4_Array<AP4_UI32>& GetEntries() { return m_Entries; }
+    const AP4_Array<AP4_UI32>& GetEntries() { LoadEntries(); return m_Entries; }
     AP4_Result                 AddEntry(AP4_UI32 sample);
     virtual AP4_Result         InspectFields(AP4_AtomInspector& inspector);
     virtual bool               IsSampleSync(AP4_Ordinal sample);
     virtual AP4_Result         WriteFields(AP4_ByteStream& stream);
+    
+    /**
+     * Returns the index of the first entry that is greater than or equal
+     * to a (1-based) sample number, or the entry count if there is none.
+     * The entries before that index are the sync samples that precede
+     * the sample.
+     */
+    AP4_Ordinal GetEntryIndexForSample(AP4_Ordinal sample);
+    
+    /**
+     * Use a bitmap of the sync samples, with a per-word rank table, for 
+     * lookups instead of a binary search over the entries. This makes 
+     * IsSampleSync() and GetEntryIndexForSample() O(1), at a cost of 1.5
+     * bits per sample (not per entry), so it is mostly worth it for dense
+     * tables. The bitmap is built on the next lookup. It is not used if the
+     * entries are not in strictly increasing order or if it would be larger
+     * than AP4_STSS_ATOM_MAX_BITMAP_SIZE.
+     */
+    void UseBitmap(bool use_bitmap);
+    bool IsUsingBitmap() { return m_UseBitmap; }
 
 private:
     // methods
     AP4_StssAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
+    bool       HasBitmap();
+    AP4_Result BuildBitmap();
+    void       ReleaseBitmap();
     
     // members
     AP4_Array<AP4_UI32> m_Entries;
     AP4_Ordinal         m_LookupCache;
+    bool                m_Sorted; // entries are strictly increasing
+    bool                m_UseBitmap;
+    bool                m_BitmapPending;
+    AP4_UI64*           m_Bitmap;      // bit n is set if sample n is sync
+    AP4_UI32*           m_BitmapRanks; // number of bits set before each word
+    AP4_Cardinal        m_BitmapWordCount;
+    AP4_DeferredAtomData m_DeferredEntries;
 };
 
 #endif // _AP4_STSS_ATOM_H_
@@ -42,13 +42,13 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_StszAtom)
 |   AP4_StszAtom::Create
 +---------------------------------------------------------------------*/
 AP4_StszAtom*
-AP4_StszAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_StszAtom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_StszAtom(size, version, flags, stream);
+    return new AP4_StszAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
@@ -67,25 +67,51 @@ AP4_StszAtom::AP4_StszAtom() :
 AP4_StszAtom::AP4_StszAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_STSZ, size, version, flags)
 {
     stream.ReadUI32(m_SampleSize);
     stream.ReadUI32(m_SampleCount);
     if (m_SampleSize == 0) { // means that the samples have different sizes
-        AP4_Cardinal sample_count = m_SampleCount;
-        m_Entries.SetItemCount(sample_count);
-        unsigned char* buffer = new unsigned char[sample_count*4];
-        AP4_Result result = stream.Read(buffer, sample_count*4);
-        if (AP4_FAILED(result)) {
-            delete[] buffer;
-            return;
-        }
-        for (unsigned int i=0; i<sample_count; i++) {
-            m_Entries[i] = AP4_BytesToUInt32BE(&buffer[i*4]);
+        if (lazy) {
+            m_DeferredEntries.Defer(stream);
+        } else {
+            ReadEntries(stream);
         }
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StszAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_StszAtom::ReadEntries(AP4_ByteStream& stream)
+{
+    AP4_Cardinal sample_count = m_SampleCount;
+    m_Entries.SetItemCount(sample_count);
+    unsigned char* buffer = new unsigned char[sample_count*4];
+    AP4_Result result = stream.Read(buffer, sample_count*4);
+    if (AP4_FAILED(result)) {
         delete[] buffer;
+        return;
     }
+    for (unsigned int i=0; i<sample_count; i++) {
+        m_Entries[i] = AP4_BytesToUInt32BE(&buffer[i*4]);
+    }
+    delete[] buffer;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_StszAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_StszAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
 }
 
 /*----------------------------------------------------------------------
@@ -96,6 +122,9 @@ AP4_StszAtom::WriteFields(AP4_ByteStream& stream)
 {
     AP4_Result result;
 
+    // make sure the entries have been read
+    LoadEntries();
+
     // sample size
     result = stream.WriteUI32(m_SampleSize);
     if (AP4_FAILED(result)) return result;
@@ -139,6 +168,7 @@ AP4_StszAtom::GetSampleSize(AP4_Ordinal sample, AP4_Size& sample_size)
         if (m_SampleSize != 0) { // constant size
             sample_size = m_SampleSize;
         } else {
+            LoadEntries();
             sample_size = m_Entries[sample - 1];
         }
         return AP4_SUCCESS;
@@ -155,6 +185,7 @@ AP4_StszAtom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
     if (sample > m_SampleCount || sample == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
     } else {
+        LoadEntries();
         if (m_Entries.ItemCount() == 0) {
             // all samples must have the same size
             if (sample_size != m_SampleSize) {
@@ -183,6 +214,7 @@ AP4_StszAtom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
 AP4_Result 
 AP4_StszAtom::AddEntry(AP4_UI32 size)
 {
+    LoadEntries();
     m_Entries.Append(size);
     m_SampleCount++;
     m_Size32 += 4;
@@ -196,6 +228,7 @@ AP4_StszAtom::AddEntry(AP4_UI32 size)
 AP4_Result
 AP4_StszAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("sample_size", m_SampleSize);
     inspector.AddField("sample_count", m_Entries.ItemCount());
 
@@ -44,7 +44,7 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_StszAtom, AP4_Atom)
 
     // class methods
-    static AP4_StszAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_StszAtom* Create(AP4_Size size, AP4_ByteStream& stream, bool lazy = false);
 
     // methods
     AP4_StszAtom();
@@ -72,12 +72,17 @@ private:
     AP4_StszAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
 
     // members
-    AP4_UI32            m_SampleSize;
-    AP4_UI32            m_SampleCount;
-    AP4_Array<AP4_UI32> m_Entries;
+    AP4_UI32             m_SampleSize;
+    AP4_UI32             m_SampleCount;
+    AP4_Array<AP4_UI32>  m_Entries;
+    AP4_DeferredAtomData m_DeferredEntries;
 };
 
 #endif // _AP4_STSZ_ATOM_H_
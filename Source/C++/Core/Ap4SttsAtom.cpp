@@ -42,24 +42,22 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_SttsAtom)
 |   AP4_SttsAtom::Create
 +---------------------------------------------------------------------*/
 AP4_SttsAtom*
-AP4_SttsAtom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_SttsAtom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_SttsAtom(size, version, flags, stream);
+    return new AP4_SttsAtom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
 |   AP4_SttsAtom::AP4_SttsAtom
 +---------------------------------------------------------------------*/
 AP4_SttsAtom::AP4_SttsAtom() :
-    AP4_Atom(AP4_ATOM_TYPE_STTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0)
+    AP4_Atom(AP4_ATOM_TYPE_STTS, AP4_FULL_ATOM_HEADER_SIZE+4, 0, 0),
+    m_LookupCache(0)
 {
-    m_LookupCache.entry_index = 0;
-    m_LookupCache.sample      = 0;
-    m_LookupCache.dts         = 0;
 }
 
 /*----------------------------------------------------------------------
@@ -68,13 +66,24 @@ AP4_SttsAtom::AP4_SttsAtom() :
 AP4_SttsAtom::AP4_SttsAtom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
-    AP4_Atom(AP4_ATOM_TYPE_STTS, size, version, flags)
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
+    AP4_Atom(AP4_ATOM_TYPE_STTS, size, version, flags),
+    m_LookupCache(0)
 {
-    m_LookupCache.entry_index = 0;
-    m_LookupCache.sample      = 0;
-    m_LookupCache.dts         = 0;
+    if (lazy) {
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
 
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_SttsAtom::ReadEntries(AP4_ByteStream& stream)
+{
     AP4_UI32 entry_count;
     stream.ReadUI32(entry_count);
     while (entry_count--) {
@@ -84,16 +93,48 @@ AP4_SttsAtom::AP4_SttsAtom(AP4_UI32        size,
             stream.ReadUI32(sample_duration) == AP4_SUCCESS) {
             m_Entries.Append(AP4_SttsTableEntry(sample_count,
                                                 sample_duration));
+            SetRunTotals(m_Entries.ItemCount()-1);
         }
     }
 }
 
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_SttsAtom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
+/*----------------------------------------------------------------------
+|   AP4_SttsAtom::SetRunTotals
++---------------------------------------------------------------------*/
+void
+AP4_SttsAtom::SetRunTotals(AP4_Ordinal entry_index)
+{
+    AP4_SttsTableEntry& entry = m_Entries[entry_index];
+    if (entry_index == 0) {
+        entry.m_FirstSample = 0;
+        entry.m_FirstDts    = 0;
+    } else {
+        const AP4_SttsTableEntry& prev = m_Entries[entry_index-1];
+        entry.m_FirstSample = prev.m_FirstSample+prev.m_SampleCount;
+        entry.m_FirstDts    = prev.m_FirstDts+
+                              (AP4_UI64)prev.m_SampleCount*(AP4_UI64)prev.m_SampleDuration;
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_SttsAtom::GetDts
 +---------------------------------------------------------------------*/
 AP4_Result
 AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
 {
+    LoadEntries();
     // default value
     dts = 0;
     if (duration) *duration = 0;
@@ -101,42 +142,46 @@ AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
     // sample indexes start at 1
     if (sample == 0) return AP4_ERROR_OUT_OF_RANGE;
 
-    // check the lookup cache
-    AP4_Ordinal lookup_start  = 0;
-    AP4_Ordinal sample_start = 0;
-    AP4_UI64    dts_start    = 0;
-    if (sample >= m_LookupCache.sample) {
-        // start from the cached entry
-        lookup_start = m_LookupCache.entry_index;
-        sample_start = m_LookupCache.sample;
-        dts_start    = m_LookupCache.dts;
+    // check the cached entry and the one after it first, so that
+    // sequential access does not need to search
+    AP4_Cardinal entry_count = m_Entries.ItemCount();
+    AP4_Ordinal  entry_index = entry_count;
+    for (AP4_Ordinal i = m_LookupCache; i < entry_count && i <= m_LookupCache+1; i++) {
+        if (sample >  m_Entries[i].m_FirstSample &&
+            sample <= m_Entries[i].m_FirstSample+m_Entries[i].m_SampleCount) {
+            entry_index = i;
+            break;
+        }
     }
 
-    // look from the last known point
-    for (AP4_Ordinal i = lookup_start; i < m_Entries.ItemCount(); i++) {
-        AP4_SttsTableEntry& entry = m_Entries[i];
-
-        // check if we have reached the sample
-        if (sample <= sample_start+entry.m_SampleCount) {
-            // we are within the sample range for the current entry
-            dts = dts_start + (AP4_UI64)(sample-1 - sample_start) * (AP4_UI64)entry.m_SampleDuration;
-            if (duration) *duration = entry.m_SampleDuration;
-            
-            // update the lookup cache
-            m_LookupCache.entry_index = i;
-            m_LookupCache.sample      = sample_start;
-            m_LookupCache.dts         = dts_start;
-            
-            return AP4_SUCCESS;
+    // binary search for the last entry that starts before the sample
+    if (entry_index == entry_count) {
+        AP4_Ordinal lo = 0;
+        AP4_Ordinal hi = entry_count;
+        while (lo < hi) {
+            AP4_Ordinal mid = lo+(hi-lo)/2;
+            if (m_Entries[mid].m_FirstSample < sample) {
+                lo = mid+1;
+            } else {
+                hi = mid;
+            }
+        }
+        
+        // sample is greater than the number of samples
+        if (lo == 0) return AP4_ERROR_OUT_OF_RANGE;
+        entry_index = lo-1;
+        if (sample > m_Entries[entry_index].m_FirstSample+m_Entries[entry_index].m_SampleCount) {
+            return AP4_ERROR_OUT_OF_RANGE;
         }
- 
-        // update the sample and dts bases
-        sample_start += entry.m_SampleCount;
-        dts_start    += entry.m_SampleCount*entry.m_SampleDuration;
     }
+    m_LookupCache = entry_index;
+
+    // we are within the sample range for the entry
+    const AP4_SttsTableEntry& entry = m_Entries[entry_index];
+    dts = entry.m_FirstDts + (AP4_UI64)(sample-1 - entry.m_FirstSample) * (AP4_UI64)entry.m_SampleDuration;
+    if (duration) *duration = entry.m_SampleDuration;
 
-    // sample is greater than the number of samples
-    return AP4_ERROR_OUT_OF_RANGE;
+    return AP4_SUCCESS;
 }
 
 /*----------------------------------------------------------------------
@@ -145,7 +190,9 @@ AP4_SttsAtom::GetDts(AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32* duration)
 AP4_Result
 AP4_SttsAtom::AddEntry(AP4_UI32 sample_count, AP4_UI32 sample_duration)
 {
+    LoadEntries();
     m_Entries.Append(AP4_SttsTableEntry(sample_count, sample_duration));
+    SetRunTotals(m_Entries.ItemCount()-1);
     m_Size32 += 8;
 
     return AP4_SUCCESS;
@@ -157,6 +204,9 @@ AP4_SttsAtom::AddEntry(AP4_UI32 sample_count, AP4_UI32 sample_duration)
 AP4_Result
 AP4_SttsAtom::WriteFields(AP4_ByteStream& stream)
 {
+    // make sure the entries have been read
+    LoadEntries();
+
     AP4_Result result;
 
     // write the entry count
@@ -185,29 +235,37 @@ AP4_Result
 AP4_SttsAtom::GetSampleIndexForTimeStamp(AP4_UI64      ts, 
                                          AP4_Ordinal&  sample_index)
 {
+    LoadEntries();
     // init
     AP4_Cardinal entry_count = m_Entries.ItemCount();
-    AP4_UI64 accumulated = 0;
     sample_index = 0;
+    if (entry_count == 0) return AP4_FAILURE;
     
-    for (AP4_Ordinal i=0; i<entry_count; i++) {
-        AP4_UI64 next_accumulated = 
-            accumulated +
-            (AP4_UI64)m_Entries[i].m_SampleCount * 
-            (AP4_UI64)m_Entries[i].m_SampleDuration;
-        
-        // check if the ts is in the range of this entry
-        if (ts < next_accumulated) {
-            sample_index += (AP4_UI32)((ts - accumulated) / m_Entries[i].m_SampleDuration);
-            return AP4_SUCCESS;
+    // binary search for the last entry that starts at or before the ts
+    // (entries with a zero sample duration start where the next entry 
+    // starts, so when several samples have a DTS of ts, the last one is
+    // returned, like a walk over the entries would)
+    AP4_Ordinal lo = 0;
+    AP4_Ordinal hi = entry_count;
+    while (lo < hi) {
+        AP4_Ordinal mid = lo+(hi-lo)/2;
+        if (m_Entries[mid].m_FirstDts <= ts) {
+            lo = mid+1;
+        } else {
+            hi = mid;
         }
-
-        // update accumulated and sample
-        accumulated = next_accumulated;
-        sample_index += m_Entries[i].m_SampleCount;
+    }
+    const AP4_SttsTableEntry& entry = m_Entries[lo-1];
+    
+    // check if the ts is in the range of this entry
+    AP4_UI64 entry_duration = (AP4_UI64)entry.m_SampleCount*(AP4_UI64)entry.m_SampleDuration;
+    if (ts < entry.m_FirstDts+entry_duration) {
+        sample_index = (AP4_Ordinal)(entry.m_FirstSample+(ts-entry.m_FirstDts)/entry.m_SampleDuration);
+        return AP4_SUCCESS;
     }
 
     // ts not in range of the table
+    sample_index = (AP4_Ordinal)(entry.m_FirstSample+entry.m_SampleCount);
     return AP4_FAILURE;
 }
 
@@ -217,6 +275,7 @@ AP4_SttsAtom::GetSampleIndexForTimeStamp(AP4_UI64      ts,
 AP4_Result
 AP4_SttsAtom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("entry_count", m_Entries.ItemCount());
 
     if (inspector.GetVerbosity() >= 1) {
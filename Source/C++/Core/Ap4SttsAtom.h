@@ -42,14 +42,20 @@ class AP4_SttsTableEntry {
  public:
     AP4_SttsTableEntry() : 
         m_SampleCount(0), 
-        m_SampleDuration(0) {}
+        m_SampleDuration(0),
+        m_FirstSample(0),
+        m_FirstDts(0) {}
     AP4_SttsTableEntry(AP4_UI32 sample_count,
                        AP4_UI32 sample_duration) :
         m_SampleCount(sample_count),
-        m_SampleDuration(sample_duration) {}
+        m_SampleDuration(sample_duration),
+        m_FirstSample(0),
+        m_FirstDts(0) {}
 
     AP4_UI32 m_SampleCount;
     AP4_UI32 m_SampleDuration;
+    AP4_UI64 m_FirstSample; // computed (not in file), 0-based
+    AP4_UI64 m_FirstDts;    // computed (not in file)
 };
 
 /*----------------------------------------------------------------------
@@ -61,7 +67,7 @@ public:
     AP4_IMPLEMENT_DYNAMIC_CAST_D(AP4_SttsAtom, AP4_Atom)
 
     // class methods
-    static AP4_SttsAtom* Create(AP4_Size size, AP4_ByteStream& stream);
+    static AP4_SttsAtom* Create(AP4_Size size, AP4_ByteStream& stream, bool lazy = false);
 
     // methods
     AP4_SttsAtom();
@@ -77,15 +83,17 @@ private:
     AP4_SttsAtom(AP4_UI32        size, 
                  AP4_UI08        version,
                  AP4_UI32        flags,
-                 AP4_ByteStream& stream);
+                 AP4_ByteStream& stream,
+                 bool            lazy);
+    void ReadEntries(AP4_ByteStream& stream);
+    void ReadDeferredEntries();
+    void LoadEntries() { if (m_DeferredEntries.IsPending()) ReadDeferredEntries(); }
+    void SetRunTotals(AP4_Ordinal entry_index);
 
     // members
     AP4_Array<AP4_SttsTableEntry> m_Entries;
-    struct {
-        AP4_Ordinal entry_index;
-        AP4_Ordinal sample;
-        AP4_UI64    dts;
-    } m_LookupCache;
+    AP4_Ordinal                   m_LookupCache; // index of the last entry found
+    AP4_DeferredAtomData          m_DeferredEntries;
 };
 
 #endif // _AP4_STTS_ATOM_H_
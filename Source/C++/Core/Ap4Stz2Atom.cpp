@@ -42,13 +42,13 @@ AP4_DEFINE_DYNAMIC_CAST_ANCHOR(AP4_Stz2Atom)
 |   AP4_Stz2Atom::Create
 +---------------------------------------------------------------------*/
 AP4_Stz2Atom*
-AP4_Stz2Atom::Create(AP4_Size size, AP4_ByteStream& stream)
+AP4_Stz2Atom::Create(AP4_Size size, AP4_ByteStream& stream, bool lazy)
 {
     AP4_UI08 version;
     AP4_UI32 flags;
     if (AP4_FAILED(AP4_Atom::ReadFullHeader(stream, version, flags))) return NULL;
     if (version != 0) return NULL;
-    return new AP4_Stz2Atom(size, version, flags, stream);
+    return new AP4_Stz2Atom(size, version, flags, stream, lazy);
 }
 
 /*----------------------------------------------------------------------
@@ -70,7 +70,8 @@ AP4_Stz2Atom::AP4_Stz2Atom(AP4_UI08 field_size) :
 AP4_Stz2Atom::AP4_Stz2Atom(AP4_UI32        size, 
                            AP4_UI08        version,
                            AP4_UI32        flags,
-                           AP4_ByteStream& stream) :
+                           AP4_ByteStream& stream,
+                           bool            lazy) :
     AP4_Atom(AP4_ATOM_TYPE_STZ2, size, version, flags)
 {
     AP4_UI08 reserved;
@@ -84,10 +85,23 @@ AP4_Stz2Atom::AP4_Stz2Atom(AP4_UI32        size,
         return;
     }
 
+    if (lazy) {
+        m_DeferredEntries.Defer(stream);
+    } else {
+        ReadEntries(stream);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Stz2Atom::ReadEntries
++---------------------------------------------------------------------*/
+void
+AP4_Stz2Atom::ReadEntries(AP4_ByteStream& stream)
+{
     AP4_Cardinal sample_count = m_SampleCount;
     m_Entries.SetItemCount(sample_count);
     unsigned int table_size = (sample_count*m_FieldSize+7)/8;
-    if ((table_size+8) > size) return;
+    if ((table_size+8) > m_Size32) return;
     unsigned char* buffer = new unsigned char[table_size];
     AP4_Result result = stream.Read(buffer, table_size);
     if (AP4_FAILED(result)) {
@@ -120,6 +134,18 @@ AP4_Stz2Atom::AP4_Stz2Atom(AP4_UI32        size,
     delete[] buffer;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Stz2Atom::ReadDeferredEntries
++---------------------------------------------------------------------*/
+void
+AP4_Stz2Atom::ReadDeferredEntries()
+{
+    AP4_ByteStream* stream = m_DeferredEntries.Begin();
+    if (stream == NULL) return;
+    ReadEntries(*stream);
+    m_DeferredEntries.End();
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Stz2Atom::WriteFields
 +---------------------------------------------------------------------*/
@@ -128,6 +154,9 @@ AP4_Stz2Atom::WriteFields(AP4_ByteStream& stream)
 {
     AP4_Result result;
 
+    // make sure the entries have been read
+    LoadEntries();
+
     // sample size
     result = stream.WriteUI08(0);
     if (AP4_FAILED(result)) return result;
@@ -193,6 +222,7 @@ AP4_Stz2Atom::GetSampleSize(AP4_Ordinal sample, AP4_Size& sample_size)
         sample_size = 0;
         return AP4_ERROR_OUT_OF_RANGE;
     } else {
+        LoadEntries();
         sample_size = m_Entries[sample - 1];
         return AP4_SUCCESS;
     }
@@ -208,6 +238,7 @@ AP4_Stz2Atom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
     if (sample > m_SampleCount || sample == 0) {
         return AP4_ERROR_OUT_OF_RANGE;
     } else {
+        LoadEntries();
         m_Entries[sample - 1] = sample_size;
         return AP4_SUCCESS;
     }
@@ -219,6 +250,7 @@ AP4_Stz2Atom::SetSampleSize(AP4_Ordinal sample, AP4_Size sample_size)
 AP4_Result 
 AP4_Stz2Atom::AddEntry(AP4_UI32 size)
 {
+    LoadEntries();
     m_Entries.Append(size);
     m_SampleCount++;
     if (m_FieldSize == 4) {
@@ -238,6 +270,7 @@ AP4_Stz2Atom::AddEntry(AP4_UI32 size)
 AP4_Result
 AP4_Stz2Atom::InspectFields(AP4_AtomInspector& inspector)
 {
+    LoadEntries();
     inspector.AddField("field_size", m_FieldSize);
     inspector.AddField("sample_count", m_Entries.ItemCount());
 
@@ -0,0 +1,161 @@
+/*****************************************************************
+|
+|    AP4 - Threads (platforms without thread support)
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Threads.h"
+
+#if !defined(AP4_CONFIG_HAVE_THREADS)
+/*----------------------------------------------------------------------
+|   AP4_Mutex::AP4_Mutex
++---------------------------------------------------------------------*/
+AP4_Mutex::AP4_Mutex() :
+    m_Impl(NULL)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::~AP4_Mutex
++---------------------------------------------------------------------*/
+AP4_Mutex::~AP4_Mutex()
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::Lock
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Mutex::Lock()
+{
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::Unlock
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Mutex::Unlock()
+{
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::AP4_Condition
++---------------------------------------------------------------------*/
+AP4_Condition::AP4_Condition() :
+    m_Impl(NULL)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::~AP4_Condition
++---------------------------------------------------------------------*/
+AP4_Condition::~AP4_Condition()
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Wait
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Wait(AP4_Mutex& /* mutex */)
+{
+    // nobody else could ever signal us
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Signal
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Signal()
+{
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Broadcast
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Broadcast()
+{
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::GetProcessorCount
++---------------------------------------------------------------------*/
+AP4_Cardinal
+AP4_Thread::GetProcessorCount()
+{
+    return 1;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::AP4_Thread
++---------------------------------------------------------------------*/
+AP4_Thread::AP4_Thread() :
+    m_Impl(NULL)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::~AP4_Thread
++---------------------------------------------------------------------*/
+AP4_Thread::~AP4_Thread()
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::Start
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Thread::Start()
+{
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::Wait
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Thread::Wait()
+{
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_System_GetTimeStampUs
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_System_GetTimeStampUs()
+{
+    return 0;
+}
+#endif // !AP4_CONFIG_HAVE_THREADS
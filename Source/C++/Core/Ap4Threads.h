@@ -0,0 +1,191 @@
+/*****************************************************************
+|
+|    AP4 - Threads
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+#ifndef _AP4_THREADS_H_
+#define _AP4_THREADS_H_
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Types.h"
+#include "Ap4Results.h"
+#include "Ap4List.h"
+
+/*----------------------------------------------------------------------
+|   class references
++---------------------------------------------------------------------*/
+class AP4_MutexImpl;
+class AP4_ConditionImpl;
+class AP4_ThreadImpl;
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex
++---------------------------------------------------------------------*/
+class AP4_Mutex
+{
+public:
+    AP4_Mutex();
+   ~AP4_Mutex();
+    AP4_Result Lock();
+    AP4_Result Unlock();
+
+private:
+    // friends
+    friend class AP4_Condition;
+
+    // members
+    AP4_MutexImpl* m_Impl;
+
+    // no copy
+    AP4_Mutex(const AP4_Mutex&);
+    AP4_Mutex& operator=(const AP4_Mutex&);
+};
+
+/*----------------------------------------------------------------------
+|   AP4_AutoLock
++---------------------------------------------------------------------*/
+class AP4_AutoLock
+{
+public:
+    AP4_AutoLock(AP4_Mutex& mutex) : m_Mutex(mutex) { m_Mutex.Lock();   }
+   ~AP4_AutoLock()                                  { m_Mutex.Unlock(); }
+
+private:
+    AP4_Mutex& m_Mutex;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_Condition
++---------------------------------------------------------------------*/
+/**
+ * Condition variable. Wait() must be called with the mutex locked, and
+ * returns with the mutex locked again.
+ */
+class AP4_Condition
+{
+public:
+    AP4_Condition();
+   ~AP4_Condition();
+    AP4_Result Wait(AP4_Mutex& mutex);
+    AP4_Result Signal();
+    AP4_Result Broadcast();
+
+private:
+    // members
+    AP4_ConditionImpl* m_Impl;
+
+    // no copy
+    AP4_Condition(const AP4_Condition&);
+    AP4_Condition& operator=(const AP4_Condition&);
+};
+
+/*----------------------------------------------------------------------
+|   AP4_Thread
++---------------------------------------------------------------------*/
+/**
+ * Subclasses implement Run(), which is called on a new thread by Start().
+ * A started thread must be waited for before the object is destroyed.
+ * On platforms without thread support, Start() returns
+ * AP4_ERROR_NOT_SUPPORTED and callers are expected to do the work
+ * themselves.
+ */
+class AP4_Thread
+{
+public:
+    // class methods
+    static AP4_Cardinal GetProcessorCount();
+
+    // methods
+    AP4_Thread();
+    virtual ~AP4_Thread();
+    AP4_Result Start();
+    AP4_Result Wait();
+
+protected:
+    // methods
+    virtual void Run() = 0;
+
+private:
+    // friends
+    friend class AP4_ThreadImpl;
+
+    // members
+    AP4_ThreadImpl* m_Impl;
+
+    // no copy
+    AP4_Thread(const AP4_Thread&);
+    AP4_Thread& operator=(const AP4_Thread&);
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ObjectPool
++---------------------------------------------------------------------*/
+/**
+ * Thread-safe list of spare objects, for objects that may not be shared
+ * between threads but are costly to create, such as ciphers. Get() 
+ * returns NULL when there is no spare object, in which case the caller
+ * creates one, and Put() gives the object back when the caller is done
+ * with it. The pool deletes the objects it holds when it is destroyed.
+ */
+template <typename T>
+class AP4_ObjectPool
+{
+public:
+    AP4_ObjectPool() {}
+   ~AP4_ObjectPool() { m_Objects.DeleteReferences(); }
+    T* Get() {
+        AP4_AutoLock lock(m_Lock);
+        T* object = NULL;
+        m_Objects.PopHead(object);
+        return object;
+    }
+    void Put(T* object) {
+        AP4_AutoLock lock(m_Lock);
+        m_Objects.Add(object);
+    }
+
+private:
+    // members
+    AP4_Mutex   m_Lock;
+    AP4_List<T> m_Objects;
+
+    // no copy
+    AP4_ObjectPool(const AP4_ObjectPool&);
+    AP4_ObjectPool& operator=(const AP4_ObjectPool&);
+};
+
+/*----------------------------------------------------------------------
+|   time functions
++---------------------------------------------------------------------*/
+/**
+ * Monotonic clock, in microseconds, for measuring elapsed times.
+ * Returns 0 on platforms where it is not available.
+ */
+AP4_UI64 AP4_System_GetTimeStampUs();
+
+#endif // _AP4_THREADS_H_
@@ -394,6 +394,22 @@ AP4_Track::ReadSample(AP4_Ordinal     index,
     return sample.ReadData(data);
 }
 
+/*----------------------------------------------------------------------
+|   AP4_Track::ReadSamples
++---------------------------------------------------------------------*/
+AP4_Result   
+AP4_Track::ReadSamples(AP4_Ordinal                first_sample,
+                       AP4_Cardinal               sample_count,
+                       AP4_DataBuffer&            data,
+                       AP4_Array<AP4_SampleSpan>& spans,
+                       AP4_Size                   max_size)
+{
+    // delegate to the sample table
+    return m_SampleTable ? 
+           m_SampleTable->ReadSamples(first_sample, sample_count, data, spans, max_size) :
+           AP4_FAILURE;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_Track::GetSampleIndexForTimeStampMs
 +---------------------------------------------------------------------*/
@@ -34,6 +34,7 @@
 +---------------------------------------------------------------------*/
 #include "Ap4Types.h"
 #include "Ap4Array.h"
+#include "Ap4SampleTable.h"
 
 /*----------------------------------------------------------------------
 |   forward declarations
@@ -110,6 +111,11 @@ class AP4_Track {
     AP4_Result   ReadSample(AP4_Ordinal     index, 
                             AP4_Sample&     sample,
                             AP4_DataBuffer& data);
+    AP4_Result   ReadSamples(AP4_Ordinal                first_sample,
+                             AP4_Cardinal               sample_count,
+                             AP4_DataBuffer&            data,
+                             AP4_Array<AP4_SampleSpan>& spans,
+                             AP4_Size                   max_size = 0);
     AP4_Result   GetSampleIndexForTimeStampMs(AP4_UI32     ts_ms, 
                                               AP4_Ordinal& index);
     AP4_Result   GetSampleIndexForTimeStamp(AP4_UI64 ts, AP4_UI32 timescale, AP4_Ordinal& index);
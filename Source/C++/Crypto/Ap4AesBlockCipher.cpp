@@ -40,6 +40,59 @@ Issue Date: 29/07/2002
 #include "Ap4Results.h"
 #include "Ap4Utils.h"
 
+/*----------------------------------------------------------------------
+|   hardware acceleration
++---------------------------------------------------------------------*/
+// the x86 code is compiled for AES-NI with a per-function target attribute,
+// so that the rest of the library does not require it. The ARMv8 code 
+// requires the compiler to target the cryptography extension (this is the
+// case by default for 64-bit Apple platforms).
+#if !defined(AP4_CONFIG_NO_AES_HARDWARE)
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define AP4_AES_HARDWARE_X86
+#define AP4_AES_HARDWARE_TARGET __attribute__((target("aes,sse2")))
+#include <wmmintrin.h>
+#include <cpuid.h>
+#endif
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define AP4_AES_HARDWARE_X86
+#define AP4_AES_HARDWARE_TARGET
+#include <wmmintrin.h>
+#include <intrin.h>
+#elif defined(__aarch64__) && !defined(__AARCH64EB__) && \
+      (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#if defined(__APPLE__) || defined(__linux__)
+#define AP4_AES_HARDWARE_ARM
+#define AP4_AES_HARDWARE_TARGET
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+#endif
+#endif
+
+#if defined(AP4_AES_HARDWARE_X86) || defined(AP4_AES_HARDWARE_ARM)
+#define AP4_AES_HARDWARE
+#endif
+
+// the CTR keystream is xor'ed with the data 16 bytes at a time when the 
+// baseline instruction set has vector registers
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AP4_AES_XOR_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AP4_AES_XOR_NEON
+#include <arm_neon.h>
+#endif
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+// number of counter blocks encrypted in one batch in CTR mode
+const unsigned int AP4_AES_CTR_BATCH_BLOCK_COUNT = 8;
+
 /*----------------------------------------------------------------------
 |   AES types
 +---------------------------------------------------------------------*/
@@ -1917,6 +1970,40 @@ private:
     unsigned int m_CounterSize;
 };
 
+/*----------------------------------------------------------------------
+|   AP4_AesXorKeystream
++---------------------------------------------------------------------*/
+static void
+AP4_AesXorKeystream(const AP4_UI08* input,
+                    const AP4_UI08* keystream,
+                    AP4_UI08*       output,
+                    AP4_Size        size)
+{
+#if defined(AP4_AES_XOR_SSE2)
+    for (; size >= 16; size -= 16, input += 16, keystream += 16, output += 16) {
+        _mm_storeu_si128((__m128i*)output, 
+                         _mm_xor_si128(_mm_loadu_si128((const __m128i*)input),
+                                       _mm_loadu_si128((const __m128i*)keystream)));
+    }
+#elif defined(AP4_AES_XOR_NEON)
+    for (; size >= 16; size -= 16, input += 16, keystream += 16, output += 16) {
+        vst1q_u8(output, veorq_u8(vld1q_u8(input), vld1q_u8(keystream)));
+    }
+#else
+    // the copies let the compiler use unaligned word loads and stores
+    for (; size >= 8; size -= 8, input += 8, keystream += 8, output += 8) {
+        AP4_UI64 x, k;
+        AP4_CopyMemory(&x, input, 8);
+        AP4_CopyMemory(&k, keystream, 8);
+        x ^= k;
+        AP4_CopyMemory(output, &x, 8);
+    }
+#endif
+    for (unsigned int i=0; i<size; i++) {
+        output[i] = input[i]^keystream[i];
+    }
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesCtrBlockCipher::Process
 +---------------------------------------------------------------------*/
@@ -1934,16 +2021,19 @@ AP4_AesCtrBlockCipher::Process(const AP4_UI08* input,
         AP4_SetMemory(counter, 0, AP4_AES_BLOCK_SIZE);
     }
     
-    // process all blocks
+    // process the blocks in batches: generate the keystream for a batch,
+    // then xor it with the data in one pass
+    AP4_UI08 keystream[AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE];
     while (input_size) {
-        AP4_UI08 block[AP4_AES_BLOCK_SIZE];
-        aes_enc_blk(counter, block, m_Context);
-        unsigned int chunk = input_size>=AP4_AES_BLOCK_SIZE?AP4_AES_BLOCK_SIZE:input_size;
-        for (unsigned int j=0; j<chunk; j++) {
-            output[j] = input[j]^block[j];
+        AP4_Size     chunk       = input_size;
+        unsigned int block_count = (chunk+AP4_AES_BLOCK_SIZE-1)/AP4_AES_BLOCK_SIZE;
+        if (block_count > AP4_AES_CTR_BATCH_BLOCK_COUNT) {
+            block_count = AP4_AES_CTR_BATCH_BLOCK_COUNT;
+            chunk       = block_count*AP4_AES_BLOCK_SIZE;
         }
-        input_size -= chunk;
-        if (input_size) {
+        for (unsigned int b=0; b<block_count; b++) {
+            aes_enc_blk(counter, keystream+b*AP4_AES_BLOCK_SIZE, m_Context);
+
             // increment the counter
             for (int x=AP4_AES_BLOCK_SIZE-1; x; --x) {
                 if (counter[x] == 255) {
@@ -1954,15 +2044,413 @@ AP4_AesCtrBlockCipher::Process(const AP4_UI08* input,
                     break;
                 }
             }
+        }
+        AP4_AesXorKeystream(input, keystream, output, chunk);
             
-            // move to the next block
+        // move to the next batch
+        input      += chunk;
+        output     += chunk;
+        input_size -= chunk;
+    }
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   globals
++---------------------------------------------------------------------*/
+static bool AP4_AesHardwareAccelerationEnabled = true;
+
+#if defined(AP4_AES_HARDWARE)
+/*----------------------------------------------------------------------
+|   AES instructions
++---------------------------------------------------------------------*/
+#define AP4_AES_HARDWARE_ROUNDS 10
+#if defined(AP4_AES_HARDWARE_X86)
+typedef __m128i AP4_AesHwBlock;
+
+AP4_AES_HARDWARE_TARGET static inline AP4_AesHwBlock 
+AP4_AesHwLoad(const AP4_UI08* data) 
+{
+    return _mm_loadu_si128((const __m128i*)data);
+}
+
+AP4_AES_HARDWARE_TARGET static inline void
+AP4_AesHwStore(AP4_UI08* data, AP4_AesHwBlock block) 
+{
+    _mm_storeu_si128((__m128i*)data, block);
+}
+
+AP4_AES_HARDWARE_TARGET static inline AP4_AesHwBlock 
+AP4_AesHwXor(AP4_AesHwBlock a, AP4_AesHwBlock b) 
+{
+    return _mm_xor_si128(a, b);
+}
+
+AP4_AES_HARDWARE_TARGET static inline AP4_AesHwBlock 
+AP4_AesHwInvMixColumns(AP4_AesHwBlock block) 
+{
+    return _mm_aesimc_si128(block);
+}
+
+AP4_AES_HARDWARE_TARGET static inline AP4_AesHwBlock 
+AP4_AesHwCounter(AP4_UI64 high, AP4_UI64 low) 
+{
+#if defined(_MSC_VER)
+    return _mm_set_epi64x(_byteswap_uint64(low), _byteswap_uint64(high));
+#else
+    return _mm_set_epi64x(__builtin_bswap64(low), __builtin_bswap64(high));
+#endif
+}
+
+// encrypt N blocks, interleaving the rounds so that they can be pipelined
+#define AP4_AES_HW_ENCRYPT(_blocks, _count, _keys) {                           \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = _mm_xor_si128(_blocks[b], _keys[0]);                      \
+    }                                                                          \
+    for (unsigned int r=1; r<AP4_AES_HARDWARE_ROUNDS; r++) {                   \
+        for (unsigned int b=0; b<_count; b++) {                                \
+            _blocks[b] = _mm_aesenc_si128(_blocks[b], _keys[r]);               \
+        }                                                                      \
+    }                                                                          \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = _mm_aesenclast_si128(_blocks[b], _keys[AP4_AES_HARDWARE_ROUNDS]); \
+    }                                                                          \
+}
+
+// decrypt N blocks with the equivalent inverse cipher key schedule
+#define AP4_AES_HW_DECRYPT(_blocks, _count, _keys) {                           \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = _mm_xor_si128(_blocks[b], _keys[0]);                      \
+    }                                                                          \
+    for (unsigned int r=1; r<AP4_AES_HARDWARE_ROUNDS; r++) {                   \
+        for (unsigned int b=0; b<_count; b++) {                                \
+            _blocks[b] = _mm_aesdec_si128(_blocks[b], _keys[r]);               \
+        }                                                                      \
+    }                                                                          \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = _mm_aesdeclast_si128(_blocks[b], _keys[AP4_AES_HARDWARE_ROUNDS]); \
+    }                                                                          \
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AesHardwareAccelerationAvailable
++---------------------------------------------------------------------*/
+static bool
+AP4_AesHardwareAccelerationAvailable()
+{
+    // CPUID leaf 1: ECX bit 25 is AES-NI, EDX bit 26 is SSE2
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    unsigned int ecx = (unsigned int)info[2];
+    unsigned int edx = (unsigned int)info[3];
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+#endif
+    return (ecx & (1<<25)) && (edx & (1<<26));
+}
+#endif
+
+#if defined(AP4_AES_HARDWARE_ARM)
+typedef uint8x16_t AP4_AesHwBlock;
+
+static inline AP4_AesHwBlock 
+AP4_AesHwLoad(const AP4_UI08* data) 
+{
+    return vld1q_u8(data);
+}
+
+static inline void
+AP4_AesHwStore(AP4_UI08* data, AP4_AesHwBlock block) 
+{
+    vst1q_u8(data, block);
+}
+
+static inline AP4_AesHwBlock 
+AP4_AesHwXor(AP4_AesHwBlock a, AP4_AesHwBlock b) 
+{
+    return veorq_u8(a, b);
+}
+
+static inline AP4_AesHwBlock 
+AP4_AesHwInvMixColumns(AP4_AesHwBlock block) 
+{
+    return vaesimcq_u8(block);
+}
+
+static inline AP4_AesHwBlock 
+AP4_AesHwCounter(AP4_UI64 high, AP4_UI64 low) 
+{
+    return vrev64q_u8(vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(high), vcreate_u64(low))));
+}
+
+// AESE does AddRoundKey before SubBytes and ShiftRows, so the 
+// rounds are shifted by one compared to the x86 instructions
+#define AP4_AES_HW_ENCRYPT(_blocks, _count, _keys) {                           \
+    for (unsigned int r=0; r<AP4_AES_HARDWARE_ROUNDS-1; r++) {                 \
+        for (unsigned int b=0; b<_count; b++) {                                \
+            _blocks[b] = vaesmcq_u8(vaeseq_u8(_blocks[b], _keys[r]));          \
+        }                                                                      \
+    }                                                                          \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = veorq_u8(vaeseq_u8(_blocks[b], _keys[AP4_AES_HARDWARE_ROUNDS-1]), \
+                              _keys[AP4_AES_HARDWARE_ROUNDS]);                 \
+    }                                                                          \
+}
+
+#define AP4_AES_HW_DECRYPT(_blocks, _count, _keys) {                           \
+    for (unsigned int r=0; r<AP4_AES_HARDWARE_ROUNDS-1; r++) {                 \
+        for (unsigned int b=0; b<_count; b++) {                                \
+            _blocks[b] = vaesimcq_u8(vaesdq_u8(_blocks[b], _keys[r]));         \
+        }                                                                      \
+    }                                                                          \
+    for (unsigned int b=0; b<_count; b++) {                                    \
+        _blocks[b] = veorq_u8(vaesdq_u8(_blocks[b], _keys[AP4_AES_HARDWARE_ROUNDS-1]), \
+                              _keys[AP4_AES_HARDWARE_ROUNDS]);                 \
+    }                                                                          \
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AesHardwareAccelerationAvailable
++---------------------------------------------------------------------*/
+static bool
+AP4_AesHardwareAccelerationAvailable()
+{
+#if defined(__APPLE__)
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & (1<<3)) != 0; // HWCAP_AES
+#endif
+}
+#endif
+
+/*----------------------------------------------------------------------
+|   AP4_AesHwCbcBlockCipher
++---------------------------------------------------------------------*/
+class AP4_AesHwCbcBlockCipher : public AP4_AesBlockCipher
+{
+public:
+    AP4_AesHwCbcBlockCipher(CipherDirection direction,
+                            const aes_ctx*  context);
+        
+    // AP4_BlockCipher methods
+    virtual AP4_Result Process(const AP4_UI08* input, 
+                               AP4_Size        input_size,
+                               AP4_UI08*       output,
+                               const AP4_UI08* iv);
+
+private:
+    AP4_UI08 m_RoundKeys[AP4_AES_HARDWARE_ROUNDS+1][AP4_AES_BLOCK_SIZE];
+};
+
+/*----------------------------------------------------------------------
+|   AP4_AesHwCbcBlockCipher::AP4_AesHwCbcBlockCipher
++---------------------------------------------------------------------*/
+AP4_AES_HARDWARE_TARGET
+AP4_AesHwCbcBlockCipher::AP4_AesHwCbcBlockCipher(CipherDirection direction,
+                                                 const aes_ctx*  context) :
+    AP4_AesBlockCipher(direction, CBC, NULL)
+{
+    // the context has the encryption key schedule, stored in byte order
+    const AP4_UI08* keys = (const AP4_UI08*)context->k_sch;
+    if (direction == ENCRYPT) {
+        AP4_CopyMemory(m_RoundKeys, keys, sizeof(m_RoundKeys));
+    } else {
+        // equivalent inverse cipher: reverse order, InvMixColumns on the inner keys
+        AP4_CopyMemory(m_RoundKeys[0], keys+AP4_AES_HARDWARE_ROUNDS*AP4_AES_BLOCK_SIZE, AP4_AES_BLOCK_SIZE);
+        for (unsigned int r=1; r<AP4_AES_HARDWARE_ROUNDS; r++) {
+            AP4_AesHwBlock key = AP4_AesHwLoad(keys+(AP4_AES_HARDWARE_ROUNDS-r)*AP4_AES_BLOCK_SIZE);
+            AP4_AesHwStore(m_RoundKeys[r], AP4_AesHwInvMixColumns(key));
+        }
+        AP4_CopyMemory(m_RoundKeys[AP4_AES_HARDWARE_ROUNDS], keys, AP4_AES_BLOCK_SIZE);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AesHwCbcBlockCipher::Process
++---------------------------------------------------------------------*/
+AP4_AES_HARDWARE_TARGET AP4_Result 
+AP4_AesHwCbcBlockCipher::Process(const AP4_UI08* input, 
+                                 AP4_Size        input_size,
+                                 AP4_UI08*       output,
+                                 const AP4_UI08* iv)
+{
+    // check the parameters
+    if (input_size%AP4_AES_BLOCK_SIZE) {
+        return AP4_ERROR_INVALID_PARAMETERS;
+    }
+    
+    // load the keys
+    AP4_AesHwBlock keys[AP4_AES_HARDWARE_ROUNDS+1];
+    for (unsigned int r=0; r<=AP4_AES_HARDWARE_ROUNDS; r++) {
+        keys[r] = AP4_AesHwLoad(m_RoundKeys[r]);
+    }
+    
+    // setup the chaining block from the IV
+    AP4_UI08 zero_iv[AP4_AES_BLOCK_SIZE];
+    if (iv == NULL) {
+        AP4_SetMemory(zero_iv, 0, AP4_AES_BLOCK_SIZE);
+        iv = zero_iv;
+    }
+    AP4_AesHwBlock chaining_block = AP4_AesHwLoad(iv);
+    
+    // process all blocks
+    unsigned int block_count = input_size/AP4_AES_BLOCK_SIZE;
+    if (m_Direction == ENCRYPT) {
+        // each block depends on the previous one
+        for (unsigned int i=0; i<block_count; i++) {
+            AP4_AesHwBlock block[1] = { AP4_AesHwXor(AP4_AesHwLoad(input), chaining_block) };
+            AP4_AES_HW_ENCRYPT(block, 1, keys);
+            AP4_AesHwStore(output, block[0]);
+            chaining_block = block[0];
+            input  += AP4_AES_BLOCK_SIZE;
+            output += AP4_AES_BLOCK_SIZE;
+        }
+    } else {
+        // blocks can be decrypted independently, 4 at a time
+        unsigned int i=0;
+        for (; i+4 <= block_count; i += 4) {
+            AP4_AesHwBlock in[4];
+            AP4_AesHwBlock blocks[4];
+            for (unsigned int b=0; b<4; b++) {
+                blocks[b] = in[b] = AP4_AesHwLoad(input+b*AP4_AES_BLOCK_SIZE);
+            }
+            AP4_AES_HW_DECRYPT(blocks, 4, keys);
+            AP4_AesHwStore(output,                       AP4_AesHwXor(blocks[0], chaining_block));
+            AP4_AesHwStore(output+  AP4_AES_BLOCK_SIZE,  AP4_AesHwXor(blocks[1], in[0]));
+            AP4_AesHwStore(output+2*AP4_AES_BLOCK_SIZE,  AP4_AesHwXor(blocks[2], in[1]));
+            AP4_AesHwStore(output+3*AP4_AES_BLOCK_SIZE,  AP4_AesHwXor(blocks[3], in[2]));
+            chaining_block = in[3];
+            input  += 4*AP4_AES_BLOCK_SIZE;
+            output += 4*AP4_AES_BLOCK_SIZE;
+        }
+        for (; i<block_count; i++) {
+            AP4_AesHwBlock in = AP4_AesHwLoad(input);
+            AP4_AesHwBlock block[1] = { in };
+            AP4_AES_HW_DECRYPT(block, 1, keys);
+            AP4_AesHwStore(output, AP4_AesHwXor(block[0], chaining_block));
+            chaining_block = in;
             input  += AP4_AES_BLOCK_SIZE;
             output += AP4_AES_BLOCK_SIZE;
         }
     }
+    
     return AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_AesHwCtrBlockCipher
++---------------------------------------------------------------------*/
+class AP4_AesHwCtrBlockCipher : public AP4_AesBlockCipher
+{
+public:
+    AP4_AesHwCtrBlockCipher(CipherDirection direction,
+                            const aes_ctx*  context) :
+        AP4_AesBlockCipher(direction, CTR, NULL) {
+        AP4_CopyMemory(m_RoundKeys, context->k_sch, sizeof(m_RoundKeys));
+    }
+        
+    // AP4_BlockCipher methods
+    virtual AP4_Result Process(const AP4_UI08* input, 
+                               AP4_Size        input_size,
+                               AP4_UI08*       output,
+                               const AP4_UI08* iv);
+
+private:
+    AP4_UI08 m_RoundKeys[AP4_AES_HARDWARE_ROUNDS+1][AP4_AES_BLOCK_SIZE];
+};
+
+/*----------------------------------------------------------------------
+|   AP4_AesHwCtrBlockCipher::Process
++---------------------------------------------------------------------*/
+AP4_AES_HARDWARE_TARGET AP4_Result 
+AP4_AesHwCtrBlockCipher::Process(const AP4_UI08* input, 
+                                 AP4_Size        input_size,
+                                 AP4_UI08*       output,
+                                 const AP4_UI08* iv)
+{
+    // load the keys
+    AP4_AesHwBlock keys[AP4_AES_HARDWARE_ROUNDS+1];
+    for (unsigned int r=0; r<=AP4_AES_HARDWARE_ROUNDS; r++) {
+        keys[r] = AP4_AesHwLoad(m_RoundKeys[r]);
+    }
+
+    // the counter is kept as two 64-bit big-endian halves. Like the 
+    // table-based implementation, the increment does not carry into byte 0
+    AP4_UI64 counter_high = 0;
+    AP4_UI64 counter_low  = 0;
+    if (iv) {
+        counter_high = AP4_BytesToUInt64BE(iv);
+        counter_low  = AP4_BytesToUInt64BE(iv+8);
+    }
+    const AP4_UI64 counter_high_fixed = AP4_UI64(0xFF) << 56;
+    
+    // process the blocks in batches, interleaving their rounds
+    while (input_size >= AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE) {
+        AP4_AesHwBlock blocks[AP4_AES_CTR_BATCH_BLOCK_COUNT];
+        for (unsigned int b=0; b<AP4_AES_CTR_BATCH_BLOCK_COUNT; b++) {
+            blocks[b] = AP4_AesHwCounter(counter_high, counter_low);
+            if (++counter_low == 0) {
+                counter_high = (counter_high & counter_high_fixed) | 
+                               ((counter_high+1) & ~counter_high_fixed);
+            }
+        }
+        AP4_AES_HW_ENCRYPT(blocks, AP4_AES_CTR_BATCH_BLOCK_COUNT, keys);
+        for (unsigned int b=0; b<AP4_AES_CTR_BATCH_BLOCK_COUNT; b++) {
+            AP4_AesHwStore(output+b*AP4_AES_BLOCK_SIZE,
+                           AP4_AesHwXor(blocks[b], AP4_AesHwLoad(input+b*AP4_AES_BLOCK_SIZE)));
+        }
+        input      += AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE;
+        output     += AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE;
+        input_size -= AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE;
+    }
+    
+    // process the remaining blocks as one shorter batch
+    if (input_size) {
+        AP4_AesHwBlock blocks[AP4_AES_CTR_BATCH_BLOCK_COUNT];
+        unsigned int   block_count = (input_size+AP4_AES_BLOCK_SIZE-1)/AP4_AES_BLOCK_SIZE;
+        for (unsigned int b=0; b<block_count; b++) {
+            blocks[b] = AP4_AesHwCounter(counter_high, counter_low);
+            if (++counter_low == 0) {
+                counter_high = (counter_high & counter_high_fixed) | 
+                               ((counter_high+1) & ~counter_high_fixed);
+            }
+        }
+        AP4_AES_HW_ENCRYPT(blocks, block_count, keys);
+        AP4_UI08 keystream[AP4_AES_CTR_BATCH_BLOCK_COUNT*AP4_AES_BLOCK_SIZE];
+        for (unsigned int b=0; b<block_count; b++) {
+            AP4_AesHwStore(keystream+b*AP4_AES_BLOCK_SIZE, blocks[b]);
+        }
+        AP4_AesXorKeystream(input, keystream, output, input_size);
+    }
+    
+    return AP4_SUCCESS;
+}
+#endif
+
+/*----------------------------------------------------------------------
+|   AP4_AesBlockCipher::IsHardwareAccelerationAvailable
++---------------------------------------------------------------------*/
+bool
+AP4_AesBlockCipher::IsHardwareAccelerationAvailable()
+{
+#if defined(AP4_AES_HARDWARE)
+    return AP4_AesHardwareAccelerationAvailable();
+#else
+    return false;
+#endif
+}
+
+/*----------------------------------------------------------------------
+|   AP4_AesBlockCipher::EnableHardwareAcceleration
++---------------------------------------------------------------------*/
+void
+AP4_AesBlockCipher::EnableHardwareAcceleration(bool enable)
+{
+    AP4_AesHardwareAccelerationEnabled = enable;
+}
+
 /*----------------------------------------------------------------------
 |   AP4_AesBlockCipher::Create
 +---------------------------------------------------------------------*/
@@ -1977,6 +2465,27 @@ AP4_AesBlockCipher::Create(const AP4_UI08*      key,
 
     aes_ctx* context = new aes_ctx();
     
+#if defined(AP4_AES_HARDWARE)
+    // use the processor's AES instructions if we can
+    if (AP4_AesHardwareAccelerationEnabled && AP4_AesHardwareAccelerationAvailable()) {
+        aes_enc_key(key, AP4_AES_KEY_LENGTH, context);
+        switch (mode) {
+            case AP4_BlockCipher::CBC:
+                cipher = new AP4_AesHwCbcBlockCipher(direction, context);
+                break;
+                
+            case AP4_BlockCipher::CTR:
+                cipher = new AP4_AesHwCtrBlockCipher(direction, context);
+                break;
+                
+            default:
+                break;
+        }
+        delete context;
+        return cipher?AP4_SUCCESS:AP4_ERROR_INVALID_PARAMETERS;
+    }
+#endif
+
     switch (mode) {
         case AP4_BlockCipher::CBC:
             if (direction == AP4_BlockCipher::ENCRYPT) {
@@ -38,6 +38,21 @@ public:
                              AP4_AesBlockCipher*& cipher);
     virtual ~AP4_AesBlockCipher();
 
+    /**
+     * Returns true if the processor has AES instructions that can be used 
+     * by this implementation (AES-NI on x86, the cryptography extension 
+     * on ARMv8).
+     */
+    static bool IsHardwareAccelerationAvailable();
+
+    /**
+     * Enable or disable the use of the processor's AES instructions for
+     * ciphers created after this call. It is enabled by default.
+     * When it is disabled, or when the instructions are not available, 
+     * the portable table-based implementation is used.
+     */
+    static void EnableHardwareAcceleration(bool enable);
+
     virtual CipherDirection GetDirection() { return m_Direction; }
     
 protected:
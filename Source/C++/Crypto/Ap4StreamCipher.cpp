@@ -171,8 +171,11 @@ AP4_CtrStreamCipher::ProcessBuffer(const AP4_UI08* in,
         in_size        -= partial;
     }
     
-    // process all the remaining bytes in the buffer
-    if (in_size) {
+    // process all the remaining complete blocks in one call, so that the
+    // block cipher can generate the keystream for several blocks at once
+    AP4_Size tail_size = in_size%AP4_CIPHER_BLOCK_SIZE;
+    AP4_Size bulk_size = in_size-tail_size;
+    if (bulk_size) {
         // the cache won't be valid anymore
         m_CacheValid = false;
 
@@ -181,13 +184,34 @@ AP4_CtrStreamCipher::ProcessBuffer(const AP4_UI08* in,
         ComputeCounter(m_StreamOffset, counter_block);
         
         // process the data
-        AP4_Result result = m_BlockCipher->Process(in, in_size, out, counter_block);
+        AP4_Result result = m_BlockCipher->Process(in, bulk_size, out, counter_block);
+        if (AP4_FAILED(result)) {
+            if (out_size) *out_size = 0;
+            return result;
+        }
+        m_StreamOffset += bulk_size;
+        in             += bulk_size;
+        out            += bulk_size;
+    }
+    
+    // process the last partial block from the cache, so that the next call, 
+    // which typically continues in the same block (CENC subsamples), does
+    // not need to compute its keystream again
+    if (tail_size) {
+        AP4_UI08 block[AP4_CIPHER_BLOCK_SIZE] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+        AP4_UI08 counter_block[AP4_CIPHER_BLOCK_SIZE];
+        ComputeCounter(m_StreamOffset, counter_block);
+        AP4_Result result = m_BlockCipher->Process(block, AP4_CIPHER_BLOCK_SIZE, m_CacheBlock, counter_block);
         if (AP4_FAILED(result)) {
+            m_CacheValid = false;
             if (out_size) *out_size = 0;
             return result;
         }
-        m_StreamOffset += in_size;
-        return result;
+        m_CacheValid = true;
+        for (unsigned int i=0; i<tail_size; i++) {
+            out[i] = in[i]^m_CacheBlock[i];
+        }
+        m_StreamOffset += tail_size;
     }
     
     return AP4_SUCCESS;
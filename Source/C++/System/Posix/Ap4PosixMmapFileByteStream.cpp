@@ -0,0 +1,264 @@
+/*****************************************************************
+|
+|    AP4 - Posix Memory-Mapped File Byte Stream implementation
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#define _LARGEFILE_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "Ap4Config.h"
+
+#if defined(AP4_CONFIG_HAVE_MMAP)
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "Ap4FileByteStream.h"
+#include "Ap4Utils.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+const AP4_Size AP4_MMAP_FILE_BYTE_STREAM_MAX_COPY_CHUNK = 0x1000000;
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::Create
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::Create(AP4_FileByteStream* delegator,
+                               const char*         name,
+                               AP4_ByteStream*&    stream)
+{
+    // default value
+    stream = NULL;
+    
+    // check arguments
+    if (name == NULL) return AP4_ERROR_INVALID_PARAMETERS;
+    
+    // the standard streams cannot be mapped
+    if (!strcmp(name, "-stdin")  || 
+        !strcmp(name, "-stdout") || 
+        !strcmp(name, "-stderr")) {
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    
+    // open the file
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return AP4_ERROR_NO_SUCH_FILE;
+        } else if (errno == EACCES) {
+            return AP4_ERROR_PERMISSION_DENIED;
+        } else {
+            return AP4_ERROR_CANNOT_OPEN_FILE;
+        }
+    }
+    
+    // get the size, only regular files can be mapped
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    AP4_LargeSize size = (AP4_LargeSize)info.st_size;
+    if ((AP4_LargeSize)(size_t)size != size) {
+        // too large for the address space
+        close(fd);
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    
+    // map the file (empty files cannot be mapped, but don't need to be)
+    // the mapping is private, so pages that a caller would write to through
+    // a borrowed pointer are copied and never reach the file
+    AP4_UI08* data = NULL;
+    if (size) {
+        void* mapped = mmap(NULL, (size_t)size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            return AP4_ERROR_NOT_SUPPORTED;
+        }
+        data = (AP4_UI08*)mapped;
+    }
+    
+    // the mapping stays valid after the file is closed
+    close(fd);
+    
+    stream = new AP4_MmapFileByteStream(delegator, data, size);
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::AP4_MmapFileByteStream
++---------------------------------------------------------------------*/
+AP4_MmapFileByteStream::AP4_MmapFileByteStream(AP4_FileByteStream* delegator,
+                                               AP4_UI08*           data,
+                                               AP4_LargeSize       size) :
+    m_Delegator(delegator),
+    m_ReferenceCount(1),
+    m_Data(data),
+    m_Size(size),
+    m_Position(0)
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::~AP4_MmapFileByteStream
++---------------------------------------------------------------------*/
+AP4_MmapFileByteStream::~AP4_MmapFileByteStream()
+{
+    if (m_Data) {
+        munmap(m_Data, (size_t)m_Size);
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::AddReference
++---------------------------------------------------------------------*/
+void
+AP4_MmapFileByteStream::AddReference()
+{
+    m_ReferenceCount++;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::Release
++---------------------------------------------------------------------*/
+void
+AP4_MmapFileByteStream::Release()
+{
+    if (--m_ReferenceCount == 0) {
+        if (m_Delegator) {
+            delete m_Delegator;
+        } else {
+            delete this;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::ReadPartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::ReadPartial(void*     buffer, 
+                                    AP4_Size  bytes_to_read, 
+                                    AP4_Size& bytes_read)
+{
+    // default values
+    bytes_read = 0;
+
+    // shortcut
+    if (bytes_to_read == 0) {
+        return AP4_SUCCESS;
+    }
+
+    // clamp to range
+    if (m_Position+bytes_to_read > m_Size) {
+        bytes_to_read = (AP4_Size)(m_Size - m_Position);
+    }
+
+    // check for end of stream
+    if (bytes_to_read == 0) {
+        return AP4_ERROR_EOS;
+    }
+
+    // read from the mapped memory
+    AP4_CopyMemory(buffer, m_Data+m_Position, bytes_to_read);
+    m_Position += bytes_to_read;
+
+    bytes_read = bytes_to_read;
+
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::WritePartial
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::WritePartial(const void* /* buffer */, 
+                                     AP4_Size    /* bytes_to_write */, 
+                                     AP4_Size&   bytes_written)
+{
+    bytes_written = 0;
+    return AP4_ERROR_WRITE_FAILED;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::Seek
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::Seek(AP4_Position position)
+{
+    if (position > m_Size) return AP4_FAILURE;
+    m_Position = position;
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::CopyTo
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::CopyTo(AP4_ByteStream& stream, AP4_LargeSize size)
+{
+    // write directly from the mapped memory, in large chunks
+    while (size) {
+        if (m_Position >= m_Size) return AP4_ERROR_EOS;
+        AP4_LargeSize chunk = m_Size-m_Position;
+        if (chunk > size) chunk = size;
+        if (chunk > AP4_MMAP_FILE_BYTE_STREAM_MAX_COPY_CHUNK) {
+            chunk = AP4_MMAP_FILE_BYTE_STREAM_MAX_COPY_CHUNK;
+        }
+        AP4_Result result = stream.Write(m_Data+m_Position, (AP4_Size)chunk);
+        if (AP4_FAILED(result)) return result;
+        m_Position += chunk;
+        size       -= chunk;
+    }
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_MmapFileByteStream::BorrowData
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_MmapFileByteStream::BorrowData(AP4_Position     position,
+                                   AP4_Size         size,
+                                   const AP4_UI08*& data)
+{
+    data = NULL;
+    if (position > m_Size || size > m_Size-position) return AP4_ERROR_OUT_OF_RANGE;
+    data = m_Data+position;
+    return AP4_SUCCESS;
+}
+
+#endif // AP4_CONFIG_HAVE_MMAP
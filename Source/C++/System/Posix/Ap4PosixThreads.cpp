@@ -0,0 +1,239 @@
+/*****************************************************************
+|
+|    AP4 - Posix Threads implementation
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include "Ap4Config.h"
+
+#if defined(AP4_CONFIG_HAVE_THREADS)
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+#include "Ap4Threads.h"
+
+/*----------------------------------------------------------------------
+|   AP4_MutexImpl
++---------------------------------------------------------------------*/
+class AP4_MutexImpl
+{
+public:
+    AP4_MutexImpl()  { pthread_mutex_init(&m_Mutex, NULL); }
+   ~AP4_MutexImpl()  { pthread_mutex_destroy(&m_Mutex);    }
+
+    pthread_mutex_t m_Mutex;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ConditionImpl
++---------------------------------------------------------------------*/
+class AP4_ConditionImpl
+{
+public:
+    AP4_ConditionImpl()  { pthread_cond_init(&m_Condition, NULL); }
+   ~AP4_ConditionImpl()  { pthread_cond_destroy(&m_Condition);    }
+
+    pthread_cond_t m_Condition;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_ThreadImpl
++---------------------------------------------------------------------*/
+class AP4_ThreadImpl
+{
+public:
+    AP4_ThreadImpl() : m_Started(false) {}
+
+    static void* EntryPoint(void* argument) {
+        static_cast<AP4_Thread*>(argument)->Run();
+        return NULL;
+    }
+
+    pthread_t m_Thread;
+    bool      m_Started;
+};
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::AP4_Mutex
++---------------------------------------------------------------------*/
+AP4_Mutex::AP4_Mutex() :
+    m_Impl(new AP4_MutexImpl())
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::~AP4_Mutex
++---------------------------------------------------------------------*/
+AP4_Mutex::~AP4_Mutex()
+{
+    delete m_Impl;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::Lock
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Mutex::Lock()
+{
+    return pthread_mutex_lock(&m_Impl->m_Mutex) ? AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Mutex::Unlock
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Mutex::Unlock()
+{
+    return pthread_mutex_unlock(&m_Impl->m_Mutex) ? AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::AP4_Condition
++---------------------------------------------------------------------*/
+AP4_Condition::AP4_Condition() :
+    m_Impl(new AP4_ConditionImpl())
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::~AP4_Condition
++---------------------------------------------------------------------*/
+AP4_Condition::~AP4_Condition()
+{
+    delete m_Impl;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Wait
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Wait(AP4_Mutex& mutex)
+{
+    return pthread_cond_wait(&m_Impl->m_Condition, &mutex.m_Impl->m_Mutex) ? 
+           AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Signal
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Signal()
+{
+    return pthread_cond_signal(&m_Impl->m_Condition) ? AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Condition::Broadcast
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Condition::Broadcast()
+{
+    return pthread_cond_broadcast(&m_Impl->m_Condition) ? AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::GetProcessorCount
++---------------------------------------------------------------------*/
+AP4_Cardinal
+AP4_Thread::GetProcessorCount()
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0) return (AP4_Cardinal)count;
+#endif
+    return 1;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::AP4_Thread
++---------------------------------------------------------------------*/
+AP4_Thread::AP4_Thread() :
+    m_Impl(new AP4_ThreadImpl())
+{
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::~AP4_Thread
++---------------------------------------------------------------------*/
+AP4_Thread::~AP4_Thread()
+{
+    // the subclass is already gone by now, so it is too late to wait
+    if (m_Impl->m_Started) {
+        pthread_detach(m_Impl->m_Thread);
+    }
+    delete m_Impl;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::Start
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Thread::Start()
+{
+    if (m_Impl->m_Started) return AP4_ERROR_INVALID_STATE;
+    if (pthread_create(&m_Impl->m_Thread, NULL, AP4_ThreadImpl::EntryPoint, this)) {
+        return AP4_FAILURE;
+    }
+    m_Impl->m_Started = true;
+    
+    return AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_Thread::Wait
++---------------------------------------------------------------------*/
+AP4_Result
+AP4_Thread::Wait()
+{
+    if (!m_Impl->m_Started) return AP4_SUCCESS;
+    m_Impl->m_Started = false;
+    return pthread_join(m_Impl->m_Thread, NULL) ? AP4_FAILURE : AP4_SUCCESS;
+}
+
+/*----------------------------------------------------------------------
+|   AP4_System_GetTimeStampUs
++---------------------------------------------------------------------*/
+AP4_UI64
+AP4_System_GetTimeStampUs()
+{
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return mach_absolute_time()*timebase.numer/timebase.denom/1000;
+#else
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now)) return 0;
+    return (AP4_UI64)now.tv_sec*1000000+now.tv_nsec/1000;
+#endif
+}
+
+#endif // AP4_CONFIG_HAVE_THREADS
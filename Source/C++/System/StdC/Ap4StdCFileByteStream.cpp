@@ -320,6 +320,26 @@ AP4_StdcFileByteStream::Flush()
     return (ret_val > 0) ? AP4_FAILURE: AP4_SUCCESS;
 }
 
+/*----------------------------------------------------------------------
+|   AP4_CreateFileByteStream
++---------------------------------------------------------------------*/
+static AP4_Result
+AP4_CreateFileByteStream(AP4_FileByteStream*      delegator,
+                         const char*              name, 
+                         AP4_FileByteStream::Mode mode,
+                         AP4_ByteStream*&         stream)
+{
+    if (mode == AP4_FileByteStream::STREAM_MODE_READ_MAPPED) {
+#if defined(AP4_CONFIG_HAVE_MMAP)
+        AP4_Result result = AP4_MmapFileByteStream::Create(delegator, name, stream);
+        if (AP4_SUCCEEDED(result)) return result;
+#endif
+        // fall back to regular reads if the file cannot be mapped
+        mode = AP4_FileByteStream::STREAM_MODE_READ;
+    }
+    return AP4_StdcFileByteStream::Create(delegator, name, mode, stream);
+}
+
 /*----------------------------------------------------------------------
 |   AP4_FileByteStream::Create
 +---------------------------------------------------------------------*/
@@ -328,7 +348,7 @@ AP4_FileByteStream::Create(const char*              name,
                            AP4_FileByteStream::Mode mode,
                            AP4_ByteStream*&         stream)
 {
-    return AP4_StdcFileByteStream::Create(NULL, name, mode, stream);
+    return AP4_CreateFileByteStream(NULL, name, mode, stream);
 }
 
 #if !defined(AP4_CONFIG_NO_EXCEPTIONS)
@@ -339,7 +359,7 @@ AP4_FileByteStream::AP4_FileByteStream(const char*              name,
                                        AP4_FileByteStream::Mode mode)
 {
     AP4_ByteStream* stream = NULL;
-    AP4_Result result = AP4_StdcFileByteStream::Create(this, name, mode, stream);
+    AP4_Result result = AP4_CreateFileByteStream(this, name, mode, stream);
     if (AP4_FAILED(result)) throw AP4_Exception(result);
     
     m_Delegate = stream;
@@ -42,6 +42,8 @@
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "Ap4AesBlockCipher.h"
+#include "Ap4NalParser.h"
 
 /*----------------------------------------------------------------------
 |   constants
@@ -50,6 +52,22 @@
 #define ENC_IN_BUFFER_SIZE (1024*128)
 #define ENC_OUT_BUFFER_SIZE (ENC_IN_BUFFER_SIZE+32)
 #define SCALE_MB (1024.0f*1024.0f)
+#define SYNC_LOOKUP_SAMPLE_COUNT (1<<20)
+#define SYNC_LOOKUP_GOP_SIZE     12
+#define SYNC_LOOKUP_COUNT        (1<<16)
+#define TS_WRITE_FRAME_SIZE      (1024*32)
+#define TS_WRITE_FRAME_COUNT     64
+#define CRC32_SECTION_SIZE       1024
+#define NAL_PARSE_NALU_SIZE      4096
+
+/*----------------------------------------------------------------------
+|   globals
++---------------------------------------------------------------------*/
+static AP4_FileByteStream::Mode ReadMode = AP4_FileByteStream::STREAM_MODE_READ;
+static bool         ReadAhead            = false;
+static AP4_UI64     ReadAheadPrefetched  = 0;
+static AP4_Cardinal ReadAheadStallCount  = 0;
+static AP4_UI64     ReadAheadStallTime   = 0;
 
 /*----------------------------------------------------------------------
 |   macros
@@ -113,6 +131,8 @@ PrintUsage()
     printf("benchmarktest [options] <test-name> [, <test-name>, ...]\n"
            "options:\n"
            "  --iterations=<n>: run each test for <n> iterations instead of a fixed run time.\n"
+           "  --mmap: open the test files as memory-mapped streams\n"
+           "  --read-ahead: read-file tests read through a read-ahead stream\n"
            "  --test-file-read=<filename> (any file for read tests)\n"
            "  --test-file-mp4=<filename> (MP4 file for parse-file, parse-samples and read-samples)\n"
            "  --test-file-dcf-cbc=<filename> (DCF/CBC file for read-samples-dcf-cbc)\n"
@@ -129,6 +149,8 @@ PrintUsage()
            "aes-cbc-stream-encrypt\n"
            "aes-cbc-stream-decrypt\n"
            "aes-ctr-stream\n"
+           "cenc-encrypt\n"
+           "cenc-decrypt\n"
            "parse-file\n"
            "parse-file-buffered\n"
            "parse-samples\n"
@@ -144,7 +166,12 @@ PrintUsage()
            "read-samples-dcf-cbc\n"
            "read-samples-dcf-ctr\n"
            "read-samples-pdcf-cbc\n"
-           "read-samples-pdcf-ctr\n");
+           "read-samples-pdcf-ctr\n"
+           "sync-lookup-search\n"
+           "sync-lookup-bitmap\n"
+           "ts-write\n"
+           "crc32\n"
+           "nal-parse\n");
 }
 
 /*----------------------------------------------------------------------
@@ -276,7 +303,7 @@ ParseAllSamples(const char* filename, unsigned int repeats)
 {
     // open the input
     AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    AP4_Result result = AP4_FileByteStream::Create(filename, ReadMode, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
         return 0;
@@ -308,7 +335,7 @@ ParseFile(const char* filename, unsigned int repeats, bool buffered)
     
     // open the input
     AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    AP4_Result result = AP4_FileByteStream::Create(filename, ReadMode, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
         return 0;
@@ -343,7 +370,7 @@ LoadAllSamples(const char* filename, unsigned int repeats)
 {
     // open the input
     AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    AP4_Result result = AP4_FileByteStream::Create(filename, ReadMode, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open input file (%s)\n", filename);
         return 0;
@@ -381,12 +408,19 @@ static unsigned int
 ReadFile(const char* filename, unsigned int block_size, bool sequential)
 {
     AP4_ByteStream* input = NULL;
-    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    AP4_Result result = AP4_FileByteStream::Create(filename, ReadMode, input);
     if (AP4_FAILED(result)) {
         fprintf(stderr, "ERROR: cannot open file %s (error %d)\n", filename, result);
         return 0;
     }
     
+    AP4_ReadAheadInputStream* read_ahead = NULL;
+    if (ReadAhead) {
+        read_ahead = new AP4_ReadAheadInputStream(*input);
+        input->Release();
+        input = read_ahead;
+    }
+
     AP4_LargeSize file_size = 0;
     input->GetSize(file_size);
     
@@ -417,12 +451,61 @@ ReadFile(const char* filename, unsigned int block_size, bool sequential)
         }
     }
     
+    if (read_ahead) {
+        ReadAheadPrefetched += read_ahead->GetBytesPrefetched();
+        ReadAheadStallCount += read_ahead->GetStallCount();
+        ReadAheadStallTime  += read_ahead->GetStallTime();
+    }
+
     delete[] buffer;
     input->Release();
     
     return total_read;
 }
 
+/*----------------------------------------------------------------------
+|   LookupSyncSamples
++---------------------------------------------------------------------*/
+static unsigned int
+LookupSyncSamples(AP4_StssAtom& stss)
+{
+    // random lookups, like a packager snapping segment boundaries
+    AP4_UI32 position = 0;
+    AP4_UI32 found    = 0;
+    for (unsigned int i=0; i<SYNC_LOOKUP_COUNT; i++) {
+        position = (position+(SYNC_LOOKUP_SAMPLE_COUNT/7)+i)%SYNC_LOOKUP_SAMPLE_COUNT;
+        AP4_Ordinal sample = position+1;
+        if (stss.IsSampleSync(sample)) ++found;
+        found += stss.GetEntryIndexForSample(sample)&1;
+    }
+    
+    // keep the compiler from optimizing the lookups out
+    return found ? SYNC_LOOKUP_COUNT : 0;
+}
+
+/*----------------------------------------------------------------------
+|   WriteTransportStream
++---------------------------------------------------------------------*/
+static unsigned int
+WriteTransportStream(AP4_Mpeg2TsWriter&               writer,
+                     AP4_Mpeg2TsWriter::SampleStream* stream,
+                     const unsigned char*             frame,
+                     AP4_MemoryByteStream&            output)
+{
+    // one PAT/PMT followed by a run of video PES packets, like a segment
+    output.Seek(0);
+    writer.WritePAT(output);
+    writer.WritePMT(output);
+    for (unsigned int i=0; i<TS_WRITE_FRAME_COUNT; i++) {
+        AP4_UI64 ts = 3003*i;
+        stream->WritePES(frame, TS_WRITE_FRAME_SIZE, ts, true, ts+3003, true, output);
+    }
+    
+    AP4_Position size = 0;
+    output.Tell(size);
+    return (unsigned int)(size/188);
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -440,6 +523,8 @@ main(int argc, char** argv)
     bool do_aes_cbc_stream_encrypt = false;
     bool do_aes_cbc_stream_decrypt = false;
     bool do_aes_ctr_stream         = false;
+    bool do_cenc_encrypt           = false;
+    bool do_cenc_decrypt           = false;
     bool do_read_file_seq_1        = false;
     bool do_read_file_seq_16       = false;
     bool do_read_file_seq_256      = false;
@@ -456,6 +541,11 @@ main(int argc, char** argv)
     bool do_read_samples_dcf_ctr   = false;
     bool do_read_samples_pdcf_cbc  = false;
     bool do_read_samples_pdcf_ctr  = false;
+    bool do_sync_lookup_search     = false;
+    bool do_sync_lookup_bitmap     = false;
+    bool do_ts_write               = false;
+    bool do_crc32                  = false;
+    bool do_nal_parse              = false;
     const char* test_file_read     = "test-bench.mp4";
     const char* test_file_mp4      = "test-bench.mp4";
     const char* test_file_dcf_cbc  = "test-bench.mp4.cbc.odf";
@@ -478,6 +568,10 @@ main(int argc, char** argv)
             do_aes_cbc_stream_decrypt = true;
         } else if (!strcmp(arg, "aes-ctr-stream")) {
             do_aes_ctr_stream = true;
+        } else if (!strcmp(arg, "cenc-encrypt")) {
+            do_cenc_encrypt = true;
+        } else if (!strcmp(arg, "cenc-decrypt")) {
+            do_cenc_decrypt = true;
         } else if (!strcmp(arg, "read-file-seq-1")) {
             do_read_file_seq_1 = true;
         } else if (!strcmp(arg, "read-file-seq-16")) {
@@ -510,6 +604,16 @@ main(int argc, char** argv)
             do_read_samples_pdcf_cbc = true;
         } else if (!strcmp(arg, "read-samples-pdcf-ctr")) {
             do_read_samples_pdcf_ctr = true;
+        } else if (!strcmp(arg, "sync-lookup-search")) {
+            do_sync_lookup_search = true;
+        } else if (!strcmp(arg, "sync-lookup-bitmap")) {
+            do_sync_lookup_bitmap = true;
+        } else if (!strcmp(arg, "ts-write")) {
+            do_ts_write = true;
+        } else if (!strcmp(arg, "crc32")) {
+            do_crc32 = true;
+        } else if (!strcmp(arg, "nal-parse")) {
+            do_nal_parse = true;
         } else if (!strncmp(arg, "--test-file-read=", 17)) {
             test_file_read = arg+17;
         } else if (!strncmp(arg, "--test-file-mp4=", 16)) {
@@ -524,6 +628,10 @@ main(int argc, char** argv)
             test_file_pdcf_ctr = arg+21;
         } else if (!strncmp(arg, "--iterations=", 13)) {
             max_iterations = strtoul(arg+13, NULL, 10);
+        } else if (!strcmp(arg, "--mmap")) {
+            ReadMode = AP4_FileByteStream::STREAM_MODE_READ_MAPPED;
+        } else if (!strcmp(arg, "--read-ahead")) {
+            ReadAhead = true;
         } else if (!strcmp(arg, "all")) {
             do_aes_cbc_block_decrypt  = true;
             do_aes_cbc_block_encrypt  = true;
@@ -531,6 +639,8 @@ main(int argc, char** argv)
             do_aes_cbc_stream_encrypt = true;
             do_aes_cbc_stream_decrypt = true;
             do_aes_ctr_stream         = true;
+            do_cenc_encrypt           = true;
+            do_cenc_decrypt           = true;
             do_read_file_seq_1        = true;
             do_read_file_seq_16       = true;
             do_read_file_seq_256      = true;
@@ -547,6 +657,11 @@ main(int argc, char** argv)
             do_read_samples_dcf_ctr   = true;
             do_read_samples_pdcf_cbc  = true;
             do_read_samples_pdcf_ctr  = true;
+            do_sync_lookup_search     = true;
+            do_sync_lookup_bitmap     = true;
+            do_ts_write               = true;
+            do_crc32                  = true;
+            do_nal_parse              = true;
         } else {
             fprintf(stderr, "ERROR: unknown test name (%s)\n", arg);
             return 1;
@@ -566,57 +681,107 @@ main(int argc, char** argv)
     AP4_SetMemory(megabyte_in, 0, ENC_IN_BUFFER_SIZE);
     unsigned char* megabyte_out = new unsigned char[ENC_OUT_BUFFER_SIZE];
     
+    AP4_StssAtom stss;
+    for (unsigned int sample=1; sample<=SYNC_LOOKUP_SAMPLE_COUNT; sample += SYNC_LOOKUP_GOP_SIZE) {
+        stss.AddEntry(sample);
+    }
+
+    // run the cipher tests with the processor's AES instructions, if
+    // available, and with the portable table-based implementation
+    for (unsigned int backend=0; backend<2; backend++) {
+    bool accelerate = (backend == 0);
+    if (accelerate && !AP4_AesBlockCipher::IsHardwareAccelerationAvailable()) continue;
+    AP4_AesBlockCipher::EnableHardwareAcceleration(accelerate);
+    const char* backend_name = accelerate?"AES instructions":"tables";
+    char name[256];
+    
     AP4_BlockCipher* e_cbc_block_cipher;
     AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CBC, NULL, key, 16, e_cbc_block_cipher);
     AP4_BlockCipher* d_cbc_block_cipher;
     AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::DECRYPT, AP4_BlockCipher::CBC, NULL, key, 16, d_cbc_block_cipher);
     AP4_BlockCipher* ctr_block_cipher;
     AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CTR, NULL, key, 16, ctr_block_cipher);
+    AP4_BlockCipher* cenc_block_cipher;
+    AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CTR, NULL, key, 16, cenc_block_cipher);
 
     AP4_CbcStreamCipher e_cbc_stream_cipher(e_cbc_block_cipher);
     AP4_CbcStreamCipher d_cbc_stream_cipher(d_cbc_block_cipher);
     AP4_CtrStreamCipher ctr_stream_cipher(ctr_block_cipher, 16);
-
-    BENCH_START("AES CBC Block Encryption", do_aes_cbc_block_encrypt)
+    AP4_CencCtrSampleEncrypter cenc_encrypter(new AP4_CtrStreamCipher(cenc_block_cipher, 8), 8);
+    AP4_CencSingleSampleDecrypter* cenc_decrypter = NULL;
+    AP4_CencSingleSampleDecrypter::Create(AP4_CENC_ALGORITHM_ID_CTR, key, 16, NULL, cenc_decrypter);
+    AP4_DataBuffer cenc_clear(megabyte_in, ENC_IN_BUFFER_SIZE);
+    AP4_DataBuffer cenc_encrypted;
+    AP4_DataBuffer cenc_decrypted;
+    AP4_DataBuffer cenc_sample_infos;
+    AP4_UI08       cenc_iv[16];
+    AP4_SetMemory(cenc_iv, 0, sizeof(cenc_iv));
+    cenc_encrypter.SetIv(cenc_iv);
+    cenc_encrypter.EncryptSampleData(cenc_clear, cenc_encrypted, cenc_sample_infos);
+
+    AP4_FormatString(name, sizeof(name), "AES CBC Block Encryption (%s)", backend_name);
+    BENCH_START(name, do_aes_cbc_block_encrypt)
     for (unsigned b=0; b<256; b++) {
         e_cbc_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
     }
     total += 256*blocks_size;
     BENCH_END("MB", SCALE_MB)
     
-    BENCH_START("AES CBC Block Decryption", do_aes_cbc_block_decrypt)
+    AP4_FormatString(name, sizeof(name), "AES CBC Block Decryption (%s)", backend_name);
+    BENCH_START(name, do_aes_cbc_block_decrypt)
     for (unsigned b=0; b<256; b++) {
         d_cbc_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
     }
     total += 256*blocks_size;
     BENCH_END("MB", SCALE_MB)
          
-    BENCH_START("AES CTR Block Encryption/Decryption", do_aes_ctr_block)
+    AP4_FormatString(name, sizeof(name), "AES CTR Block Encryption/Decryption (%s)", backend_name);
+    BENCH_START(name, do_aes_ctr_block)
     for (unsigned b=0; b<256; b++) {
         ctr_block_cipher->Process(blocks_in, blocks_size, blocks_out, NULL);
     }
     total += 256*blocks_size;
     BENCH_END("MB", SCALE_MB)
 
-    BENCH_START("AES CBC Stream Encryption", do_aes_cbc_stream_encrypt)
+    AP4_FormatString(name, sizeof(name), "AES CBC Stream Encryption (%s)", backend_name);
+    BENCH_START(name, do_aes_cbc_stream_encrypt)
     AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
     AP4_Result result = e_cbc_stream_cipher.ProcessBuffer(megabyte_in, ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
     if (AP4_FAILED(result)) fprintf(stderr, "ERROR\n");
     total += ENC_IN_BUFFER_SIZE;
     BENCH_END("MB", SCALE_MB)
 
-    BENCH_START("AES CBC Stream Decryption", do_aes_cbc_stream_decrypt)
+    AP4_FormatString(name, sizeof(name), "AES CBC Stream Decryption (%s)", backend_name);
+    BENCH_START(name, do_aes_cbc_stream_decrypt)
     AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
     d_cbc_stream_cipher.ProcessBuffer(megabyte_in,ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
     total += ENC_IN_BUFFER_SIZE;
     BENCH_END("MB", SCALE_MB)
 
-    BENCH_START("AES CTR Stream", do_aes_ctr_stream)
+    AP4_FormatString(name, sizeof(name), "AES CTR Stream (%s)", backend_name);
+    BENCH_START(name, do_aes_ctr_stream)
     AP4_Size out_size = ENC_OUT_BUFFER_SIZE;
     ctr_stream_cipher.ProcessBuffer(megabyte_in, ENC_IN_BUFFER_SIZE, megabyte_out, &out_size, false);
     total += ENC_IN_BUFFER_SIZE;
     BENCH_END("MB", SCALE_MB)
 
+    AP4_FormatString(name, sizeof(name), "CENC Sample Encryption (%s)", backend_name);
+    BENCH_START(name, do_cenc_encrypt)
+    cenc_sample_infos.SetDataSize(0);
+    cenc_encrypter.EncryptSampleData(cenc_clear, cenc_encrypted, cenc_sample_infos);
+    total += ENC_IN_BUFFER_SIZE;
+    BENCH_END("MB", SCALE_MB)
+
+    AP4_FormatString(name, sizeof(name), "CENC Sample Decryption (%s)", backend_name);
+    BENCH_START(name, do_cenc_decrypt)
+    cenc_decrypter->DecryptSampleData(cenc_encrypted, cenc_decrypted, cenc_iv, 0, NULL, NULL);
+    total += ENC_IN_BUFFER_SIZE;
+    BENCH_END("MB", SCALE_MB)
+    
+    delete cenc_decrypter;
+    }
+    AP4_AesBlockCipher::EnableHardwareAcceleration(true);
+
     BENCH_START("Read File Sequential (1 Byte Blocks)", do_read_file_seq_1)
     total += ReadFile(test_file_read, 1, true);
     BENCH_END("MB", SCALE_MB)
@@ -681,5 +846,88 @@ main(int argc, char** argv)
     total += LoadAllSamples(test_file_pdcf_ctr, 16);
     BENCH_END("MB", SCALE_MB)
 
+    BENCH_START("Sync Sample Lookup (Binary Search)", do_sync_lookup_search)
+    stss.UseBitmap(false);
+    total += LookupSyncSamples(stss);
+    BENCH_END("lookups", 1)
+
+    BENCH_START("Sync Sample Lookup (Bitmap)", do_sync_lookup_bitmap)
+    stss.UseBitmap(true);
+    total += LookupSyncSamples(stss);
+    BENCH_END("lookups", 1)
+
+    AP4_Mpeg2TsWriter ts_writer;
+    AP4_Mpeg2TsWriter::SampleStream* ts_stream = NULL;
+    ts_writer.SetVideoStream(90000, 
+                             AP4_MPEG2_STREAM_TYPE_AVC, 
+                             AP4_MPEG2_TS_DEFAULT_STREAM_ID_VIDEO, 
+                             ts_stream);
+    AP4_MemoryByteStream* ts_output = new AP4_MemoryByteStream();
+    BENCH_START("TS Write", do_ts_write)
+    total += WriteTransportStream(ts_writer, ts_stream, megabyte_in, *ts_output);
+    BENCH_END("packets", 1)
+    ts_output->Release();
+
+    // the CRC of short sections, as inserted in a transport stream, and of
+    // large buffers, with and without carry-less multiplication
+    for (unsigned int backend=0; backend<2; backend++) {
+        bool accelerate = (backend == 0);
+        if (accelerate && !AP4_Crc32::IsHardwareAccelerationAvailable()) continue;
+        AP4_Crc32::EnableHardwareAcceleration(accelerate);
+        const char* backend_name = accelerate?"carry-less multiplication":"tables";
+        char name[256];
+        
+        AP4_FormatString(name, sizeof(name), "CRC32 Sections (%s)", backend_name);
+        BENCH_START(name, do_crc32)
+        AP4_UI32 crc = 0;
+        for (unsigned int s=0; s<ENC_IN_BUFFER_SIZE/CRC32_SECTION_SIZE; s++) {
+            crc ^= AP4_Crc32::Compute(megabyte_in+s*CRC32_SECTION_SIZE, CRC32_SECTION_SIZE);
+        }
+        if (crc == 0x12345678) printf(" ");
+        total += ENC_IN_BUFFER_SIZE;
+        BENCH_END("MB", SCALE_MB)
+        
+        AP4_FormatString(name, sizeof(name), "CRC32 Buffer (%s)", backend_name);
+        BENCH_START(name, do_crc32)
+        if (AP4_Crc32::Compute(megabyte_in, ENC_IN_BUFFER_SIZE) == 0x12345678) printf(" ");
+        total += ENC_IN_BUFFER_SIZE;
+        BENCH_END("MB", SCALE_MB)
+    }
+    AP4_Crc32::EnableHardwareAcceleration(true);
+
+    // an Annex-B stream with pseudo-random NAL unit payloads, in which 0 
+    // bytes are about as frequent as in entropy-coded slices
+    unsigned char* nal_stream = new unsigned char[ENC_IN_BUFFER_SIZE];
+    AP4_UI32 nal_random = 1;
+    for (unsigned int n=0; n<ENC_IN_BUFFER_SIZE; n++) {
+        if (n%NAL_PARSE_NALU_SIZE < 4) {
+            nal_stream[n] = (n%NAL_PARSE_NALU_SIZE == 3) ? 1 : 0;
+        } else {
+            nal_random = nal_random*1103515245+12345;
+            nal_stream[n] = (unsigned char)(nal_random>>24);
+        }
+    }
+    AP4_NalParser nal_parser;
+    BENCH_START("NAL Parse", do_nal_parse)
+    nal_parser.Reset();
+    unsigned int offset = 0;
+    for (;;) {
+        AP4_Size bytes_consumed = 0;
+        const AP4_DataBuffer* nalu = NULL;
+        nal_parser.Feed(nal_stream+offset, ENC_IN_BUFFER_SIZE-offset, bytes_consumed, nalu, true);
+        offset += bytes_consumed;
+        if (nalu == NULL) break;
+    }
+    total += ENC_IN_BUFFER_SIZE;
+    BENCH_END("MB", SCALE_MB)
+    delete[] nal_stream;
+
+    if (ReadAhead) {
+        printf("read-ahead: %lld bytes prefetched, %d stalls, %lld us stalled\n",
+               (long long)ReadAheadPrefetched,
+               (int)ReadAheadStallCount,
+               (long long)ReadAheadStallTime);
+    }
+
     return 1;
 }
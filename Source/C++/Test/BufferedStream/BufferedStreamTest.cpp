@@ -212,10 +212,15 @@ TestStream::Release()
 |   DoTest
 +---------------------------------------------------------------------*/
 static int
-DoTest(unsigned int buffer_size,  unsigned int seek_as_read_threshold, unsigned int source_size, bool partial)
+DoTest(unsigned int buffer_size,  unsigned int seek_as_read_threshold, unsigned int source_size, bool partial, bool read_ahead)
 {
     TestStream* source = new TestStream(source_size, partial);
-    AP4_BufferedInputStream* stream = new AP4_BufferedInputStream(*source, buffer_size, seek_as_read_threshold);
+    AP4_ByteStream* stream;
+    if (read_ahead) {
+        stream = new AP4_ReadAheadInputStream(*source, buffer_size, 3, seek_as_read_threshold);
+    } else {
+        stream = new AP4_BufferedInputStream(*source, buffer_size, seek_as_read_threshold);
+    }
     unsigned char* buffer = new unsigned char[4096];
     
     // read all linearly
@@ -229,7 +234,7 @@ DoTest(unsigned int buffer_size,  unsigned int seek_as_read_threshold, unsigned
             if (chunk) CHECK(bytes_read);
             CHECK(bytes_read <= chunk);
             for (unsigned int i=0; i<bytes_read; i++) {
-                CHECK(buffer[i+position] == (unsigned char)(buffer[i+position]));
+                CHECK(buffer[i] == (unsigned char)(i+position));
             }
             position += bytes_read;
             AP4_Position where;
@@ -266,7 +271,7 @@ DoTest(unsigned int buffer_size,  unsigned int seek_as_read_threshold, unsigned
             if (chunk) CHECK(bytes_read);
             CHECK(bytes_read <= chunk);
             for (unsigned int i=0; i<bytes_read; i++) {
-                CHECK(buffer[i+position] == (unsigned char)(buffer[i+position]));
+                CHECK(buffer[i] == (unsigned char)(i+position));
             }
             position += bytes_read;
             AP4_Position where;
@@ -288,13 +293,13 @@ DoTest(unsigned int buffer_size,  unsigned int seek_as_read_threshold, unsigned
 |   TestBuffer
 +---------------------------------------------------------------------*/
 static int
-TestBuffer(unsigned int buffer_size)
+TestBuffer(unsigned int buffer_size, bool read_ahead)
 {
     for (unsigned int source_size=1; source_size<buffer_size*32; source_size += 17) {
         for (unsigned int seek_as_read_threshold=0; seek_as_read_threshold < 128; seek_as_read_threshold+=16) { 
-            int result = DoTest(buffer_size, seek_as_read_threshold, source_size, true);
+            int result = DoTest(buffer_size, seek_as_read_threshold, source_size, true, read_ahead);
             if (result < 0) return result;
-            result = DoTest(buffer_size, seek_as_read_threshold, source_size, false);
+            result = DoTest(buffer_size, seek_as_read_threshold, source_size, false, read_ahead);
             if (result < 0) return result;
         }
     }
@@ -309,7 +314,11 @@ int
 main(int argc, char** argv)
 {
     for (unsigned int buffer_size=1; buffer_size<256; buffer_size++) {
-        int result = TestBuffer(buffer_size);
+        int result = TestBuffer(buffer_size, false);
+        if (result < 0) return 1;
+    }
+    for (unsigned int buffer_size=1; buffer_size<256; buffer_size += 31) {
+        int result = TestBuffer(buffer_size, true);
         if (result < 0) return 1;
     }
     
@@ -34,8 +34,10 @@
 
 #include "Ap4.h"
 #include "Ap4StreamCipher.h"
+#include "Ap4AesBlockCipher.h"
 #include "Ap4Hmac.h"
 #include "Ap4KeyWrap.h"
+#include "Ap4CommonEncryption.h"
 
 #define REPEAT_COUNT 10000
 
@@ -2304,26 +2306,628 @@ TestCbcStreamCipher()
     return 0;
 }
 
+/*----------------------------------------------------------------------
+|   TestAesImplementations
++---------------------------------------------------------------------*/
+static int
+TestAesImplementations()
+{
+    if (!AP4_AesBlockCipher::IsHardwareAccelerationAvailable()) return 0;
+    
+    unsigned char key[] = {
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+    };
+    
+    // create the same ciphers with and without hardware acceleration
+    AP4_BlockCipher* ciphers[2][3];
+    for (unsigned int i=0; i<2; i++) {
+        AP4_AesBlockCipher::EnableHardwareAcceleration(i==0);
+        AP4_Result result;
+        result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CBC, NULL, key, 16, ciphers[i][0]);
+        CHECK(result == AP4_SUCCESS);
+        result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::DECRYPT, AP4_BlockCipher::CBC, NULL, key, 16, ciphers[i][1]);
+        CHECK(result == AP4_SUCCESS);
+        result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, AP4_BlockCipher::ENCRYPT, AP4_BlockCipher::CTR, NULL, key, 16, ciphers[i][2]);
+        CHECK(result == AP4_SUCCESS);
+    }
+    AP4_AesBlockCipher::EnableHardwareAcceleration(true);
+    
+    // compare the output of both on random data, with counters close to wrapping around
+    AP4_UI08* in      = new AP4_UI08[4096];
+    AP4_UI08* out_hw  = new AP4_UI08[4096];
+    AP4_UI08* out_tab = new AP4_UI08[4096];
+    for (unsigned int i=0; i<4096; i++) {
+        in[i] = (AP4_UI08)rand();
+    }
+    for (unsigned int i=0; i<REPEAT_COUNT/10; i++) {
+        AP4_UI08 iv[16];
+        for (unsigned int j=0; j<16; j++) {
+            iv[j] = (rand()%3)?0xFF:(AP4_UI08)rand();
+        }
+        AP4_Size size = rand()%4096;
+        AP4_Size cbc_size = size-size%16;
+        for (unsigned int c=0; c<3; c++) {
+            AP4_Size process_size = c==2?size:cbc_size;
+            CHECK(ciphers[0][c]->Process(in, process_size, out_hw,  iv) == AP4_SUCCESS);
+            CHECK(ciphers[1][c]->Process(in, process_size, out_tab, iv) == AP4_SUCCESS);
+            CHECK(BuffersEqual(out_hw, out_tab, process_size));
+        }
+    }
+    delete[] in;
+    delete[] out_hw;
+    delete[] out_tab;
+    for (unsigned int i=0; i<2; i++) {
+        for (unsigned int c=0; c<3; c++) {
+            delete ciphers[i][c];
+        }
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestCrc32
++---------------------------------------------------------------------*/
+static int
+TestCrc32()
+{
+    // known value for the MPEG-2 CRC
+    const AP4_UI08* check = (const AP4_UI08*)"123456789";
+    CHECK(AP4_Crc32::Compute(check, 9) == 0x0376E6E7);
+    
+    // compare with a bit-at-a-time CRC on random data, for all sizes and 
+    // alignments around the block sizes, and when split in two parts
+    AP4_UI08* data = new AP4_UI08[1024+16];
+    for (unsigned int i=0; i<1024+16; i++) {
+        data[i] = (AP4_UI08)rand();
+    }
+    for (unsigned int i=0; i<2; i++) {
+        bool accelerate = (i == 0);
+        if (accelerate && !AP4_Crc32::IsHardwareAccelerationAvailable()) continue;
+        AP4_Crc32::EnableHardwareAcceleration(accelerate);
+        for (unsigned int size=0; size<=1024; size++) {
+            unsigned int offset = size%16;
+            AP4_UI32 expected = 0xFFFFFFFF;
+            for (unsigned int j=0; j<size; j++) {
+                expected ^= (AP4_UI32)data[offset+j]<<24;
+                for (unsigned int k=0; k<8; k++) {
+                    expected = (expected & 0x80000000) ? (expected<<1)^0x04C11DB7 : (expected<<1);
+                }
+            }
+            CHECK(AP4_Crc32::Compute(data+offset, size) == expected);
+            unsigned int split = size/3;
+            AP4_UI32 crc = AP4_Crc32::Compute(data+offset, split);
+            CHECK(AP4_Crc32::Compute(data+offset+split, size-split, crc) == expected);
+        }
+    }
+    AP4_Crc32::EnableHardwareAcceleration(true);
+    delete[] data;
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   AppendData
++---------------------------------------------------------------------*/
+static void
+AppendData(AP4_DataBuffer& buffer, const AP4_UI08* data, AP4_Size data_size)
+{
+    AP4_Size offset = buffer.GetDataSize();
+    buffer.SetDataSize(offset+data_size);
+    AP4_CopyMemory(buffer.UseData()+offset, data, data_size);
+}
+
+/*----------------------------------------------------------------------
+|   CreateCencSampleEncrypter
++---------------------------------------------------------------------*/
+static AP4_CencSampleEncrypter*
+CreateCencSampleEncrypter(AP4_UI32        algorithm_id, 
+                          AP4_Size        nalu_length_size, 
+                          unsigned int    iv_size,
+                          const AP4_UI08* key,
+                          const AP4_UI08* iv)
+{
+    // same setup as AP4_CencEncryptingProcessor
+    AP4_BlockCipher*           block_cipher = NULL;
+    AP4_BlockCipher::CtrParams ctr_params;
+    ctr_params.counter_size = 8;
+    bool ctr = (algorithm_id == AP4_CENC_ALGORITHM_ID_CTR);
+    AP4_Result result = AP4_DefaultBlockCipherFactory::Instance.CreateCipher(AP4_BlockCipher::AES_128, 
+                                                                             AP4_BlockCipher::ENCRYPT, 
+                                                                             ctr?AP4_BlockCipher::CTR:AP4_BlockCipher::CBC,
+                                                                             ctr?&ctr_params:NULL,
+                                                                             key, 
+                                                                             16, 
+                                                                             block_cipher);
+    if (AP4_FAILED(result)) return NULL;
+    AP4_CencSampleEncrypter* sample_encrypter;
+    if (ctr) {
+        AP4_StreamCipher* stream_cipher = new AP4_CtrStreamCipher(block_cipher, 16);
+        if (nalu_length_size) {
+            sample_encrypter = new AP4_CencCtrSubSampleEncrypter(stream_cipher, nalu_length_size, iv_size);
+        } else {
+            sample_encrypter = new AP4_CencCtrSampleEncrypter(stream_cipher, iv_size);
+        }
+    } else {
+        AP4_StreamCipher* stream_cipher = new AP4_CbcStreamCipher(block_cipher);
+        if (nalu_length_size) {
+            sample_encrypter = new AP4_CencCbcSubSampleEncrypter(stream_cipher, nalu_length_size);
+        } else {
+            sample_encrypter = new AP4_CencCbcSampleEncrypter(stream_cipher);
+        }
+    }
+    sample_encrypter->SetIv(iv);
+    
+    return sample_encrypter;
+}
+
+/*----------------------------------------------------------------------
+|   TestCencBatchEncryption
++---------------------------------------------------------------------*/
+static int
+TestCencBatchEncryption()
+{
+    unsigned char key[] = {
+      0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+    };
+    
+    // the lower half of the IV wraps around within the samples
+    unsigned char iv[] = {
+      0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00
+    };
+    
+    struct {
+        AP4_UI32     algorithm_id;
+        AP4_Size     nalu_length_size;
+        unsigned int iv_size;
+    } variants[] = {
+        { AP4_CENC_ALGORITHM_ID_CTR, 0,  8 },
+        { AP4_CENC_ALGORITHM_ID_CTR, 0, 16 },
+        { AP4_CENC_ALGORITHM_ID_CTR, 4,  8 },
+        { AP4_CENC_ALGORITHM_ID_CTR, 4, 16 },
+        { AP4_CENC_ALGORITHM_ID_CBC, 0, 16 },
+        { AP4_CENC_ALGORITHM_ID_CBC, 4, 16 }
+    };
+    
+    for (unsigned int v=0; v<sizeof(variants)/sizeof(variants[0]); v++) {
+        AP4_Size nalu_length_size = variants[v].nalu_length_size;
+        AP4_UI08 iv_size          = (AP4_UI08)variants[v].iv_size;
+        
+        // one encrypter for the samples one at a time, one for the batches,
+        // and, in CTR mode, one that skips the first batch
+        AP4_CencSampleEncrypter* single  = CreateCencSampleEncrypter(variants[v].algorithm_id, nalu_length_size, iv_size, key, iv);
+        AP4_CencSampleEncrypter* batch   = CreateCencSampleEncrypter(variants[v].algorithm_id, nalu_length_size, iv_size, key, iv);
+        AP4_CencSampleEncrypter* skipper = CreateCencSampleEncrypter(variants[v].algorithm_id, nalu_length_size, iv_size, key, iv);
+        CHECK(single && batch && skipper);
+        
+        for (unsigned int b=0; b<2; b++) {
+            // make a batch of random samples, made of NAL units with subsamples
+            AP4_DataBuffer      data_in;
+            AP4_Array<AP4_UI32> sample_sizes;
+            unsigned int sample_count = 1+rand()%40;
+            for (unsigned int i=0; i<sample_count; i++) {
+                AP4_Size sample_size = 0;
+                unsigned int nalu_count = 1+rand()%4;
+                for (unsigned int j=0; j<nalu_count; j++) {
+                    AP4_Size nalu_size = 1+((rand()%4)?rand()%64:rand()%4000);
+                    AP4_Size offset = data_in.GetDataSize();
+                    data_in.SetDataSize(offset+4+nalu_size);
+                    AP4_UI08* nalu = data_in.UseData()+offset;
+                    AP4_BytesFromUInt32BE(nalu, nalu_size);
+                    for (unsigned int k=0; k<nalu_size; k++) {
+                        nalu[4+k] = (AP4_UI08)rand();
+                    }
+                    sample_size += 4+nalu_size;
+                }
+                sample_sizes.Append(sample_size);
+            }
+            
+            // encrypt the samples one at a time
+            AP4_DataBuffer      expected_data;
+            AP4_DataBuffer      expected_infos;
+            AP4_Array<AP4_UI08> expected_info_sizes;
+            AP4_Size offset = 0;
+            for (unsigned int i=0; i<sample_count; i++) {
+                AP4_DataBuffer sample_in(data_in.GetData()+offset, sample_sizes[i]);
+                AP4_DataBuffer sample_out;
+                AP4_DataBuffer subsample_info;
+                AP4_UI08 sample_iv[16];
+                AP4_CopyMemory(sample_iv, single->GetIv(), 16);
+                CHECK(single->EncryptSampleData(sample_in, sample_out, subsample_info) == AP4_SUCCESS);
+                CHECK(sample_out.GetDataSize() == sample_sizes[i]);
+                AppendData(expected_data, sample_out.GetData(), sample_out.GetDataSize());
+                AppendData(expected_infos, sample_iv, iv_size);
+                AppendData(expected_infos, subsample_info.GetData(), subsample_info.GetDataSize());
+                expected_info_sizes.Append((AP4_UI08)(iv_size+subsample_info.GetDataSize()));
+                offset += sample_sizes[i];
+            }
+            
+            // the batch must give the same data, sample infos and next IV
+            AP4_DataBuffer      data_out;
+            AP4_DataBuffer      sample_infos;
+            AP4_Array<AP4_UI08> sample_info_sizes;
+            CHECK(batch->EncryptSamples(data_in, sample_sizes, iv_size, data_out, sample_infos, sample_info_sizes) == AP4_SUCCESS);
+            CHECK(data_out.GetDataSize() == expected_data.GetDataSize());
+            CHECK(BuffersEqual(data_out.GetData(), expected_data.GetData(), expected_data.GetDataSize()));
+            CHECK(sample_infos.GetDataSize() == expected_infos.GetDataSize());
+            CHECK(BuffersEqual(sample_infos.GetData(), expected_infos.GetData(), expected_infos.GetDataSize()));
+            CHECK(sample_info_sizes.ItemCount() == sample_count);
+            for (unsigned int i=0; i<sample_count; i++) {
+                CHECK(sample_info_sizes[i] == expected_info_sizes[i]);
+            }
+            CHECK(BuffersEqual(batch->GetIv(), single->GetIv(), 16));
+            
+            // skipping the first batch must lead to the same IV, and then to
+            // the same second batch
+            if (variants[v].algorithm_id == AP4_CENC_ALGORITHM_ID_CTR) {
+                if (b == 0) {
+                    CHECK(skipper->SkipSamples(data_in, sample_sizes) == AP4_SUCCESS);
+                    CHECK(BuffersEqual(skipper->GetIv(), single->GetIv(), 16));
+                } else {
+                    AP4_DataBuffer      skipper_out;
+                    AP4_DataBuffer      skipper_infos;
+                    AP4_Array<AP4_UI08> skipper_info_sizes;
+                    CHECK(skipper->EncryptSamples(data_in, sample_sizes, iv_size, skipper_out, skipper_infos, skipper_info_sizes) == AP4_SUCCESS);
+                    CHECK(skipper_out.GetDataSize() == expected_data.GetDataSize());
+                    CHECK(BuffersEqual(skipper_out.GetData(), expected_data.GetData(), expected_data.GetDataSize()));
+                }
+            } else {
+                CHECK(skipper->SkipSamples(data_in, sample_sizes) == AP4_ERROR_NOT_SUPPORTED);
+            }
+        }
+        
+        delete single;
+        delete batch;
+        delete skipper;
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ReadFragmentedSamples
++---------------------------------------------------------------------*/
+static AP4_Result
+ReadFragmentedSamples(AP4_DataBuffer& file_data, AP4_DataBuffer& samples)
+{
+    samples.SetDataSize(0);
+    
+    AP4_MemoryByteStream* input = new AP4_MemoryByteStream(file_data);
+    AP4_File* file = new AP4_File(*input, AP4_DefaultAtomFactory::Instance, true);
+    AP4_Movie* movie = file->GetMovie();
+    if (movie == NULL || !movie->HasFragments()) {
+        delete file;
+        input->Release();
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    
+    // concatenate the track ID and data of every sample, in reading order
+    AP4_LinearReader reader(*movie, input);
+    AP4_List<AP4_Track>::Item* item = movie->GetTracks().FirstItem();
+    for (; item; item = item->GetNext()) {
+        reader.EnableTrack(item->GetData()->GetId());
+    }
+    AP4_Result     result;
+    AP4_Sample     sample;
+    AP4_DataBuffer sample_data;
+    AP4_UI32       track_id = 0;
+    while (AP4_SUCCEEDED(result = reader.ReadNextSample(sample, sample_data, track_id))) {
+        AP4_Size offset = samples.GetDataSize();
+        samples.SetDataSize(offset+4+sample_data.GetDataSize());
+        AP4_BytesFromUInt32BE(samples.UseData()+offset, track_id);
+        AP4_CopyMemory(samples.UseData()+offset+4, sample_data.GetData(), sample_data.GetDataSize());
+    }
+    
+    delete file;
+    input->Release();
+    
+    return result == AP4_ERROR_EOS ? AP4_SUCCESS : result;
+}
+
+/*----------------------------------------------------------------------
+|   ProcessFile
++---------------------------------------------------------------------*/
+static AP4_Result
+ProcessFile(AP4_Processor& processor, AP4_DataBuffer& input_data, AP4_DataBuffer& output_data)
+{
+    output_data.SetDataSize(0);
+    AP4_MemoryByteStream* input  = new AP4_MemoryByteStream(input_data);
+    AP4_MemoryByteStream* output = new AP4_MemoryByteStream(output_data);
+    AP4_Result result = processor.Process(*input, *output);
+    input->Release();
+    output->Release();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   SequentialByteStream
++---------------------------------------------------------------------*/
+/**
+ * Memory stream that can only be read forward, like a pipe.
+ */
+class SequentialByteStream : public AP4_ByteStream
+{
+public:
+    SequentialByteStream(AP4_DataBuffer& data) : 
+        m_Data(data), m_Position(0), m_ReferenceCount(1) {}
+    
+    // AP4_ByteStream methods
+    AP4_Result ReadPartial(void* buffer, AP4_Size bytes_to_read, AP4_Size& bytes_read) {
+        bytes_read = 0;
+        if (m_Position >= m_Data.GetDataSize()) return AP4_ERROR_EOS;
+        AP4_Size available = m_Data.GetDataSize()-(AP4_Size)m_Position;
+        if (bytes_to_read > available) bytes_to_read = available;
+        AP4_CopyMemory(buffer, m_Data.GetData()+m_Position, bytes_to_read);
+        m_Position += bytes_to_read;
+        bytes_read = bytes_to_read;
+        return AP4_SUCCESS;
+    }
+    AP4_Result WritePartial(const void*, AP4_Size, AP4_Size& bytes_written) {
+        bytes_written = 0;
+        return AP4_ERROR_NOT_SUPPORTED;
+    }
+    AP4_Result Seek(AP4_Position position) { 
+        return position == m_Position ? AP4_SUCCESS : AP4_ERROR_NOT_SUPPORTED; 
+    }
+    AP4_Result Tell(AP4_Position& position) { 
+        position = m_Position; 
+        return AP4_SUCCESS; 
+    }
+    AP4_Result GetSize(AP4_LargeSize& size) { 
+        size = 0;
+        return AP4_ERROR_NOT_SUPPORTED; 
+    }
+    
+    // AP4_Referenceable methods
+    void AddReference() { ++m_ReferenceCount; }
+    void Release()      { if (--m_ReferenceCount == 0) delete this; }
+    
+private:
+    AP4_DataBuffer& m_Data;
+    AP4_Position    m_Position;
+    AP4_Cardinal    m_ReferenceCount;
+};
+
+/*----------------------------------------------------------------------
+|   GetMoofOffsets
++---------------------------------------------------------------------*/
+static void
+GetMoofOffsets(AP4_DataBuffer& file, AP4_Array<AP4_UI64>& offsets)
+{
+    AP4_UI64 offset = 0;
+    while (offset+8 <= file.GetDataSize()) {
+        AP4_UI64 size = AP4_BytesToUInt32BE(file.GetData()+offset);
+        if (size == 1) size = AP4_BytesToUInt64BE(file.GetData()+offset+8);
+        if (size == 0) size = file.GetDataSize()-offset;
+        if (size < 8) break;
+        if (AP4_BytesToUInt32BE(file.GetData()+offset+4) == AP4_ATOM_TYPE_MOOF) {
+            offsets.Append(offset);
+        }
+        offset += size;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   CheckMfra
++---------------------------------------------------------------------*/
+static int
+CheckMfra(AP4_DataBuffer& input, AP4_DataBuffer& output)
+{
+    AP4_Array<AP4_UI64> input_moofs;
+    AP4_Array<AP4_UI64> output_moofs;
+    GetMoofOffsets(input,  input_moofs);
+    GetMoofOffsets(output, output_moofs);
+    CHECK(output_moofs.ItemCount() == input_moofs.ItemCount());
+    
+    AP4_MemoryByteStream* input_stream  = new AP4_MemoryByteStream(input);
+    AP4_MemoryByteStream* output_stream = new AP4_MemoryByteStream(output);
+    AP4_File* input_file  = new AP4_File(*input_stream);
+    AP4_File* output_file = new AP4_File(*output_stream);
+    AP4_ContainerAtom* input_mfra  = AP4_DYNAMIC_CAST(AP4_ContainerAtom, input_file->GetChild(AP4_ATOM_TYPE_MFRA));
+    AP4_ContainerAtom* output_mfra = AP4_DYNAMIC_CAST(AP4_ContainerAtom, output_file->GetChild(AP4_ATOM_TYPE_MFRA));
+    CHECK((input_mfra == NULL) == (output_mfra == NULL));
+    if (input_mfra) {
+        // every tfra entry must point to the output moof of its input moof
+        for (unsigned int i=0; ; i++) {
+            AP4_TfraAtom* input_tfra  = AP4_DYNAMIC_CAST(AP4_TfraAtom, input_mfra->GetChild(AP4_ATOM_TYPE_TFRA, i));
+            AP4_TfraAtom* output_tfra = AP4_DYNAMIC_CAST(AP4_TfraAtom, output_mfra->GetChild(AP4_ATOM_TYPE_TFRA, i));
+            CHECK((input_tfra == NULL) == (output_tfra == NULL));
+            if (input_tfra == NULL) break;
+            AP4_Array<AP4_TfraAtom::Entry>& input_entries  = input_tfra->GetEntries();
+            AP4_Array<AP4_TfraAtom::Entry>& output_entries = output_tfra->GetEntries();
+            CHECK(output_entries.ItemCount() == input_entries.ItemCount());
+            for (unsigned int j=0; j<input_entries.ItemCount(); j++) {
+                CHECK(output_entries[j].m_Time == input_entries[j].m_Time);
+                unsigned int k = 0;
+                while (k < input_moofs.ItemCount() && input_moofs[k] != input_entries[j].m_MoofOffset) ++k;
+                CHECK(k < input_moofs.ItemCount());
+                CHECK(output_entries[j].m_MoofOffset == output_moofs[k]);
+            }
+        }
+    }
+    
+    delete input_file;
+    delete output_file;
+    input_stream->Release();
+    output_stream->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestSequentialFragmentProcessing
++---------------------------------------------------------------------*/
+static int
+TestSequentialFragmentProcessing(AP4_DataBuffer&       input_data, 
+                                 AP4_DataBuffer&       input_samples,
+                                 AP4_ProtectionKeyMap& key_map)
+{
+    for (unsigned int t=0; t<2; t++) {
+        // encrypt from a seekable stream and from one that can only be read forward
+        AP4_DataBuffer encrypted[2];
+        for (unsigned int i=0; i<2; i++) {
+            AP4_CencEncryptingProcessor processor(AP4_CENC_VARIANT_MPEG);
+            processor.GetKeyMap().SetKeys(key_map);
+            processor.SetThreadCount(t==0?1:4);
+            if (i == 0) {
+                CHECK(AP4_SUCCEEDED(ProcessFile(processor, input_data, encrypted[i])));
+            } else {
+                SequentialByteStream*  input  = new SequentialByteStream(input_data);
+                AP4_MemoryByteStream*  output = new AP4_MemoryByteStream(encrypted[i]);
+                AP4_Result result = processor.Process(*input, *output);
+                input->Release();
+                output->Release();
+                CHECK(AP4_SUCCEEDED(result));
+            }
+        }
+        CHECK(encrypted[0].GetDataSize() == encrypted[1].GetDataSize());
+        CHECK(BuffersEqual(encrypted[0].GetData(), encrypted[1].GetData(), encrypted[0].GetDataSize()));
+        CHECK(CheckMfra(input_data, encrypted[0]) == 0);
+        
+        // decrypt from a stream that can only be read forward
+        AP4_CencDecryptingProcessor processor(&key_map);
+        processor.SetThreadCount(t==0?1:4);
+        AP4_DataBuffer decrypted;
+        SequentialByteStream* input  = new SequentialByteStream(encrypted[0]);
+        AP4_MemoryByteStream* output = new AP4_MemoryByteStream(decrypted);
+        AP4_Result result = processor.Process(*input, *output);
+        input->Release();
+        output->Release();
+        CHECK(AP4_SUCCEEDED(result));
+        AP4_DataBuffer decrypted_samples;
+        CHECK(AP4_SUCCEEDED(ReadFragmentedSamples(decrypted, decrypted_samples)));
+        CHECK(decrypted_samples.GetDataSize() == input_samples.GetDataSize());
+        CHECK(BuffersEqual(decrypted_samples.GetData(), input_samples.GetData(), input_samples.GetDataSize()));
+        CHECK(CheckMfra(encrypted[0], decrypted) == 0);
+    }
+    printf("sequential fragment processing OK\n");
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestParallelFragmentEncryption
++---------------------------------------------------------------------*/
+static int
+TestParallelFragmentEncryption(const char* filename)
+{
+    // load the file
+    AP4_ByteStream* input = NULL;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input)));
+    AP4_LargeSize input_size = 0;
+    CHECK(AP4_SUCCEEDED(input->GetSize(input_size)));
+    AP4_DataBuffer input_data;
+    input_data.SetDataSize((AP4_Size)input_size);
+    CHECK(AP4_SUCCEEDED(input->Read(input_data.UseData(), (AP4_Size)input_size)));
+    input->Release();
+    AP4_DataBuffer input_samples;
+    CHECK(AP4_SUCCEEDED(ReadFragmentedSamples(input_data, input_samples)));
+    CHECK(input_samples.GetDataSize() != 0);
+    
+    // the same keys and IVs for all the tracks
+    AP4_ProtectionKeyMap key_map;
+    {
+        AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(input_data);
+        AP4_File* file = new AP4_File(*stream, AP4_DefaultAtomFactory::Instance, true);
+        AP4_List<AP4_Track>::Item* item = file->GetMovie()->GetTracks().FirstItem();
+        for (; item; item = item->GetNext()) {
+            AP4_UI08 key[16];
+            AP4_UI08 iv[8];
+            for (unsigned int i=0; i<16; i++) key[i] = (AP4_UI08)(0x10+i);
+            for (unsigned int i=0; i<8;  i++) iv[i]  = (AP4_UI08)(0xF0+i);
+            key_map.SetKey(item->GetData()->GetId(), key, 16, iv, 8);
+        }
+        delete file;
+        stream->Release();
+    }
+    
+    AP4_CencVariant variants[] = {
+        AP4_CENC_VARIANT_MPEG,
+        AP4_CENC_VARIANT_PIFF_CTR,
+        AP4_CENC_VARIANT_PIFF_CBC
+    };
+    for (unsigned int v=0; v<sizeof(variants)/sizeof(variants[0]); v++) {
+        // encrypting with one thread or several must give the same bytes
+        AP4_DataBuffer encrypted[2];
+        for (unsigned int i=0; i<2; i++) {
+            AP4_CencEncryptingProcessor processor(variants[v]);
+            processor.GetKeyMap().SetKeys(key_map);
+            processor.SetThreadCount(i==0?1:4);
+            CHECK(AP4_SUCCEEDED(ProcessFile(processor, input_data, encrypted[i])));
+        }
+        CHECK(encrypted[0].GetDataSize() == encrypted[1].GetDataSize());
+        CHECK(BuffersEqual(encrypted[0].GetData(), encrypted[1].GetData(), encrypted[0].GetDataSize()));
+        
+        // and decrypting it, with one thread or several, must give back the
+        // samples of the input
+        for (unsigned int i=0; i<2; i++) {
+            AP4_CencDecryptingProcessor processor(&key_map);
+            processor.SetThreadCount(i==0?1:4);
+            AP4_DataBuffer decrypted;
+            CHECK(AP4_SUCCEEDED(ProcessFile(processor, encrypted[0], decrypted)));
+            AP4_DataBuffer decrypted_samples;
+            CHECK(AP4_SUCCEEDED(ReadFragmentedSamples(decrypted, decrypted_samples)));
+            CHECK(decrypted_samples.GetDataSize() == input_samples.GetDataSize());
+            CHECK(BuffersEqual(decrypted_samples.GetData(), input_samples.GetData(), input_samples.GetDataSize()));
+        }
+    }
+    printf("parallel fragment encryption: %d bytes of samples\n", (int)input_samples.GetDataSize());
+    
+    // fragments must be processed the same way when the input can't be seeked
+    CHECK(TestSequentialFragmentProcessing(input_data, input_samples, key_map) == 0);
+    
+    return 0;
+}
+
 int
-main(int /*argc*/, char** /*argv*/)
+main(int argc, char** argv)
 {
+    if (argc > 2) {
+        fprintf(stderr, "usage: cryptotest [<fragmented-test-filename>]\n");
+        return 1;
+    }
+    
     int result;
     
     result = TestHmac();
     if (result) return result;
 
-    result = TestKeyWrap();
-    if (result) return result;
+    // run the AES tests with and without hardware acceleration
+    for (unsigned int i=0; i<2; i++) {
+        bool accelerate = (i == 0);
+        if (accelerate && !AP4_AesBlockCipher::IsHardwareAccelerationAvailable()) continue;
+        AP4_AesBlockCipher::EnableHardwareAcceleration(accelerate);
+        
+        result = TestKeyWrap();
+        if (result) return result;
+        
+        result = TestBlockCiphers();
+        if (result) return result;
+
+        result = TestCtrStreamCipher();
+        if (result) return result;
+
+        result = TestCbcStreamCipher();
+        if (result) return result;
+    }
+    AP4_AesBlockCipher::EnableHardwareAcceleration(true);
     
-    result = TestBlockCiphers();
+    result = TestAesImplementations();
     if (result) return result;
-
-    result = TestCtrStreamCipher();
+    
+    result = TestCrc32();
     if (result) return result;
-
-    result = TestCbcStreamCipher();
+    
+    result = TestCencBatchEncryption();
     if (result) return result;
     
+    // parallel encryption of a fragmented file
+    if (argc == 2) {
+        result = TestParallelFragmentEncryption(argv[1]);
+        if (result) return result;
+    }
+    
     return 0;
 }
 
@@ -31,6 +31,7 @@
 +---------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "Ap4.h"
 
@@ -199,6 +200,116 @@ ProcessMoof(AP4_Movie*         movie,
     return 0;
 }
 
+/*----------------------------------------------------------------------
+|   WriteAtom
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteAtom(AP4_Atom& atom, AP4_DataBuffer& atom_data)
+{
+    atom_data.SetDataSize(0);
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(atom_data);
+    AP4_Result result = atom.Write(*stream);
+    stream->Release();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   TestArenaMoofs
++---------------------------------------------------------------------*/
+static int
+TestArenaMoofs(AP4_ByteStream& input)
+{
+    // find all the moof atoms
+    AP4_Array<AP4_Position> moof_positions;
+    AP4_Atom* atom = NULL;
+    CHECK(AP4_SUCCEEDED(input.Seek(0)));
+    while (AP4_SUCCEEDED(AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(input, atom))) {
+        if (atom->GetType() == AP4_ATOM_TYPE_MOOF) {
+            AP4_Position position = 0;
+            input.Tell(position);
+            moof_positions.Append(position-atom->GetSize());
+        }
+        delete atom;
+    }
+    
+    // parse each moof from the heap and from an arena, with small blocks so
+    // that each tree spans several of them, and free the arena trees in 
+    // different orders
+    AP4_List<AP4_Atom> kept_moofs;
+    for (unsigned int i=0; i<moof_positions.ItemCount(); i++) {
+        AP4_Atom* heap_moof = NULL;
+        CHECK(AP4_SUCCEEDED(input.Seek(moof_positions[i])));
+        CHECK(AP4_SUCCEEDED(AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(input, heap_moof)));
+        AP4_DataBuffer heap_data;
+        CHECK(AP4_SUCCEEDED(WriteAtom(*heap_moof, heap_data)));
+        delete heap_moof;
+        
+        AP4_Arena* arena = new AP4_Arena(256);
+        AP4_Atom*  moof = NULL;
+        CHECK(AP4_SUCCEEDED(input.Seek(moof_positions[i])));
+        if (i%4 == 3) {
+            // through a factory that owns the arena
+            AP4_DefaultAtomFactory factory;
+            factory.SetArena(arena);
+            CHECK(AP4_SUCCEEDED(factory.CreateAtomFromStream(input, moof)));
+            factory.SetArena(NULL);
+        } else {
+            // through the current arena of this thread
+            AP4_Arena::Scope scope(arena);
+            CHECK(AP4_SUCCEEDED(AP4_DefaultAtomFactory::Instance.CreateAtomFromStream(input, moof)));
+        }
+        CHECK(arena->GetAllocationCount() != 0);
+        AP4_DataBuffer arena_data;
+        CHECK(AP4_SUCCEEDED(WriteAtom(*moof, arena_data)));
+        CHECK(arena_data.GetDataSize() == heap_data.GetDataSize());
+        CHECK(memcmp(arena_data.GetData(), heap_data.GetData(), heap_data.GetDataSize()) == 0);
+        
+        AP4_ContainerAtom* container = AP4_DYNAMIC_CAST(AP4_ContainerAtom, moof);
+        CHECK(container != NULL);
+        switch (i%4) {
+            case 0:
+            case 3:
+                // the moof outlives the arena's owner
+                arena->Release();
+                delete moof;
+                break;
+                
+            case 1: {
+                // the children outlive their parent, and are deleted last first
+                AP4_Array<AP4_Atom*> children;
+                while (container->GetChildren().FirstItem()) {
+                    AP4_Atom* child = container->GetChildren().FirstItem()->GetData();
+                    child->Detach();
+                    children.Append(child);
+                }
+                delete moof;
+                for (unsigned int j=children.ItemCount(); j-- > 0;) {
+                    delete children[j];
+                }
+                CHECK(arena->GetAllocationCount() == 0);
+                arena->Release();
+                break;
+            }
+                
+            case 2:
+                // the moof outlives the next fragments, and is deleted at the end
+                arena->Release();
+                kept_moofs.Add(moof);
+                break;
+        }
+    }
+    
+    // delete the kept moofs, last first
+    while (kept_moofs.FirstItem()) {
+        AP4_Atom* moof = kept_moofs.LastItem()->GetData();
+        kept_moofs.Remove(moof);
+        delete moof;
+    }
+    
+    return 0;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -218,6 +329,10 @@ main(int argc, char** argv)
         return 1;
     }
         
+    // moofs parsed into arenas must be freeable in any order
+    CHECK(TestArenaMoofs(*input) == 0);
+    input->Seek(0);
+    
     // get the movie
     AP4_File* file = new AP4_File(*input, AP4_DefaultAtomFactory::Instance, true);
     AP4_Movie* movie = file->GetMovie();
@@ -56,21 +56,138 @@ PrintUsageAndExit()
 {
     fprintf(stderr, 
             BANNER 
-            "\n\nusage: linearreadertest <test-filename>\n");
+            "\n\nusage: linearreadertest <test-filename> [<fragmented-test-filename>]\n");
     exit(1);
 }
 
+/*----------------------------------------------------------------------
+|   ReadFragmentedFile
++---------------------------------------------------------------------*/
+static AP4_Result
+ReadFragmentedFile(const char*      filename, 
+                   AP4_AtomFactory& atom_factory, 
+                   AP4_Cardinal&    sample_count,
+                   AP4_UI32&        checksum)
+{
+    sample_count = 0;
+    checksum     = 0;
+    
+    AP4_ByteStream* input = NULL;
+    AP4_Result result = AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input);
+    if (AP4_FAILED(result)) return result;
+    AP4_File* file = new AP4_File(*input, atom_factory, true);
+    AP4_Movie* movie = file->GetMovie();
+    if (movie == NULL || !movie->HasFragments()) {
+        delete file;
+        input->Release();
+        return AP4_ERROR_INVALID_FORMAT;
+    }
+    
+    AP4_LinearReader reader(*movie, input, AP4_LINEAR_READER_DEFAULT_BUFFER_SIZE, atom_factory);
+    AP4_List<AP4_Track>::Item* item = movie->GetTracks().FirstItem();
+    for (; item; item = item->GetNext()) {
+        reader.EnableTrack(item->GetData()->GetId());
+    }
+    AP4_Sample     sample;
+    AP4_DataBuffer sample_data;
+    AP4_UI32       track_id = 0;
+    while (AP4_SUCCEEDED(result = reader.ReadNextSample(sample, sample_data, track_id))) {
+        checksum = checksum*31+track_id;
+        checksum = checksum*31+(AP4_UI32)sample.GetDts();
+        const AP4_UI08* data = sample_data.GetData();
+        for (unsigned int i=0; i<sample_data.GetDataSize(); i++) {
+            checksum = checksum*31+data[i];
+        }
+        ++sample_count;
+    }
+    
+    delete file;
+    input->Release();
+    
+    return result == AP4_ERROR_EOS ? AP4_SUCCESS : result;
+}
+
+/*----------------------------------------------------------------------
+|   FragmentedReaderThread
++---------------------------------------------------------------------*/
+class FragmentedReaderThread : public AP4_Thread
+{
+public:
+    FragmentedReaderThread(const char* filename) :
+        m_Filename(filename),
+        m_SampleCount(0),
+        m_Checksum(0),
+        m_Result(AP4_ERROR_INVALID_STATE) {}
+        
+    // AP4_Thread methods
+    void Run() {
+        // each reader parses its fragments with a factory of its own
+        AP4_DefaultAtomFactory atom_factory;
+        m_Result = ReadFragmentedFile(m_Filename, atom_factory, m_SampleCount, m_Checksum);
+    }
+    
+    // members
+    const char*  m_Filename;
+    AP4_Cardinal m_SampleCount;
+    AP4_UI32     m_Checksum;
+    AP4_Result   m_Result;
+};
+
+/*----------------------------------------------------------------------
+|   TestConcurrentFragmentedReaders
++---------------------------------------------------------------------*/
+static int
+TestConcurrentFragmentedReaders(const char* filename)
+{
+    // read the file once, in this thread
+    AP4_Cardinal sample_count = 0;
+    AP4_UI32     checksum     = 0;
+    CHECK(AP4_SUCCEEDED(ReadFragmentedFile(filename, AP4_DefaultAtomFactory::Instance, sample_count, checksum)));
+    CHECK(sample_count != 0);
+    
+    // then with several readers at the same time, which must all see the
+    // same samples
+    const unsigned int thread_count = 4;
+    FragmentedReaderThread* threads[thread_count];
+    bool started[thread_count];
+    for (unsigned int i=0; i<thread_count; i++) {
+        threads[i] = new FragmentedReaderThread(filename);
+        started[i] = AP4_SUCCEEDED(threads[i]->Start());
+    }
+    for (unsigned int i=0; i<thread_count; i++) {
+        if (started[i]) {
+            threads[i]->Wait();
+        } else {
+            threads[i]->Run();
+        }
+    }
+    for (unsigned int i=0; i<thread_count; i++) {
+        CHECK(threads[i]->m_Result == AP4_SUCCESS);
+        CHECK(threads[i]->m_SampleCount == sample_count);
+        CHECK(threads[i]->m_Checksum == checksum);
+        delete threads[i];
+    }
+    printf("%d concurrent readers, %d samples each\n", thread_count, sample_count);
+    
+    return 0;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
 int
 main(int argc, char** argv)
 {
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         PrintUsageAndExit();
     }
     const char* input_filename  = argv[1];
     
+    // concurrent reads of a fragmented file
+    if (argc == 3) {
+        CHECK(TestConcurrentFragmentedReaders(argv[2]) == 0);
+    }
+    
     // open the input
     AP4_ByteStream* input = NULL;
     AP4_Result result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
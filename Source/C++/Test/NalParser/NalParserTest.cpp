@@ -0,0 +1,273 @@
+/*****************************************************************
+|
+|    AP4 - NAL Parser Test
+|
+|    Copyright 2002-2014 Axiomatic Systems, LLC
+|
+|
+|    This file is part of Bento4/AP4 (MP4 Atom Processing Library).
+|
+|    Unless you have obtained Bento4 under a difference license,
+|    this version of Bento4 is Bento4|GPL.
+|    Bento4|GPL is free software; you can redistribute it and/or modify
+|    it under the terms of the GNU General Public License as published by
+|    the Free Software Foundation; either version 2, or (at your option)
+|    any later version.
+|
+|    Bento4|GPL is distributed in the hope that it will be useful,
+|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+|    GNU General Public License for more details.
+|
+|    You should have received a copy of the GNU General Public License
+|    along with Bento4|GPL; see the file COPYING.  If not, write to the
+|    Free Software Foundation, 59 Temple Place - Suite 330, Boston, MA
+|    02111-1307, USA.
+|
+ ****************************************************************/
+
+/*----------------------------------------------------------------------
+|   includes
++---------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Ap4.h"
+#include "Ap4NalParser.h"
+
+/*----------------------------------------------------------------------
+|   constants
++---------------------------------------------------------------------*/
+#define BANNER "NAL Parser Test - Version 1.0\n"\
+               "(Bento4 Version " AP4_VERSION_STRING ")\n"\
+               "(c) 2002-2014 Axiomatic Systems, LLC"
+
+const unsigned int STREAM_COUNT    = 2000;
+const unsigned int STREAM_MAX_SIZE = 4096;
+
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
+/*----------------------------------------------------------------------
+|   AppendNalu
++---------------------------------------------------------------------*/
+static void
+AppendNalu(AP4_DataBuffer& nalus, const AP4_UI08* nalu, AP4_Size nalu_size)
+{
+    // each NAL unit is stored after its 32-bit size
+    AP4_Size offset = nalus.GetDataSize();
+    nalus.SetDataSize(offset+4+nalu_size);
+    AP4_BytesFromUInt32BE(nalus.UseData()+offset, nalu_size);
+    if (nalu_size) AP4_CopyMemory(nalus.UseData()+offset+4, nalu, nalu_size);
+}
+
+/*----------------------------------------------------------------------
+|   ScanNalUnits
++---------------------------------------------------------------------*/
+// reference for AP4_NalParser::Feed(): the same state machine, one byte at
+// a time over the whole stream, with none of the skipping
+static void
+ScanNalUnits(const AP4_UI08* data, AP4_Size data_size, bool eos, AP4_DataBuffer& nalus)
+{
+    enum {
+        STATE_RESET,
+        STATE_START_CODE_1,
+        STATE_START_CODE_2,
+        STATE_START_NALU,
+        STATE_IN_NALU
+    } state = STATE_RESET;
+    AP4_Cardinal   zero_trail = 0;
+    AP4_DataBuffer nalu;
+    for (unsigned int i=0; i<data_size; i++) {
+        AP4_UI08 byte = data[i];
+        switch (state) {
+            case STATE_RESET:
+                if (byte == 0) state = STATE_START_CODE_1;
+                break;
+                
+            case STATE_START_CODE_1:
+                state = (byte == 0) ? STATE_START_CODE_2 : STATE_RESET;
+                break;
+                
+            case STATE_START_CODE_2:
+                if (byte == 0) break;
+                state = (byte == 1) ? STATE_START_NALU : STATE_RESET;
+                break;
+                
+            case STATE_START_NALU:
+                nalu.SetDataSize(0);
+                zero_trail = 0;
+                state = STATE_IN_NALU;
+                // FALLTHROUGH
+                
+            case STATE_IN_NALU:
+                if (byte == 1 && zero_trail >= 2) {
+                    // the zero bytes of the start code are not part of the payload
+                    AP4_Size nalu_size = nalu.GetDataSize();
+                    if (zero_trail >= 3 && nalu_size >= 3) {
+                        nalu_size -= 3;
+                    } else if (nalu_size >= 2) {
+                        nalu_size -= 2;
+                    }
+                    AppendNalu(nalus, nalu.GetData(), nalu_size);
+                    state = STATE_START_NALU;
+                    break;
+                }
+                zero_trail = (byte == 0) ? zero_trail+1 : 0;
+                nalu.SetDataSize(nalu.GetDataSize()+1);
+                nalu.UseData()[nalu.GetDataSize()-1] = byte;
+                break;
+        }
+    }
+    
+    // at the end of the stream, the last NAL unit ends with the data
+    if (eos && state == STATE_IN_NALU) {
+        AppendNalu(nalus, nalu.GetData(), nalu.GetDataSize());
+    }
+}
+
+/*----------------------------------------------------------------------
+|   ParseNalUnits
++---------------------------------------------------------------------*/
+static int
+ParseNalUnits(const AP4_UI08* data, 
+              AP4_Size        data_size, 
+              AP4_Size        max_chunk_size, 
+              bool            eos, 
+              AP4_DataBuffer& nalus)
+{
+    // feed the data in chunks of random sizes, each one until it is consumed.
+    // Each chunk is copied to a buffer followed by random bytes, so that
+    // nothing past the end of a chunk can be mistaken for the next chunk
+    AP4_NalParser  parser;
+    AP4_DataBuffer chunk;
+    for (AP4_Size offset=0; offset<data_size;) {
+        AP4_Size chunk_size = 1+rand()%max_chunk_size;
+        if (chunk_size > data_size-offset) chunk_size = data_size-offset;
+        bool last_chunk = (offset+chunk_size == data_size);
+        chunk.SetDataSize(chunk_size+64);
+        AP4_CopyMemory(chunk.UseData(), data+offset, chunk_size);
+        for (unsigned int i=chunk_size; i<chunk.GetDataSize(); i++) {
+            chunk.UseData()[i] = (AP4_UI08)(rand()%3);
+        }
+        for (AP4_Size chunk_offset=0; chunk_offset<chunk_size;) {
+            const AP4_DataBuffer* nalu = NULL;
+            AP4_Size bytes_consumed = 0;
+            CHECK(AP4_SUCCEEDED(parser.Feed(chunk.GetData()+chunk_offset, 
+                                            chunk_size-chunk_offset, 
+                                            bytes_consumed, 
+                                            nalu, 
+                                            eos && last_chunk)));
+            CHECK(bytes_consumed > 0 && bytes_consumed <= chunk_size-chunk_offset);
+            if (nalu) AppendNalu(nalus, nalu->GetData(), nalu->GetDataSize());
+            chunk_offset += bytes_consumed;
+        }
+        offset += chunk_size;
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   MakeStream
++---------------------------------------------------------------------*/
+static void
+MakeStream(AP4_DataBuffer& stream)
+{
+    AP4_Size stream_size = rand()%(STREAM_MAX_SIZE+1);
+    stream.SetDataSize(stream_size);
+    AP4_UI08* data = stream.UseData();
+    switch (rand()%3) {
+        case 0:
+            // dense 0, 1 and 3 bytes: start codes, emulation prevention 
+            // bytes and pairs of 0 bytes everywhere
+            for (unsigned int i=0; i<stream_size; i++) {
+                static const AP4_UI08 bytes[4] = { 0, 0, 1, 3 };
+                data[i] = bytes[rand()%4];
+            }
+            break;
+            
+        case 1:
+            // long runs of non-zero bytes between start codes of 3 and
+            // 4 bytes and runs of 0 bytes, so that most of the data is skipped
+            for (unsigned int i=0; i<stream_size;) {
+                AP4_UI08 pattern[6] = { 0, 0, 0, 1, 0, 0 };
+                unsigned int pattern_offset = 0;
+                unsigned int pattern_size   = 0;
+                switch (rand()%4) {
+                    case 0: pattern_offset = 1; pattern_size = 3; break;
+                    case 1: pattern_offset = 0; pattern_size = 4; break;
+                    case 2: pattern_offset = 4; pattern_size = 1+rand()%2; break;
+                    case 3: pattern_offset = 0; pattern_size = 3; break;
+                }
+                for (unsigned int j=0; j<pattern_size && i<stream_size; j++) {
+                    data[i++] = pattern[pattern_offset+j];
+                }
+                unsigned int run = rand()%((rand()%4 == 0) ? 300 : 40);
+                for (unsigned int j=0; j<run && i<stream_size; j++) {
+                    data[i++] = (AP4_UI08)(1+rand()%255);
+                }
+            }
+            break;
+            
+        case 2:
+            // random bytes, with a 0 byte about every 8 bytes
+            for (unsigned int i=0; i<stream_size; i++) {
+                data[i] = (rand()%8 == 0) ? 0 : (AP4_UI08)rand();
+            }
+            break;
+    }
+}
+
+/*----------------------------------------------------------------------
+|   TestRandomStreams
++---------------------------------------------------------------------*/
+static int
+TestRandomStreams()
+{
+    AP4_DataBuffer stream;
+    AP4_DataBuffer expected;
+    AP4_DataBuffer nalus;
+    for (unsigned int i=0; i<STREAM_COUNT; i++) {
+        MakeStream(stream);
+        for (unsigned int eos=0; eos<2; eos++) {
+            expected.SetDataSize(0);
+            ScanNalUnits(stream.GetData(), stream.GetDataSize(), eos != 0, expected);
+            
+            // byte by byte, in small and large chunks, and all at once
+            static const AP4_Size max_chunk_sizes[5] = { 1, 7, 64, 1000, STREAM_MAX_SIZE };
+            for (unsigned int j=0; j<5; j++) {
+                nalus.SetDataSize(0);
+                CHECK(ParseNalUnits(stream.GetData(), stream.GetDataSize(), max_chunk_sizes[j], eos != 0, nalus) == 0);
+                CHECK(nalus.GetDataSize() == expected.GetDataSize());
+                CHECK(nalus.GetDataSize() == 0 || 
+                      memcmp(nalus.GetData(), expected.GetData(), nalus.GetDataSize()) == 0);
+            }
+        }
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+int
+main(int argc, char** /* argv */)
+{
+    if (argc != 1) {
+        fprintf(stderr, BANNER "\n\nusage: nalparsertest\n");
+        return 1;
+    }
+    
+    // the NAL units must be the ones found by a byte by byte scan,
+    // however the data is split
+    CHECK(TestRandomStreams() == 0);
+    
+    return 0;
+}
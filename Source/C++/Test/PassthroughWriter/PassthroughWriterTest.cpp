@@ -31,9 +31,17 @@
 +---------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "Ap4.h"
 
+/*----------------------------------------------------------------------
+|   macros
++---------------------------------------------------------------------*/
+#define CHECK(x) do { \
+    if (!(x)) { fprintf(stderr, "ERROR line %d\n", __LINE__); return -1; }\
+} while (0)
+
 /*----------------------------------------------------------------------
 |   constants
 +---------------------------------------------------------------------*/
@@ -121,6 +129,281 @@ CopyTrack(AP4_Movie* input_movie, AP4_Track* input_track, AP4_Movie* output_movi
     output_movie->AddTrack(output_track);
 }
 
+/*----------------------------------------------------------------------
+|   CheckWrittenFile
++---------------------------------------------------------------------*/
+static int
+CheckWrittenFile(AP4_Movie& movie, AP4_DataBuffer& file_data, AP4_UI32 chunk_duration)
+{
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(file_data);
+    AP4_File* file = new AP4_File(*stream);
+    AP4_Movie* written_movie = file->GetMovie();
+    CHECK(written_movie != NULL);
+    CHECK(written_movie->GetTracks().ItemCount() == movie.GetTracks().ItemCount());
+    
+    // every track must have the same samples as the original
+    AP4_Array<AP4_Track*>   tracks;
+    AP4_Array<AP4_Ordinal>  next_samples;
+    AP4_List<AP4_Track>::Item* item         = movie.GetTracks().FirstItem();
+    AP4_List<AP4_Track>::Item* written_item = written_movie->GetTracks().FirstItem();
+    for (; item; item = item->GetNext(), written_item = written_item->GetNext()) {
+        AP4_Track* track         = item->GetData();
+        AP4_Track* written_track = written_item->GetData();
+        CHECK(written_track->GetSampleCount() == track->GetSampleCount());
+        AP4_Sample     sample;
+        AP4_Sample     written_sample;
+        AP4_DataBuffer data;
+        AP4_DataBuffer written_data;
+        for (AP4_Ordinal i=0; i<track->GetSampleCount(); i++) {
+            CHECK(AP4_SUCCEEDED(track->ReadSample(i, sample, data)));
+            CHECK(AP4_SUCCEEDED(written_track->ReadSample(i, written_sample, written_data)));
+            CHECK(written_sample.GetDts()              == sample.GetDts());
+            CHECK(written_sample.GetCts()              == sample.GetCts());
+            CHECK(written_sample.GetDuration()         == sample.GetDuration());
+            CHECK(written_sample.GetDescriptionIndex() == sample.GetDescriptionIndex());
+            CHECK(written_sample.IsSync()              == sample.IsSync());
+            CHECK(written_data.GetDataSize() == data.GetDataSize());
+            CHECK(memcmp(written_data.GetData(), data.GetData(), data.GetDataSize()) == 0);
+        }
+        tracks.Append(written_track);
+        next_samples.Append(0);
+    }
+    
+    // with time interleaving, going through the samples in file order must
+    // never go back to an earlier chunk duration slot
+    if (chunk_duration) {
+        AP4_UI64 last_slot = 0;
+        for (;;) {
+            // the next sample in the file is the first one not yet seen with the lowest offset
+            AP4_Track*    next_track = NULL;
+            AP4_Sample    next_sample;
+            AP4_Ordinal   next_index = 0;
+            for (unsigned int t=0; t<tracks.ItemCount(); t++) {
+                if (next_samples[t] >= tracks[t]->GetSampleCount()) continue;
+                AP4_Sample sample;
+                CHECK(AP4_SUCCEEDED(tracks[t]->GetSample(next_samples[t], sample)));
+                if (next_track == NULL || sample.GetOffset() < next_sample.GetOffset()) {
+                    next_track  = tracks[t];
+                    next_sample = sample;
+                    next_index  = t;
+                }
+            }
+            if (next_track == NULL) break;
+            ++next_samples[next_index];
+            AP4_UI64 slot = AP4_ConvertTime(next_sample.GetDts(), next_track->GetMediaTimeScale(), 1000)/chunk_duration;
+            CHECK(slot >= last_slot);
+            last_slot = slot;
+        }
+    }
+    
+    delete file;
+    stream->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   SuffixTrackHandler
++---------------------------------------------------------------------*/
+class SuffixTrackHandler : public AP4_Processor::TrackHandler {
+public:
+    // appends the size of the sample to its data
+    virtual AP4_Size GetProcessedSampleSize(AP4_Sample& sample) { 
+        return sample.GetSize()+4; 
+    }
+    virtual AP4_Result ProcessSample(AP4_DataBuffer& data_in, 
+                                     AP4_DataBuffer& data_out) {
+        data_out.SetDataSize(data_in.GetDataSize()+4);
+        if (data_in.GetDataSize()) {
+            AP4_CopyMemory(data_out.UseData(), data_in.GetData(), data_in.GetDataSize());
+        }
+        AP4_BytesFromUInt32BE(data_out.UseData()+data_in.GetDataSize(), data_in.GetDataSize());
+        return AP4_SUCCESS;
+    }
+    virtual bool IsStatelessPerSample() { return true; }
+};
+
+/*----------------------------------------------------------------------
+|   SuffixProcessor
++---------------------------------------------------------------------*/
+class SuffixProcessor : public AP4_Processor {
+public:
+    SuffixProcessor() : m_TrackCount(0) {}
+    
+    // every other track gets a handler, the others are copied as they are
+    virtual TrackHandler* CreateTrackHandler(AP4_TrakAtom* /* trak */) {
+        return (m_TrackCount++ % 2) ? NULL : new SuffixTrackHandler();
+    }
+    
+private:
+    unsigned int m_TrackCount;
+};
+
+/*----------------------------------------------------------------------
+|   GetStorageOrder
++---------------------------------------------------------------------*/
+static int
+GetStorageOrder(AP4_Movie& movie, AP4_Array<AP4_UI32>& track_indexes, AP4_Array<AP4_UI32>& sample_indexes)
+{
+    AP4_Array<AP4_Track*>  tracks;
+    AP4_Array<AP4_Ordinal> next_samples;
+    for (AP4_List<AP4_Track>::Item* item = movie.GetTracks().FirstItem(); item; item = item->GetNext()) {
+        tracks.Append(item->GetData());
+        next_samples.Append(0);
+    }
+    for (;;) {
+        int         next_track = -1;
+        AP4_Sample  next_sample;
+        for (unsigned int t=0; t<tracks.ItemCount(); t++) {
+            if (next_samples[t] >= tracks[t]->GetSampleCount()) continue;
+            AP4_Sample sample;
+            CHECK(AP4_SUCCEEDED(tracks[t]->GetSample(next_samples[t], sample)));
+            if (next_track < 0 || sample.GetOffset() < next_sample.GetOffset()) {
+                next_track  = t;
+                next_sample = sample;
+            }
+        }
+        if (next_track < 0) break;
+        track_indexes.Append(next_track);
+        sample_indexes.Append(next_samples[next_track]++);
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CheckProcessedFile
++---------------------------------------------------------------------*/
+static int
+CheckProcessedFile(AP4_DataBuffer& file_data, unsigned int thread_count)
+{
+    // process the file
+    AP4_DataBuffer processed_data;
+    AP4_MemoryByteStream* input  = new AP4_MemoryByteStream(file_data);
+    AP4_MemoryByteStream* output = new AP4_MemoryByteStream(processed_data);
+    SuffixProcessor processor;
+    processor.SetThreadCount(thread_count);
+    AP4_Result result = processor.Process(*input, *output);
+    output->Release();
+    CHECK(AP4_SUCCEEDED(result));
+    
+    // parse the input again and the output
+    CHECK(AP4_SUCCEEDED(input->Seek(0)));
+    AP4_File* file = new AP4_File(*input);
+    AP4_MemoryByteStream* processed_stream = new AP4_MemoryByteStream(processed_data);
+    AP4_File* processed_file = new AP4_File(*processed_stream);
+    AP4_Movie* movie           = file->GetMovie();
+    AP4_Movie* processed_movie = processed_file->GetMovie();
+    CHECK(movie != NULL && processed_movie != NULL);
+    CHECK(processed_movie->GetTracks().ItemCount() == movie->GetTracks().ItemCount());
+    
+    // every sample must have the same timing, and the same data, followed
+    // by its size for the tracks with a handler
+    unsigned int track_index = 0;
+    AP4_List<AP4_Track>::Item* item           = movie->GetTracks().FirstItem();
+    AP4_List<AP4_Track>::Item* processed_item = processed_movie->GetTracks().FirstItem();
+    for (; item; item = item->GetNext(), processed_item = processed_item->GetNext(), track_index++) {
+        AP4_Track* track           = item->GetData();
+        AP4_Track* processed_track = processed_item->GetData();
+        AP4_Size   suffix_size     = (track_index % 2) ? 0 : 4;
+        CHECK(processed_track->GetSampleCount() == track->GetSampleCount());
+        AP4_Sample     sample;
+        AP4_Sample     processed_sample;
+        AP4_DataBuffer data;
+        AP4_DataBuffer processed_data_buffer;
+        for (AP4_Ordinal i=0; i<track->GetSampleCount(); i++) {
+            CHECK(AP4_SUCCEEDED(track->ReadSample(i, sample, data)));
+            CHECK(AP4_SUCCEEDED(processed_track->ReadSample(i, processed_sample, processed_data_buffer)));
+            CHECK(processed_sample.GetDts()              == sample.GetDts());
+            CHECK(processed_sample.GetCts()              == sample.GetCts());
+            CHECK(processed_sample.GetDuration()         == sample.GetDuration());
+            CHECK(processed_sample.GetDescriptionIndex() == sample.GetDescriptionIndex());
+            CHECK(processed_sample.IsSync()              == sample.IsSync());
+            CHECK(processed_data_buffer.GetDataSize() == data.GetDataSize()+suffix_size);
+            CHECK(memcmp(processed_data_buffer.GetData(), data.GetData(), data.GetDataSize()) == 0);
+            if (suffix_size) {
+                CHECK(AP4_BytesToUInt32BE(processed_data_buffer.GetData()+data.GetDataSize()) == data.GetDataSize());
+            }
+        }
+    }
+    
+    // the samples must be stored in the same order as in the input
+    AP4_Array<AP4_UI32> track_indexes;
+    AP4_Array<AP4_UI32> sample_indexes;
+    AP4_Array<AP4_UI32> processed_track_indexes;
+    AP4_Array<AP4_UI32> processed_sample_indexes;
+    CHECK(GetStorageOrder(*movie, track_indexes, sample_indexes) == 0);
+    CHECK(GetStorageOrder(*processed_movie, processed_track_indexes, processed_sample_indexes) == 0);
+    CHECK(processed_track_indexes.ItemCount() == track_indexes.ItemCount());
+    for (unsigned int i=0; i<track_indexes.ItemCount(); i++) {
+        CHECK(processed_track_indexes[i]  == track_indexes[i]);
+        CHECK(processed_sample_indexes[i] == sample_indexes[i]);
+    }
+    
+    delete file;
+    delete processed_file;
+    input->Release();
+    processed_stream->Release();
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestProcessing
++---------------------------------------------------------------------*/
+static int
+TestProcessing(AP4_ByteStream& input)
+{
+    // load the file
+    AP4_LargeSize input_size = 0;
+    CHECK(AP4_SUCCEEDED(input.GetSize(input_size)));
+    AP4_DataBuffer file_data;
+    CHECK(AP4_SUCCEEDED(file_data.SetDataSize((AP4_Size)input_size)));
+    CHECK(AP4_SUCCEEDED(input.Seek(0)));
+    CHECK(AP4_SUCCEEDED(input.Read(file_data.UseData(), (AP4_Size)input_size)));
+    CHECK(AP4_SUCCEEDED(input.Seek(0)));
+    
+    // a processor must keep the layout of the samples, with or without threads
+    CHECK(CheckProcessedFile(file_data, 1) == 0);
+    CHECK(CheckProcessedFile(file_data, 4) == 0);
+    printf("Processing OK\n");
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestInterleaving
++---------------------------------------------------------------------*/
+static int
+TestInterleaving(AP4_File& file)
+{
+    AP4_Movie* movie = file.GetMovie();
+    CHECK(movie != NULL);
+    
+    // sequential, then time interleaved with a few chunk durations
+    AP4_UI32 chunk_durations[] = { 0, 100, 500, 2000 };
+    for (unsigned int i=0; i<sizeof(chunk_durations)/sizeof(chunk_durations[0]); i++) {
+        AP4_DataBuffer file_data;
+        AP4_MemoryByteStream* output = new AP4_MemoryByteStream(file_data);
+        AP4_Result result;
+        if (chunk_durations[i]) {
+            result = AP4_FileWriter::Write(file, *output, AP4_FileWriter::INTERLEAVING_TIME, chunk_durations[i]);
+        } else {
+            result = AP4_FileWriter::Write(file, *output);
+        }
+        output->Release();
+        CHECK(AP4_SUCCEEDED(result));
+        CHECK(CheckWrittenFile(*movie, file_data, chunk_durations[i]) == 0);
+        
+        // a processor must keep the layout of the samples, with or without threads
+        CHECK(CheckProcessedFile(file_data, 1) == 0);
+        CHECK(CheckProcessedFile(file_data, 4) == 0);
+    }
+    printf("Interleaving OK\n");
+    
+    return 0;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -142,6 +425,9 @@ main(int argc, char** argv)
         return 1;
     }
     
+    // check that a processor keeps the samples and their layout
+    if (TestProcessing(*input)) return 1;
+    
     // open the output
     AP4_ByteStream* output = NULL;
     result = AP4_FileByteStream::Create(output_filename, AP4_FileByteStream::STREAM_MODE_WRITE, output);
@@ -157,6 +443,9 @@ main(int argc, char** argv)
         fprintf(stderr, "ERROR: no movie in file\n");
         return 1;
     }
+    
+    // check that the interleaved layouts have the same samples
+    if (TestInterleaving(*input_file)) return 1;
 
     AP4_Movie* output_movie = new AP4_Movie(input_movie->GetTimeScale());
     AP4_File* output_file = new AP4_File(output_movie);    
@@ -31,6 +31,7 @@
 +---------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "Ap4.h"
 
@@ -60,6 +61,435 @@ PrintUsageAndExit()
     exit(1);
 }
 
+/*----------------------------------------------------------------------
+|   WriteMoov
++---------------------------------------------------------------------*/
+static AP4_Result
+WriteMoov(AP4_Movie& movie, AP4_DataBuffer& moov_data)
+{
+    moov_data.SetDataSize(0);
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(moov_data);
+    AP4_Result result = movie.GetMoovAtom()->Write(*stream);
+    stream->Release();
+    
+    return result;
+}
+
+/*----------------------------------------------------------------------
+|   TestLazySampleTables
++---------------------------------------------------------------------*/
+static int
+TestLazySampleTables(const char* filename)
+{
+    // open the file twice, with the sample tables parsed eagerly and lazily
+    AP4_DefaultAtomFactory lazy_factory;
+    lazy_factory.SetLazySampleTables(true);
+    AP4_ByteStream* inputs[2] = { NULL, NULL };
+    AP4_File*       files[2];
+    for (unsigned int i=0; i<2; i++) {
+        CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, inputs[i])));
+        if (i == 0) {
+            files[i] = new AP4_File(*inputs[i]);
+        } else {
+            files[i] = new AP4_File(*inputs[i], lazy_factory);
+        }
+        CHECK(files[i]->GetMovie() != NULL);
+    }
+    AP4_Movie* eager_movie = files[0]->GetMovie();
+    AP4_Movie* lazy_movie  = files[1]->GetMovie();
+    
+    // a moov written before any table is accessed must be the same
+    AP4_DataBuffer eager_moov;
+    AP4_DataBuffer lazy_moov;
+    CHECK(AP4_SUCCEEDED(WriteMoov(*eager_movie, eager_moov)));
+    CHECK(AP4_SUCCEEDED(WriteMoov(*lazy_movie,  lazy_moov)));
+    CHECK(lazy_moov.GetDataSize() == eager_moov.GetDataSize());
+    CHECK(memcmp(lazy_moov.GetData(), eager_moov.GetData(), eager_moov.GetDataSize()) == 0);
+    
+    // every sample must be the same, with the lazy tables accessed from the 
+    // last sample backwards
+    CHECK(lazy_movie->GetTracks().ItemCount() == eager_movie->GetTracks().ItemCount());
+    AP4_List<AP4_Track>::Item* eager_item = eager_movie->GetTracks().FirstItem();
+    AP4_List<AP4_Track>::Item* lazy_item  = lazy_movie->GetTracks().FirstItem();
+    for (; eager_item; eager_item = eager_item->GetNext(), lazy_item = lazy_item->GetNext()) {
+        AP4_Track* eager_track = eager_item->GetData();
+        AP4_Track* lazy_track  = lazy_item->GetData();
+        AP4_Cardinal sample_count = eager_track->GetSampleCount();
+        CHECK(lazy_track->GetSampleCount() == sample_count);
+        for (AP4_Ordinal i=sample_count; i-- > 0;) {
+            AP4_Sample eager_sample;
+            AP4_Sample lazy_sample;
+            CHECK(AP4_SUCCEEDED(lazy_track->GetSample(i, lazy_sample)));
+            CHECK(AP4_SUCCEEDED(eager_track->GetSample(i, eager_sample)));
+            CHECK(lazy_sample.GetOffset()           == eager_sample.GetOffset());
+            CHECK(lazy_sample.GetSize()             == eager_sample.GetSize());
+            CHECK(lazy_sample.GetDts()              == eager_sample.GetDts());
+            CHECK(lazy_sample.GetCts()              == eager_sample.GetCts());
+            CHECK(lazy_sample.GetDuration()         == eager_sample.GetDuration());
+            CHECK(lazy_sample.GetDescriptionIndex() == eager_sample.GetDescriptionIndex());
+            CHECK(lazy_sample.IsSync()              == eager_sample.IsSync());
+            AP4_Ordinal eager_chunk = 0, eager_position = 0;
+            AP4_Ordinal lazy_chunk  = 0, lazy_position  = 0;
+            CHECK(AP4_SUCCEEDED(eager_track->GetSampleTable()->GetSampleChunkPosition(i, eager_chunk, eager_position)));
+            CHECK(AP4_SUCCEEDED(lazy_track->GetSampleTable()->GetSampleChunkPosition(i, lazy_chunk, lazy_position)));
+            CHECK(lazy_chunk    == eager_chunk);
+            CHECK(lazy_position == eager_position);
+            CHECK(lazy_track->GetNearestSyncSampleIndex(i, true)  == eager_track->GetNearestSyncSampleIndex(i, true));
+            CHECK(lazy_track->GetNearestSyncSampleIndex(i, false) == eager_track->GetNearestSyncSampleIndex(i, false));
+        }
+        AP4_UI32 duration_ms = eager_track->GetDurationMs();
+        for (AP4_UI32 ts_ms=0; ts_ms<=duration_ms; ts_ms += 100) {
+            AP4_Ordinal eager_index = 0;
+            AP4_Ordinal lazy_index  = 0;
+            AP4_Result eager_result = eager_track->GetSampleIndexForTimeStampMs(ts_ms, eager_index);
+            AP4_Result lazy_result  = lazy_track->GetSampleIndexForTimeStampMs(ts_ms, lazy_index);
+            CHECK(lazy_result == eager_result);
+            if (AP4_SUCCEEDED(eager_result)) CHECK(lazy_index == eager_index);
+        }
+    }
+    
+    // and so must a moov written once the tables have been decoded
+    CHECK(AP4_SUCCEEDED(WriteMoov(*lazy_movie, lazy_moov)));
+    CHECK(lazy_moov.GetDataSize() == eager_moov.GetDataSize());
+    CHECK(memcmp(lazy_moov.GetData(), eager_moov.GetData(), eager_moov.GetDataSize()) == 0);
+    
+    for (unsigned int i=0; i<2; i++) {
+        delete files[i];
+        inputs[i]->Release();
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TimeTableEntry
++---------------------------------------------------------------------*/
+struct TimeTableEntry {
+    AP4_UI32 m_Count;
+    AP4_UI32 m_Value; // sample duration or cts offset
+};
+
+/*----------------------------------------------------------------------
+|   GetReferenceDts
++---------------------------------------------------------------------*/
+static AP4_Result
+GetReferenceDts(AP4_Array<TimeTableEntry>& entries, AP4_Ordinal sample, AP4_UI64& dts, AP4_UI32& duration)
+{
+    // walk the entries, sample indexes start at 1
+    AP4_UI64 first_sample = 0;
+    AP4_UI64 first_dts    = 0;
+    for (unsigned int i=0; sample && i<entries.ItemCount(); i++) {
+        if (sample <= first_sample+entries[i].m_Count) {
+            dts      = first_dts+(sample-1-first_sample)*(AP4_UI64)entries[i].m_Value;
+            duration = entries[i].m_Value;
+            return AP4_SUCCESS;
+        }
+        first_sample += entries[i].m_Count;
+        first_dts    += (AP4_UI64)entries[i].m_Count*(AP4_UI64)entries[i].m_Value;
+    }
+    return AP4_ERROR_OUT_OF_RANGE;
+}
+
+/*----------------------------------------------------------------------
+|   GetReferenceSampleIndex
++---------------------------------------------------------------------*/
+static AP4_Result
+GetReferenceSampleIndex(AP4_Array<TimeTableEntry>& entries, AP4_UI64 ts, AP4_Ordinal& sample_index)
+{
+    // walk the entries, skipping the ones that have no duration
+    AP4_UI64 first_dts = 0;
+    sample_index = 0;
+    for (unsigned int i=0; i<entries.ItemCount(); i++) {
+        AP4_UI64 end_dts = first_dts+(AP4_UI64)entries[i].m_Count*(AP4_UI64)entries[i].m_Value;
+        if (ts < end_dts) {
+            sample_index += (AP4_Ordinal)((ts-first_dts)/entries[i].m_Value);
+            return AP4_SUCCESS;
+        }
+        first_dts = end_dts;
+        sample_index += entries[i].m_Count;
+    }
+    return AP4_FAILURE;
+}
+
+/*----------------------------------------------------------------------
+|   GetReferenceCtsOffset
++---------------------------------------------------------------------*/
+static AP4_Result
+GetReferenceCtsOffset(AP4_Array<TimeTableEntry>& entries, AP4_Ordinal sample, AP4_UI32& cts_offset)
+{
+    AP4_UI64 first_sample = 0;
+    for (unsigned int i=0; sample && i<entries.ItemCount(); i++) {
+        if (sample <= first_sample+entries[i].m_Count) {
+            cts_offset = entries[i].m_Value;
+            return AP4_SUCCESS;
+        }
+        first_sample += entries[i].m_Count;
+    }
+    return AP4_ERROR_OUT_OF_RANGE;
+}
+
+/*----------------------------------------------------------------------
+|   CheckTimeTableSample
++---------------------------------------------------------------------*/
+static int
+CheckTimeTableSample(AP4_SttsAtom&              stts, 
+                     AP4_Array<TimeTableEntry>& stts_entries,
+                     AP4_CttsAtom&              ctts, 
+                     AP4_Array<TimeTableEntry>& ctts_entries,
+                     AP4_Ordinal                sample)
+{
+    // dts and duration
+    AP4_UI64   dts = 0, expected_dts = 0;
+    AP4_UI32   duration = 0, expected_duration = 0;
+    AP4_Result result = stts.GetDts(sample, dts, &duration);
+    CHECK(AP4_SUCCEEDED(result) == AP4_SUCCEEDED(GetReferenceDts(stts_entries, sample, expected_dts, expected_duration)));
+    if (AP4_SUCCEEDED(result)) {
+        CHECK(dts      == expected_dts);
+        CHECK(duration == expected_duration);
+    
+        // timestamps at the start, in the middle and at the end of the sample
+        AP4_UI64 timestamps[3] = { dts, dts+duration/2, dts+(duration?duration-1:0) };
+        for (unsigned int i=0; i<3; i++) {
+            AP4_Ordinal index = 0, expected_index = 0;
+            result = stts.GetSampleIndexForTimeStamp(timestamps[i], index);
+            CHECK(AP4_SUCCEEDED(result) == AP4_SUCCEEDED(GetReferenceSampleIndex(stts_entries, timestamps[i], expected_index)));
+            if (AP4_SUCCEEDED(result)) CHECK(index == expected_index);
+        }
+    }
+    
+    // cts offset
+    AP4_UI32 cts_offset = 0, expected_cts_offset = 0;
+    result = ctts.GetCtsOffset(sample, cts_offset);
+    CHECK(AP4_SUCCEEDED(result) == AP4_SUCCEEDED(GetReferenceCtsOffset(ctts_entries, sample, expected_cts_offset)));
+    if (AP4_SUCCEEDED(result)) CHECK(cts_offset == expected_cts_offset);
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CheckTimeTables
++---------------------------------------------------------------------*/
+static int
+CheckTimeTables(AP4_SttsAtom&              stts, 
+                AP4_Array<TimeTableEntry>& stts_entries,
+                AP4_CttsAtom&              ctts, 
+                AP4_Array<TimeTableEntry>& ctts_entries)
+{
+    AP4_Cardinal sample_count = 0;
+    AP4_UI64     duration     = 0;
+    for (unsigned int i=0; i<stts_entries.ItemCount(); i++) {
+        sample_count += stts_entries[i].m_Count;
+        duration     += (AP4_UI64)stts_entries[i].m_Count*(AP4_UI64)stts_entries[i].m_Value;
+    }
+    
+    // forward, backward and random sample lookups, with one sample past the end
+    for (AP4_Ordinal sample=0; sample<=sample_count+1; sample++) {
+        CHECK(CheckTimeTableSample(stts, stts_entries, ctts, ctts_entries, sample) == 0);
+    }
+    for (AP4_Ordinal sample=sample_count+1; sample>0; sample--) {
+        CHECK(CheckTimeTableSample(stts, stts_entries, ctts, ctts_entries, sample) == 0);
+    }
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_Ordinal sample = (AP4_Ordinal)(rand()%(sample_count+2));
+        CHECK(CheckTimeTableSample(stts, stts_entries, ctts, ctts_entries, sample) == 0);
+    }
+    
+    // random timestamps, with some past the end
+    for (unsigned int i=0; i<sample_count; i++) {
+        AP4_UI64 ts = ((((AP4_UI64)rand())<<31)^(AP4_UI64)rand())%(duration+duration/16+1);
+        AP4_Ordinal index = 0, expected_index = 0;
+        AP4_Result result = stts.GetSampleIndexForTimeStamp(ts, index);
+        CHECK(AP4_SUCCEEDED(result) == AP4_SUCCEEDED(GetReferenceSampleIndex(stts_entries, ts, expected_index)));
+        if (AP4_SUCCEEDED(result)) CHECK(index == expected_index);
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   ParseAtom
++---------------------------------------------------------------------*/
+static AP4_Atom*
+ParseAtom(AP4_Atom& atom, AP4_AtomFactory& factory, AP4_DataBuffer& atom_data)
+{
+    atom_data.SetDataSize(0);
+    AP4_MemoryByteStream* stream = new AP4_MemoryByteStream(atom_data);
+    AP4_Atom* parsed = NULL;
+    if (AP4_SUCCEEDED(atom.Write(*stream))) {
+        stream->Seek(0);
+        factory.CreateAtomFromStream(*stream, parsed);
+    }
+    stream->Release();
+    
+    return parsed;
+}
+
+/*----------------------------------------------------------------------
+|   TestTimeTables
++---------------------------------------------------------------------*/
+static int
+TestTimeTables()
+{
+    // random runs, some empty, some with a zero duration, and a few with
+    // durations large enough for the total to cross 32 bits
+    AP4_Array<TimeTableEntry> stts_entries;
+    AP4_Array<TimeTableEntry> ctts_entries;
+    AP4_SttsAtom stts;
+    AP4_CttsAtom ctts;
+    AP4_UI64     duration = 0;
+    for (unsigned int i=0; i<400; i++) {
+        TimeTableEntry entry;
+        entry.m_Count = (rand()%40 == 0) ? 0 : 1+rand()%40;
+        switch (rand()%20) {
+            case 0:  entry.m_Value = 0; break;
+            case 1:  entry.m_Value = 0x80000000+(AP4_UI32)rand(); break;
+            default: entry.m_Value = 1+rand()%3000; break;
+        }
+        if (i == 200) {
+            entry.m_Count = 5;
+            entry.m_Value = 0xF0000000;
+        }
+        duration += (AP4_UI64)entry.m_Count*(AP4_UI64)entry.m_Value;
+        stts_entries.Append(entry);
+        CHECK(AP4_SUCCEEDED(stts.AddEntry(entry.m_Count, entry.m_Value)));
+        
+        // the cts offsets have runs of their own
+        entry.m_Count = 1+rand()%60;
+        entry.m_Value = (AP4_UI32)rand()^((AP4_UI32)rand()<<16);
+        ctts_entries.Append(entry);
+        CHECK(AP4_SUCCEEDED(ctts.AddEntry(entry.m_Count, entry.m_Value)));
+        
+        // the tables must stay consistent while they grow
+        if (i%100 == 99) {
+            CHECK(CheckTimeTables(stts, stts_entries, ctts, ctts_entries) == 0);
+        }
+    }
+    CHECK(duration > 0xFFFFFFFF);
+    
+    // and after a round trip through a file, parsed now or on first access
+    AP4_DefaultAtomFactory lazy_factory;
+    lazy_factory.SetLazySampleTables(true);
+    AP4_AtomFactory* factories[2] = { &AP4_DefaultAtomFactory::Instance, &lazy_factory };
+    for (unsigned int i=0; i<2; i++) {
+        AP4_DataBuffer stts_data;
+        AP4_DataBuffer ctts_data;
+        AP4_Atom* parsed_stts = ParseAtom(stts, *factories[i], stts_data);
+        AP4_Atom* parsed_ctts = ParseAtom(ctts, *factories[i], ctts_data);
+        CHECK(AP4_DYNAMIC_CAST(AP4_SttsAtom, parsed_stts) != NULL);
+        CHECK(AP4_DYNAMIC_CAST(AP4_CttsAtom, parsed_ctts) != NULL);
+        CHECK(CheckTimeTables(*AP4_DYNAMIC_CAST(AP4_SttsAtom, parsed_stts), stts_entries, 
+                              *AP4_DYNAMIC_CAST(AP4_CttsAtom, parsed_ctts), ctts_entries) == 0);
+        delete parsed_stts;
+        delete parsed_ctts;
+    }
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   CompareSampleIndex
++---------------------------------------------------------------------*/
+static int
+CompareSampleIndex(AP4_ContainerAtom* stbl, AP4_ByteStream& stream)
+{
+    // one table that walks the atoms and one that uses the sample index
+    AP4_AtomSampleTable* walked  = new AP4_AtomSampleTable(stbl, stream);
+    AP4_AtomSampleTable* indexed = new AP4_AtomSampleTable(stbl, stream);
+    walked->SetIndexMemoryBudget(0);
+    
+    AP4_Cardinal sample_count = walked->GetSampleCount();
+    CHECK(indexed->GetSampleCount() == sample_count);
+    AP4_UI64 end_dts = 0;
+    for (AP4_Ordinal i=0; i<sample_count; i++) {
+        AP4_Sample walked_sample;
+        AP4_Sample indexed_sample;
+        CHECK(AP4_SUCCEEDED(walked->GetSample(i, walked_sample)));
+        CHECK(AP4_SUCCEEDED(indexed->GetSample(i, indexed_sample)));
+        CHECK(indexed_sample.GetOffset()           == walked_sample.GetOffset());
+        CHECK(indexed_sample.GetSize()             == walked_sample.GetSize());
+        CHECK(indexed_sample.GetDts()              == walked_sample.GetDts());
+        CHECK(indexed_sample.GetCts()              == walked_sample.GetCts());
+        CHECK(indexed_sample.GetDuration()         == walked_sample.GetDuration());
+        CHECK(indexed_sample.IsSync()              == walked_sample.IsSync());
+        CHECK(indexed_sample.GetDescriptionIndex() == walked_sample.GetDescriptionIndex());
+        CHECK(indexed->GetNearestSyncSampleIndex(i, true)  == walked->GetNearestSyncSampleIndex(i, true));
+        CHECK(indexed->GetNearestSyncSampleIndex(i, false) == walked->GetNearestSyncSampleIndex(i, false));
+        end_dts = walked_sample.GetDts()+walked_sample.GetDuration();
+    }
+    
+    // look up the timestamps around every sample and past the end
+    for (AP4_Ordinal i=0; i<=sample_count; i++) {
+        AP4_UI64 dts = end_dts;
+        if (i < sample_count) {
+            AP4_Sample sample;
+            CHECK(AP4_SUCCEEDED(walked->GetSample(i, sample)));
+            dts = sample.GetDts();
+        }
+        for (int delta=-1; delta<=1; delta++) {
+            if (dts == 0 && delta < 0) continue;
+            AP4_Ordinal walked_index  = 0;
+            AP4_Ordinal indexed_index = 0;
+            AP4_Result walked_result  = walked->GetSampleIndexForTimeStamp(dts+delta, walked_index);
+            AP4_Result indexed_result = indexed->GetSampleIndexForTimeStamp(dts+delta, indexed_index);
+            CHECK(AP4_SUCCEEDED(indexed_result) == AP4_SUCCEEDED(walked_result));
+            if (AP4_SUCCEEDED(walked_result)) CHECK(indexed_index == walked_index);
+        }
+    }
+    
+    delete walked;
+    delete indexed;
+    
+    return 0;
+}
+
+/*----------------------------------------------------------------------
+|   TestSampleIndex
++---------------------------------------------------------------------*/
+static int
+TestSampleIndex(const char* filename)
+{
+    AP4_ByteStream* input = NULL;
+    CHECK(AP4_SUCCEEDED(AP4_FileByteStream::Create(filename, AP4_FileByteStream::STREAM_MODE_READ, input)));
+    AP4_File* file = new AP4_File(*input);
+    CHECK(file->GetMovie() != NULL);
+    
+    AP4_List<AP4_Track>::Item* item = file->GetMovie()->GetTracks().FirstItem();
+    for (; item; item = item->GetNext()) {
+        AP4_ContainerAtom* stbl = AP4_DYNAMIC_CAST(AP4_ContainerAtom, item->GetData()->GetTrakAtom()->FindChild("mdia/minf/stbl"));
+        CHECK(stbl != NULL);
+        CHECK(CompareSampleIndex(stbl, *input) == 0);
+        
+        // the same with runs of samples with a zero duration, in the middle
+        // of the table, then also at its end
+        AP4_SttsAtom* stts = AP4_DYNAMIC_CAST(AP4_SttsAtom, stbl->GetChild(AP4_ATOM_TYPE_STTS));
+        CHECK(stts != NULL);
+        AP4_Cardinal sample_count = item->GetData()->GetSampleCount();
+        for (unsigned int trailing=0; trailing<2; trailing++) {
+            static const AP4_UI32 runs[][2] = { {3, 0}, {5, 1000}, {2, 0}, {1, 0}, {4, 500}, {1, 0} };
+            AP4_SttsAtom* zero_stts = new AP4_SttsAtom();
+            AP4_Cardinal remaining = sample_count-trailing;
+            for (unsigned int r=0; remaining; r = (r+1)%(sizeof(runs)/sizeof(runs[0]))) {
+                AP4_UI32 count = runs[r][0] < remaining ? runs[r][0] : remaining;
+                zero_stts->AddEntry(count, runs[r][1]);
+                remaining -= count;
+            }
+            if (trailing) zero_stts->AddEntry(trailing, 0);
+            stbl->RemoveChild(stts);
+            stbl->AddChild(zero_stts);
+            int result = CompareSampleIndex(stbl, *input);
+            stbl->RemoveChild(zero_stts);
+            stbl->AddChild(stts);
+            delete zero_stts;
+            CHECK(result == 0);
+        }
+    }
+    
+    delete file;
+    input->Release();
+    
+    return 0;
+}
+
 /*----------------------------------------------------------------------
 |   main
 +---------------------------------------------------------------------*/
@@ -71,6 +501,15 @@ main(int argc, char** argv)
     }
     const char* input_filename  = argv[1];
     
+    // the time to sample tables must give the results of a linear walk
+    CHECK(TestTimeTables() == 0);
+    
+    // lazily parsed sample tables must behave like eagerly parsed ones
+    CHECK(TestLazySampleTables(input_filename) == 0);
+    
+    // the sample index must give the same results as the sample table atoms
+    CHECK(TestSampleIndex(input_filename) == 0);
+    
     // open the input
     AP4_ByteStream* input = NULL;
     AP4_Result result = AP4_FileByteStream::Create(input_filename, AP4_FileByteStream::STREAM_MODE_READ, input);
@@ -0,0 +1,314 @@
+#! /usr/bin/env python
+
+# Segmentation tests for the command line tools.
+# usage: SegmentTests.py <bin-root> <work-dir>
+
+import os
+import struct
+import subprocess
+import sys
+
+TEST_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'Data', 'test-001.mp4')
+
+SEGMENT_DURATION_THRESHOLD = 50 # ms, mp42ts default
+
+def Check(condition, message):
+    if not condition:
+        raise Exception(message)
+
+def Run(args):
+    print(' '.join(args))
+    Check(subprocess.call(args) == 0, args[0]+' failed')
+
+def RunAndGetOutput(args):
+    print(' '.join(args))
+    process = subprocess.Popen(args, stdout=subprocess.PIPE)
+    output = process.communicate()[0].decode('latin-1')
+    Check(process.returncode == 0, args[0]+' failed')
+    return output
+
+def MakeVideoVariant(output, sample_duration):
+    # a copy of the test file in which all the video samples are sync samples
+    # (the stss atom is turned into a free atom), with another video sample
+    # duration (in the 1/30000 video timescale), so that the variant has
+    # sync samples at other times than the original. The hint tracks are
+    # turned into free atoms too, because mp4fragment does not fragment them
+    # properly.
+    data = bytearray(open(TEST_FILE, 'rb').read())
+    stts = data.find(b'stts'+struct.pack('>IIII', 0, 1, 54, 2000))
+    Check(stts > 0, 'video stts not found')
+    stss = data.find(b'stss', stts)
+    Check(stss > 0, 'video stss not found')
+    data[stss:stss+4] = b'free'
+    data[stts+16:stts+20] = struct.pack('>I', sample_duration)
+    moov = [box for box in GetBoxes(data, 0, len(data)) if box[0] == 'moov'][0]
+    for trak in GetBoxes(data, moov[3], moov[1]+moov[2]):
+        if trak[0] != 'trak': continue
+        hdlr = GetChildBox(data, GetChildBox(data, trak, 'mdia'), 'hdlr')
+        if bytes(data[hdlr[3]+8:hdlr[3]+12]) == b'hint':
+            data[trak[1]+4:trak[1]+8] = b'free'
+    f = open(output, 'wb')
+    f.write(data)
+    f.close()
+
+def ReadUI32(data, offset):
+    return struct.unpack('>I', bytes(data[offset:offset+4]))[0]
+
+def ReadUI64(data, offset):
+    return struct.unpack('>Q', bytes(data[offset:offset+8]))[0]
+
+def GetBoxes(data, start, end):
+    # list of (type, offset, size, payload offset) of the boxes in a range
+    boxes = []
+    offset = start
+    while offset+8 <= end:
+        size = ReadUI32(data, offset)
+        type = bytes(data[offset+4:offset+8]).decode('latin-1')
+        payload = offset+8
+        if size == 1:
+            size = ReadUI64(data, offset+8)
+            payload += 8
+        elif size == 0:
+            size = end-offset
+        Check(size >= 8 and offset+size <= end, 'invalid box at %d' % offset)
+        boxes.append((type, offset, size, payload))
+        offset += size
+    return boxes
+
+def GetChildBox(data, box, type):
+    for child in GetBoxes(data, box[3], box[1]+box[2]):
+        if child[0] == type: return child
+    return None
+
+def ParseSidx(data, box):
+    # returns (reference_ID, timescale, earliest_presentation_time, first_offset, references)
+    # with references as a list of (referenced_size, subsegment_duration, starts_with_SAP)
+    offset = box[3]
+    version = data[offset]
+    reference_id = ReadUI32(data, offset+4)
+    timescale    = ReadUI32(data, offset+8)
+    if version == 0:
+        ept          = ReadUI32(data, offset+12)
+        first_offset = ReadUI32(data, offset+16)
+        offset += 20
+    else:
+        ept          = ReadUI64(data, offset+12)
+        first_offset = ReadUI64(data, offset+20)
+        offset += 28
+    reference_count = struct.unpack('>H', bytes(data[offset+2:offset+4]))[0]
+    offset += 4
+    references = []
+    for i in range(reference_count):
+        Check(data[offset]&0x80 == 0, 'unexpected sidx reference type')
+        references.append((ReadUI32(data, offset)&0x7FFFFFFF,
+                           ReadUI32(data, offset+4),
+                           data[offset+8]>>7))
+        offset += 12
+    return (reference_id, timescale, ept, first_offset, references)
+
+def GetTrexDefaultDurations(data, moov):
+    durations = {}
+    for box in GetBoxes(data, moov[3], moov[1]+moov[2]):
+        if box[0] != 'mvex': continue
+        for trex in GetBoxes(data, box[3], box[1]+box[2]):
+            if trex[0] == 'trex':
+                durations[ReadUI32(data, trex[3]+4)] = ReadUI32(data, trex[3]+12)
+    return durations
+
+def ParseMoof(data, moof, trex_durations):
+    # returns (track_ID, decode time, composition offset of the first sample, duration)
+    # of the first track fragment of a moof
+    traf = GetChildBox(data, moof, 'traf')
+    tfhd = GetChildBox(data, traf, 'tfhd')
+    tfdt = GetChildBox(data, traf, 'tfdt')
+    trun = GetChildBox(data, traf, 'trun')
+    Check(tfhd and tfdt and trun, 'incomplete traf')
+    tfhd_flags = ReadUI32(data, tfhd[3])&0xFFFFFF
+    track_id = ReadUI32(data, tfhd[3]+4)
+    default_duration = trex_durations.get(track_id, 0)
+    offset = tfhd[3]+8
+    if tfhd_flags & 0x01: offset += 8
+    if tfhd_flags & 0x02: offset += 4
+    if tfhd_flags & 0x08: default_duration = ReadUI32(data, offset)
+    if data[tfdt[3]] == 1:
+        decode_time = ReadUI64(data, tfdt[3]+4)
+    else:
+        decode_time = ReadUI32(data, tfdt[3]+4)
+    trun_flags   = ReadUI32(data, trun[3])&0xFFFFFF
+    sample_count = ReadUI32(data, trun[3]+4)
+    offset = trun[3]+8
+    if trun_flags & 0x01: offset += 4
+    if trun_flags & 0x04: offset += 4
+    duration = 0
+    first_composition_offset = None
+    for i in range(sample_count):
+        if trun_flags & 0x100:
+            duration += ReadUI32(data, offset)
+            offset += 4
+        else:
+            duration += default_duration
+        if trun_flags & 0x200: offset += 4
+        if trun_flags & 0x400: offset += 4
+        if trun_flags & 0x800:
+            if first_composition_offset is None:
+                first_composition_offset = struct.unpack('>i', bytes(data[offset:offset+4]))[0]
+            offset += 4
+    return (track_id, decode_time, first_composition_offset or 0, duration)
+
+def TestMp4FragmentSidx(work_dir):
+    input = os.path.join(work_dir, 'sidx-input.mp4')
+    MakeVideoVariant(input, 2000)
+
+    # a single file with a top-level sidx: each reference must span the
+    # fragments from one fragment of the indexed track to the next one, and
+    # have the duration of that track's fragment
+    output = os.path.join(work_dir, 'sidx.mp4')
+    Run([BIN_ROOT+'/mp4fragment', '--sidx', '--fragment-duration', '1000', input, output])
+    data = bytearray(open(output, 'rb').read())
+    boxes = GetBoxes(data, 0, len(data))
+    types = [box[0] for box in boxes]
+    Check(types.count('sidx') == 1, 'expected one sidx')
+    Check(types.index('moov') < types.index('sidx') < types.index('moof'), 'sidx misplaced')
+    trex_durations = GetTrexDefaultDurations(data, boxes[types.index('moov')])
+    sidx = boxes[types.index('sidx')]
+    (reference_id, timescale, ept, first_offset, references) = ParseSidx(data, sidx)
+    indexed_moofs = []
+    for box in boxes:
+        if box[0] == 'moof':
+            fragment = ParseMoof(data, box, trex_durations)
+            if fragment[0] == reference_id: indexed_moofs.append((box, fragment))
+    Check(len(references) > 2, 'not enough references')
+    Check(len(references) == len(indexed_moofs), 'one reference per fragment expected')
+    Check(ept == indexed_moofs[0][1][1]+indexed_moofs[0][1][2], 'wrong earliest presentation time')
+    end = len(data)
+    if 'mfra' in types: end = boxes[types.index('mfra')][1]
+    start = sidx[1]+sidx[2]+first_offset
+    for i in range(len(references)):
+        (moof, fragment) = indexed_moofs[i]
+        if i+1 < len(references):
+            next_start = indexed_moofs[i+1][0][1]
+        else:
+            next_start = end
+        (size, duration, starts_with_sap) = references[i]
+        Check(start == moof[1], 'reference %d does not start at its fragment' % i)
+        Check(size == next_start-start, 'reference %d has the wrong size' % i)
+        Check(duration == fragment[3], 'reference %d has the wrong duration' % i)
+        Check(starts_with_sap == 1, 'reference %d does not start with a SAP' % i)
+        start += size
+
+    # media segments with a sidx each: the reference must span the rest of
+    # the segment, and have the duration of its fragment
+    init = os.path.join(work_dir, 'sidx-init.mp4')
+    pattern = os.path.join(work_dir, 'sidx-%llu-%llu.m4s')
+    Run([BIN_ROOT+'/mp4fragment', '--sidx', '--fragment-duration', '1000', '--media-segment', pattern, input, init])
+    init_data = bytearray(open(init, 'rb').read())
+    init_boxes = GetBoxes(init_data, 0, len(init_data))
+    Check('sidx' not in [box[0] for box in init_boxes], 'unexpected sidx in the init segment')
+    moov = [box for box in init_boxes if box[0] == 'moov'][0]
+    trex_durations = GetTrexDefaultDurations(init_data, moov)
+    segment_count = 0
+    for track_id in trex_durations.keys():
+        number = 0
+        while os.path.exists(pattern.replace('%llu', str(track_id), 1).replace('%llu', str(number), 1)):
+            segment = pattern.replace('%llu', str(track_id), 1).replace('%llu', str(number), 1)
+            data = bytearray(open(segment, 'rb').read())
+            boxes = GetBoxes(data, 0, len(data))
+            Check([box[0] for box in boxes] == ['sidx', 'moof', 'mdat'], 'unexpected boxes in '+segment)
+            (reference_id, timescale, ept, first_offset, references) = ParseSidx(data, boxes[0])
+            fragment = ParseMoof(data, boxes[1], trex_durations)
+            Check(reference_id == track_id and fragment[0] == track_id, 'wrong track in '+segment)
+            Check(len(references) == 1, 'expected one reference in '+segment)
+            Check(ept == fragment[1]+fragment[2], 'wrong earliest presentation time in '+segment)
+            Check(references[0][0] == len(data)-boxes[0][2]-first_offset, 'wrong reference size in '+segment)
+            Check(references[0][1] == fragment[3], 'wrong reference duration in '+segment)
+            number += 1
+            segment_count += 1
+    Check(segment_count > len(trex_durations), 'not enough media segments')
+    print('OK')
+
+def TestMp4SplitIndexed(work_dir):
+    # split the same fragments with and without an mfra index: the indexed
+    # input is split with byte range copies, the other one atom by atom,
+    # and the segments must be the same
+    input = os.path.join(work_dir, 'split-input.mp4')
+    MakeVideoVariant(input, 2000)
+    fragmented = {}
+    for (name, options) in [('indexed', []), ('unindexed', ['--no-mfra'])]:
+        fragmented[name] = os.path.join(work_dir, 'split-'+name+'.mp4')
+        Run([BIN_ROOT+'/mp4fragment', '--fragment-duration', '1000']+options+[input, fragmented[name]])
+    for selection in [[], ['--video'], ['--audio'], ['--track-id', '1']]:
+        files = {}
+        for name in ['indexed', 'unindexed']:
+            prefix = os.path.join(work_dir, 'split-'+name)
+            output = RunAndGetOutput([BIN_ROOT+'/mp4split', '--verbose',
+                                      '--init-segment', prefix+'-init.mp4',
+                                      '--media-segment', prefix+'-%llu-%llu.m4s']+
+                                     selection+[fragmented[name]])
+            Check(('using the fragment index' in output) == (name == 'indexed'),
+                  'unexpected split path for the '+name+' input')
+            files[name] = {}
+            for file in os.listdir(work_dir):
+                if file.startswith('split-'+name+'-'):
+                    path = os.path.join(work_dir, file)
+                    files[name][file[len('split-'+name):]] = open(path, 'rb').read()
+                    os.unlink(path)
+        Check(len(files['indexed']) > 2, 'not enough segments')
+        Check(sorted(files['indexed'].keys()) == sorted(files['unindexed'].keys()), 'different segments')
+        for file in files['indexed'].keys():
+            Check(files['indexed'][file] == files['unindexed'][file], 'segment '+file+' differs')
+    print('OK')
+
+def GetFirstVideoTimestamp(ts_file, video_pid=0x102):
+    # the DTS (or PTS) of the first video PES packet, in ms
+    data = bytearray(open(ts_file, 'rb').read())
+    for offset in range(0, len(data), 188):
+        packet = data[offset:offset+188]
+        pid = (packet[1]&0x1F)<<8 | packet[2]
+        if pid != video_pid or not (packet[1]&0x40): continue
+        payload = 4
+        if packet[3]&0x20: payload += 1+packet[4]
+        pes = packet[payload:]
+        if (pes[7]>>6) == 3:
+            t = pes[14:19]
+        else:
+            t = pes[9:14]
+        timestamp = ((t[0]>>1)&7)<<30 | t[1]<<22 | (t[2]>>1)<<15 | t[3]<<7 | t[4]>>1
+        return timestamp/90.0
+    return None
+
+def GetSegmentStarts(segment_template):
+    starts = []
+    while os.path.exists(segment_template % len(starts)):
+        starts.append(GetFirstVideoTimestamp(segment_template % len(starts)))
+    return starts
+
+def TestMp42TsSegmentAlignment(work_dir):
+    # the first rendition has a sync sample every 66.7ms, the second one
+    # every 60ms: the second one must start each segment at its first sync
+    # sample at or after (within the threshold) the start of the same
+    # segment of the first one, not one segment duration after its own
+    # previous segment
+    renditions = [(2000, 'align-0.mp4', 'align-0-%d.ts'),
+                  (1800, 'align-1.mp4', 'align-1-%d.ts')]
+    args = [BIN_ROOT+'/mp42ts', '--segment', '1', '--playlist', os.path.join(work_dir, 'align-%d.m3u8')]
+    for (sample_duration, input, output) in renditions:
+        MakeVideoVariant(os.path.join(work_dir, input), sample_duration)
+        args += [os.path.join(work_dir, input), os.path.join(work_dir, output)]
+    Run(args)
+
+    starts = [GetSegmentStarts(os.path.join(work_dir, output)) for (_, _, output) in renditions]
+    print('segment starts: '+str(starts))
+    Check(len(starts[0]) > 2, 'not enough segments')
+    Check(len(starts[1]) == len(starts[0]), 'different segment counts')
+    frame_duration = renditions[1][0]/30.0
+    for (leader, follower) in zip(starts[0][1:], starts[1][1:]):
+        Check(follower >= leader-SEGMENT_DURATION_THRESHOLD and
+              follower <  leader-SEGMENT_DURATION_THRESHOLD+frame_duration,
+              'segment at %f not aligned on %f' % (follower, leader))
+    print('OK')
+
+BIN_ROOT = sys.argv[1]
+WORK_DIR = sys.argv[2]
+TestMp4FragmentSidx(WORK_DIR)
+TestMp4SplitIndexed(WORK_DIR)
+TestMp42TsSegmentAlignment(WORK_DIR)